@@ -0,0 +1,1315 @@
+//
+// bench.c
+// Benchmark madcrow_buffer (eager and lazy shift), madcrow_chunkbuf,
+// madcrow_list, madcrow_ring, madcrow_linkedlist and madcrow_unrolled
+//
+// Usage: ./run_bench [-n <max_elements>] [-c] [-l]
+//   -n <N>  largest number of elements to test, 1e3..1e8 (default: 1e6)
+//   -c      print CSV instead of a table, for comparing between releases
+//   -l      print push latency percentiles instead (see below)
+//
+// Each container is run with 1, 8 and 64 byte objects on sizes 1e3, 1e4, ...
+// up to N, for the patterns:
+//
+//   append  n single element pushes onto an empty container
+//   queue   n x (push at the tail + shift from the head), depth kept at 256
+//   deque   n x (add + remove at random ends), depth kept at 256
+//   random  n random gets then n random sets on n elements
+//   bulk    getn/setn over n elements in blocks of 64
+//   walk    iterate over n elements, madcrow_unrolled vs madcrow_linkedlist
+//   scan    count then find_any over n elements, scan_scalar forces the
+//           scalar kernels to show the SIMD speedup
+//   sort    radix sort n random 8 byte keys, on 1 thread and on 4 (sort_mt4),
+//           compared with qsort and a madcrow_linkedlist merge sort
+//   reduce  parallel_fill then parallel_reduce (sum of squares) over n 8 byte
+//           elements, on the calling thread and with a pool of 4 (reduce_mt4)
+//   load    load n saved 8 byte elements from a file and sum them, with _load
+//           (buf) and zero-copy _load_mmap (mmap)
+//   count   madcrow_hash counting n random keys (n/4 distinct) from empty
+//   lookup  n random lookups, half missing, in madcrow_hash vs bsearch on a
+//           sorted buffer (sorted)
+//   ops     and, or, xor, andnot and count over two madcrow_bitbufs of n 64 bit
+//           words, ops_scalar forces the scalar kernels
+//   rank    n rank then n select queries on a bitbuf of n random words
+//   hold    n x (pop + push a later time) on a heap of n, 4-ary madcrow_heap
+//           vs a binary heap (bheap)
+//   mpsc4   4 producer threads pass n nodes to one consumer, comparing
+//           madcrow_mpsc with a mutex-protected madcrow_linkedlist
+//   small   n short-lived buffers, each filled with 24 bytes and freed,
+//           comparing madcrow_buffer with madcrow_buffer_sbo (32 inline)
+//           and madcrow_buffer_arena (arena reset every 1024 buffers)
+//   wipe    grow a zeroed buffer to n elements, set 64 of them and reset, 16
+//           times, comparing madcrow_buffer_wipe (memset) with
+//           madcrow_buffer_wipe_pages (madvise)
+//   pipe    1 producer thread passes n records to 1 consumer in blocks of 64,
+//           comparing madcrow_spsc with a mutex-protected madcrow_buffer
+//
+// With -l, each of n appends of an 8 byte element onto a container of
+// capacity 8 is timed on its own, and the p50, p99, p99.9 and max latencies
+// are printed for madcrow_buffer (buf), madcrow_buffer_incr (ibuf),
+// madcrow_list (list), madcrow_list_incr (ilist) and madcrow_chunkbuf (cbuf).
+// Every sample includes the cost of reading the clock.
+//
+// ns/op is per element operation, so a 64 element getn counts as 64 ops.
+// Every case runs in its own process so that peak RSS is per case. For random
+// and bulk, filling the container is not timed or counted.
+//
+
+#define _XOPEN_SOURCE 700
+#define _DEFAULT_SOURCE // MADV_DONTNEED
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "madcrow_buffer.h"
+#include "madcrow_list.h"
+#include "madcrow_linkedlist.h"
+#include "madcrow_ring.h"
+#include "madcrow_mpsc.h"
+#include "madcrow_spsc.h"
+#include "madcrow_sort.h"
+#include "madcrow_chunkbuf.h"
+#include "madcrow_unrolled.h"
+#include "madcrow_parallel.h"
+#include "madcrow_mmap.h"
+#include "madcrow_save.h"
+#include "madcrow_hash.h"
+#include "madcrow_bitbuf.h"
+#include "madcrow_heap.h"
+
+#define BENCH_DEPTH 256
+#define BENCH_BLOCK 64
+
+static size_t bench_nreallocs = 0, bench_realloc_bytes = 0;
+static size_t bench_memmove_bytes = 0;
+static volatile size_t bench_sink = 0;
+static double bench_t0;
+
+static double bench_now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Start (or restart after setup) the timed section
+static void bench_start()
+{
+  bench_nreallocs = bench_realloc_bytes = bench_memmove_bytes = 0;
+  bench_t0 = bench_now_ns();
+}
+
+static void* bench_realloc(void *ptr, size_t n)
+{
+  bench_nreallocs++;
+  bench_realloc_bytes += n;
+  return realloc(ptr, n);
+}
+
+static inline void* bench_memmove(void *dst, const void *src, size_t n)
+{
+  bench_memmove_bytes += n;
+  return memmove(dst, src, n);
+}
+
+static inline uint64_t bench_rand(uint64_t *x)
+{
+  *x ^= *x << 13; *x ^= *x >> 7; *x ^= *x << 17;
+  return *x;
+}
+
+typedef uint8_t  Obj1;
+typedef uint64_t Obj8;
+typedef struct { uint64_t w[8]; } Obj64;
+
+static inline Obj1  obj1_make(size_t i)  { return (Obj1)i; }
+static inline Obj8  obj8_make(size_t i)  { return (Obj8)i; }
+static inline Obj64 obj64_make(size_t i) { Obj64 o = {{i}}; return o; }
+static inline size_t obj1_key(Obj1 o)   { return o; }
+static inline size_t obj8_key(Obj8 o)   { return o; }
+static inline size_t obj64_key(Obj64 o) { return o.w[0]; }
+
+// Generated functions call memmove by name, so count bytes moved by
+// redirecting it while the containers are instantiated
+#define memmove bench_memmove
+
+madcrow_buffer2(buf1,Buf1,Obj1,calloc,bench_realloc,free,MC_INIT_MEM_UNDEF);
+madcrow_buffer2(buf8,Buf8,Obj8,calloc,bench_realloc,free,MC_INIT_MEM_UNDEF);
+madcrow_buffer2(buf64,Buf64,Obj64,calloc,bench_realloc,free,MC_INIT_MEM_UNDEF);
+
+madcrow_buffer2(zbuf8,ZBuf8,Obj8,calloc,bench_realloc,free,MC_INIT_MEM_WIPE);
+madcrow_buffer2(pzbuf8,PZBuf8,Obj8,calloc,bench_realloc,free,MC_INIT_MEM_PAGES);
+
+madcrow_buffer_sbo2(sbo1,Sbo1,Obj1,32,calloc,bench_realloc,free,MC_INIT_MEM_UNDEF);
+madcrow_buffer_arena(abuf1,ABuf1,Obj1);
+
+madcrow_buffer_lazy2(lbuf1,LBuf1,Obj1,calloc,bench_realloc,free,MC_INIT_MEM_UNDEF);
+madcrow_buffer_lazy2(lbuf8,LBuf8,Obj8,calloc,bench_realloc,free,MC_INIT_MEM_UNDEF);
+madcrow_buffer_lazy2(lbuf64,LBuf64,Obj64,calloc,bench_realloc,free,MC_INIT_MEM_UNDEF);
+
+madcrow_chunkbuf(cbuf1,CBuf1,Obj1);
+madcrow_chunkbuf(cbuf8,CBuf8,Obj8);
+madcrow_chunkbuf(cbuf64,CBuf64,Obj64);
+
+madcrow_list2(list1,List1,Obj1,calloc,bench_realloc,free);
+madcrow_list2(list8,List8,Obj8,calloc,bench_realloc,free);
+madcrow_list2(list64,List64,Obj64,calloc,bench_realloc,free);
+
+madcrow_ring2(ring1,Ring1,Obj1,calloc,bench_realloc,free);
+madcrow_ring2(ring8,Ring8,Obj8,calloc,bench_realloc,free);
+madcrow_ring2(ring64,Ring64,Obj64,calloc,bench_realloc,free);
+
+madcrow_linkedlist(llist1,LList1,LNode1,Obj1);
+madcrow_linkedlist(llist8,LList8,LNode8,Obj8);
+madcrow_linkedlist(llist64,LList64,LNode64,Obj64);
+
+madcrow_unrolled(ulist1,UList1,UNode1,UIter1,Obj1);
+madcrow_unrolled(ulist8,UList8,UNode8,UIter8,Obj8);
+madcrow_unrolled(ulist64,UList64,UNode64,UIter64,Obj64);
+
+madcrow_buffer_sort(buf8,Buf8,Obj8,MC_SORT_KEY);
+madcrow_buffer_parallel(buf8,Buf8,Obj8);
+madcrow_buffer_save(buf8,Buf8,Obj8);
+
+madcrow_buffer_mmap(mbuf8,MBuf8,Obj8);
+madcrow_buffer_save_mmap(mbuf8,MBuf8,Obj8);
+
+madcrow_hash(hmap8,HMap8,Obj8,Obj8,MC_HASH_INT,MC_HASH_EQ);
+madcrow_bitbuf(bits8,Bits8);
+madcrow_heap(heap8,Heap8,Obj8,MC_HEAP_CMP);
+madcrow_heap2(bheap8,BHeap8,Obj8,MC_HEAP_CMP,2,calloc,realloc,free);
+madcrow_linkedlist_sort(llist8,LList8,LNode8,MC_HEAP_CMP);
+
+madcrow_buffer_incr(ibuf8,IBuf8,Obj8);
+madcrow_list_incr(ilist8,IList8,Obj8);
+
+madcrow_mpsc(mpsc8,Mpsc8,LNode8);
+madcrow_spsc(spsc8,Spsc8,Obj8);
+
+madcrow_nodepool(lpool1,LPool1,llist1,LList1,LNode1,Obj1);
+madcrow_nodepool(lpool8,LPool8,llist8,LList8,LNode8,Obj8);
+madcrow_nodepool(lpool64,LPool64,llist64,LList64,LNode64,Obj64);
+
+#undef memmove
+
+//
+// Buffer and lazy buffer
+//
+#define BENCH_BUF(c,T,S)                                                       \
+                                                                               \
+static size_t bench_##c##S##_append(size_t n) {                                \
+  T##S b; size_t i;                                                            \
+  c##S##_alloc(&b, 8);                                                         \
+  for(i = 0; i < n; i++) { Obj##S o = obj##S##_make(i); c##S##_push(&b,&o,1); }\
+  bench_sink += b.len;                                                         \
+  c##S##_dealloc(&b);                                                          \
+  return n;                                                                    \
+}                                                                              \
+                                                                               \
+static size_t bench_##c##S##_queue(size_t n) {                                 \
+  T##S b; Obj##S o; size_t i, sum = 0;                                         \
+  c##S##_alloc(&b, 8);                                                         \
+  for(i = 0; i < BENCH_DEPTH; i++) { o = obj##S##_make(i); c##S##_push(&b,&o,1); }\
+  for(i = 0; i < n; i++) {                                                     \
+    o = obj##S##_make(i); c##S##_push(&b,&o,1);                                \
+    c##S##_shift(&b,&o,1); sum += obj##S##_key(o);                             \
+  }                                                                            \
+  bench_sink += sum;                                                           \
+  c##S##_dealloc(&b);                                                          \
+  return 2*n;                                                                  \
+}                                                                              \
+                                                                               \
+static size_t bench_##c##S##_deque(size_t n) {                                 \
+  T##S b; Obj##S o; size_t i, sum = 0; uint64_t r = 88172645463325252ULL;      \
+  c##S##_alloc(&b, 8);                                                         \
+  for(i = 0; i < BENCH_DEPTH; i++) { o = obj##S##_make(i); c##S##_push(&b,&o,1); }\
+  for(i = 0; i < n; i++) {                                                     \
+    uint64_t x = bench_rand(&r);                                               \
+    o = obj##S##_make(i);                                                      \
+    if(x & 1) c##S##_push(&b,&o,1); else c##S##_unshift(&b,&o,1);              \
+    if(x & 2) c##S##_pop(&b,&o,1);  else c##S##_shift(&b,&o,1);                \
+    sum += obj##S##_key(o);                                                    \
+  }                                                                            \
+  bench_sink += sum;                                                           \
+  c##S##_dealloc(&b);                                                          \
+  return 2*n;                                                                  \
+}                                                                              \
+                                                                               \
+static size_t bench_##c##S##_random(size_t n) {                                \
+  T##S b; Obj##S o; size_t i, sum = 0; uint64_t r = 88172645463325252ULL;      \
+  c##S##_alloc(&b, n);                                                         \
+  for(i = 0; i < n; i++) { o = obj##S##_make(i); c##S##_push(&b,&o,1); }       \
+  bench_start();                                                               \
+  for(i = 0; i < n; i++) sum += obj##S##_key(c##S##_get(&b, bench_rand(&r) % n));\
+  for(i = 0; i < n; i++) c##S##_set(&b, bench_rand(&r) % n, obj##S##_make(i)); \
+  bench_sink += sum;                                                           \
+  c##S##_dealloc(&b);                                                          \
+  return 2*n;                                                                  \
+}                                                                              \
+                                                                               \
+static size_t bench_##c##S##_bulk(size_t n) {                                  \
+  T##S b; Obj##S o, tmp[BENCH_BLOCK]; size_t i, j, m, sum = 0;                 \
+  c##S##_alloc(&b, n);                                                         \
+  for(i = 0; i < n; i++) { o = obj##S##_make(i); c##S##_push(&b,&o,1); }       \
+  bench_start();                                                               \
+  for(i = 0; i < n; i += BENCH_BLOCK) {                                        \
+    m = n-i < BENCH_BLOCK ? n-i : BENCH_BLOCK;                                 \
+    c##S##_getn(&b, i, tmp, m);                                                \
+    for(j = 0; j < m; j++) sum += obj##S##_key(tmp[j]);                        \
+    c##S##_setn(&b, n-i-m, tmp, m);                                            \
+  }                                                                            \
+  bench_sink += sum;                                                           \
+  c##S##_dealloc(&b);                                                          \
+  return 2*n;                                                                  \
+}
+
+//
+// Chunked buffer: append, random and bulk only (no shift/unshift)
+//
+#define BENCH_CHUNK(S)                                                         \
+                                                                               \
+static size_t bench_cbuf##S##_append(size_t n) {                               \
+  CBuf##S b; size_t i;                                                         \
+  cbuf##S##_alloc(&b, 8);                                                      \
+  for(i = 0; i < n; i++) { Obj##S o = obj##S##_make(i); cbuf##S##_push(&b,&o,1); }\
+  bench_sink += b.len;                                                         \
+  cbuf##S##_dealloc(&b);                                                       \
+  return n;                                                                    \
+}                                                                              \
+                                                                               \
+static size_t bench_cbuf##S##_random(size_t n) {                               \
+  CBuf##S b; Obj##S o; size_t i, sum = 0; uint64_t r = 88172645463325252ULL;   \
+  cbuf##S##_alloc(&b, n);                                                      \
+  for(i = 0; i < n; i++) { o = obj##S##_make(i); cbuf##S##_push(&b,&o,1); }    \
+  bench_start();                                                               \
+  for(i = 0; i < n; i++) sum += obj##S##_key(cbuf##S##_get(&b, bench_rand(&r) % n));\
+  for(i = 0; i < n; i++) cbuf##S##_set(&b, bench_rand(&r) % n, obj##S##_make(i));\
+  bench_sink += sum;                                                           \
+  cbuf##S##_dealloc(&b);                                                       \
+  return 2*n;                                                                  \
+}                                                                              \
+                                                                               \
+static size_t bench_cbuf##S##_bulk(size_t n) {                                 \
+  CBuf##S b; Obj##S o, tmp[BENCH_BLOCK]; size_t i, j, m, sum = 0;              \
+  cbuf##S##_alloc(&b, n);                                                      \
+  for(i = 0; i < n; i++) { o = obj##S##_make(i); cbuf##S##_push(&b,&o,1); }    \
+  bench_start();                                                               \
+  for(i = 0; i < n; i += BENCH_BLOCK) {                                        \
+    m = n-i < BENCH_BLOCK ? n-i : BENCH_BLOCK;                                 \
+    cbuf##S##_getn(&b, i, tmp, m);                                             \
+    for(j = 0; j < m; j++) sum += obj##S##_key(tmp[j]);                        \
+    cbuf##S##_setn(&b, n-i-m, tmp, m);                                         \
+  }                                                                            \
+  bench_sink += sum;                                                           \
+  cbuf##S##_dealloc(&b);                                                       \
+  return 2*n;                                                                  \
+}
+
+//
+// Buffer and list searches
+//
+#define BENCH_SCAN(c,T,S)                                                      \
+                                                                               \
+static size_t bench_##c##S##_scan_level(size_t n, int level) {                 \
+  T##S b; Obj##S o, xs[2]; size_t i, sum = 0;                                  \
+  c##S##_alloc(&b, n);                                                         \
+  for(i = 0; i < n; i++) { o = obj##S##_make(i % 100); c##S##_push(&b,&o,1); } \
+  xs[0] = obj##S##_make(100); xs[1] = obj##S##_make(101);                      \
+  mc_search_max = level;                                                       \
+  bench_start();                                                               \
+  sum += c##S##_count(&b, xs[0]);                                              \
+  sum += (size_t)c##S##_find_any(&b, xs, 2);                                   \
+  mc_search_max = 3;                                                           \
+  bench_sink += sum;                                                           \
+  c##S##_dealloc(&b);                                                          \
+  return 2*n;                                                                  \
+}                                                                              \
+                                                                               \
+static size_t bench_##c##S##_scan(size_t n) {                                  \
+  return bench_##c##S##_scan_level(n, 3);                                      \
+}                                                                              \
+                                                                               \
+static size_t bench_##c##S##_scan_scalar(size_t n) {                           \
+  return bench_##c##S##_scan_level(n, 0);                                      \
+}
+
+//
+// List and ring share an API
+//
+#define BENCH_LIST(c,T,S)                                                      \
+                                                                               \
+static size_t bench_##c##S##_append(size_t n) {                                \
+  T##S l; size_t i;                                                            \
+  c##S##_alloc(&l, 8);                                                         \
+  for(i = 0; i < n; i++) { Obj##S o = obj##S##_make(i); c##S##_push(&l,&o,1); }\
+  bench_sink += c##S##_len(&l);                                                \
+  c##S##_dealloc(&l);                                                          \
+  return n;                                                                    \
+}                                                                              \
+                                                                               \
+static size_t bench_##c##S##_queue(size_t n) {                                 \
+  T##S l; Obj##S o; size_t i, sum = 0;                                         \
+  c##S##_alloc(&l, 8);                                                         \
+  for(i = 0; i < BENCH_DEPTH; i++) { o = obj##S##_make(i); c##S##_push(&l,&o,1); }\
+  for(i = 0; i < n; i++) {                                                     \
+    o = obj##S##_make(i); c##S##_push(&l,&o,1);                                \
+    c##S##_shift(&l,&o,1); sum += obj##S##_key(o);                             \
+  }                                                                            \
+  bench_sink += sum;                                                           \
+  c##S##_dealloc(&l);                                                          \
+  return 2*n;                                                                  \
+}                                                                              \
+                                                                               \
+static size_t bench_##c##S##_deque(size_t n) {                                 \
+  T##S l; Obj##S o; size_t i, sum = 0; uint64_t r = 88172645463325252ULL;      \
+  c##S##_alloc(&l, 8);                                                         \
+  for(i = 0; i < BENCH_DEPTH; i++) { o = obj##S##_make(i); c##S##_push(&l,&o,1); }\
+  for(i = 0; i < n; i++) {                                                     \
+    uint64_t x = bench_rand(&r);                                               \
+    o = obj##S##_make(i);                                                      \
+    if(x & 1) c##S##_push(&l,&o,1); else c##S##_unshift(&l,&o,1);              \
+    if(x & 2) c##S##_pop(&l,&o,1);  else c##S##_shift(&l,&o,1);                \
+    sum += obj##S##_key(o);                                                    \
+  }                                                                            \
+  bench_sink += sum;                                                           \
+  c##S##_dealloc(&l);                                                          \
+  return 2*n;                                                                  \
+}                                                                              \
+                                                                               \
+static size_t bench_##c##S##_random(size_t n) {                                \
+  T##S l; Obj##S o; size_t i, sum = 0; uint64_t r = 88172645463325252ULL;      \
+  c##S##_alloc(&l, 2*n);                                                       \
+  for(i = 0; i < n; i++) { o = obj##S##_make(i); c##S##_push(&l,&o,1); }       \
+  bench_start();                                                               \
+  for(i = 0; i < n; i++) sum += obj##S##_key(c##S##_get(&l, bench_rand(&r) % n));\
+  for(i = 0; i < n; i++) c##S##_set(&l, bench_rand(&r) % n, obj##S##_make(i)); \
+  bench_sink += sum;                                                           \
+  c##S##_dealloc(&l);                                                          \
+  return 2*n;                                                                  \
+}                                                                              \
+                                                                               \
+static size_t bench_##c##S##_bulk(size_t n) {                                  \
+  T##S l; Obj##S o, tmp[BENCH_BLOCK]; size_t i, j, m, sum = 0;                 \
+  c##S##_alloc(&l, 2*n);                                                       \
+  for(i = 0; i < n; i++) { o = obj##S##_make(i); c##S##_push(&l,&o,1); }       \
+  bench_start();                                                               \
+  for(i = 0; i < n; i += BENCH_BLOCK) {                                        \
+    m = n-i < BENCH_BLOCK ? n-i : BENCH_BLOCK;                                 \
+    c##S##_getn(&l, i, tmp, m);                                                \
+    for(j = 0; j < m; j++) sum += obj##S##_key(tmp[j]);                        \
+    c##S##_setn(&l, n-i-m, tmp, m);                                            \
+  }                                                                            \
+  bench_sink += sum;                                                           \
+  c##S##_dealloc(&l);                                                          \
+  return 2*n;                                                                  \
+}
+
+//
+// Linked list, one malloc per node as callers do. Note that llist_shift adds
+// to the start and llist_unshift removes from the start.
+//
+#define BENCH_LLIST(S)                                                         \
+                                                                               \
+static inline LNode##S* bench_llist##S##_node(size_t i) {                      \
+  LNode##S *node = malloc(sizeof(LNode##S));                                   \
+  node->data = obj##S##_make(i);                                               \
+  return node;                                                                 \
+}                                                                              \
+                                                                               \
+static void bench_llist##S##_free(LList##S *l) {                               \
+  LNode##S *node;                                                              \
+  while((node = llist##S##_unshift(l)) != NULL) free(node);                    \
+}                                                                              \
+                                                                               \
+static size_t bench_llist##S##_append(size_t n) {                              \
+  LList##S l; size_t i;                                                        \
+  llist##S##_init(&l);                                                         \
+  for(i = 0; i < n; i++) llist##S##_push(&l, bench_llist##S##_node(i));       \
+  bench_sink += obj##S##_key(l.last->data);                                    \
+  bench_llist##S##_free(&l);                                                   \
+  return n;                                                                    \
+}                                                                              \
+                                                                               \
+static size_t bench_llist##S##_queue(size_t n) {                               \
+  LList##S l; LNode##S *node; size_t i, sum = 0;                               \
+  llist##S##_init(&l);                                                         \
+  for(i = 0; i < BENCH_DEPTH; i++) llist##S##_push(&l, bench_llist##S##_node(i));\
+  for(i = 0; i < n; i++) {                                                     \
+    llist##S##_push(&l, bench_llist##S##_node(i));                             \
+    node = llist##S##_unshift(&l);                                             \
+    sum += obj##S##_key(node->data);                                           \
+    free(node);                                                                \
+  }                                                                            \
+  bench_sink += sum;                                                           \
+  bench_llist##S##_free(&l);                                                   \
+  return 2*n;                                                                  \
+}                                                                              \
+                                                                               \
+static size_t bench_llist##S##_deque(size_t n) {                               \
+  LList##S l; LNode##S *node; size_t i, sum = 0;                               \
+  uint64_t r = 88172645463325252ULL;                                           \
+  llist##S##_init(&l);                                                         \
+  for(i = 0; i < BENCH_DEPTH; i++) llist##S##_push(&l, bench_llist##S##_node(i));\
+  for(i = 0; i < n; i++) {                                                     \
+    uint64_t x = bench_rand(&r);                                               \
+    node = bench_llist##S##_node(i);                                           \
+    if(x & 1) llist##S##_push(&l, node); else llist##S##_shift(&l, node);      \
+    node = (x & 2) ? llist##S##_pop(&l) : llist##S##_unshift(&l);              \
+    sum += obj##S##_key(node->data);                                           \
+    free(node);                                                                \
+  }                                                                            \
+  bench_sink += sum;                                                           \
+  bench_llist##S##_free(&l);                                                   \
+  return 2*n;                                                                  \
+}
+
+//
+// Unrolled linked list, compared with llist on append/queue/deque/walk
+//
+#define BENCH_ULIST(S)                                                         \
+                                                                               \
+static size_t bench_ulist##S##_append(size_t n) {                              \
+  UList##S l; size_t i;                                                        \
+  ulist##S##_init(&l);                                                         \
+  for(i = 0; i < n; i++) ulist##S##_push(&l, obj##S##_make(i));                \
+  bench_sink += obj##S##_key(l.last->b[l.last->start + l.last->n - 1]);        \
+  ulist##S##_dealloc(&l);                                                      \
+  return n;                                                                    \
+}                                                                              \
+                                                                               \
+static size_t bench_ulist##S##_queue(size_t n) {                               \
+  UList##S l; Obj##S o = obj##S##_make(0); size_t i, sum = 0;                  \
+  ulist##S##_init(&l);                                                         \
+  for(i = 0; i < BENCH_DEPTH; i++) ulist##S##_push(&l, obj##S##_make(i));      \
+  for(i = 0; i < n; i++) {                                                     \
+    ulist##S##_push(&l, obj##S##_make(i));                                     \
+    ulist##S##_shift(&l, &o);                                                  \
+    sum += obj##S##_key(o);                                                    \
+  }                                                                            \
+  bench_sink += sum;                                                           \
+  ulist##S##_dealloc(&l);                                                      \
+  return 2*n;                                                                  \
+}                                                                              \
+                                                                               \
+static size_t bench_ulist##S##_deque(size_t n) {                               \
+  UList##S l; Obj##S o = obj##S##_make(0); size_t i, sum = 0;                  \
+  uint64_t r = 88172645463325252ULL;                                           \
+  ulist##S##_init(&l);                                                         \
+  for(i = 0; i < BENCH_DEPTH; i++) ulist##S##_push(&l, obj##S##_make(i));      \
+  for(i = 0; i < n; i++) {                                                     \
+    uint64_t x = bench_rand(&r);                                               \
+    if(x & 1) ulist##S##_push(&l, obj##S##_make(i));                           \
+    else      ulist##S##_unshift(&l, obj##S##_make(i));                        \
+    if(x & 2) ulist##S##_pop(&l, &o); else ulist##S##_shift(&l, &o);           \
+    sum += obj##S##_key(o);                                                    \
+  }                                                                            \
+  bench_sink += sum;                                                           \
+  ulist##S##_dealloc(&l);                                                      \
+  return 2*n;                                                                  \
+}                                                                              \
+                                                                               \
+static size_t bench_ulist##S##_walk(size_t n) {                                \
+  UList##S l; UIter##S it; size_t i, sum = 0;                                  \
+  ulist##S##_init(&l);                                                         \
+  for(i = 0; i < n; i++) ulist##S##_push(&l, obj##S##_make(i));                \
+  bench_start();                                                               \
+  for(ulist##S##_seek(&l, &it, 0); it.node; ulist##S##_next(&it))              \
+    sum += obj##S##_key(*ulist##S##_iter_ptr(&it));                            \
+  bench_sink += sum;                                                           \
+  ulist##S##_dealloc(&l);                                                      \
+  return n;                                                                    \
+}                                                                              \
+                                                                               \
+static size_t bench_llist##S##_walk(size_t n) {                                \
+  LList##S l; LNode##S *node; size_t i, sum = 0;                               \
+  llist##S##_init(&l);                                                         \
+  for(i = 0; i < n; i++) llist##S##_push(&l, bench_llist##S##_node(i));        \
+  bench_start();                                                               \
+  for(node = l.first; node; node = node->next) sum += obj##S##_key(node->data);\
+  bench_sink += sum;                                                           \
+  bench_llist##S##_free(&l);                                                   \
+  return n;                                                                    \
+}
+
+//
+// Linked list with nodes from a madcrow_nodepool
+//
+#define BENCH_LPOOL(S)                                                         \
+                                                                               \
+static size_t bench_lpool##S##_append(size_t n) {                              \
+  LList##S l = madcrow_linkedlist_init; LPool##S p; size_t i;                  \
+  lpool##S##_alloc(&p, 0);                                                     \
+  for(i = 0; i < n; i++) lpool##S##_push(&p, &l, obj##S##_make(i));            \
+  bench_sink += obj##S##_key(l.last->data);                                    \
+  lpool##S##_dealloc(&p);                                                      \
+  return n;                                                                    \
+}                                                                              \
+                                                                               \
+static size_t bench_lpool##S##_queue(size_t n) {                               \
+  LList##S l = madcrow_linkedlist_init; LPool##S p; Obj##S o;                  \
+  size_t i, sum = 0;                                                           \
+  lpool##S##_alloc(&p, 0);                                                     \
+  for(i = 0; i < BENCH_DEPTH; i++) lpool##S##_push(&p, &l, obj##S##_make(i));  \
+  for(i = 0; i < n; i++) {                                                     \
+    o = obj##S##_make(0);                                                      \
+    lpool##S##_push(&p, &l, obj##S##_make(i));                                 \
+    lpool##S##_unshift(&p, &l, &o);                                            \
+    sum += obj##S##_key(o);                                                    \
+  }                                                                            \
+  bench_sink += sum;                                                           \
+  lpool##S##_dealloc(&p);                                                      \
+  return 2*n;                                                                  \
+}                                                                              \
+                                                                               \
+static size_t bench_lpool##S##_deque(size_t n) {                               \
+  LList##S l = madcrow_linkedlist_init; LPool##S p; Obj##S o;                  \
+  size_t i, sum = 0; uint64_t r = 88172645463325252ULL;                        \
+  lpool##S##_alloc(&p, 0);                                                     \
+  for(i = 0; i < BENCH_DEPTH; i++) lpool##S##_push(&p, &l, obj##S##_make(i));  \
+  for(i = 0; i < n; i++) {                                                     \
+    uint64_t x = bench_rand(&r);                                               \
+    o = obj##S##_make(i);                                                      \
+    if(x & 1) lpool##S##_push(&p, &l, o); else lpool##S##_shift(&p, &l, o);    \
+    if(x & 2) lpool##S##_pop(&p, &l, &o); else lpool##S##_unshift(&p, &l, &o); \
+    sum += obj##S##_key(o);                                                    \
+  }                                                                            \
+  bench_sink += sum;                                                           \
+  lpool##S##_dealloc(&p);                                                      \
+  return 2*n;                                                                  \
+}
+
+//
+// Multiple producers, single consumer
+//
+#define BENCH_NPRODUCERS 4
+
+typedef struct {
+  Mpsc8 q;
+  LList8 list;
+  pthread_mutex_t lock;
+} BenchMpsc;
+
+typedef struct {
+  BenchMpsc *shared;
+  LNode8 *nodes;
+  size_t n;
+} BenchProducer;
+
+static void* bench_mpsc_produce(void *arg)
+{
+  BenchProducer *p = arg;
+  size_t i;
+  for(i = 0; i < p->n; i++) mpsc8_push(&p->shared->q, &p->nodes[i]);
+  return NULL;
+}
+
+static void* bench_mutex_produce(void *arg)
+{
+  BenchProducer *p = arg;
+  size_t i;
+  for(i = 0; i < p->n; i++) {
+    pthread_mutex_lock(&p->shared->lock);
+    llist8_push(&p->shared->list, &p->nodes[i]);
+    pthread_mutex_unlock(&p->shared->lock);
+  }
+  return NULL;
+}
+
+// Returns number of pushes + pops
+static size_t bench_mpsc_run(size_t n, int use_mutex)
+{
+  size_t i, m = n / BENCH_NPRODUCERS, total = m * BENCH_NPRODUCERS, sum = 0;
+  BenchMpsc shared;
+  BenchProducer producers[BENCH_NPRODUCERS];
+  pthread_t threads[BENCH_NPRODUCERS];
+  LNode8 *nodes = malloc(total * sizeof(LNode8)), *node;
+
+  mpsc8_init(&shared.q);
+  llist8_init(&shared.list);
+  pthread_mutex_init(&shared.lock, NULL);
+  for(i = 0; i < total; i++) nodes[i].data = i;
+  bench_start();
+
+  for(i = 0; i < BENCH_NPRODUCERS; i++) {
+    producers[i] = (BenchProducer){.shared = &shared, .nodes = nodes + i*m,
+                                   .n = m};
+    pthread_create(&threads[i], NULL,
+                   use_mutex ? bench_mutex_produce : bench_mpsc_produce,
+                   &producers[i]);
+  }
+
+  for(i = 0; i < total; ) {
+    if(use_mutex) {
+      pthread_mutex_lock(&shared.lock);
+      node = llist8_unshift(&shared.list);
+      pthread_mutex_unlock(&shared.lock);
+    }
+    else node = mpsc8_pop(&shared.q);
+    if(node == NULL) { sched_yield(); continue; }
+    sum += node->data;
+    i++;
+  }
+
+  for(i = 0; i < BENCH_NPRODUCERS; i++) pthread_join(threads[i], NULL);
+  pthread_mutex_destroy(&shared.lock);
+  bench_sink += sum;
+  free(nodes);
+  return 2 * total;
+}
+
+static size_t bench_mpsc8_mpsc4(size_t n) { return bench_mpsc_run(n, 0); }
+static size_t bench_mutex8_mpsc4(size_t n) { return bench_mpsc_run(n, 1); }
+
+//
+// Single producer, single consumer
+//
+#define BENCH_PIPE_DEPTH 4096
+
+typedef struct {
+  Spsc8 q;
+  Buf8 buf;
+  pthread_mutex_t lock;
+  size_t n;
+} BenchPipe;
+
+static void* bench_spsc_produce(void *arg)
+{
+  BenchPipe *p = arg;
+  Obj8 block[BENCH_BLOCK];
+  size_t i, j, m, sent;
+  for(i = 0; i < p->n; i += m) {
+    m = p->n - i < BENCH_BLOCK ? p->n - i : BENCH_BLOCK;
+    for(j = 0; j < m; j++) block[j] = obj8_make(i+j);
+    for(sent = 0; sent < m; ) {
+      j = spsc8_push_n(&p->q, block+sent, m-sent);
+      if(j == 0) sched_yield();
+      sent += j;
+    }
+  }
+  return NULL;
+}
+
+static void* bench_pipe_mutex_produce(void *arg)
+{
+  BenchPipe *p = arg;
+  Obj8 block[BENCH_BLOCK];
+  size_t i, j, m, sent, len;
+  for(i = 0; i < p->n; i += m) {
+    m = p->n - i < BENCH_BLOCK ? p->n - i : BENCH_BLOCK;
+    for(j = 0; j < m; j++) block[j] = obj8_make(i+j);
+    for(sent = 0; sent < m; ) {
+      pthread_mutex_lock(&p->lock);
+      len = buf8_len(&p->buf);
+      j = BENCH_PIPE_DEPTH - len < m-sent ? BENCH_PIPE_DEPTH - len : m-sent;
+      buf8_push(&p->buf, block+sent, j);
+      pthread_mutex_unlock(&p->lock);
+      if(j == 0) sched_yield();
+      sent += j;
+    }
+  }
+  return NULL;
+}
+
+// Returns number of elements pushed + popped
+static size_t bench_pipe_run(size_t n, int use_mutex)
+{
+  size_t i, j, k, sum = 0;
+  Obj8 block[BENCH_BLOCK];
+  BenchPipe p = {.n = n};
+  pthread_t thread;
+
+  spsc8_alloc(&p.q, BENCH_PIPE_DEPTH);
+  buf8_alloc(&p.buf, BENCH_PIPE_DEPTH);
+  pthread_mutex_init(&p.lock, NULL);
+  bench_start();
+
+  pthread_create(&thread, NULL,
+                 use_mutex ? bench_pipe_mutex_produce : bench_spsc_produce, &p);
+
+  for(i = 0; i < n; i += j) {
+    if(use_mutex) {
+      pthread_mutex_lock(&p.lock);
+      j = buf8_len(&p.buf) < BENCH_BLOCK ? buf8_len(&p.buf) : BENCH_BLOCK;
+      buf8_shift(&p.buf, block, j);
+      pthread_mutex_unlock(&p.lock);
+    }
+    else j = spsc8_pop_n(&p.q, block, BENCH_BLOCK);
+    if(j == 0) { sched_yield(); continue; }
+    for(k = 0; k < j; k++) sum += obj8_key(block[k]);
+  }
+
+  pthread_join(thread, NULL);
+  pthread_mutex_destroy(&p.lock);
+  spsc8_dealloc(&p.q);
+  buf8_dealloc(&p.buf);
+  bench_sink += sum;
+  return 2 * n;
+}
+
+static size_t bench_spsc8_pipe(size_t n) { return bench_pipe_run(n, 0); }
+static size_t bench_mutex8_pipe(size_t n) { return bench_pipe_run(n, 1); }
+
+BENCH_BUF(buf,Buf,1)
+BENCH_BUF(buf,Buf,8)
+BENCH_BUF(buf,Buf,64)
+BENCH_BUF(lbuf,LBuf,1)
+BENCH_BUF(lbuf,LBuf,8)
+BENCH_BUF(lbuf,LBuf,64)
+BENCH_CHUNK(1)
+BENCH_CHUNK(8)
+BENCH_CHUNK(64)
+//
+// Many small short-lived buffers
+//
+#define BENCH_SMALL(c,T)                                                       \
+static size_t bench_##c##1_small(size_t n) {                                   \
+  T##1 b; size_t i, j, sum = 0;                                                \
+  for(i = 0; i < n; i++) {                                                     \
+    c##1_alloc(&b, 16);                                                        \
+    for(j = 0; j < 24; j++) { Obj1 o = obj1_make(i+j); c##1_push(&b,&o,1); }   \
+    sum += b.b[i % 24];                                                        \
+    c##1_dealloc(&b);                                                          \
+  }                                                                            \
+  bench_sink += sum;                                                           \
+  return n;                                                                    \
+}
+
+BENCH_SMALL(buf,Buf)
+BENCH_SMALL(sbo,Sbo)
+
+// Buffers are never freed individually, the arena is reset instead
+static size_t bench_abuf1_small(size_t n) {
+  mc_arena_t arena; ABuf1 b = madcrow_buffer_ctx_init(&arena);
+  size_t i, j, sum = 0;
+  mc_arena_alloc(&arena, 0);
+  for(i = 0; i < n; i++) {
+    if(i % 1024 == 0) mc_arena_reset(&arena);
+    abuf1_alloc(&b, 16);
+    for(j = 0; j < 24; j++) { Obj1 o = obj1_make(i+j); abuf1_push(&b,&o,1); }
+    sum += b.b[i % 24];
+  }
+  mc_arena_dealloc(&arena);
+  bench_sink += sum;
+  return n;
+}
+
+//
+// Zeroed buffers that are mostly untouched between resets
+//
+#define BENCH_WIPE(c,T)                                                        \
+static size_t bench_##c##8_wipe(size_t n) {                                    \
+  T##8 b; size_t i, r, sum = 0; uint64_t x = 88172645463325252ULL;             \
+  c##8_alloc(&b, 16);                                                          \
+  for(r = 0; r < 16; r++) {                                                    \
+    c##8_resize(&b, n);                                                        \
+    for(i = 0; i < 64; i++) b.b[bench_rand(&x) % n] = i;                       \
+    sum += b.b[n/2];                                                           \
+    c##8_reset(&b);                                                            \
+  }                                                                            \
+  c##8_dealloc(&b);                                                            \
+  bench_sink += sum;                                                           \
+  return 16 * n;                                                               \
+}
+
+BENCH_WIPE(zbuf,ZBuf)
+BENCH_WIPE(pzbuf,PZBuf)
+
+//
+// Sorting
+//
+static int bench_cmp8(const void *a, const void *b)
+{
+  Obj8 x = *(const Obj8*)a, y = *(const Obj8*)b;
+  return x < y ? -1 : x > y;
+}
+
+// nthreads is 0 for qsort
+static size_t bench_sort_run(size_t n, size_t nthreads)
+{
+  Buf8 b; size_t i; uint64_t r = 88172645463325252ULL;
+  buf8_alloc(&b, n);
+  for(i = 0; i < n; i++) { Obj8 o = bench_rand(&r); buf8_push(&b,&o,1); }
+  bench_start();
+  if(nthreads) buf8_sort_mt(&b, nthreads);
+  else qsort(b.b, b.len, sizeof(Obj8), bench_cmp8);
+  bench_sink += b.b[n/2];
+  buf8_dealloc(&b);
+  return n;
+}
+
+static size_t bench_buf8_sort(size_t n) { return bench_sort_run(n, 1); }
+static size_t bench_buf8_sort_mt4(size_t n) { return bench_sort_run(n, 4); }
+static size_t bench_qsort8_sort(size_t n) { return bench_sort_run(n, 0); }
+
+// Merge sort by relinking nodes, which sit in one array
+static size_t bench_llist8_sort(size_t n)
+{
+  LList8 l = madcrow_linkedlist_init; size_t i;
+  uint64_t r = 88172645463325252ULL;
+  LNode8 *nodes = malloc(n * sizeof(LNode8));
+  for(i = 0; i < n; i++) {
+    nodes[i].data = bench_rand(&r);
+    llist8_push(&l, &nodes[i]);
+  }
+  bench_start();
+  llist8_sort(&l);
+  bench_sink += l.first->data;
+  free(nodes);
+  return n;
+}
+
+//
+// Parallel fill then sum, on the calling thread (NULL pool) or a pool of 4
+//
+static void bench_fold8(void *acc, const Obj8 *ptr, size_t n, size_t idx,
+                        void *ctx)
+{
+  size_t i; uint64_t sum = 0;
+  (void)idx; (void)ctx;
+  for(i = 0; i < n; i++) sum += ptr[i] * ptr[i];
+  *(uint64_t*)acc += sum;
+}
+
+static void bench_merge8(void *acc, const void *part, void *ctx)
+{
+  (void)ctx;
+  *(uint64_t*)acc += *(const uint64_t*)part;
+}
+
+static size_t bench_reduce_run(size_t n, size_t nthreads)
+{
+  Buf8 b; mc_pool_t pool, *p = NULL; uint64_t sum = 0;
+  if(nthreads > 1) { mc_pool_alloc(&pool, nthreads); p = &pool; }
+  buf8_alloc(&b, n);
+  b.len = n;
+  bench_start();
+  buf8_parallel_fill(p, &b, 3);
+  buf8_parallel_reduce(p, &b, &sum, sizeof(sum), bench_fold8, bench_merge8,
+                       NULL);
+  bench_sink += sum;
+  buf8_dealloc(&b);
+  if(p) mc_pool_dealloc(p);
+  return 2*n;
+}
+
+static size_t bench_buf8_reduce(size_t n) { return bench_reduce_run(n, 1); }
+static size_t bench_buf8_reduce_mt4(size_t n) { return bench_reduce_run(n, 4); }
+
+//
+// Save n elements to a temporary file, then load them back and sum them with
+// _load (read into the buffer) or _load_mmap (map the file, no checksum).
+// Only the load and sum is timed.
+//
+static size_t bench_load_run(size_t n, int map)
+{
+  Buf8 b; MBuf8 m = madcrow_buffer_init; size_t i; uint64_t sum = 0;
+  char path[] = "/tmp/madcrow_bench_XXXXXX";
+  int fd = mkstemp(path);
+  if(fd < 0) { perror("mkstemp"); exit(EXIT_FAILURE); }
+  close(fd);
+  buf8_alloc(&b, n);
+  for(i = 0; i < n; i++) { Obj8 o = obj8_make(i); buf8_push(&b,&o,1); }
+  if(buf8_save(&b, path) < 0) { perror("save"); exit(EXIT_FAILURE); }
+  buf8_dealloc(&b);
+  bench_start();
+  if(map) {
+    if(mbuf8_load_mmap(&m, path, 0) < 0) { perror("load"); exit(EXIT_FAILURE); }
+    for(i = 0; i < m.len; i++) sum += m.b[i];
+    mbuf8_dealloc(&m);
+  }
+  else {
+    buf8_alloc(&b, 8);
+    if(buf8_load(&b, path) < 0) { perror("load"); exit(EXIT_FAILURE); }
+    for(i = 0; i < b.len; i++) sum += b.b[i];
+    buf8_dealloc(&b);
+  }
+  bench_sink += sum;
+  unlink(path);
+  return n;
+}
+
+static size_t bench_buf8_load(size_t n) { return bench_load_run(n, 0); }
+static size_t bench_mbuf8_load(size_t n) { return bench_load_run(n, 1); }
+
+//
+// Hash map: count n random keys drawn from n/4 distinct (grows from empty),
+// then look up n random keys in a map of n, half of them missing. Lookup is
+// compared with bsearch on a sorted buffer; building the map or buffer is not
+// timed.
+//
+static size_t bench_hmap8_count(size_t n)
+{
+  HMap8 map; size_t i; uint64_t r = 88172645463325252ULL;
+  hmap8_alloc(&map, 0);
+  for(i = 0; i < n; i++) (*hmap8_add(&map, bench_rand(&r) % (n/4+1), NULL))++;
+  bench_sink += hmap8_len(&map);
+  hmap8_dealloc(&map);
+  return n;
+}
+
+// even keys are present, odd ones are not
+static size_t bench_lookup_run(size_t n, int hash)
+{
+  HMap8 map; Buf8 b; size_t i; uint64_t r = 88172645463325252ULL, k;
+  if(hash) {
+    hmap8_alloc(&map, n);
+    for(i = 0; i < n; i++) hmap8_set(&map, 2*i, i);
+    bench_start();
+    for(i = 0; i < n; i++) {
+      Obj8 *v = hmap8_get(&map, bench_rand(&r) % (2*n));
+      bench_sink += v ? *v : 0;
+    }
+    hmap8_dealloc(&map);
+  }
+  else {
+    buf8_alloc(&b, n);
+    for(i = 0; i < n; i++) { Obj8 o = 2*i; buf8_push(&b,&o,1); }
+    bench_start();
+    for(i = 0; i < n; i++) {
+      k = bench_rand(&r) % (2*n);
+      Obj8 *v = bsearch(&k, b.b, b.len, sizeof(Obj8), bench_cmp8);
+      bench_sink += v ? *v : 0;
+    }
+    buf8_dealloc(&b);
+  }
+  return n;
+}
+
+static size_t bench_hmap8_lookup(size_t n) { return bench_lookup_run(n, 1); }
+static size_t bench_bsearch8_lookup(size_t n) { return bench_lookup_run(n, 0); }
+
+//
+// Bit vectors of n 64 bit words: and, or, xor, andnot then count (ops are
+// words), with the SIMD/popcnt kernels or forced scalar. rank does n random
+// rank then n random select queries; building the index is not timed.
+//
+static void bench_bits8_fill(Bits8 *bb, size_t n, uint64_t *r)
+{
+  size_t i;
+  bits8_alloc(bb, 64*n);
+  bits8_resize(bb, 64*n);
+  for(i = 0; i < n; i++) bb->w.b[i] = bench_rand(r);
+}
+
+static size_t bench_bitops_level(size_t n, int level)
+{
+  Bits8 a, b; uint64_t r = 88172645463325252ULL;
+  bench_bits8_fill(&a, n, &r);
+  bench_bits8_fill(&b, n, &r);
+  mc_search_max = level;
+  bench_start();
+  bits8_and(&a, &b);
+  bits8_or(&a, &b);
+  bits8_xor(&a, &b);
+  bits8_andnot(&a, &b);
+  bench_sink += bits8_count(&a);
+  mc_search_max = 3;
+  bits8_dealloc(&a);
+  bits8_dealloc(&b);
+  return 5*n;
+}
+
+static size_t bench_bits8_bitops(size_t n) { return bench_bitops_level(n, 3); }
+static size_t bench_bits8_bitops_scalar(size_t n) {
+  return bench_bitops_level(n, 0);
+}
+
+static size_t bench_bits8_rank(size_t n)
+{
+  Bits8 a; size_t i, sum = 0, ones; uint64_t r = 88172645463325252ULL;
+  bench_bits8_fill(&a, n, &r);
+  if(bits8_index(&a) < 0) { perror("index"); exit(EXIT_FAILURE); }
+  ones = bits8_count(&a);
+  bench_start();
+  for(i = 0; i < n; i++) sum += bits8_rank(&a, bench_rand(&r) % (64*n));
+  for(i = 0; i < n; i++) sum += bits8_select(&a, bench_rand(&r) % ones);
+  bench_sink += sum;
+  bits8_dealloc(&a);
+  return 2*n;
+}
+
+//
+// Priority queue hold model: a heap of n random times, then n x (pop the
+// smallest + push it back a random time later). 4-ary (heap) vs binary (bheap);
+// filling the heap is not timed.
+//
+#define BENCH_HOLD(c,T)                                                        \
+static size_t bench_##c##8_hold(size_t n) {                                    \
+  T##8 h; Obj8 o = 0; size_t i; uint64_t r = 88172645463325252ULL;             \
+  c##8_alloc(&h, n);                                                           \
+  for(i = 0; i < n; i++) c##8_push(&h, bench_rand(&r) % (n * 16));             \
+  bench_start();                                                               \
+  for(i = 0; i < n; i++) {                                                     \
+    c##8_pop(&h, &o);                                                          \
+    c##8_push(&h, o + bench_rand(&r) % (n * 16));                              \
+  }                                                                            \
+  bench_sink += *c##8_peek(&h);                                                \
+  c##8_dealloc(&h);                                                            \
+  return 2*n;                                                                  \
+}
+
+BENCH_HOLD(heap,Heap)
+BENCH_HOLD(bheap,BHeap)
+
+BENCH_SCAN(buf,Buf,1)
+BENCH_SCAN(buf,Buf,8)
+BENCH_SCAN(buf,Buf,64)
+BENCH_SCAN(list,List,1)
+BENCH_SCAN(list,List,8)
+BENCH_SCAN(list,List,64)
+BENCH_LIST(list,List,1)
+BENCH_LIST(list,List,8)
+BENCH_LIST(list,List,64)
+BENCH_LIST(ring,Ring,1)
+BENCH_LIST(ring,Ring,8)
+BENCH_LIST(ring,Ring,64)
+BENCH_LLIST(1)
+BENCH_LLIST(8)
+BENCH_LLIST(64)
+BENCH_ULIST(1)
+BENCH_ULIST(8)
+BENCH_ULIST(64)
+BENCH_LPOOL(1)
+BENCH_LPOOL(8)
+BENCH_LPOOL(64)
+
+typedef struct {
+  const char *container, *pattern;
+  size_t objsize;
+  size_t (*run)(size_t n); // returns number of element operations
+} BenchCase;
+
+#define BENCH_CASES(c,S) \
+  {#c, "append", S, bench_##c##S##_append}, \
+  {#c, "queue",  S, bench_##c##S##_queue},  \
+  {#c, "deque",  S, bench_##c##S##_deque}
+
+#define BENCH_CASES_RANDOM(c,S) \
+  {#c, "random", S, bench_##c##S##_random}, \
+  {#c, "bulk",   S, bench_##c##S##_bulk}
+
+#define BENCH_CASES_SCAN(c,S) \
+  {#c, "scan",        S, bench_##c##S##_scan}, \
+  {#c, "scan_scalar", S, bench_##c##S##_scan_scalar}
+
+static const BenchCase bench_cases[] = {
+  BENCH_CASES(buf,1), BENCH_CASES(buf,8), BENCH_CASES(buf,64),
+  BENCH_CASES_RANDOM(buf,1), BENCH_CASES_RANDOM(buf,8), BENCH_CASES_RANDOM(buf,64),
+  BENCH_CASES_SCAN(buf,1), BENCH_CASES_SCAN(buf,8), BENCH_CASES_SCAN(buf,64),
+  BENCH_CASES(lbuf,1), BENCH_CASES(lbuf,8), BENCH_CASES(lbuf,64),
+  BENCH_CASES_RANDOM(lbuf,1), BENCH_CASES_RANDOM(lbuf,8), BENCH_CASES_RANDOM(lbuf,64),
+  {"cbuf", "append", 1, bench_cbuf1_append},
+  {"cbuf", "append", 8, bench_cbuf8_append},
+  {"cbuf", "append", 64, bench_cbuf64_append},
+  BENCH_CASES_RANDOM(cbuf,1), BENCH_CASES_RANDOM(cbuf,8), BENCH_CASES_RANDOM(cbuf,64),
+  BENCH_CASES(list,1), BENCH_CASES(list,8), BENCH_CASES(list,64),
+  BENCH_CASES_RANDOM(list,1), BENCH_CASES_RANDOM(list,8), BENCH_CASES_RANDOM(list,64),
+  BENCH_CASES_SCAN(list,1), BENCH_CASES_SCAN(list,8), BENCH_CASES_SCAN(list,64),
+  BENCH_CASES(ring,1), BENCH_CASES(ring,8), BENCH_CASES(ring,64),
+  BENCH_CASES_RANDOM(ring,1), BENCH_CASES_RANDOM(ring,8), BENCH_CASES_RANDOM(ring,64),
+  BENCH_CASES(llist,1), BENCH_CASES(llist,8), BENCH_CASES(llist,64),
+  BENCH_CASES(lpool,1), BENCH_CASES(lpool,8), BENCH_CASES(lpool,64),
+  BENCH_CASES(ulist,1), BENCH_CASES(ulist,8), BENCH_CASES(ulist,64),
+  {"llist", "walk", 1, bench_llist1_walk},
+  {"llist", "walk", 8, bench_llist8_walk},
+  {"llist", "walk", 64, bench_llist64_walk},
+  {"ulist", "walk", 1, bench_ulist1_walk},
+  {"ulist", "walk", 8, bench_ulist8_walk},
+  {"ulist", "walk", 64, bench_ulist64_walk},
+  {"mpsc",  "mpsc4", 8, bench_mpsc8_mpsc4},
+  {"mutex", "mpsc4", 8, bench_mutex8_mpsc4},
+  {"buf",   "small",    1, bench_buf1_small},
+  {"sbo",   "small",    1, bench_sbo1_small},
+  {"arena", "small",    1, bench_abuf1_small},
+  {"buf",   "sort",     8, bench_buf8_sort},
+  {"buf",   "sort_mt4", 8, bench_buf8_sort_mt4},
+  {"qsort", "sort",     8, bench_qsort8_sort},
+  {"llist", "sort",     8, bench_llist8_sort},
+  {"buf",   "reduce",     8, bench_buf8_reduce},
+  {"buf",   "reduce_mt4", 8, bench_buf8_reduce_mt4},
+  {"buf",   "load",     8, bench_buf8_load},
+  {"mmap",  "load",     8, bench_mbuf8_load},
+  {"hash",  "count",    8, bench_hmap8_count},
+  {"hash",  "lookup",   8, bench_hmap8_lookup},
+  {"sorted","lookup",   8, bench_bsearch8_lookup},
+  {"bits",  "ops",      8, bench_bits8_bitops},
+  {"bits",  "ops_scalar", 8, bench_bits8_bitops_scalar},
+  {"bits",  "rank",     8, bench_bits8_rank},
+  {"heap",  "hold",     8, bench_heap8_hold},
+  {"bheap", "hold",     8, bench_bheap8_hold},
+  {"wipe",  "wipe",     8, bench_zbuf8_wipe},
+  {"pages", "wipe",     8, bench_pzbuf8_wipe},
+  {"spsc",  "pipe",  8, bench_spsc8_pipe},
+  {"mutex", "pipe",  8, bench_mutex8_pipe}
+};
+
+#define NUM_BENCH_CASES (sizeof(bench_cases)/sizeof(bench_cases[0]))
+
+// Peak resident set size of this process in KB
+static size_t bench_peak_rss_kb()
+{
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  #ifdef __APPLE__
+    return ru.ru_maxrss / 1024; // bytes on macOS
+  #else
+    return ru.ru_maxrss;
+  #endif
+}
+
+//
+// Push latency under growth (-l)
+//
+typedef struct {
+  const char *container;
+  void (*run)(size_t n, uint32_t *lat); // ns taken by each of n appends
+} BenchLatency;
+
+#define BENCH_LATENCY(c,T,add)                                                 \
+static void bench_latency_##c(size_t n, uint32_t *lat) {                       \
+  T x; size_t i; double t;                                                     \
+  c##_alloc(&x, 8);                                                            \
+  for(i = 0; i < n; i++) {                                                     \
+    t = bench_now_ns();                                                        \
+    add(&x, (Obj8)i);                                                          \
+    lat[i] = (uint32_t)(bench_now_ns() - t);                                   \
+  }                                                                            \
+  c##_dealloc(&x);                                                             \
+}
+
+BENCH_LATENCY(buf8,Buf8,buf8_add)
+BENCH_LATENCY(ibuf8,IBuf8,ibuf8_add)
+BENCH_LATENCY(list8,List8,list8_append)
+BENCH_LATENCY(ilist8,IList8,ilist8_append)
+BENCH_LATENCY(cbuf8,CBuf8,cbuf8_add)
+
+static const BenchLatency bench_latencies[] = {
+  {"buf",   bench_latency_buf8},
+  {"ibuf",  bench_latency_ibuf8},
+  {"list",  bench_latency_list8},
+  {"ilist", bench_latency_ilist8},
+  {"cbuf",  bench_latency_cbuf8},
+};
+
+#define NUM_BENCH_LATENCIES (sizeof(bench_latencies)/sizeof(bench_latencies[0]))
+
+static int bench_cmp_u32(const void *a, const void *b)
+{
+  uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+  return x < y ? -1 : x > y;
+}
+
+// Run a single latency case in this process and print its percentiles
+static void bench_latency_run(const BenchLatency *bl, size_t n, int csv)
+{
+  uint32_t *lat = malloc(n * sizeof(uint32_t));
+  double sum = 0;
+  size_t i;
+  memset(lat, 0, n * sizeof(uint32_t)); // fault the pages in before timing
+  bl->run(n, lat);
+  for(i = 0; i < n; i++) sum += lat[i];
+  qsort(lat, n, sizeof(uint32_t), bench_cmp_u32);
+  uint32_t p50 = lat[n/2], p99 = lat[n/100*99], p999 = lat[n/1000*999];
+  if(csv) {
+    printf("%s,%zu,%u,%u,%u,%u,%.3f\n", bl->container, n,
+           p50, p99, p999, lat[n-1], sum / n);
+  } else {
+    printf("%-6s %10zu %8u %8u %8u %10u %10.3f\n", bl->container, n,
+           p50, p99, p999, lat[n-1], sum / n);
+  }
+  free(lat);
+}
+
+// Run a single case in this process and print the result
+static void bench_run(const BenchCase *bc, size_t n, int csv)
+{
+  bench_start();
+  size_t nops = bc->run(n);
+  double ns = (bench_now_ns() - bench_t0) / nops;
+
+  if(csv) {
+    printf("%s,%s,%zu,%zu,%zu,%.3f,%zu,%zu,%zu,%zu\n",
+           bc->container, bc->pattern, bc->objsize, n, nops, ns,
+           bench_nreallocs, bench_realloc_bytes, bench_memmove_bytes,
+           bench_peak_rss_kb());
+  } else {
+    printf("%-6s %-11s %4zu %10zu %10.3f %9zu %15zu %11zu\n",
+           bc->container, bc->pattern, bc->objsize, n, ns,
+           bench_nreallocs, bench_memmove_bytes, bench_peak_rss_kb());
+  }
+}
+
+static void print_usage()
+{
+  fprintf(stderr, "usage: run_bench [-n <max_elements>] [-c] [-l]\n"
+                  "  -n <N>  largest size to test, 1e3..1e8 [default: 1e6]\n"
+                  "  -c      print CSV\n"
+                  "  -l      print push latency percentiles\n");
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+  size_t i, n, maxn = 1000000, ncases = NUM_BENCH_CASES;
+  int c, csv = 0, latency = 0;
+
+  while((c = getopt(argc, argv, "n:cl")) != -1) {
+    switch(c) {
+      case 'n': maxn = (size_t)strtod(optarg, NULL); break;
+      case 'c': csv = 1; break;
+      case 'l': latency = 1; ncases = NUM_BENCH_LATENCIES; break;
+      default: print_usage();
+    }
+  }
+
+  if(maxn < 1000 || maxn > 100000000) print_usage();
+
+  if(latency && csv) {
+    printf("container,n,p50_ns,p99_ns,p999_ns,max_ns,ns_per_op\n");
+  } else if(latency) {
+    printf("%-6s %10s %8s %8s %8s %10s %10s\n",
+           "type", "n", "p50", "p99", "p99.9", "max", "ns/op");
+  } else if(csv) {
+    printf("container,pattern,obj_bytes,n,ops,ns_per_op,"
+           "reallocs,realloc_bytes,memmove_bytes,peak_rss_kb\n");
+  } else {
+    printf("%-6s %-11s %4s %10s %10s %9s %15s %11s\n",
+           "type", "pattern", "obj", "n", "ns/op",
+           "reallocs", "memmove_bytes", "peak_rss_kb");
+  }
+
+  for(i = 0; i < ncases; i++) {
+    for(n = 1000; n <= maxn; n *= 10) {
+      fflush(stdout);
+      pid_t pid = fork();
+      if(pid < 0) { perror("fork"); exit(EXIT_FAILURE); }
+      if(pid == 0) {
+        if(latency) bench_latency_run(&bench_latencies[i], n, csv);
+        else bench_run(&bench_cases[i], n, csv);
+        fflush(stdout);
+        _exit(EXIT_SUCCESS);
+      }
+      int status;
+      waitpid(pid, &status, 0);
+      if(!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+        if(latency) {
+          fprintf(stderr, "%s latency n=%zu failed\n",
+                  bench_latencies[i].container, n);
+        } else {
+          fprintf(stderr, "%s %s %zu n=%zu failed\n", bench_cases[i].container,
+                  bench_cases[i].pattern, bench_cases[i].objsize, n);
+        }
+      }
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
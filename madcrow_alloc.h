@@ -0,0 +1,363 @@
+#ifndef MADCROW_ALLOC_H_
+#define MADCROW_ALLOC_H_
+
+#include <stdlib.h>
+#include <stdint.h> // SIZE_MAX
+#include <string.h> // memset, memcpy
+#include <unistd.h> // sysconf
+#include <sys/mman.h> // madvise
+
+//
+// madcrow_alloc.h
+// How madcrow_buffer.h and madcrow_list.h call their allocator, plus a bump
+// (region) arena to use as a context-carrying allocator.
+//
+// madcrow_buffer2 / madcrow_list2 take plain functions:
+//   void* mc_alloc   (size_t n, size_t size)   // zeroed, like calloc
+//   void* mc_realloc (void *ptr, size_t size)
+//   void  mc_free    (void *ptr)
+//
+// madcrow_buffer_ctx2 / madcrow_list_ctx2 add a `ctx_t *ctx` field to the
+// struct and pass it to every call, along with the old size on realloc/free:
+//   void* mc_alloc   (ctx_t *ctx, size_t n, size_t size)
+//   void* mc_realloc (ctx_t *ctx, void *ptr, size_t oldsize, size_t size)
+//   void  mc_free    (ctx_t *ctx, void *ptr, size_t size)
+//
+// _new() allocates the struct itself with a NULL ctx.
+//
+// Arena example:
+//
+//   madcrow_buffer_arena(charbuf,String,char)
+//
+//   mc_arena_t arena;
+//   mc_arena_alloc(&arena, 0); // 0 => 64KB blocks
+//   String s = madcrow_buffer_ctx_init(&arena);
+//   charbuf_push(&s, "hi", 2);
+//   ...
+//   mc_arena_dealloc(&arena); // frees s and everything else at once
+//
+// The arena hands out memory by bumping a pointer through large blocks. Growing
+// the most recent allocation happens in place, so a buffer being appended to
+// does not copy. Other frees are ignored until the whole arena is reset or
+// freed. A NULL arena uses calloc/realloc/free. Not thread safe.
+//
+
+//
+// Allocator adapters: FUNC_mem_alloc/realloc/free(container, ...)
+//
+
+#define madcrow_mem(FUNC,cont_t,mc_alloc,mc_realloc,mc_free)                   \
+                                                                               \
+static inline void*  FUNC ## _mem_alloc(const cont_t *c, size_t n, size_t sz)  \
+ __attribute__((unused));                                                      \
+static inline void*  FUNC ## _mem_realloc(const cont_t *c, void *ptr,          \
+                                          size_t oldsize, size_t size)         \
+ __attribute__((unused));                                                      \
+static inline void   FUNC ## _mem_free(const cont_t *c, void *ptr, size_t sz)  \
+ __attribute__((unused));                                                      \
+                                                                               \
+static inline void*  FUNC ## _mem_alloc(const cont_t *c, size_t n, size_t sz)  \
+{                                                                              \
+  (void)c;                                                                     \
+  return mc_alloc(n, sz);                                                      \
+}                                                                              \
+                                                                               \
+static inline void*  FUNC ## _mem_realloc(const cont_t *c, void *ptr,          \
+                                          size_t oldsize, size_t size) {       \
+  (void)c; (void)oldsize;                                                      \
+  return mc_realloc(ptr, size);                                                \
+}                                                                              \
+                                                                               \
+static inline void   FUNC ## _mem_free(const cont_t *c, void *ptr, size_t sz)  \
+{                                                                              \
+  (void)c; (void)sz;                                                           \
+  mc_free(ptr);                                                                \
+}                                                                              \
+                                                                               \
+
+#define madcrow_mem_ctx(FUNC,cont_t,mc_alloc,mc_realloc,mc_free)               \
+                                                                               \
+static inline void*  FUNC ## _mem_alloc(const cont_t *c, size_t n, size_t sz)  \
+ __attribute__((unused));                                                      \
+static inline void*  FUNC ## _mem_realloc(const cont_t *c, void *ptr,          \
+                                          size_t oldsize, size_t size)         \
+ __attribute__((unused));                                                      \
+static inline void   FUNC ## _mem_free(const cont_t *c, void *ptr, size_t sz)  \
+ __attribute__((unused));                                                      \
+                                                                               \
+static inline void*  FUNC ## _mem_alloc(const cont_t *c, size_t n, size_t sz)  \
+{                                                                              \
+  return mc_alloc(c ? c->ctx : NULL, n, sz);                                   \
+}                                                                              \
+                                                                               \
+static inline void*  FUNC ## _mem_realloc(const cont_t *c, void *ptr,          \
+                                          size_t oldsize, size_t size) {       \
+  return mc_realloc(c ? c->ctx : NULL, ptr, oldsize, size);                    \
+}                                                                              \
+                                                                               \
+static inline void   FUNC ## _mem_free(const cont_t *c, void *ptr, size_t sz)  \
+{                                                                              \
+  mc_free(c ? c->ctx : NULL, ptr, sz);                                         \
+}                                                                              \
+                                                                               \
+
+//
+// Auto-shrink policy for buffers and lists (see _autoshrink)
+//
+
+// Capacity counts as unused while len < capacity / MC_SHRINK_FRACTION
+#ifndef MC_SHRINK_FRACTION
+  #define MC_SHRINK_FRACTION 4
+#endif
+
+// Auto-shrink leaves at least this many bytes allocated
+#ifndef MC_SHRINK_MIN
+  #define MC_SHRINK_MIN 4096
+#endif
+
+// Policy and count, only in containers from an _autoshrink generator
+typedef struct {
+  uint32_t ops, low_ops; // shrink after ops low removals (0 = off), count
+} mc_shrink_t;
+
+#define mc_shrink(c) (&(c)->shrink)
+#define mc_noshrink(c) ((void)(c), (mc_shrink_t[1]){{0, 0}}) // always off
+
+//
+// Incremental growth for buffers and lists (madcrow_buffer_incr etc.)
+//
+
+// Bytes migrated from the old array per operation while growing
+#ifndef MC_INCR_STEP
+  #define MC_INCR_STEP 256
+#endif
+
+// Elements migrated per operation: at least 2, which finishes a migration
+// before the doubled array can fill up again
+#define mc_incr_step(objsize) \
+        (MC_INCR_STEP / (objsize) > 2 ? MC_INCR_STEP / (objsize) : 2)
+
+// Pages of the old array are dropped in aligned blocks of this many bytes (a
+// power of two, at least the page size) as they are migrated, so that freeing
+// it at the end doesn't have to unmap them all at once
+#ifndef MC_INCR_RELEASE
+  #define MC_INCR_RELEASE (1UL<<16)
+#endif
+
+static inline void mc_incr_release(void *ptr, size_t from, size_t to)
+ __attribute__((unused));
+
+// Called after migrating bytes [from,to) of the array at ptr, which will be
+// freed without being read again. Drops the pages of any MC_INCR_RELEASE
+// blocks that were finished, with madvise(MADV_DONTNEED). Memory must be
+// private and anonymous, as for MC_INIT_MEM_PAGES. Linux only, and needs
+// _DEFAULT_SOURCE or _GNU_SOURCE, otherwise it does nothing.
+static inline void mc_incr_release(void *ptr, size_t from, size_t to)
+{
+  #if defined(__linux__) && defined(MADV_DONTNEED)
+    uintptr_t start = ((uintptr_t)ptr + from) & ~(MC_INCR_RELEASE - 1);
+    uintptr_t end = ((uintptr_t)ptr + to) & ~(MC_INCR_RELEASE - 1);
+    if(start < end) {
+      uintptr_t pagesize = (uintptr_t)sysconf(_SC_PAGESIZE);
+      uintptr_t first = ((uintptr_t)ptr + pagesize - 1) & ~(pagesize - 1);
+      if(start < first) start = first; /* don't touch memory before ptr */
+      if(start < end) madvise((void*)start, end - start, MADV_DONTNEED);
+    }
+  #else
+    (void)ptr; (void)from; (void)to;
+  #endif
+}
+
+//
+// Cache line aligned allocator: mc_aligned_calloc/realloc/free return memory
+// aligned to MC_CACHE_LINE, and realloc keeps it aligned. Each block has a
+// one line header holding its size in front of it.
+//
+
+#ifndef MC_CACHE_LINE
+  #define MC_CACHE_LINE 64
+#endif
+
+typedef struct {
+  size_t size; // bytes requested
+  char pad[MC_CACHE_LINE - sizeof(size_t)];
+} mc_aligned_hdr_t;
+
+#define mc_aligned_hdr(ptr) ((mc_aligned_hdr_t*)(ptr) - 1)
+
+static inline void* mc_aligned_calloc(size_t n, size_t size)
+ __attribute__((unused));
+static inline void* mc_aligned_realloc(void *ptr, size_t size)
+ __attribute__((unused));
+static inline void  mc_aligned_free(void *ptr)
+ __attribute__((unused));
+
+// Returns an uninitialised aligned block of size bytes, or NULL
+static inline void* mc_aligned_block(size_t size) {
+  mc_aligned_hdr_t *hdr;
+  size_t bytes;
+  if(size > SIZE_MAX - 2*MC_CACHE_LINE) return NULL;
+  bytes = (sizeof(mc_aligned_hdr_t) + size + MC_CACHE_LINE - 1) &
+          ~(size_t)(MC_CACHE_LINE - 1);
+  if((hdr = aligned_alloc(MC_CACHE_LINE, bytes)) == NULL) return NULL;
+  hdr->size = size;
+  return hdr + 1;
+}
+
+static inline void* mc_aligned_calloc(size_t n, size_t size) {
+  void *ptr;
+  if(size && n > SIZE_MAX / size) return NULL;
+  if((ptr = mc_aligned_block(n * size)) != NULL) memset(ptr, 0, n * size);
+  return ptr;
+}
+
+static inline void* mc_aligned_realloc(void *ptr, size_t size) {
+  void *newptr;
+  size_t oldsize;
+  if(ptr == NULL) return mc_aligned_block(size);
+  oldsize = mc_aligned_hdr(ptr)->size;
+  // blocks are whole lines, resizing within the last one is free
+  if((size + MC_CACHE_LINE - 1) / MC_CACHE_LINE ==
+     (oldsize + MC_CACHE_LINE - 1) / MC_CACHE_LINE) {
+    mc_aligned_hdr(ptr)->size = size;
+    return ptr;
+  }
+  if((newptr = mc_aligned_block(size)) == NULL) return NULL;
+  memcpy(newptr, ptr, oldsize < size ? oldsize : size);
+  free(mc_aligned_hdr(ptr));
+  return newptr;
+}
+
+static inline void  mc_aligned_free(void *ptr) {
+  if(ptr) free(mc_aligned_hdr(ptr));
+}
+
+//
+// Bump arena
+//
+
+// Allocations are aligned to MC_ARENA_ALIGN bytes
+#define MC_ARENA_ALIGN 16
+
+typedef struct mc_arena_block_t mc_arena_block_t;
+
+struct mc_arena_block_t {
+  mc_arena_block_t *prev;
+  size_t size; // bytes after the header
+  char pad[MC_ARENA_ALIGN - (2*sizeof(size_t)) % MC_ARENA_ALIGN];
+};
+
+typedef struct {
+  mc_arena_block_t *block; // current block, others linked by prev
+  size_t used; // bytes used in block
+  char *last; // most recent allocation, can grow in place
+  size_t block_size; // minimum size of new blocks
+} mc_arena_t;
+
+#define mc_arena_data(blk) ((char*)((blk) + 1))
+
+static inline void  mc_arena_alloc(mc_arena_t *a, size_t block_size)
+ __attribute__((unused));
+static inline void  mc_arena_dealloc(mc_arena_t *a)
+ __attribute__((unused));
+static inline void  mc_arena_reset(mc_arena_t *a)
+ __attribute__((unused));
+static inline void* mc_arena_calloc(mc_arena_t *a, size_t n, size_t size)
+ __attribute__((unused));
+static inline void* mc_arena_realloc(mc_arena_t *a, void *ptr,
+                                     size_t oldsize, size_t size)
+ __attribute__((unused));
+static inline void  mc_arena_free(mc_arena_t *a, void *ptr, size_t size)
+ __attribute__((unused));
+
+static inline void  mc_arena_alloc(mc_arena_t *a, size_t block_size) {
+  a->block = NULL;
+  a->used = 0;
+  a->last = NULL;
+  a->block_size = block_size ? block_size : 65536 - sizeof(mc_arena_block_t);
+}
+
+// Free every block
+static inline void  mc_arena_dealloc(mc_arena_t *a) {
+  mc_arena_block_t *blk, *prev;
+  for(blk = a->block; blk != NULL; blk = prev) {
+    prev = blk->prev;
+    free(blk);
+  }
+  a->block = NULL;
+  a->used = 0;
+  a->last = NULL;
+}
+
+// Forget every allocation, keeping the current block for reuse
+static inline void  mc_arena_reset(mc_arena_t *a) {
+  if(a->block) {
+    mc_arena_block_t *blk = a->block;
+    a->block = blk->prev;
+    mc_arena_dealloc(a);
+    blk->prev = NULL;
+    a->block = blk;
+  }
+  a->used = 0;
+  a->last = NULL;
+}
+
+// Returns size bytes of uninitialised memory or NULL
+static inline void* mc_arena_bump(mc_arena_t *a, size_t size) {
+  size_t bytes = (size + MC_ARENA_ALIGN - 1) & ~(size_t)(MC_ARENA_ALIGN - 1);
+  if(bytes < size) return NULL;
+  if(a->block == NULL || bytes > a->block->size - a->used) {
+    size_t bsize = bytes > a->block_size ? bytes : a->block_size;
+    mc_arena_block_t *blk;
+    if(bsize > SIZE_MAX - sizeof(mc_arena_block_t)) return NULL;
+    if((blk = malloc(sizeof(mc_arena_block_t) + bsize)) == NULL) return NULL;
+    blk->prev = a->block;
+    blk->size = bsize;
+    a->block = blk;
+    a->used = 0;
+  }
+  a->last = mc_arena_data(a->block) + a->used;
+  a->used += bytes;
+  return a->last;
+}
+
+static inline void* mc_arena_calloc(mc_arena_t *a, size_t n, size_t size) {
+  void *ptr;
+  if(a == NULL) return calloc(n, size);
+  if(size && n > SIZE_MAX / size) return NULL;
+  if((ptr = mc_arena_bump(a, n * size)) != NULL) memset(ptr, 0, n * size);
+  return ptr;
+}
+
+static inline void* mc_arena_realloc(mc_arena_t *a, void *ptr,
+                                     size_t oldsize, size_t size)
+{
+  char *p = ptr, *newp;
+  if(a == NULL) return realloc(ptr, size);
+  if(p == NULL) return mc_arena_bump(a, size);
+  if(p == a->last) {
+    // most recent allocation: grow or shrink in place if the block has room
+    size_t offset = p - mc_arena_data(a->block);
+    size_t bytes = (size + MC_ARENA_ALIGN - 1) & ~(size_t)(MC_ARENA_ALIGN - 1);
+    if(bytes >= size && bytes <= a->block->size - offset) {
+      a->used = offset + bytes;
+      return p;
+    }
+  }
+  if(size <= oldsize) return p;
+  if((newp = mc_arena_bump(a, size)) == NULL) return NULL;
+  memcpy(newp, p, oldsize);
+  return newp;
+}
+
+// Only the most recent allocation is given back, others wait for reset
+static inline void  mc_arena_free(mc_arena_t *a, void *ptr, size_t size) {
+  (void)size;
+  if(a == NULL) { free(ptr); return; }
+  if(ptr != NULL && ptr == a->last) {
+    a->used = a->last - mc_arena_data(a->block);
+    a->last = NULL;
+  }
+}
+
+#endif /* MADCROW_ALLOC_H_ */
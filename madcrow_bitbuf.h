@@ -0,0 +1,506 @@
+#ifndef MADCROW_BITBUF_H_
+#define MADCROW_BITBUF_H_
+
+#include <stdlib.h>
+#include <string.h> // memset
+#include <assert.h>
+#include <inttypes.h> // uint64_t
+
+#include "madcrow_buffer.h"
+
+//
+// madcrow_bitbuf.h
+// Define a bit vector stored in a zeroed madcrow_buffer of 64 bit words, so it
+// grows, resets and frees like madcrow_buffer_wipe (or _wipe_pages). Bits past
+// the end are always zero.
+//
+// Example:
+//
+//   #include "madcrow_bitbuf.h"
+//   madcrow_bitbuf(bits,BitBuf)
+//
+// Creates:
+//
+//   typedef struct {
+//     bits_words_t w; // madcrow_buffer of uint64_t, bits_words_* functions
+//     size_t len;     // number of bits
+//     uint64_t *rank; // rank/select index, NULL until bits_index()
+//     size_t *sel, nsel, ones;
+//   } BitBuf;
+//
+//   void   bits_alloc       (BitBuf *bb, size_t capacity)  // in bits
+//   void   bits_dealloc     (BitBuf *bb)
+//   void   bits_reset       (BitBuf *bb)
+//   void   bits_resize      (BitBuf *bb, size_t nbits) // new bits are 0
+//   size_t bits_len         (const BitBuf *bb)
+//   size_t bits_add         (BitBuf *bb, int bit)      // returns index
+//
+//   int    bits_test        (const BitBuf *bb, size_t i)
+//   void   bits_set         (BitBuf *bb, size_t i)
+//   void   bits_clear       (BitBuf *bb, size_t i)
+//   void   bits_toggle      (BitBuf *bb, size_t i)
+//   void   bits_set_range   (BitBuf *bb, size_t start, size_t n)
+//   void   bits_clear_range (BitBuf *bb, size_t start, size_t n)
+//   void   bits_toggle_range(BitBuf *bb, size_t start, size_t n)
+//
+//   void   bits_and         (BitBuf *dst, const BitBuf *src)
+//   void   bits_or          (BitBuf *dst, const BitBuf *src)
+//   void   bits_xor         (BitBuf *dst, const BitBuf *src)
+//   void   bits_andnot      (BitBuf *dst, const BitBuf *src) // dst &= ~src
+//   size_t bits_count       (const BitBuf *bb)
+//
+//   int    bits_index       (BitBuf *bb) // 0, or -1 if out of memory
+//   size_t bits_rank        (const BitBuf *bb, size_t i)
+//   size_t bits_select      (const BitBuf *bb, size_t k)
+//
+// Bulk operations leave dst the same length, treating src as zero past its
+// end. They use SSE2 or AVX2 on x86-64 and _count uses the popcnt
+// instruction, picked at runtime as in madcrow_search.h (-DMC_SEARCH_NO_SIMD
+// turns it off).
+//
+// bits_index() builds a rank/select index in one pass over the words (two
+// words per 512 bits, plus a sample every MC_BITBUF_SELECT_SAMPLE ones).
+// _rank(bb,i) is the number of set bits before i, in O(1). _select(bb,k) is the
+// position of the k-th set bit (from 0), or len if there are not that many: a
+// sample narrows it to a few 512 bit blocks, which are binary searched. Any
+// change to the bits makes the index stale; call bits_index() again.
+//
+
+// One sample of the select index per this many set bits
+#ifndef MC_BITBUF_SELECT_SAMPLE
+  #define MC_BITBUF_SELECT_SAMPLE 512
+#endif
+
+// Words needed for n bits
+#define mc_bits_nwords(n) (((n) + 63) / 64)
+
+// Mask of bits [0,n) of a word, n < 64
+#define mc_bits_lo(n) ((UINT64_C(1) << (n)) - 1)
+
+//
+// Word array kernels
+//
+#define MC_BITS_SCALAR(name,op)                                                \
+static inline void mc_bits_ ## name ## _SCALAR(uint64_t *dst,                  \
+                                               const uint64_t *src, size_t n) {\
+  size_t i;                                                                    \
+  for(i = 0; i < n; i++) dst[i] = op(dst[i], src[i]);                          \
+}
+
+#define mc_bits_op_and(a,b)    ((a) & (b))
+#define mc_bits_op_or(a,b)     ((a) | (b))
+#define mc_bits_op_xor(a,b)    ((a) ^ (b))
+#define mc_bits_op_andnot(a,b) ((a) & ~(b))
+
+MC_BITS_SCALAR(and,    mc_bits_op_and)
+MC_BITS_SCALAR(or,     mc_bits_op_or)
+MC_BITS_SCALAR(xor,    mc_bits_op_xor)
+MC_BITS_SCALAR(andnot, mc_bits_op_andnot)
+
+static inline size_t mc_bits_count_SCALAR(const uint64_t *w, size_t n) {
+  size_t i, c = 0;
+  for(i = 0; i < n; i++) c += __builtin_popcountll(w[i]);
+  return c;
+}
+
+#ifdef MC_SEARCH_X86
+
+// V words per vector. vop(a,b) combines two vectors (andnot takes ~b & a)
+#define MC_BITS_SIMD(name,isa,tgt,vec_t,V,LOAD,STORE,vop,op)                   \
+__attribute__((target(tgt)))                                                   \
+static inline void mc_bits_ ## name ## _ ## isa(uint64_t *dst,                 \
+                                  const uint64_t *src, size_t n) {             \
+  size_t i;                                                                    \
+  for(i = 0; i + V <= n; i += V)                                               \
+    STORE((vec_t*)(dst+i), vop(LOAD((const vec_t*)(src+i)),                    \
+                               LOAD((const vec_t*)(dst+i))));                  \
+  for(; i < n; i++) dst[i] = op(dst[i], src[i]);                               \
+}
+
+#define MC_BITS_SSE2(name,vop,op) \
+        MC_BITS_SIMD(name,SSE2,"sse2",__m128i,2,_mm_loadu_si128,\
+                     _mm_storeu_si128,vop,op)
+#define MC_BITS_AVX2(name,vop,op) \
+        MC_BITS_SIMD(name,AVX2,"avx2",__m256i,4,_mm256_loadu_si256,\
+                     _mm256_storeu_si256,vop,op)
+
+MC_BITS_SSE2(and,    _mm_and_si128,    mc_bits_op_and)
+MC_BITS_SSE2(or,     _mm_or_si128,     mc_bits_op_or)
+MC_BITS_SSE2(xor,    _mm_xor_si128,    mc_bits_op_xor)
+MC_BITS_SSE2(andnot, _mm_andnot_si128, mc_bits_op_andnot)
+MC_BITS_AVX2(and,    _mm256_and_si256,    mc_bits_op_and)
+MC_BITS_AVX2(or,     _mm256_or_si256,     mc_bits_op_or)
+MC_BITS_AVX2(xor,    _mm256_xor_si256,    mc_bits_op_xor)
+MC_BITS_AVX2(andnot, _mm256_andnot_si256, mc_bits_op_andnot)
+
+// Four independent sums so popcnt instructions overlap
+__attribute__((target("popcnt")))
+static inline size_t mc_bits_count_POPCNT(const uint64_t *w, size_t n) {
+  size_t i, c0 = 0, c1 = 0, c2 = 0, c3 = 0;
+  for(i = 0; i + 4 <= n; i += 4) {
+    c0 += __builtin_popcountll(w[i]);
+    c1 += __builtin_popcountll(w[i+1]);
+    c2 += __builtin_popcountll(w[i+2]);
+    c3 += __builtin_popcountll(w[i+3]);
+  }
+  for(; i < n; i++) c0 += __builtin_popcountll(w[i]);
+  return c0 + c1 + c2 + c3;
+}
+
+#define MC_BITS_CALL(name,...) do {                                            \
+  switch(mc_search_level()) {                                                  \
+    case 3: case 2: mc_bits_ ## name ## _AVX2(__VA_ARGS__); return;            \
+    case 1:         mc_bits_ ## name ## _SSE2(__VA_ARGS__); return;            \
+    default:        mc_bits_ ## name ## _SCALAR(__VA_ARGS__); return;          \
+  }                                                                            \
+} while(0)
+
+#define MC_BITS_COUNT(w,n) do {                                                \
+  if(mc_search_level() > 0 && __builtin_cpu_supports("popcnt"))                \
+    return mc_bits_count_POPCNT(w, n);                                         \
+  return mc_bits_count_SCALAR(w, n);                                           \
+} while(0)
+
+#else
+
+#define MC_BITS_CALL(name,...) mc_bits_ ## name ## _SCALAR(__VA_ARGS__)
+#define MC_BITS_COUNT(w,n) return mc_bits_count_SCALAR(w, n)
+
+#endif /* MC_SEARCH_X86 */
+
+static inline void   mc_bits_and(uint64_t *dst, const uint64_t *src, size_t n)
+ __attribute__((unused));
+static inline void   mc_bits_or(uint64_t *dst, const uint64_t *src, size_t n)
+ __attribute__((unused));
+static inline void   mc_bits_xor(uint64_t *dst, const uint64_t *src, size_t n)
+ __attribute__((unused));
+static inline void   mc_bits_andnot(uint64_t *dst, const uint64_t *src,
+                                    size_t n) __attribute__((unused));
+static inline size_t mc_bits_count(const uint64_t *w, size_t n)
+ __attribute__((unused));
+static inline unsigned mc_bits_select64(uint64_t x, unsigned r)
+ __attribute__((unused));
+static inline unsigned mc_bits_bytes_le(uint64_t s, uint64_t r)
+ __attribute__((unused));
+
+static inline void   mc_bits_and(uint64_t *dst, const uint64_t *src, size_t n) {
+  MC_BITS_CALL(and, dst, src, n);
+}
+static inline void   mc_bits_or(uint64_t *dst, const uint64_t *src, size_t n) {
+  MC_BITS_CALL(or, dst, src, n);
+}
+static inline void   mc_bits_xor(uint64_t *dst, const uint64_t *src, size_t n) {
+  MC_BITS_CALL(xor, dst, src, n);
+}
+static inline void   mc_bits_andnot(uint64_t *dst, const uint64_t *src,
+                                    size_t n) {
+  MC_BITS_CALL(andnot, dst, src, n);
+}
+
+// Number of set bits in n words
+static inline size_t mc_bits_count(const uint64_t *w, size_t n) {
+  MC_BITS_COUNT(w, n);
+}
+
+// Number of bytes of s (each at most 127) that are <= r (at most 127)
+static inline unsigned mc_bits_bytes_le(uint64_t s, uint64_t r) {
+  const uint64_t ones = UINT64_C(0x0101010101010101), msbs = ones << 7;
+  uint64_t le = ((((r * ones) | msbs) - s) & msbs) >> 7;
+  return (unsigned)((le * ones) >> 56);
+}
+
+// Position of the r-th set bit of x (from 0), which must have more than r set.
+// Without BMI2, running counts of set bits in each byte find the byte (those
+// with a count <= r come before it), then the bits of that byte are spread
+// into bytes and counted the same way, without branches.
+static inline unsigned mc_bits_select64(uint64_t x, unsigned r) {
+  #if defined(__BMI2__) && defined(MC_SEARCH_X86)
+    return __builtin_ctzll(_pdep_u64(UINT64_C(1) << r, x));
+  #else
+    const uint64_t ones = UINT64_C(0x0101010101010101), msbs = ones << 7;
+    uint64_t s = x - ((x >> 1) & UINT64_C(0x5555555555555555));
+    unsigned shift;
+    s = (s & UINT64_C(0x3333333333333333)) +
+        ((s >> 2) & UINT64_C(0x3333333333333333));
+    s = ((s + (s >> 4)) & UINT64_C(0x0f0f0f0f0f0f0f0f)) * ones;
+    shift = mc_bits_bytes_le(s, r) * 8;
+    r -= (unsigned)((s << 8) >> shift) & 0xff;
+    // byte i of s is 1 if bit i of the byte is set, then running counts
+    s = (((x >> shift) & 0xff) * ones) & UINT64_C(0x8040201008040201);
+    s = (((s + ~msbs) & msbs) >> 7) * ones;
+    return shift + mc_bits_bytes_le(s, r);
+  #endif
+}
+
+// Rank index: for each block of 8 words, the set bits before it, then the set
+// bits before each of words 1..7 of the block packed into 9 bit fields
+#define mc_bits_rank_abs(rank,b) ((rank)[2*(b)])
+#define mc_bits_rank_rel(rank,b,j) \
+        ((j) ? ((rank)[2*(b)+1] >> (9*((j)-1))) & 0x1ff : 0)
+
+#define madcrow_bitbuf(FUNC,bitbuf_t) \
+        madcrow_bitbuf2(FUNC,bitbuf_t,calloc,realloc,free,MC_INIT_MEM_WIPE)
+
+#define madcrow_bitbuf_pages(FUNC,bitbuf_t) \
+        madcrow_bitbuf2(FUNC,bitbuf_t,calloc,realloc,free,MC_INIT_MEM_PAGES)
+
+// init_mem_f is MC_INIT_MEM_WIPE or MC_INIT_MEM_PAGES, unused words must be 0
+#define madcrow_bitbuf2(FUNC,bitbuf_t,mc_alloc,mc_realloc,mc_free,init_mem_f)  \
+                                                                               \
+madcrow_buffer2(FUNC ## _words,FUNC ## _words_t,uint64_t,                      \
+                mc_alloc,mc_realloc,mc_free,init_mem_f)                        \
+                                                                               \
+typedef struct {                                                               \
+  FUNC ## _words_t w; /* w.len is the number of words in use */                \
+  size_t len; /* bits */                                                       \
+  uint64_t *rank; /* 2 words per 512 bits, +1 block, NULL if no index */       \
+  size_t *sel, nsel; /* block of every MC_BITBUF_SELECT_SAMPLE-th set bit */   \
+  size_t ones; /* set bits when the index was built */                         \
+} bitbuf_t;                                                                    \
+                                                                               \
+/* Define functions with unused attribute in case they're not used */          \
+static inline void    FUNC ## _alloc(bitbuf_t *bb, size_t capacity)            \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _dealloc(bitbuf_t *bb)                           \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _reset(bitbuf_t *bb)                             \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _resize(bitbuf_t *bb, size_t nbits)              \
+ __attribute__((unused));                                                      \
+static inline size_t  FUNC ## _len(const bitbuf_t *bb)                         \
+ __attribute__((unused));                                                      \
+static inline size_t  FUNC ## _add(bitbuf_t *bb, int bit)                      \
+ __attribute__((unused));                                                      \
+\
+static inline int     FUNC ## _test(const bitbuf_t *bb, size_t i)              \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _set(bitbuf_t *bb, size_t i)                     \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _clear(bitbuf_t *bb, size_t i)                   \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _toggle(bitbuf_t *bb, size_t i)                  \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _set_range(bitbuf_t *bb, size_t start, size_t n) \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _clear_range(bitbuf_t *bb, size_t start,         \
+                                           size_t n) __attribute__((unused));  \
+static inline void    FUNC ## _toggle_range(bitbuf_t *bb, size_t start,        \
+                                            size_t n) __attribute__((unused)); \
+\
+static inline void    FUNC ## _and(bitbuf_t *dst, const bitbuf_t *src)         \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _or(bitbuf_t *dst, const bitbuf_t *src)          \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _xor(bitbuf_t *dst, const bitbuf_t *src)         \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _andnot(bitbuf_t *dst, const bitbuf_t *src)      \
+ __attribute__((unused));                                                      \
+static inline size_t  FUNC ## _count(const bitbuf_t *bb)                       \
+ __attribute__((unused));                                                      \
+\
+static inline int     FUNC ## _index(bitbuf_t *bb)                             \
+ __attribute__((unused));                                                      \
+static inline size_t  FUNC ## _rank(const bitbuf_t *bb, size_t i)              \
+ __attribute__((unused));                                                      \
+static inline size_t  FUNC ## _select(const bitbuf_t *bb, size_t k)            \
+ __attribute__((unused));                                                      \
+                                                                               \
+static inline void    FUNC ## _alloc(bitbuf_t *bb, size_t capacity) {          \
+  FUNC ## _words_alloc(&bb->w, mc_bits_nwords(capacity)); /* calloc'd */       \
+  bb->len = 0;                                                                 \
+  bb->rank = NULL;                                                             \
+  bb->sel = NULL;                                                              \
+  bb->nsel = bb->ones = 0;                                                     \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _drop_index(bitbuf_t *bb) {                      \
+  mc_free(bb->rank); mc_free(bb->sel);                                         \
+  bb->rank = NULL; bb->sel = NULL;                                             \
+  bb->nsel = bb->ones = 0;                                                     \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _dealloc(bitbuf_t *bb) {                         \
+  FUNC ## _drop_index(bb);                                                     \
+  FUNC ## _words_dealloc(&bb->w);                                              \
+  bb->len = 0;                                                                 \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _reset(bitbuf_t *bb) {                           \
+  FUNC ## _words_reset(&bb->w);                                                \
+  bb->len = 0;                                                                 \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _resize(bitbuf_t *bb, size_t nbits) {            \
+  size_t nw = mc_bits_nwords(nbits);                                           \
+  if(nbits < bb->len) {                                                        \
+    FUNC ## _words_pop(&bb->w, NULL, bb->w.len - nw);                          \
+    if(nbits & 63) bb->w.b[nw-1] &= mc_bits_lo(nbits & 63);                    \
+  }                                                                            \
+  else FUNC ## _words_resize(&bb->w, nw);                                      \
+  bb->len = nbits;                                                             \
+}                                                                              \
+                                                                               \
+static inline size_t  FUNC ## _len(const bitbuf_t *bb) {                       \
+  return bb->len;                                                              \
+}                                                                              \
+                                                                               \
+static inline size_t  FUNC ## _add(bitbuf_t *bb, int bit) {                    \
+  if((bb->len & 63) == 0) FUNC ## _words_resize(&bb->w, bb->w.len + 1);        \
+  bb->w.b[bb->len / 64] |= (uint64_t)(bit != 0) << (bb->len & 63);             \
+  return bb->len++;                                                            \
+}                                                                              \
+                                                                               \
+static inline int     FUNC ## _test(const bitbuf_t *bb, size_t i) {            \
+  assert(i < bb->len);                                                         \
+  return (bb->w.b[i / 64] >> (i & 63)) & 1;                                    \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _set(bitbuf_t *bb, size_t i) {                   \
+  assert(i < bb->len);                                                         \
+  bb->w.b[i / 64] |= UINT64_C(1) << (i & 63);                                  \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _clear(bitbuf_t *bb, size_t i) {                 \
+  assert(i < bb->len);                                                         \
+  bb->w.b[i / 64] &= ~(UINT64_C(1) << (i & 63));                               \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _toggle(bitbuf_t *bb, size_t i) {                \
+  assert(i < bb->len);                                                         \
+  bb->w.b[i / 64] ^= UINT64_C(1) << (i & 63);                                  \
+}                                                                              \
+                                                                               \
+/* Apply op(word,mask) to the words covering bits [start,start+n). Whole */    \
+/* words in between get the full mask, so memset-able ops are fast */          \
+static inline void    FUNC ## _range(bitbuf_t *bb, size_t start, size_t n,     \
+                                     int op) {                                 \
+  size_t i, w0 = start / 64, w1 = (start + n) / 64;                            \
+  uint64_t m0 = ~mc_bits_lo(start & 63), m1 = mc_bits_lo((start + n) & 63);    \
+  assert(start + n <= bb->len);                                                \
+  if(n == 0) return;                                                           \
+  if(w0 == w1) m0 &= m1;                                                       \
+  switch(op) {                                                                 \
+    case 0: bb->w.b[w0] |= m0; break;                                          \
+    case 1: bb->w.b[w0] &= ~m0; break;                                         \
+    default: bb->w.b[w0] ^= m0; break;                                         \
+  }                                                                            \
+  if(w0 == w1) return;                                                         \
+  if(op == 0) memset(bb->w.b + w0 + 1, 0xff, (w1 - w0 - 1) * 8);               \
+  else if(op == 1) memset(bb->w.b + w0 + 1, 0, (w1 - w0 - 1) * 8);             \
+  else for(i = w0 + 1; i < w1; i++) bb->w.b[i] = ~bb->w.b[i];                  \
+  if(m1) {                                                                     \
+    switch(op) {                                                               \
+      case 0: bb->w.b[w1] |= m1; break;                                        \
+      case 1: bb->w.b[w1] &= ~m1; break;                                       \
+      default: bb->w.b[w1] ^= m1; break;                                       \
+    }                                                                          \
+  }                                                                            \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _set_range(bitbuf_t *bb, size_t start, size_t n) \
+{                                                                              \
+  FUNC ## _range(bb, start, n, 0);                                             \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _clear_range(bitbuf_t *bb, size_t start,         \
+                                           size_t n) {                         \
+  FUNC ## _range(bb, start, n, 1);                                             \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _toggle_range(bitbuf_t *bb, size_t start,        \
+                                            size_t n) {                        \
+  FUNC ## _range(bb, start, n, 2);                                             \
+}                                                                              \
+                                                                               \
+/* Words of src that overlap dst. A partial last word of dst is masked */      \
+/* afterwards so bits past dst->len stay zero */                               \
+static inline size_t  FUNC ## _overlap(const bitbuf_t *dst,                    \
+                                       const bitbuf_t *src) {                  \
+  return dst->w.len < src->w.len ? dst->w.len : src->w.len;                    \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _trim(bitbuf_t *bb) {                            \
+  if(bb->len & 63) bb->w.b[bb->w.len-1] &= mc_bits_lo(bb->len & 63);           \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _and(bitbuf_t *dst, const bitbuf_t *src) {       \
+  size_t n = FUNC ## _overlap(dst, src);                                       \
+  mc_bits_and(dst->w.b, src->w.b, n);                                          \
+  memset(dst->w.b + n, 0, (dst->w.len - n) * sizeof(uint64_t));                \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _or(bitbuf_t *dst, const bitbuf_t *src) {        \
+  mc_bits_or(dst->w.b, src->w.b, FUNC ## _overlap(dst, src));                  \
+  FUNC ## _trim(dst);                                                          \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _xor(bitbuf_t *dst, const bitbuf_t *src) {       \
+  mc_bits_xor(dst->w.b, src->w.b, FUNC ## _overlap(dst, src));                 \
+  FUNC ## _trim(dst);                                                          \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _andnot(bitbuf_t *dst, const bitbuf_t *src) {    \
+  mc_bits_andnot(dst->w.b, src->w.b, FUNC ## _overlap(dst, src));              \
+}                                                                              \
+                                                                               \
+static inline size_t  FUNC ## _count(const bitbuf_t *bb) {                     \
+  return mc_bits_count(bb->w.b, bb->w.len);                                    \
+}                                                                              \
+                                                                               \
+/* Build the rank and select index in one pass */                              \
+static inline int     FUNC ## _index(bitbuf_t *bb) {                           \
+  size_t b, j, w, nw = bb->w.len, nblocks = nw / 8 + 1;                        \
+  size_t total = 0, rel, c, s = 0;                                             \
+  FUNC ## _drop_index(bb);                                                     \
+  bb->rank = mc_alloc(2 * nblocks, sizeof(uint64_t));                          \
+  bb->ones = mc_bits_count(bb->w.b, nw);                                       \
+  bb->nsel = bb->ones / MC_BITBUF_SELECT_SAMPLE + 1;                           \
+  bb->sel = mc_alloc(bb->nsel, sizeof(size_t));                                \
+  if(!bb->rank || !bb->sel) { FUNC ## _drop_index(bb); return -1; }            \
+  for(b = 0; b < nblocks; b++) {                                               \
+    bb->rank[2*b] = total;                                                     \
+    for(j = 0, rel = 0, c = 0; j < 8; j++) {                                   \
+      if(j) bb->rank[2*b+1] |= (uint64_t)rel << (9*(j-1));                     \
+      w = 8*b + j;                                                             \
+      c = w < nw ? __builtin_popcountll(bb->w.b[w]) : 0;                       \
+      /* blocks holding sample points */                                       \
+      for(; s * MC_BITBUF_SELECT_SAMPLE < total + rel + c && s < bb->nsel; s++)\
+        bb->sel[s] = b;                                                        \
+      rel += c;                                                                \
+    }                                                                          \
+    total += rel;                                                              \
+  }                                                                            \
+  for(; s < bb->nsel; s++) bb->sel[s] = nblocks - 1;                           \
+  return 0;                                                                    \
+}                                                                              \
+                                                                               \
+/* Set bits in [0,i) */                                                        \
+static inline size_t  FUNC ## _rank(const bitbuf_t *bb, size_t i) {            \
+  size_t w = i / 64, b = w / 8, r;                                             \
+  assert(bb->rank != NULL && i <= bb->len);                                    \
+  r = mc_bits_rank_abs(bb->rank, b) + mc_bits_rank_rel(bb->rank, b, w & 7);    \
+  if(i & 63) r += __builtin_popcountll(bb->w.b[w] & mc_bits_lo(i & 63));       \
+  return r;                                                                    \
+}                                                                              \
+                                                                               \
+/* Position of the k-th set bit (from 0), or len if there are k or fewer */    \
+static inline size_t  FUNC ## _select(const bitbuf_t *bb, size_t k) {          \
+  size_t s = k / MC_BITBUF_SELECT_SAMPLE, lo, hi, mid, b, j, f, r;             \
+  assert(bb->rank != NULL);                                                    \
+  if(k >= bb->ones) return bb->len;                                            \
+  /* last block starting with k or fewer set bits before it */                 \
+  lo = bb->sel[s];                                                             \
+  hi = s + 1 < bb->nsel ? bb->sel[s+1] : bb->w.len / 8;                        \
+  while(lo < hi) {                                                             \
+    mid = lo + (hi - lo + 1) / 2;                                              \
+    if(mc_bits_rank_abs(bb->rank, mid) <= k) lo = mid;                         \
+    else hi = mid - 1;                                                         \
+  }                                                                            \
+  b = lo;                                                                      \
+  r = k - mc_bits_rank_abs(bb->rank, b);                                       \
+  for(j = 0, f = 1; f < 8; f++) j += (mc_bits_rank_rel(bb->rank, b, f) <= r);  \
+  r -= mc_bits_rank_rel(bb->rank, b, j);                                       \
+  return 64*(8*b + j) + mc_bits_select64(bb->w.b[8*b + j], (unsigned)r);       \
+}                                                                              \
+
+#endif /* MADCROW_BITBUF_H_ */
@@ -4,8 +4,15 @@
 #include <stdlib.h>
 #include <string.h> // memset
 #include <assert.h>
-#include <unistd.h> // ssize_t
+#include <unistd.h> // ssize_t, read, write
 #include <inttypes.h> // uint64_t
+#include <errno.h>
+#include <sys/uio.h> // readv, writev
+#include <sys/mman.h> // madvise
+
+#include "madcrow_stats.h"
+#include "madcrow_search.h"
+#include "madcrow_alloc.h"
 
 //
 // madcrow_buffer.h
@@ -30,6 +37,7 @@
 //   void    charbuf_reset       (String *buf)
 //   void    charbuf_capacity    (String *buf, size_t capacity)
 //   void    charbuf_len         (const String *buf)
+//   void    charbuf_shrink_to_fit(String *buf)
 //
 // Pass object:
 //   size_t  charbuf_add         (String *buf, char obj)
@@ -51,6 +59,24 @@
 //   void    charbuf_copy        (String *dst, const String *src)
 //   void    charbuf_resize      (String *buf, size_t n)
 //
+// Search (bitwise compare, SIMD for 1/2/4/8 byte elements, see
+// madcrow_search.h). find/rfind/find_any return an index or -1:
+//   ssize_t charbuf_find        (const String *buf, char obj)
+//   ssize_t charbuf_rfind       (const String *buf, char obj)
+//   size_t  charbuf_count       (const String *buf, char obj)
+//   ssize_t charbuf_find_any    (const String *buf,
+//                                char const *objs, size_t nobjs)
+//
+// Fill in place:
+//   char*   charbuf_reserve     (String *buf, size_t n)
+//   void    charbuf_commit      (String *buf, size_t n)
+//
+// File descriptors (return elements moved, 0 at EOF, -1 and errno on error):
+//   ssize_t charbuf_read        (String *buf, int fd, size_t n)
+//   ssize_t charbuf_readv       (String *buf, int fd)
+//   ssize_t charbuf_write       (const String *buf, int fd)
+//   ssize_t charbuf_writev      (String *const *bufs, size_t nbufs, int fd)
+//
 // There need to be removed:
 //   ssize_t charbuf_push_try    (String *buf, char const *ptr, size_t n)
 //   size_t  charbuf_push_rpt    (String *buf, char const *obj, size_t n)
@@ -63,6 +89,101 @@
 //  char_buf_alloc(&string, 1024);
 //  madcrow_buffer_verify(&string);
 //
+// madcrow_buffer_lazy(charbuf,String,char) creates the same functions, but
+// charbuf_shift() only moves buf->b forward past the removed elements. The
+// dead prefix (buf->head elements before buf->b) is reclaimed when it reaches
+// 1/MC_BUF_LAZY_COMPACT of the allocation, or when growing fits in it. Growing
+// past the whole allocation copies just the elements to a new array. buf->b
+// still points to the first element, but is not the start of the allocation
+// so must only be freed with charbuf_dealloc(). Only lazy buffers have a head
+// field; madcrow_buffer_lazy_verify() checks it as well.
+//
+// charbuf_reserve() returns a pointer to at least n free slots after the last
+// element; write into them then call charbuf_commit() to add them. read/readv
+// use this to read straight into the buffer without a temporary copy. readv
+// reads whatever is ready, spilling into a MC_BUF_READV_SPILL byte stack block
+// if the free space runs out, so the buffer only grows by as much as was read.
+// Reads never leave half an element: a short read is completed, and EOF part
+// way through an element is an EIO error (whole elements before it are kept).
+//
+// charbuf_shrink_to_fit() reallocs down to len elements (or back to inline
+// storage). Large blocks shrink with mremap (glibc realloc, madcrow_mmap.h)
+// so RSS drops.
+//
+// madcrow_buffer_autoshrink(charbuf,String,char) adds an mc_shrink_t shrink
+// field and charbuf_autoshrink(buf,nops), which turns on shrinking after nops
+// consecutive removals (remove/pop/shift/reset) that each leave len below
+// 1/MC_SHRINK_FRACTION of the capacity; it then reallocs to 2*len, but no
+// less than MC_SHRINK_MIN bytes. nops=0 turns it off again, as does
+// charbuf_alloc(), so call it after alloc. Other buffers have no policy to
+// check on removal (their _autoshrink does nothing).
+//
+// madcrow_buffer_wipe(charbuf,String,char) keeps unused slots zeroed by
+// memsetting them on grow, reset, pop, shift etc. madcrow_buffer_wipe_pages()
+// does the same with MC_INIT_MEM_PAGES, which zeroes ranges of
+// MC_ZERO_PAGES_THRESHOLD (1MB) or more by releasing their pages, so resetting
+// a large buffer costs a syscall and pages are refaulted as zero when used.
+// A large grown tail is also released rather than memset, so fresh pages from
+// calloc/realloc (or madcrow_buffer_mmap_wipe's mremap) are never touched.
+// Linux only, and needs _DEFAULT_SOURCE or _GNU_SOURCE for MADV_DONTNEED,
+// otherwise it is a memset.
+//
+// madcrow_buffer_sbo(charbuf,String,char,N) creates the same functions for a
+// buffer that keeps up to N elements in the struct itself (buf->inl), so small
+// buffers never call the allocator. Once it grows past N, the elements move to
+// the heap. While inline, buf->b points into the struct: copy buffers with
+// charbuf_copy(), not struct assignment.
+//
+// madcrow_buffer_arena(charbuf,String,char) adds a `mc_arena_t *ctx` field that
+// all of the buffer's memory comes from (madcrow_buffer_ctx2 takes any
+// allocator with a context, see madcrow_alloc.h). Set it before alloc, e.g.
+// String s = madcrow_buffer_ctx_init(&arena). Appending to the most recently
+// grown buffer in an arena extends it in place, and mc_arena_dealloc() frees
+// every buffer at once so charbuf_dealloc() is optional.
+//
+// madcrow_buffer_incr(charbuf,IncrString,char) creates a buffer that never
+// copies all of its elements at once, for callers that can't afford the
+// occasional O(n) realloc. When full it allocates an array twice the size and
+// keeps the old one: every later add/remove moves mc_incr_step() elements
+// (MC_INCR_STEP bytes, see madcrow_alloc.h) across until the old array is
+// empty and freed, which always happens before the new one fills. Elements
+// [buf->lo, buf->hi) are still in buf->old meanwhile, so access goes through
+// get/set/getptr. charbuf_flush() finishes the migration, after which buf->b
+// holds all len elements contiguously:
+//
+//   typedef struct {
+//     char *b, *old;
+//     size_t len, size, lo, hi;
+//   } IncrString;
+//
+//   void    charbuf_alloc       (IncrString *buf, size_t capacity)
+//   void    charbuf_dealloc     (IncrString *buf)
+//   void    charbuf_reset       (IncrString *buf)
+//   size_t  charbuf_len         (const IncrString *buf)
+//   void    charbuf_flush       (IncrString *buf)
+//   size_t  charbuf_add         (IncrString *buf, char obj)
+//   char    charbuf_remove      (IncrString *buf)
+//   char    charbuf_get         (const IncrString *buf, size_t idx)
+//   void    charbuf_set         (IncrString *buf, size_t idx, char obj)
+//   char*   charbuf_getptr      (IncrString *buf, size_t idx)
+//   void    charbuf_getn        (IncrString *buf, size_t idx, char *ptr, size_t n)
+//   void    charbuf_setn        (IncrString *buf, size_t idx,
+//                                char const *ptr, size_t n)
+//   size_t  charbuf_push        (IncrString *buf, char const *ptr, size_t n)
+//   void    charbuf_pop         (IncrString *buf, char *ptr, size_t n)
+//   char*   charbuf_reserve     (IncrString *buf, size_t n)
+//   void    charbuf_commit      (IncrString *buf, size_t n)
+//
+// charbuf_push and charbuf_commit migrate n steps' worth at once, in
+// proportion to the elements they add. There is no shift/unshift: either
+// would move every element at once, use madcrow_list_incr for a queue.
+// Pointers from charbuf_getptr are only valid until the next add/remove. The
+// old array's pages are dropped in MC_INCR_RELEASE blocks as they empty, so
+// freeing it doesn't stall either (mc_incr_release() in madcrow_alloc.h).
+//
+// Compile with -DMC_STATS to count reallocs, memmoves etc. in charbuf_stats,
+// see madcrow_stats.h
+//
 
 // Round a number up to the nearest number that is a power of two
 #ifndef roundup64
@@ -73,14 +194,59 @@
 #endif
 
 #define madcrow_buffer_init {.b = NULL, .len = 0, .size = 0}
+#define madcrow_buffer_ctx_init(c) {.b = NULL, .len = 0, .size = 0, .ctx = (c)}
 
 #define madcrow_buffer_verify(buf) do {                                        \
-  assert(buf->len <= buf->size);                                               \
-  assert(buf->size == 0 || buf->b != NULL);                                    \
+  assert((buf)->len <= (buf)->size);                                           \
+  assert((buf)->size == 0 || (buf)->b != NULL);                                \
+} while(0)
+
+// Lazy buffers also have a dead prefix, which is dropped once they're empty
+#define madcrow_buffer_lazy_verify(buf) do {                                   \
+  madcrow_buffer_verify(buf);                                                  \
+  assert((buf)->head == 0 || ((buf)->b != NULL && (buf)->len > 0));            \
 } while(0)
 
 #define MC_INIT_MEM_WIPE(arr,n) memset(arr, 0, (n)*sizeof(*(arr)))
 #define MC_INIT_MEM_UNDEF(arr,n) do {} while(0)
+#define MC_INIT_MEM_PAGES(arr,n) mc_zero_pages(arr, (n)*sizeof(*(arr)))
+
+// MC_INIT_MEM_PAGES hands ranges of at least this many bytes back to the kernel
+#ifndef MC_ZERO_PAGES_THRESHOLD
+  #define MC_ZERO_PAGES_THRESHOLD (1UL<<20)
+#endif
+
+static inline void    mc_zero_pages(void *ptr, size_t nbytes)
+ __attribute__((unused));
+
+// Zero nbytes at ptr. Large ranges are dropped with madvise(MADV_DONTNEED), so
+// the kernel maps in zero pages only when they are next touched. Only the
+// partial pages at either end are memset. Memory must be private and
+// anonymous (malloc, calloc, mc_mmap_calloc), not a shared or file mapping.
+static inline void    mc_zero_pages(void *ptr, size_t nbytes)
+{
+  #if defined(__linux__) && defined(MADV_DONTNEED)
+    if(nbytes >= MC_ZERO_PAGES_THRESHOLD) {
+      uintptr_t pagesize = (uintptr_t)sysconf(_SC_PAGESIZE);
+      char *start = ptr, *end = start + nbytes;
+      char *pstart = (char*)(((uintptr_t)start + pagesize - 1) & ~(pagesize-1));
+      char *pend = (char*)((uintptr_t)end & ~(pagesize - 1));
+      if(pstart < pend && madvise(pstart, pend - pstart, MADV_DONTNEED) == 0) {
+        memset(start, 0, pstart - start);
+        memset(pend, 0, end - pend);
+        return;
+      }
+    }
+  #endif
+  memset(ptr, 0, nbytes);
+}
+
+// Lazy buffers compact once the dead prefix is 1/MC_BUF_LAZY_COMPACT of the
+// allocation. Moving len elements then costs at most
+// (MC_BUF_LAZY_COMPACT-1) moves per element shifted.
+#ifndef MC_BUF_LAZY_COMPACT
+  #define MC_BUF_LAZY_COMPACT 2
+#endif
 
 #define madcrow_buffer(FUNC,buf_t,obj_t) \
         madcrow_buffer2(FUNC,buf_t,obj_t,calloc,realloc,free,MC_INIT_MEM_UNDEF)
@@ -88,19 +254,161 @@
 #define madcrow_buffer_wipe(FUNC,buf_t,obj_t) \
         madcrow_buffer2(FUNC,buf_t,obj_t,calloc,realloc,free,MC_INIT_MEM_WIPE)
 
+#define madcrow_buffer_wipe_pages(FUNC,buf_t,obj_t) \
+        madcrow_buffer2(FUNC,buf_t,obj_t,calloc,realloc,free,MC_INIT_MEM_PAGES)
+
+#define madcrow_buffer_autoshrink(FUNC,buf_t,obj_t) \
+        madcrow_buffer_autoshrink2(FUNC,buf_t,obj_t,calloc,realloc,free,       \
+                                   MC_INIT_MEM_UNDEF)
+
+#define madcrow_buffer_lazy(FUNC,buf_t,obj_t) \
+        madcrow_buffer_lazy2(FUNC,buf_t,obj_t,calloc,realloc,free,MC_INIT_MEM_UNDEF)
+
+#define madcrow_buffer_sbo(FUNC,buf_t,obj_t,N) \
+        madcrow_buffer_sbo2(FUNC,buf_t,obj_t,N,calloc,realloc,free,MC_INIT_MEM_UNDEF)
+
+#define madcrow_buffer_arena(FUNC,buf_t,obj_t) \
+        madcrow_buffer_ctx2(FUNC,buf_t,obj_t,mc_arena_t,mc_arena_calloc,\
+                            mc_arena_realloc,mc_arena_free,MC_INIT_MEM_UNDEF)
+
+// Stack space readv() can spill into past the end of the buffer
+#ifndef MC_BUF_READV_SPILL
+  #define MC_BUF_READV_SPILL 65536
+#endif
+
+// Number of buffers passed to each writev() call
+#define MC_BUF_WRITEV_MAX 16
+
+static inline int     mc_fd_read_rest(int fd, char *ptr, size_t nbytes,
+                                      size_t objsize) __attribute__((unused));
+static inline int     mc_fd_writev_all(int fd, struct iovec *iov, int iovcnt)
+ __attribute__((unused));
+
+// Finish reading an object of which the first nbytes (< objsize) are at ptr.
+// Returns 1 if an object was completed, 0 if nbytes was 0 or -1 with errno set
+// (EIO if EOF mid-object)
+static inline int     mc_fd_read_rest(int fd, char *ptr, size_t nbytes,
+                                      size_t objsize)
+{
+  ssize_t r;
+  if(nbytes == 0) return 0;
+  while(nbytes < objsize) {
+    r = read(fd, ptr + nbytes, objsize - nbytes);
+    if(r < 0 && errno == EINTR) continue;
+    if(r == 0) errno = EIO;
+    if(r <= 0) return -1;
+    nbytes += r;
+  }
+  return 1;
+}
+
+// Write all of iov, retrying short writes and EINTR. Modifies iov.
+// Returns 0 or -1 with errno set
+static inline int     mc_fd_writev_all(int fd, struct iovec *iov, int iovcnt)
+{
+  ssize_t w;
+  while(iovcnt > 0) {
+    if(iov->iov_len == 0) { iov++; iovcnt--; continue; }
+    w = writev(fd, iov, iovcnt);
+    if(w < 0 && errno == EINTR) continue;
+    if(w < 0) return -1;
+    for(; iovcnt > 0 && (size_t)w >= iov->iov_len; iov++, iovcnt--)
+      w -= iov->iov_len;
+    if(iovcnt > 0) {
+      iov->iov_base = (char*)iov->iov_base + w;
+      iov->iov_len -= w;
+    }
+  }
+  return 0;
+}
+
 // MACROs
 #define mdc_buf_getptr(l,idx) ((l)->b + (idx))
 #define mdc_buf_get(l,idx) (*mdc_buf_getptr(l,idx))
 #define mdc_buf_len(l) ((l)->len)
 
-// init_mem_f is one of MC_INIT_MEM_WIPE or MC_INIT_MEM_UNDEF
+// Inline storage of a buffer, NULL if it has none
+#define mc_buf_inl(buf) ((buf)->inl)
+#define mc_buf_noinl(buf) NULL
+
+// Unused elements before b: only lazy buffers have them, others read a zero
+#define mc_buf_head(buf) ((buf)->head)
+#define mc_buf_nohead(buf) (*(size_t[1]){0})
+
+// init_mem_f is one of MC_INIT_MEM_WIPE, MC_INIT_MEM_PAGES or MC_INIT_MEM_UNDEF
 #define madcrow_buffer2(FUNC,buf_t,obj_t,mc_alloc,mc_realloc,mc_free,init_mem_f)\
                                                                                \
 typedef struct {                                                               \
-  obj_t *b;                                                                    \
-  size_t len, size;                                                            \
+  obj_t *b; /* first element */                                                \
+  size_t len, size; /* size is capacity from b */                              \
+} buf_t;                                                                       \
+                                                                               \
+madcrow_buffer_funcs(FUNC,buf_t,obj_t,madcrow_mem,mc_alloc,mc_realloc,mc_free, \
+                     init_mem_f,0,mc_buf_nohead,0,mc_buf_noinl,0,mc_noshrink)
+
+// Shrink after a run of removals that leave the buffer mostly empty
+#define madcrow_buffer_autoshrink2(FUNC,buf_t,obj_t,mc_alloc,mc_realloc,mc_free,\
+                                   init_mem_f)                                 \
+                                                                               \
+typedef struct {                                                               \
+  obj_t *b; /* first element */                                                \
+  size_t len, size; /* size is capacity from b */                              \
+  mc_shrink_t shrink; /* auto-shrink policy and count */                       \
 } buf_t;                                                                       \
                                                                                \
+madcrow_buffer_funcs(FUNC,buf_t,obj_t,madcrow_mem,mc_alloc,mc_realloc,mc_free, \
+                     init_mem_f,0,mc_buf_nohead,0,mc_buf_noinl,1,mc_shrink)
+
+// Shift leaves a dead prefix of head elements rather than memmoving
+#define madcrow_buffer_lazy2(FUNC,buf_t,obj_t,mc_alloc,mc_realloc,mc_free,     \
+                             init_mem_f)                                       \
+                                                                               \
+typedef struct {                                                               \
+  obj_t *b; /* first element */                                                \
+  size_t len, size; /* size is capacity from b */                              \
+  size_t head; /* unused elements before b */                                  \
+} buf_t;                                                                       \
+                                                                               \
+madcrow_buffer_funcs(FUNC,buf_t,obj_t,madcrow_mem,mc_alloc,mc_realloc,mc_free, \
+                     init_mem_f,1,mc_buf_head,0,mc_buf_noinl,0,mc_noshrink)
+
+// Keep up to N elements in the struct, only allocating when it grows past N
+#define madcrow_buffer_sbo2(FUNC,buf_t,obj_t,N,mc_alloc,mc_realloc,mc_free,     \
+                            init_mem_f)                                        \
+                                                                               \
+typedef struct {                                                               \
+  obj_t *b; /* first element, inl or a heap allocation */                      \
+  size_t len, size; /* size is capacity from b */                              \
+  obj_t inl[N];                                                                \
+} buf_t;                                                                       \
+                                                                               \
+madcrow_buffer_funcs(FUNC,buf_t,obj_t,madcrow_mem,mc_alloc,mc_realloc,mc_free, \
+                     init_mem_f,0,mc_buf_nohead,N,mc_buf_inl,0,mc_noshrink)
+
+// Carry an allocator context in buf->ctx, passed to every allocator call
+// (see madcrow_alloc.h)
+#define madcrow_buffer_ctx2(FUNC,buf_t,obj_t,ctx_t,mc_alloc,mc_realloc,mc_free, \
+                            init_mem_f)                                        \
+                                                                               \
+typedef struct {                                                               \
+  obj_t *b; /* first element */                                                \
+  size_t len, size; /* size is capacity from b */                              \
+  ctx_t *ctx; /* allocator context */                                          \
+} buf_t;                                                                       \
+                                                                               \
+madcrow_buffer_funcs(FUNC,buf_t,obj_t,madcrow_mem_ctx,                         \
+                     mc_alloc,mc_realloc,mc_free,init_mem_f,0,mc_buf_nohead,   \
+                     0,mc_buf_noinl,0,mc_noshrink)
+
+// sbo is the number of inline elements (0 for none) and INL(buf) gives them.
+// autoshrink is 1 if SHRINK(buf) is an mc_shrink_t in the struct, else 0.
+// MEM is madcrow_mem or madcrow_mem_ctx, which define FUNC_mem_alloc etc.
+#define madcrow_buffer_funcs(FUNC,buf_t,obj_t,MEM,mc_alloc,mc_realloc,mc_free,  \
+                             init_mem_f,lazy,HEAD,sbo,INL,autoshrink,SHRINK)   \
+                                                                               \
+MC_STATS_DEFINE(FUNC)                                                          \
+MEM(FUNC,buf_t,mc_alloc,mc_realloc,mc_free)                                    \
+                                                                               \
 /* Define functions with unused attribute in case they're not used */          \
 static inline buf_t*  FUNC ## _new(size_t capacity)                            \
  __attribute__((unused));                                                      \
@@ -161,11 +469,44 @@ static inline void    FUNC ## _unshift_zero(buf_t *buf, size_t n)              \
 static inline void    FUNC ## _copy(buf_t *dst, const buf_t *src)              \
  __attribute__((unused));                                                      \
 static inline void    FUNC ## _resize(buf_t *buf, size_t len)                  \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _compact(buf_t *buf)                             \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _shrink_to_fit(buf_t *buf)                       \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _autoshrink(buf_t *buf, uint32_t nops)           \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _shrink(buf_t *buf, size_t cap)                  \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _shrink_check(buf_t *buf)                        \
+ __attribute__((unused));                                                      \
+\
+static inline ssize_t FUNC ## _find(const buf_t *buf, obj_t obj)               \
+ __attribute__((unused));                                                      \
+static inline ssize_t FUNC ## _rfind(const buf_t *buf, obj_t obj)              \
+ __attribute__((unused));                                                      \
+static inline size_t  FUNC ## _count(const buf_t *buf, obj_t obj)              \
+ __attribute__((unused));                                                      \
+static inline ssize_t FUNC ## _find_any(const buf_t *buf,                      \
+                                        obj_t const *objs, size_t nobjs)       \
+ __attribute__((unused));                                                      \
+\
+static inline obj_t*  FUNC ## _reserve(buf_t *buf, size_t n)                   \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _commit(buf_t *buf, size_t n)                    \
+ __attribute__((unused));                                                      \
+static inline ssize_t FUNC ## _read(buf_t *buf, int fd, size_t n)              \
+ __attribute__((unused));                                                      \
+static inline ssize_t FUNC ## _readv(buf_t *buf, int fd)                       \
+ __attribute__((unused));                                                      \
+static inline ssize_t FUNC ## _write(const buf_t *buf, int fd)                 \
+ __attribute__((unused));                                                      \
+static inline ssize_t FUNC ## _writev(buf_t *const *bufs, size_t nbufs, int fd)\
  __attribute__((unused));                                                      \
                                                                                \
 static inline buf_t*  FUNC ## _new(size_t capacity)                            \
 {                                                                              \
-  buf_t *buf = mc_alloc(1, sizeof(buf_t));                                     \
+  buf_t *buf = FUNC ## _mem_alloc(NULL, 1, sizeof(buf_t));                     \
   if(buf) FUNC ## _alloc(buf, capacity);                                       \
   return buf;                                                                  \
 }                                                                              \
@@ -173,34 +514,149 @@ static inline buf_t*  FUNC ## _new(size_t capacity)                            \
 static inline void    FUNC ## _destroy(buf_t *buf)                             \
 {                                                                              \
   FUNC ## _dealloc(buf);                                                       \
-  mc_free(buf);                                                                \
+  FUNC ## _mem_free(NULL, buf, sizeof(buf_t));                                 \
 }                                                                              \
                                                                                \
 static inline void    FUNC ## _alloc(buf_t *buf, size_t capacity) {            \
+  buf->len = HEAD(buf) = 0;                                                    \
+  if(autoshrink) SHRINK(buf)->ops = SHRINK(buf)->low_ops = 0;                  \
+  if(sbo && capacity <= sbo) {                                                 \
+    buf->size = sbo;                                                           \
+    buf->b = INL(buf);                                                         \
+    init_mem_f(buf->b, buf->size);                                             \
+    return;                                                                    \
+  }                                                                            \
   buf->size = capacity;                                                        \
-  buf->b = mc_alloc(buf->size, sizeof(obj_t));                                 \
-  buf->len = 0;                                                                \
+  buf->b = FUNC ## _mem_alloc(buf, buf->size, sizeof(obj_t));                  \
 }                                                                              \
                                                                                \
 static inline void    FUNC ## _dealloc(buf_t *buf) {                           \
-  mc_free(buf->b);                                                             \
-  memset(buf, 0, sizeof(buf_t));                                               \
+  if(!sbo || buf->b != INL(buf)) {                                             \
+    FUNC ## _mem_free(buf, buf->b ? buf->b - HEAD(buf) : NULL,                 \
+                      (HEAD(buf) + buf->size) * sizeof(obj_t));                \
+  }                                                                            \
+  buf->b = NULL;                                                               \
+  buf->len = buf->size = HEAD(buf) = 0;                                        \
+  if(autoshrink) SHRINK(buf)->low_ops = 0;                                     \
 }                                                                              \
                                                                                \
 static inline void    FUNC ## _reset(buf_t *buf) {                             \
+  /* judge by the length before reset */                                       \
+  if(autoshrink) FUNC ## _shrink_check(buf);                                   \
   init_mem_f(buf->b, buf->len);                                                \
   buf->len = 0;                                                                \
+  if(lazy && HEAD(buf)) {                                                      \
+    buf->b -= HEAD(buf);                                                       \
+    buf->size += HEAD(buf);                                                    \
+    HEAD(buf) = 0;                                                             \
+  }                                                                            \
+}                                                                              \
+                                                                               \
+/* Move elements back to the start of the allocation (lazy buffers only) */    \
+static inline void    FUNC ## _compact(buf_t *buf) {                           \
+  if(HEAD(buf)) {                                                              \
+    MC_STATS_ADD(FUNC, memmove_bytes, buf->len * sizeof(obj_t));               \
+    memmove(buf->b - HEAD(buf), buf->b, buf->len * sizeof(obj_t));             \
+    buf->b -= HEAD(buf);                                                       \
+    buf->size += HEAD(buf);                                                    \
+    init_mem_f(buf->b + buf->len, HEAD(buf));                                  \
+    HEAD(buf) = 0;                                                             \
+  }                                                                            \
 }                                                                              \
                                                                                \
 static inline void    FUNC ## _capacity(buf_t *buf, size_t cap) {              \
-  if(cap > buf->size) {                                                        \
+  obj_t *b;                                                                    \
+  if(lazy && HEAD(buf) && cap > buf->size) {                                   \
+    if(cap <= HEAD(buf) + buf->size) { FUNC ## _compact(buf); return; }        \
+    /* compacting is not enough: copy the elements once into a new array */    \
     cap = roundup64(cap);                                                      \
-    buf->b = mc_realloc(buf->b, cap * sizeof(obj_t));                          \
+    MC_STATS_ADD(FUNC, reallocs, 1);                                           \
+    MC_STATS_ADD(FUNC, realloc_bytes, cap * sizeof(obj_t));                    \
+    MC_STATS_MAX(FUNC, max_capacity, cap);                                     \
+    b = FUNC ## _mem_realloc(buf, NULL, 0, cap * sizeof(obj_t));               \
+    memcpy(b, buf->b, buf->len * sizeof(obj_t));                               \
+    init_mem_f(b + buf->len, cap - buf->len);                                  \
+    FUNC ## _mem_free(buf, buf->b - HEAD(buf),                                 \
+                      (HEAD(buf) + buf->size) * sizeof(obj_t));                \
+    buf->b = b;                                                                \
+    buf->size = cap;                                                           \
+    HEAD(buf) = 0;                                                             \
+    return;                                                                    \
+  }                                                                            \
+  if(sbo && cap > buf->size && buf->b == NULL && cap <= sbo) {                 \
+    /* unallocated: start inline */                                            \
+    buf->size = sbo;                                                           \
+    buf->b = INL(buf);                                                         \
+    init_mem_f(buf->b, buf->size);                                             \
+  }                                                                            \
+  else if(cap > buf->size) {                                                   \
+    cap = roundup64(cap);                                                      \
+    MC_STATS_ADD(FUNC, reallocs, 1);                                           \
+    MC_STATS_ADD(FUNC, realloc_bytes, cap * sizeof(obj_t));                    \
+    MC_STATS_MAX(FUNC, max_capacity, cap);                                     \
+    if(sbo && buf->b == INL(buf)) {                                            \
+      /* move from inline storage to the heap */                               \
+      b = FUNC ## _mem_alloc(buf, cap, sizeof(obj_t));                         \
+      memcpy(b, buf->b, buf->size * sizeof(obj_t));                            \
+      buf->b = b;                                                              \
+    }                                                                          \
+    else {                                                                     \
+      buf->b = FUNC ## _mem_realloc(buf, buf->b, buf->size * sizeof(obj_t),    \
+                                    cap * sizeof(obj_t));                      \
+    }                                                                          \
     init_mem_f(buf->b + buf->size, cap - buf->size);                           \
     buf->size = cap;                                                           \
   }                                                                            \
 }                                                                              \
                                                                                \
+/* Release capacity beyond max(len,cap), going back inline if it fits */       \
+static inline void    FUNC ## _shrink(buf_t *buf, size_t cap) {                \
+  obj_t *b;                                                                    \
+  if(cap < buf->len) cap = buf->len;                                           \
+  if(lazy) FUNC ## _compact(buf);                                              \
+  b = buf->b;                                                                  \
+  if(cap >= buf->size || (sbo && b == INL(buf))) return;                       \
+  if(sbo && cap <= sbo) {                                                      \
+    buf->b = INL(buf);                                                         \
+    memcpy(buf->b, b, buf->len * sizeof(obj_t));                               \
+    init_mem_f(buf->b + buf->len, sbo - buf->len);                             \
+    FUNC ## _mem_free(buf, b, buf->size * sizeof(obj_t));                      \
+    buf->size = sbo;                                                           \
+  }                                                                            \
+  else if(cap == 0) {                                                          \
+    FUNC ## _mem_free(buf, b, buf->size * sizeof(obj_t));                      \
+    buf->b = NULL;                                                             \
+    buf->size = 0;                                                             \
+  }                                                                            \
+  else if((b = FUNC ## _mem_realloc(buf, b, buf->size * sizeof(obj_t),         \
+                                    cap * sizeof(obj_t))) != NULL) {           \
+    buf->b = b;                                                                \
+    buf->size = cap;                                                           \
+  }                                                                            \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _shrink_to_fit(buf_t *buf) {                     \
+  FUNC ## _shrink(buf, buf->len);                                              \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _autoshrink(buf_t *buf, uint32_t nops) {         \
+  SHRINK(buf)->ops = nops;                                                     \
+  SHRINK(buf)->low_ops = 0;                                                    \
+}                                                                              \
+                                                                               \
+/* Called after removing elements: shrink if len has stayed low */             \
+static inline void    FUNC ## _shrink_check(buf_t *buf) {                      \
+  mc_shrink_t *sh = SHRINK(buf);                                               \
+  if(sh->ops == 0) return;                                                     \
+  if(buf->len >= buf->size / MC_SHRINK_FRACTION ||                             \
+     buf->size * sizeof(obj_t) <= MC_SHRINK_MIN) sh->low_ops = 0;              \
+  else if(++sh->low_ops >= sh->ops) {                                          \
+    size_t cap = MC_SHRINK_MIN / sizeof(obj_t);                                \
+    sh->low_ops = 0;                                                           \
+    FUNC ## _shrink(buf, 2 * buf->len > cap ? 2 * buf->len : cap);             \
+  }                                                                            \
+}                                                                              \
+                                                                               \
 static inline size_t  FUNC ## _len(const buf_t *buf) {                         \
   return buf->len;                                                             \
 }                                                                              \
@@ -214,6 +670,7 @@ static inline size_t  FUNC ## _len(const buf_t *buf) {                         \
 static inline size_t  FUNC ## _add(buf_t *buf, obj_t obj) {                    \
   FUNC ## _capacity(buf, buf->len+1);                                          \
   memcpy(buf->b+buf->len, &obj, sizeof(obj));                                  \
+  MC_STATS_MAX(FUNC, max_len, buf->len + 1);                                   \
   return buf->len++;                                                           \
 }                                                                              \
                                                                                \
@@ -223,6 +680,7 @@ static inline obj_t   FUNC ## _remove(buf_t *buf)                              \
   assert(buf->len > 0);                                                        \
   obj_t tmp = buf->b[--buf->len];                                              \
   init_mem_f(buf->b+buf->len, 1);                                              \
+  if(autoshrink) FUNC ## _shrink_check(buf);                                   \
   return tmp;                                                                  \
 }                                                                              \
                                                                                \
@@ -272,6 +730,7 @@ static inline size_t  FUNC ## _push(buf_t *buf, obj_t const *ptr, size_t n)    \
   FUNC ## _capacity(buf, buf->len+n);                                          \
   memmove(buf->b+buf->len, ptr, n * sizeof(obj_t));                            \
   buf->len += n;                                                               \
+  MC_STATS_MAX(FUNC, max_len, buf->len);                                       \
   return idx;                                                                  \
 }                                                                              \
                                                                                \
@@ -283,15 +742,27 @@ static inline void    FUNC ## _pop(buf_t *buf, obj_t *ptr, size_t n)           \
   buf->len -= n;                                                               \
   if(ptr) memmove(ptr, buf->b+buf->len, n * sizeof(obj_t));                    \
   init_mem_f(buf->b+buf->len, n);                                              \
+  if(autoshrink) FUNC ## _shrink_check(buf);                                   \
 }                                                                              \
                                                                                \
 /* Add items to the start of a buffer */                                       \
 static inline void    FUNC ## _unshift(buf_t *buf, obj_t const *ptr, size_t n) \
 {                                                                              \
+  MC_STATS_ADD(FUNC, unshifts, 1);                                             \
+  if(lazy && HEAD(buf) >= n) {                                                 \
+    /* Reuse space before b */                                                 \
+    buf->b -= n; HEAD(buf) -= n; buf->size += n;                               \
+    memmove(buf->b, ptr, n * sizeof(obj_t));                                   \
+    buf->len += n;                                                             \
+    MC_STATS_MAX(FUNC, max_len, buf->len);                                     \
+    return;                                                                    \
+  }                                                                            \
   FUNC ## _capacity(buf, buf->len+n);                                          \
+  MC_STATS_ADD(FUNC, memmove_bytes, buf->len * sizeof(obj_t));                 \
   memmove(buf->b+n, buf->b, buf->len * sizeof(obj_t));                         \
   memmove(buf->b, ptr, n * sizeof(obj_t));                                     \
   buf->len += n;                                                               \
+  MC_STATS_MAX(FUNC, max_len, buf->len);                                       \
 }                                                                              \
                                                                                \
 /* Remove and return items to the start of a buffer */                         \
@@ -300,15 +771,30 @@ static inline void    FUNC ## _shift(buf_t *buf, obj_t *ptr, size_t n)         \
 {                                                                              \
   assert(n <= buf->len);                                                       \
   buf->len -= n;                                                               \
+  MC_STATS_ADD(FUNC, shifts, 1);                                               \
   if(ptr) memmove(ptr, buf->b, n * sizeof(obj_t));                             \
+  if(lazy) {                                                                   \
+    init_mem_f(buf->b, n);                                                     \
+    buf->b += n; HEAD(buf) += n; buf->size -= n;                               \
+    if(buf->len == 0) FUNC ## _reset(buf);                                     \
+    else {                                                                     \
+      if(HEAD(buf) >= (HEAD(buf) + buf->size) / MC_BUF_LAZY_COMPACT)           \
+        FUNC ## _compact(buf);                                                 \
+      if(autoshrink) FUNC ## _shrink_check(buf);                               \
+    }                                                                          \
+    return;                                                                    \
+  }                                                                            \
+  MC_STATS_ADD(FUNC, memmove_bytes, buf->len * sizeof(obj_t));                 \
   memmove(buf->b, buf->b+n, buf->len * sizeof(obj_t));                         \
   init_mem_f(buf->b+buf->len, n);                                              \
+  if(autoshrink) FUNC ## _shrink_check(buf);                                   \
 }                                                                              \
                                                                                \
 /* Returns index or -1 on failure */                                           \
 static inline ssize_t FUNC ## _push_try(buf_t *buf, obj_t const *ptr, size_t n)\
 {                                                                              \
   if(buf->len + n > buf->size) return -1;                                      \
+  MC_STATS_MAX(FUNC, max_len, buf->len + n);                                   \
   memmove(buf->b+buf->len, ptr, n*sizeof(obj_t));                              \
   ssize_t idx = buf->len; buf->len += n;                                       \
   return idx;                                                                  \
@@ -322,6 +808,7 @@ static inline size_t  FUNC ## _push_rpt(buf_t *buf, obj_t const *obj, size_t n)\
   FUNC ## _capacity(buf, end);                                                 \
   for(; buf->len < end; buf->len++)                                            \
     memmove(buf->b+buf->len, obj, sizeof(obj_t));                              \
+  MC_STATS_MAX(FUNC, max_len, buf->len);                                       \
   return idx;                                                                  \
 }                                                                              \
                                                                                \
@@ -330,6 +817,9 @@ static inline size_t  FUNC ## _push_rpt(buf_t *buf, obj_t const *obj, size_t n)\
 static inline ssize_t FUNC ## _unshift_try(buf_t *buf, obj_t const *ptr, size_t n)\
 {                                                                              \
   if(buf->len + n > buf->size) return -1;                                      \
+  MC_STATS_MAX(FUNC, max_len, buf->len + n);                                   \
+  MC_STATS_ADD(FUNC, unshifts, 1);                                             \
+  MC_STATS_ADD(FUNC, memmove_bytes, buf->len * sizeof(obj_t));                 \
   memmove(buf->b+n, buf->b, buf->len * sizeof(obj_t));                         \
   memmove(buf->b,   ptr,    n * sizeof(obj_t));                                \
   buf->len += n;                                                               \
@@ -341,9 +831,12 @@ static inline void    FUNC ## _unshift_rpt(buf_t *buf, obj_t const *obj, size_t
 {                                                                              \
   size_t i;                                                                    \
   FUNC ## _capacity(buf, buf->len+n);                                          \
+  MC_STATS_ADD(FUNC, unshifts, 1);                                             \
+  MC_STATS_ADD(FUNC, memmove_bytes, buf->len * sizeof(obj_t));                 \
   memmove(buf->b+n, buf->b, buf->len*sizeof(obj_t));                           \
   for(i = 0; i < n; i++) memmove(buf->b+i, obj, sizeof(obj_t));                \
   buf->len += n;                                                               \
+  MC_STATS_MAX(FUNC, max_len, buf->len);                                       \
 }                                                                              \
                                                                                \
 /* Add a zero'd item to the end of the array n times */                        \
@@ -353,6 +846,7 @@ static inline size_t  FUNC ## _push_zero(buf_t *buf, size_t n)                 \
   FUNC ## _capacity(buf, buf->len+n);                                          \
   memset(buf->b+buf->len, 0, n*sizeof(obj_t));                                 \
   size_t idx = buf->len; buf->len += n;                                        \
+  MC_STATS_MAX(FUNC, max_len, buf->len);                                       \
   return idx;                                                                  \
 }                                                                              \
                                                                                \
@@ -360,9 +854,12 @@ static inline size_t  FUNC ## _push_zero(buf_t *buf, size_t n)                 \
 static inline void    FUNC ## _unshift_zero(buf_t *buf, size_t n)              \
 {                                                                              \
   FUNC ## _capacity(buf, buf->len+n);                                          \
+  MC_STATS_ADD(FUNC, unshifts, 1);                                             \
+  MC_STATS_ADD(FUNC, memmove_bytes, buf->len * sizeof(obj_t));                 \
   memmove(buf->b+n, buf->b, buf->len*sizeof(obj_t));                           \
   memset(buf->b, 0, n*sizeof(obj_t));                                          \
   buf->len += n;                                                               \
+  MC_STATS_MAX(FUNC, max_len, buf->len);                                       \
 }                                                                              \
                                                                                \
 /* Clone one buffer into another */                                            \
@@ -371,12 +868,339 @@ static inline void    FUNC ## _copy(buf_t *dst, const buf_t *src) {            \
   FUNC ## _capacity(dst, src->len);                                            \
   memmove(dst->b, src->b, sizeof(obj_t) * src->len);                           \
   dst->len = src->len;                                                         \
+  MC_STATS_MAX(FUNC, max_len, dst->len);                                       \
 }                                                                              \
                                                                                \
 /* Expand but never shrink array length */                                     \
 static inline void    FUNC ## _resize(buf_t *buf, size_t len) {                \
   FUNC ## _capacity(buf, len);                                                 \
   if(len > buf->len) buf->len = len;                                           \
+  MC_STATS_MAX(FUNC, max_len, buf->len);                                       \
+}                                                                              \
+                                                                               \
+/* Index of the first element equal to obj, or -1 */                           \
+static inline ssize_t FUNC ## _find(const buf_t *buf, obj_t obj) {             \
+  size_t i = mc_find(buf->b, buf->len, sizeof(obj_t), &obj);                   \
+  return i < buf->len ? (ssize_t)i : -1;                                       \
+}                                                                              \
+                                                                               \
+/* Index of the last element equal to obj, or -1 */                            \
+static inline ssize_t FUNC ## _rfind(const buf_t *buf, obj_t obj) {            \
+  size_t i = mc_rfind(buf->b, buf->len, sizeof(obj_t), &obj);                  \
+  return i < buf->len ? (ssize_t)i : -1;                                       \
+}                                                                              \
+                                                                               \
+/* Number of elements equal to obj */                                          \
+static inline size_t  FUNC ## _count(const buf_t *buf, obj_t obj) {            \
+  return mc_count(buf->b, buf->len, sizeof(obj_t), &obj);                      \
+}                                                                              \
+                                                                               \
+/* Index of the first element equal to any of objs, or -1 */                   \
+static inline ssize_t FUNC ## _find_any(const buf_t *buf,                      \
+                                        obj_t const *objs, size_t nobjs) {     \
+  size_t i = mc_find_any(buf->b, buf->len, sizeof(obj_t), objs, nobjs);        \
+  return i < buf->len ? (ssize_t)i : -1;                                       \
+}                                                                              \
+                                                                               \
+/* Return a pointer to at least n free slots after the last element */         \
+static inline obj_t*  FUNC ## _reserve(buf_t *buf, size_t n) {                 \
+  FUNC ## _capacity(buf, buf->len+n);                                          \
+  return buf->b + buf->len;                                                    \
+}                                                                              \
+                                                                               \
+/* Add n elements written into the space returned by _reserve() */             \
+static inline void    FUNC ## _commit(buf_t *buf, size_t n) {                  \
+  assert(buf->len + n <= buf->size);                                           \
+  buf->len += n;                                                               \
+  MC_STATS_MAX(FUNC, max_len, buf->len);                                       \
+}                                                                              \
+                                                                               \
+/* Read up to n elements from fd onto the end of the buffer */                 \
+/* Returns number of elements added, 0 at EOF, -1 on error */                  \
+static inline ssize_t FUNC ## _read(buf_t *buf, int fd, size_t n) {            \
+  char *ptr = (char*)FUNC ## _reserve(buf, n);                                 \
+  ssize_t r, nobjs;                                                            \
+  do { r = read(fd, ptr, n * sizeof(obj_t)); } while(r < 0 && errno == EINTR); \
+  if(r <= 0) return r;                                                         \
+  nobjs = r / sizeof(obj_t);                                                   \
+  FUNC ## _commit(buf, nobjs);                                                 \
+  r = mc_fd_read_rest(fd, (char*)(buf->b + buf->len), r % sizeof(obj_t),       \
+                      sizeof(obj_t));                                          \
+  if(r < 0) return -1;                                                         \
+  FUNC ## _commit(buf, r);                                                     \
+  return nobjs + r;                                                            \
+}                                                                              \
+                                                                               \
+/* Read what fd has ready in one readv() into the free space at the end of */  \
+/* the buffer, then a stack block that is appended if used. */                 \
+/* Returns number of elements added, 0 at EOF, -1 on error */                  \
+static inline ssize_t FUNC ## _readv(buf_t *buf, int fd) {                     \
+  char spill[MC_BUF_READV_SPILL];                                              \
+  size_t nfree, nbytes, nobjs = 0;                                             \
+  ssize_t r;                                                                   \
+  if(buf->len == buf->size) FUNC ## _capacity(buf, buf->len+1);                \
+  nfree = (buf->size - buf->len) * sizeof(obj_t);                              \
+  struct iovec iov[2] = {{.iov_base = buf->b + buf->len, .iov_len = nfree},    \
+                         {.iov_base = spill, .iov_len = sizeof(spill)}};       \
+  do { r = readv(fd, iov, 2); } while(r < 0 && errno == EINTR);                \
+  if(r <= 0) return r;                                                         \
+  nbytes = r;                                                                  \
+  if(nbytes > nfree) {                                                         \
+    /* free space is full: add it before growing, which may move elements */   \
+    nobjs = nfree / sizeof(obj_t);                                             \
+    FUNC ## _commit(buf, nobjs);                                               \
+    nbytes -= nfree;                                                           \
+    FUNC ## _capacity(buf, buf->len + (nbytes+sizeof(obj_t)-1)/sizeof(obj_t)); \
+    memcpy(buf->b + buf->len, spill, nbytes);                                  \
+  }                                                                            \
+  nobjs += nbytes / sizeof(obj_t);                                             \
+  FUNC ## _commit(buf, nbytes / sizeof(obj_t));                                \
+  r = mc_fd_read_rest(fd, (char*)(buf->b + buf->len), nbytes % sizeof(obj_t),  \
+                      sizeof(obj_t));                                          \
+  if(r < 0) return -1;                                                         \
+  FUNC ## _commit(buf, r);                                                     \
+  return nobjs + r;                                                            \
+}                                                                              \
+                                                                               \
+/* Write all elements to fd. Returns number written or -1 on error */          \
+static inline ssize_t FUNC ## _write(const buf_t *buf, int fd) {               \
+  struct iovec iov = {.iov_base = buf->b, .iov_len = buf->len*sizeof(obj_t)};  \
+  return mc_fd_writev_all(fd, &iov, 1) ? -1 : (ssize_t)buf->len;               \
+}                                                                              \
+                                                                               \
+/* Write the elements of several buffers to fd in order, using writev() */     \
+/* Returns total number written or -1 on error */                              \
+static inline ssize_t FUNC ## _writev(buf_t *const *bufs, size_t nbufs, int fd)\
+{                                                                              \
+  struct iovec iov[MC_BUF_WRITEV_MAX];                                         \
+  size_t i, j, total = 0;                                                      \
+  for(i = 0; i < nbufs; i += j) {                                              \
+    for(j = 0; j < MC_BUF_WRITEV_MAX && i+j < nbufs; j++) {                    \
+      iov[j].iov_base = bufs[i+j]->b;                                          \
+      iov[j].iov_len = bufs[i+j]->len * sizeof(obj_t);                         \
+      total += bufs[i+j]->len;                                                 \
+    }                                                                          \
+    if(mc_fd_writev_all(fd, iov, (int)j)) return -1;                           \
+  }                                                                            \
+  return total;                                                                \
+}                                                                              \
+
+#define madcrow_buffer_incr(FUNC,buf_t,obj_t)                                  \
+        madcrow_buffer_incr2(FUNC,buf_t,obj_t,calloc,free)
+
+// Grow by allocating a larger array and migrating elements a few at a time
+#define madcrow_buffer_incr2(FUNC,buf_t,obj_t,mc_alloc,mc_free)                \
+                                                                               \
+typedef struct {                                                               \
+  obj_t *b; /* current array of size elements */                               \
+  obj_t *old; /* previous array, NULL unless migrating */                      \
+  size_t len, size;                                                            \
+  size_t lo, hi; /* elements [lo,hi) are still in old */                       \
+} buf_t;                                                                       \
+                                                                               \
+MC_STATS_DEFINE(FUNC)                                                          \
+                                                                               \
+/* Define functions with unused attribute in case they're not used */          \
+static inline void    FUNC ## _alloc(buf_t *buf, size_t capacity)              \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _dealloc(buf_t *buf)                             \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _reset(buf_t *buf)                               \
+ __attribute__((unused));                                                      \
+static inline size_t  FUNC ## _len(const buf_t *buf)                           \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _flush(buf_t *buf)                               \
+ __attribute__((unused));                                                      \
+static inline size_t  FUNC ## _add(buf_t *buf, obj_t obj)                      \
+ __attribute__((unused));                                                      \
+static inline obj_t   FUNC ## _remove(buf_t *buf)                              \
+ __attribute__((unused));                                                      \
+static inline obj_t   FUNC ## _get(const buf_t *buf, size_t idx)               \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _set(buf_t *buf, size_t idx, obj_t obj)          \
+ __attribute__((unused));                                                      \
+static inline obj_t*  FUNC ## _getptr(buf_t *buf, size_t idx)                  \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _getn(buf_t *buf, size_t idx, obj_t *ptr, size_t n)\
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _setn(buf_t *buf, size_t idx,                    \
+                                    obj_t const *ptr, size_t n)                \
+ __attribute__((unused));                                                      \
+static inline size_t  FUNC ## _push(buf_t *buf, obj_t const *ptr, size_t n)    \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _pop(buf_t *buf, obj_t *ptr, size_t n)           \
+ __attribute__((unused));                                                      \
+static inline obj_t*  FUNC ## _reserve(buf_t *buf, size_t n)                   \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _commit(buf_t *buf, size_t n)                    \
+ __attribute__((unused));                                                      \
+                                                                               \
+static inline void    FUNC ## _alloc(buf_t *buf, size_t capacity) {            \
+  memset(buf, 0, sizeof(buf_t));                                               \
+  buf->size = capacity < 8 ? 8 : roundup64(capacity);                          \
+  buf->b = mc_alloc(buf->size, sizeof(obj_t));                                 \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _dealloc(buf_t *buf) {                           \
+  mc_free(buf->b);                                                             \
+  mc_free(buf->old);                                                           \
+  memset(buf, 0, sizeof(buf_t));                                               \
+}                                                                              \
+                                                                               \
+static inline size_t  FUNC ## _len(const buf_t *buf) {                         \
+  return buf->len;                                                             \
 }                                                                              \
+                                                                               \
+static inline void    FUNC ## _reset_old(buf_t *buf) {                         \
+  mc_free(buf->old);                                                           \
+  buf->old = NULL;                                                             \
+  buf->lo = buf->hi = 0;                                                       \
+}                                                                              \
+                                                                               \
+/* Move up to n elements from old to b, freeing old once it's empty */         \
+static inline void    FUNC ## _migrate(buf_t *buf, size_t n) {                 \
+  if(n > buf->hi - buf->lo) n = buf->hi - buf->lo;                             \
+  memcpy(buf->b + buf->lo, buf->old + buf->lo, n * sizeof(obj_t));             \
+  MC_STATS_ADD(FUNC, memmove_bytes, n * sizeof(obj_t));                        \
+  mc_incr_release(buf->old, buf->lo * sizeof(obj_t),                           \
+                  (buf->lo + n) * sizeof(obj_t));                              \
+  buf->lo += n;                                                                \
+  if(buf->lo >= buf->hi) FUNC ## _reset_old(buf);                              \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _flush(buf_t *buf) {                             \
+  if(buf->old) FUNC ## _migrate(buf, buf->hi - buf->lo);                       \
+}                                                                              \
+                                                                               \
+/* Migrate on behalf of n added elements: n steps, which keeps the old array */\
+/* draining at least as fast as the new one fills */                           \
+static inline void    FUNC ## _migrate_n(buf_t *buf, size_t n) {               \
+  size_t step = mc_incr_step(sizeof(obj_t));                                   \
+  FUNC ## _migrate(buf, n < buf->hi / step ? n * step : buf->hi);              \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _reset(buf_t *buf) {                             \
+  if(buf->old) FUNC ## _reset_old(buf);                                        \
+  buf->len = 0;                                                                \
+}                                                                              \
+                                                                               \
+/* Swap in an array at least twice the size with room for n more elements, */  \
+/* leaving the current ones in old for now */                                  \
+static inline void    FUNC ## _grow(buf_t *buf, size_t n) {                    \
+  size_t cap = buf->size ? 2 * buf->size : 8;                                  \
+  /* a no-op for one element: migrating ends before b is full. Adding n */     \
+  /* leaves fewer than n steps to do */                                        \
+  FUNC ## _flush(buf);                                                         \
+  while(cap < buf->len + n) cap *= 2;                                          \
+  MC_STATS_ADD(FUNC, reallocs, 1);                                             \
+  MC_STATS_ADD(FUNC, realloc_bytes, cap * sizeof(obj_t));                      \
+  MC_STATS_MAX(FUNC, max_capacity, cap);                                       \
+  buf->old = buf->b;                                                           \
+  buf->lo = 0;                                                                 \
+  buf->hi = buf->len;                                                          \
+  buf->b = mc_alloc(cap, sizeof(obj_t));                                       \
+  buf->size = cap;                                                             \
+}                                                                              \
+                                                                               \
+static inline obj_t*  FUNC ## _getptr(buf_t *buf, size_t idx) {                \
+  assert(idx < buf->len);                                                      \
+  return (idx >= buf->lo && idx < buf->hi ? buf->old : buf->b) + idx;          \
+}                                                                              \
+                                                                               \
+static inline obj_t   FUNC ## _get(const buf_t *buf, size_t idx) {             \
+  assert(idx < buf->len);                                                      \
+  return idx >= buf->lo && idx < buf->hi ? buf->old[idx] : buf->b[idx];        \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _set(buf_t *buf, size_t idx, obj_t obj) {        \
+  *FUNC ## _getptr(buf, idx) = obj;                                            \
+}                                                                              \
+                                                                               \
+/* Pointer to element idx, and in *m how many elements from there on are in */ \
+/* the same array */                                                           \
+static inline obj_t*  FUNC ## _run(const buf_t *buf, size_t idx, size_t *m) {  \
+  if(idx < buf->lo) { *m = buf->lo - idx; return buf->b + idx; }               \
+  if(idx < buf->hi) { *m = buf->hi - idx; return buf->old + idx; }             \
+  *m = SIZE_MAX;                                                               \
+  return buf->b + idx;                                                         \
+}                                                                              \
+                                                                               \
+/* Copy n elements from idx to ptr, from whichever array holds them */         \
+static inline void    FUNC ## _getn(buf_t *buf, size_t idx, obj_t *ptr, size_t n)\
+{                                                                              \
+  size_t m;                                                                    \
+  obj_t *p;                                                                    \
+  assert(idx+n <= buf->len);                                                   \
+  for(; n > 0; idx += m, ptr += m, n -= m) {                                   \
+    p = FUNC ## _run(buf, idx, &m);                                            \
+    if(m > n) m = n;                                                           \
+    memcpy(ptr, p, m * sizeof(obj_t));                                         \
+  }                                                                            \
+}                                                                              \
+                                                                               \
+/* Overwrite n elements from idx with ptr */                                   \
+static inline void    FUNC ## _setn(buf_t *buf, size_t idx,                    \
+                                    obj_t const *ptr, size_t n)                \
+{                                                                              \
+  size_t m;                                                                    \
+  obj_t *p;                                                                    \
+  assert(idx+n <= buf->len);                                                   \
+  for(; n > 0; idx += m, ptr += m, n -= m) {                                   \
+    p = FUNC ## _run(buf, idx, &m);                                            \
+    if(m > n) m = n;                                                           \
+    memcpy(p, ptr, m * sizeof(obj_t));                                         \
+  }                                                                            \
+}                                                                              \
+                                                                               \
+/* Add an object to the end of the buffer */                                   \
+/* Returns index of new object in buffer */                                    \
+static inline size_t  FUNC ## _add(buf_t *buf, obj_t obj) {                    \
+  if(buf->len == buf->size) FUNC ## _grow(buf, 1);                             \
+  else if(buf->old) FUNC ## _migrate(buf, mc_incr_step(sizeof(obj_t)));        \
+  buf->b[buf->len] = obj;                                                      \
+  MC_STATS_MAX(FUNC, max_len, buf->len + 1);                                   \
+  return buf->len++;                                                           \
+}                                                                              \
+                                                                               \
+/* Remove an object from the end of the buffer and return it */                \
+static inline obj_t   FUNC ## _remove(buf_t *buf) {                            \
+  obj_t obj = FUNC ## _get(buf, buf->len - 1);                                 \
+  buf->len--;                                                                  \
+  if(buf->hi > buf->len) buf->hi = buf->len > buf->lo ? buf->len : buf->lo;    \
+  if(buf->old) FUNC ## _migrate(buf, mc_incr_step(sizeof(obj_t)));             \
+  return obj;                                                                  \
+}                                                                              \
+                                                                               \
+/* Return a pointer to at least n free slots after the last element */         \
+static inline obj_t*  FUNC ## _reserve(buf_t *buf, size_t n) {                 \
+  if(buf->len + n > buf->size) FUNC ## _grow(buf, n);                          \
+  return buf->b + buf->len;                                                    \
+}                                                                              \
+                                                                               \
+/* Add n elements written into the space returned by _reserve() */             \
+static inline void    FUNC ## _commit(buf_t *buf, size_t n) {                  \
+  assert(buf->len + n <= buf->size);                                           \
+  if(buf->old) FUNC ## _migrate_n(buf, n);                                     \
+  buf->len += n;                                                               \
+  MC_STATS_MAX(FUNC, max_len, buf->len);                                       \
+}                                                                              \
+                                                                               \
+/* Append n objects to the end of the buffer */                                \
+static inline size_t  FUNC ## _push(buf_t *buf, obj_t const *ptr, size_t n) {  \
+  size_t idx = buf->len;                                                       \
+  memcpy(FUNC ## _reserve(buf, n), ptr, n * sizeof(obj_t));                    \
+  FUNC ## _commit(buf, n);                                                     \
+  return idx;                                                                  \
+}                                                                              \
+                                                                               \
+/* Remove and return last n elements */                                        \
+/* @param ptr if != NULL, removed elements are copied to ptr */                \
+static inline void    FUNC ## _pop(buf_t *buf, obj_t *ptr, size_t n) {         \
+  assert(buf->len >= n);                                                       \
+  if(ptr) FUNC ## _getn(buf, buf->len - n, ptr, n);                            \
+  buf->len -= n;                                                               \
+  if(buf->hi > buf->len) buf->hi = buf->len > buf->lo ? buf->len : buf->lo;    \
+  if(buf->old) FUNC ## _migrate(buf, mc_incr_step(sizeof(obj_t)));             \
+}
 
 #endif /* MADCROW_BUFFER_H_ */
@@ -0,0 +1,261 @@
+#ifndef MADCROW_CHUNKBUF_H_
+#define MADCROW_CHUNKBUF_H_
+
+#include <stdlib.h>
+#include <string.h> // memcpy
+#include <assert.h>
+#include <inttypes.h> // uint64_t
+#include <sys/uio.h> // struct iovec
+
+//
+// madcrow_chunkbuf.h
+// Define a buffer stored in fixed-size chunks of 2^shift elements, found
+// through a directory of chunk pointers. Growing allocates new chunks and only
+// reallocs the directory, so existing elements are never copied and pointers
+// to them stay valid until dealloc. Indexing is a shift and a mask.
+//
+// Example:
+//
+//   #include "madcrow_chunkbuf.h"
+//   madcrow_chunkbuf(rope,Rope,char)
+//
+// Creates:
+//
+//   typedef struct {
+//     char **chunks; // directory
+//     size_t nchunks, dirsize; // chunks allocated, directory capacity
+//     size_t len;
+//   } Rope;
+//
+//   Rope*   rope_new      (size_t capacity)
+//   void    rope_destroy  (Rope *cb)
+//   void    rope_alloc    (Rope *cb, size_t capacity)
+//   void    rope_dealloc  (Rope *cb)
+//   void    rope_reset    (Rope *cb) // keeps the chunks for reuse
+//   void    rope_capacity (Rope *cb, size_t capacity)
+//   size_t  rope_len      (const Rope *cb)
+//
+//   size_t  rope_add      (Rope *cb, char obj) // returns index
+//   char    rope_remove   (Rope *cb)
+//   char    rope_get      (const Rope *cb, size_t idx)
+//   void    rope_set      (Rope *cb, size_t idx, char obj)
+//   char*   rope_getptr   (Rope *cb, size_t idx) // stable until dealloc
+//
+//   size_t  rope_push     (Rope *cb, const char *ptr, size_t n)
+//   void    rope_pop      (Rope *cb, char *ptr, size_t n)
+//   void    rope_getn     (const Rope *cb, size_t idx, char *ptr, size_t n)
+//   void    rope_setn     (Rope *cb, size_t idx, const char *ptr, size_t n)
+//
+// Export elements idx..len as up to iovcnt spans, returning the number used:
+//   size_t  rope_iovec    (const Rope *cb, size_t idx,
+//                          struct iovec *iov, size_t iovcnt)
+//
+// e.g. to flush with one writev() and no copy:
+//
+//   struct iovec iov[64];
+//   writev(fd, iov, rope_iovec(&rope, 0, iov, 64));
+//
+// madcrow_chunkbuf uses chunks of about 64KB (mc_chunkbuf_shift), or pass
+// shift to madcrow_chunkbuf2 along with allocators.
+//
+
+// Round a number up to the nearest number that is a power of two
+#ifndef roundup64
+  #define roundup64(x) roundup64(x)
+  static inline uint64_t roundup64(uint64_t x) {
+    return (--x, x|=x>>1, x|=x>>2, x|=x>>4, x|=x>>8, x|=x>>16, x|=x>>32, ++x);
+  }
+#endif
+
+#define madcrow_chunkbuf_init \
+        {.chunks = NULL, .nchunks = 0, .dirsize = 0, .len = 0}
+
+// log2 of elements per chunk giving chunks of about 64KB, at least 256 elements
+#define mc_chunkbuf_shift(size)                                                \
+  ((size) <= 1 ? 16 : (size) <= 2 ? 15 : (size) <= 4 ? 14 : (size) <= 8 ? 13 : \
+   (size) <= 16 ? 12 : (size) <= 32 ? 11 : (size) <= 64 ? 10 :                 \
+   (size) <= 128 ? 9 : 8)
+
+#define madcrow_chunkbuf(FUNC,cbuf_t,obj_t) \
+        madcrow_chunkbuf2(FUNC,cbuf_t,obj_t,mc_chunkbuf_shift(sizeof(obj_t)),\
+                          calloc,realloc,free)
+
+#define madcrow_chunkbuf2(FUNC,cbuf_t,obj_t,shift,mc_alloc,mc_realloc,mc_free) \
+                                                                               \
+typedef struct {                                                               \
+  obj_t **chunks; /* directory of chunks of 2^shift elements */                \
+  size_t nchunks, dirsize; /* chunks allocated, directory capacity */          \
+  size_t len;                                                                  \
+} cbuf_t;                                                                      \
+                                                                               \
+/* Define functions with unused attribute in case they're not used */          \
+static inline cbuf_t* FUNC ## _new(size_t capacity)                            \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _destroy(cbuf_t *cb)                             \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _alloc(cbuf_t *cb, size_t capacity)              \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _dealloc(cbuf_t *cb)                             \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _reset(cbuf_t *cb)                               \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _capacity(cbuf_t *cb, size_t capacity)           \
+ __attribute__((unused));                                                      \
+static inline size_t  FUNC ## _len(const cbuf_t *cb)                           \
+ __attribute__((unused));                                                      \
+static inline size_t  FUNC ## _add(cbuf_t *cb, obj_t obj)                      \
+ __attribute__((unused));                                                      \
+static inline obj_t   FUNC ## _remove(cbuf_t *cb)                              \
+ __attribute__((unused));                                                      \
+static inline obj_t   FUNC ## _get(const cbuf_t *cb, size_t idx)               \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _set(cbuf_t *cb, size_t idx, obj_t obj)          \
+ __attribute__((unused));                                                      \
+static inline obj_t*  FUNC ## _getptr(cbuf_t *cb, size_t idx)                  \
+ __attribute__((unused));                                                      \
+static inline size_t  FUNC ## _push(cbuf_t *cb, const obj_t *ptr, size_t n)    \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _pop(cbuf_t *cb, obj_t *ptr, size_t n)           \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _getn(const cbuf_t *cb, size_t idx,              \
+                                    obj_t *ptr, size_t n)                      \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _setn(cbuf_t *cb, size_t idx,                    \
+                                    const obj_t *ptr, size_t n)                \
+ __attribute__((unused));                                                      \
+static inline size_t  FUNC ## _iovec(const cbuf_t *cb, size_t idx,             \
+                                     struct iovec *iov, size_t iovcnt)         \
+ __attribute__((unused));                                                      \
+                                                                               \
+static inline cbuf_t* FUNC ## _new(size_t capacity) {                          \
+  cbuf_t *cb = mc_alloc(1, sizeof(cbuf_t));                                    \
+  if(cb) FUNC ## _alloc(cb, capacity);                                         \
+  return cb;                                                                   \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _destroy(cbuf_t *cb) {                           \
+  FUNC ## _dealloc(cb);                                                        \
+  mc_free(cb);                                                                 \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _alloc(cbuf_t *cb, size_t capacity) {            \
+  cb->chunks = NULL;                                                           \
+  cb->nchunks = cb->dirsize = cb->len = 0;                                     \
+  FUNC ## _capacity(cb, capacity);                                             \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _dealloc(cbuf_t *cb) {                           \
+  size_t i;                                                                    \
+  for(i = 0; i < cb->nchunks; i++) mc_free(cb->chunks[i]);                     \
+  mc_free(cb->chunks);                                                         \
+  memset(cb, 0, sizeof(cbuf_t));                                               \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _reset(cbuf_t *cb) {                             \
+  cb->len = 0;                                                                 \
+}                                                                              \
+                                                                               \
+/* Add chunks until there is room for cap elements. Existing chunks and the */ \
+/* elements in them never move, only the directory of pointers is realloc'd */ \
+static inline void    FUNC ## _capacity(cbuf_t *cb, size_t cap) {              \
+  size_t nchunks = (cap + ((size_t)1 << (shift)) - 1) >> (shift);              \
+  if(nchunks <= cb->nchunks) return;                                           \
+  if(nchunks > cb->dirsize) {                                                  \
+    cb->dirsize = roundup64(nchunks);                                          \
+    cb->chunks = mc_realloc(cb->chunks, cb->dirsize * sizeof(obj_t*));         \
+  }                                                                            \
+  for(; cb->nchunks < nchunks; cb->nchunks++) {                                \
+    cb->chunks[cb->nchunks] = mc_alloc((size_t)1 << (shift), sizeof(obj_t));   \
+  }                                                                            \
+}                                                                              \
+                                                                               \
+static inline size_t  FUNC ## _len(const cbuf_t *cb) {                         \
+  return cb->len;                                                              \
+}                                                                              \
+                                                                               \
+static inline obj_t*  FUNC ## _getptr(cbuf_t *cb, size_t idx) {                \
+  assert(idx < cb->len);                                                       \
+  return cb->chunks[idx >> (shift)] + (idx & (((size_t)1 << (shift)) - 1));    \
+}                                                                              \
+                                                                               \
+static inline obj_t   FUNC ## _get(const cbuf_t *cb, size_t idx) {             \
+  assert(idx < cb->len);                                                       \
+  return cb->chunks[idx >> (shift)][idx & (((size_t)1 << (shift)) - 1)];       \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _set(cbuf_t *cb, size_t idx, obj_t obj) {        \
+  *FUNC ## _getptr(cb, idx) = obj;                                             \
+}                                                                              \
+                                                                               \
+static inline size_t  FUNC ## _add(cbuf_t *cb, obj_t obj) {                    \
+  size_t idx = cb->len;                                                        \
+  FUNC ## _capacity(cb, idx+1);                                                \
+  cb->len++;                                                                   \
+  *FUNC ## _getptr(cb, idx) = obj;                                             \
+  return idx;                                                                  \
+}                                                                              \
+                                                                               \
+static inline obj_t   FUNC ## _remove(cbuf_t *cb) {                            \
+  assert(cb->len > 0);                                                         \
+  obj_t obj = FUNC ## _get(cb, cb->len-1);                                     \
+  cb->len--;                                                                   \
+  return obj;                                                                  \
+}                                                                              \
+                                                                               \
+/* Copy n elements from idx out to ptr (out=1) or in from ptr (out=0) */       \
+static inline void    FUNC ## _copyn(const cbuf_t *cb, size_t idx,             \
+                                     obj_t *ptr, size_t n, int out) {          \
+  const size_t csize = (size_t)1 << (shift);                                   \
+  size_t off = idx & (csize-1), m;                                             \
+  obj_t *const *chunk = cb->chunks + (idx >> (shift));                         \
+  for(; n > 0; n -= m, ptr += m, off = 0, chunk++) {                           \
+    m = csize - off < n ? csize - off : n;                                     \
+    if(out) memcpy(ptr, *chunk + off, m * sizeof(obj_t));                      \
+    else memcpy(*chunk + off, ptr, m * sizeof(obj_t));                         \
+  }                                                                            \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _getn(const cbuf_t *cb, size_t idx,              \
+                                    obj_t *ptr, size_t n) {                    \
+  assert(idx + n <= cb->len);                                                  \
+  FUNC ## _copyn(cb, idx, ptr, n, 1);                                          \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _setn(cbuf_t *cb, size_t idx,                    \
+                                    const obj_t *ptr, size_t n) {              \
+  assert(idx + n <= cb->len);                                                  \
+  FUNC ## _copyn(cb, idx, (obj_t*)ptr, n, 0);                                  \
+}                                                                              \
+                                                                               \
+/* Append n elements, returns the index of the first */                        \
+static inline size_t  FUNC ## _push(cbuf_t *cb, const obj_t *ptr, size_t n) {  \
+  size_t idx = cb->len;                                                        \
+  FUNC ## _capacity(cb, idx+n);                                                \
+  cb->len += n;                                                                \
+  FUNC ## _copyn(cb, idx, (obj_t*)ptr, n, 0);                                  \
+  return idx;                                                                  \
+}                                                                              \
+                                                                               \
+/* Remove (and return) elements from the end */                                \
+/* @param ptr if != NULL, removed elements are copied to ptr */                \
+static inline void    FUNC ## _pop(cbuf_t *cb, obj_t *ptr, size_t n) {         \
+  assert(n <= cb->len);                                                        \
+  cb->len -= n;                                                                \
+  if(ptr) FUNC ## _copyn(cb, cb->len, ptr, n, 1);                              \
+}                                                                              \
+                                                                               \
+static inline size_t  FUNC ## _iovec(const cbuf_t *cb, size_t idx,             \
+                                     struct iovec *iov, size_t iovcnt) {       \
+  const size_t csize = (size_t)1 << (shift);                                   \
+  size_t i, off, m;                                                            \
+  assert(idx <= cb->len);                                                      \
+  for(i = 0; i < iovcnt && idx < cb->len; i++, idx += m) {                     \
+    off = idx & (csize-1);                                                     \
+    m = csize - off < cb->len - idx ? csize - off : cb->len - idx;             \
+    iov[i].iov_base = cb->chunks[idx >> (shift)] + off;                        \
+    iov[i].iov_len = m * sizeof(obj_t);                                        \
+  }                                                                            \
+  return i;                                                                    \
+}                                                                              \
+
+#endif /* MADCROW_CHUNKBUF_H_ */
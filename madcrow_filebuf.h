@@ -0,0 +1,306 @@
+#ifndef MADCROW_FILEBUF_H_
+#define MADCROW_FILEBUF_H_
+
+#include <stdlib.h>
+#include <string.h> // memcpy
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h> // ssize_t, ftruncate
+#include <inttypes.h> // uint64_t
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//
+// madcrow_filebuf.h
+// Define a buffer stored in a memory mapped file. The file grows with
+// ftruncate and is remapped (with mremap on Linux, needs _GNU_SOURCE). Opening
+// a file read-only maps it straight into buf->b, so reloading a saved buffer
+// does no parsing or copying, and the OS can page data larger than RAM in and
+// out as needed.
+//
+// Example:
+//
+//   #include "madcrow_filebuf.h"
+//   madcrow_filebuf(kfile,KmerFile,uint64_t)
+//
+// Creates:
+//
+//   typedef struct {
+//     uint64_t *b;
+//     size_t len, size;
+//     int fd, readonly;
+//   } KmerFile;
+//
+//   int      kfile_open    (KmerFile *buf, const char *path, int flags)
+//   int      kfile_close   (KmerFile *buf)
+//   int      kfile_sync    (KmerFile *buf)
+//   int      kfile_capacity(KmerFile *buf, size_t capacity)
+//   void     kfile_reset   (KmerFile *buf)
+//   size_t   kfile_len     (const KmerFile *buf)
+//
+//   ssize_t  kfile_add     (KmerFile *buf, uint64_t obj)
+//   uint64_t kfile_get     (const KmerFile *buf, size_t idx)
+//   void     kfile_set     (KmerFile *buf, size_t idx, uint64_t obj)
+//   void     kfile_getn    (const KmerFile *buf, size_t idx,
+//                           uint64_t *ptr, size_t n)
+//   void     kfile_setn    (KmerFile *buf, size_t idx,
+//                           uint64_t const *ptr, size_t n)
+//   uint64_t* kfile_getptr (KmerFile *buf, size_t idx)
+//   ssize_t  kfile_push    (KmerFile *buf, uint64_t const *ptr, size_t n)
+//   void     kfile_pop     (KmerFile *buf, uint64_t *ptr, size_t n)
+//
+// flags is one of:
+//   MC_FILEBUF_RDONLY  map an existing file read-only
+//   MC_FILEBUF_RDWR    map an existing file for reading and writing
+//   MC_FILEBUF_CREATE  create or truncate a file for reading and writing
+//
+// Functions that can fail return -1 and set errno. The length is written to
+// the file by kfile_sync() and kfile_close(). kfile_close() also truncates the
+// file to its length.
+//
+// File layout: a 64 byte header (magic, sizeof(obj_t), length) then the
+// elements, so buf->b is 64 byte aligned.
+//
+
+// Round a number up to the nearest number that is a power of two
+#ifndef roundup64
+  #define roundup64(x) roundup64(x)
+  static inline uint64_t roundup64(uint64_t x) {
+    return (--x, x|=x>>1, x|=x>>2, x|=x>>4, x|=x>>8, x|=x>>16, x|=x>>32, ++x);
+  }
+#endif
+
+#define MC_FILEBUF_RDONLY 0
+#define MC_FILEBUF_RDWR   1
+#define MC_FILEBUF_CREATE 2
+
+#define MC_FILEBUF_MAGIC "MCFILEBF"
+
+typedef struct {
+  char magic[8];
+  uint64_t objsize, len;
+  char pad[40];
+} mc_filebuf_hdr_t;
+
+#define madcrow_filebuf_init {.b = NULL, .len = 0, .size = 0, .fd = -1, \
+                              .readonly = 0}
+
+#define madcrow_filebuf_verify(buf) do {                                       \
+  assert((buf)->len <= (buf)->size);                                           \
+  assert((buf)->fd < 0 || (buf)->b != NULL);                                   \
+} while(0)
+
+#define madcrow_filebuf_hdr(buf) ((mc_filebuf_hdr_t*)(buf)->b - 1)
+
+// Change the size of a file mapping, returns new address or MAP_FAILED
+// On failure the old mapping is left in place
+static inline void* mc_filebuf_remap(void *map, size_t oldsize, size_t newsize,
+                                     int fd)
+{
+  #if defined(__linux__) && defined(MREMAP_MAYMOVE)
+    (void)fd;
+    return mremap(map, oldsize, newsize, MREMAP_MAYMOVE);
+  #else
+    void *newmap = mmap(NULL, newsize, PROT_READ | PROT_WRITE, MAP_SHARED,
+                        fd, 0);
+    if(newmap != MAP_FAILED) munmap(map, oldsize);
+    return newmap;
+  #endif
+}
+
+#define madcrow_filebuf(FUNC,buf_t,obj_t)                                      \
+                                                                               \
+typedef struct {                                                               \
+  obj_t *b;                                                                    \
+  size_t len, size;                                                            \
+  int fd, readonly;                                                            \
+} buf_t;                                                                       \
+                                                                               \
+/* Define functions with unused attribute in case they're not used */          \
+static inline int     FUNC ## _open(buf_t *buf, const char *path, int flags)   \
+ __attribute__((unused));                                                      \
+static inline int     FUNC ## _close(buf_t *buf)                               \
+ __attribute__((unused));                                                      \
+static inline int     FUNC ## _sync(buf_t *buf)                                \
+ __attribute__((unused));                                                      \
+static inline int     FUNC ## _capacity(buf_t *buf, size_t cap)                \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _reset(buf_t *buf)                               \
+ __attribute__((unused));                                                      \
+static inline size_t  FUNC ## _len(const buf_t *buf)                           \
+ __attribute__((unused));                                                      \
+static inline ssize_t FUNC ## _add(buf_t *buf, obj_t obj)                      \
+ __attribute__((unused));                                                      \
+static inline obj_t   FUNC ## _get(const buf_t *buf, size_t idx)               \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _set(buf_t *buf, size_t idx, obj_t obj)          \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _getn(const buf_t *buf, size_t idx,              \
+                                    obj_t *ptr, size_t n)                      \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _setn(buf_t *buf, size_t idx,                    \
+                                    obj_t const *ptr, size_t n)                \
+ __attribute__((unused));                                                      \
+static inline obj_t*  FUNC ## _getptr(buf_t *buf, size_t idx)                  \
+ __attribute__((unused));                                                      \
+static inline ssize_t FUNC ## _push(buf_t *buf, obj_t const *ptr, size_t n)    \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _pop(buf_t *buf, obj_t *ptr, size_t n)           \
+ __attribute__((unused));                                                      \
+                                                                               \
+static inline int     FUNC ## _open(buf_t *buf, const char *path, int flags)   \
+{                                                                              \
+  int oflags = flags == MC_FILEBUF_RDONLY ? O_RDONLY :                         \
+               flags == MC_FILEBUF_RDWR ? O_RDWR : O_RDWR|O_CREAT|O_TRUNC;     \
+  int prot = flags == MC_FILEBUF_RDONLY ? PROT_READ : PROT_READ|PROT_WRITE;    \
+  struct stat st;                                                              \
+  mc_filebuf_hdr_t *hdr;                                                       \
+  memset(buf, 0, sizeof(buf_t));                                               \
+  buf->fd = -1;                                                                \
+  int fd = open(path, oflags, 0644);                                           \
+  if(fd < 0) return -1;                                                        \
+  if(flags == MC_FILEBUF_CREATE &&                                             \
+     ftruncate(fd, sizeof(mc_filebuf_hdr_t)) < 0) goto fail;                   \
+  if(fstat(fd, &st) < 0) goto fail;                                            \
+  if((size_t)st.st_size < sizeof(mc_filebuf_hdr_t)) { errno = EINVAL; goto fail; }\
+  hdr = mmap(NULL, st.st_size, prot, MAP_SHARED, fd, 0);                       \
+  if(hdr == MAP_FAILED) goto fail;                                             \
+  if(flags == MC_FILEBUF_CREATE) {                                             \
+    memcpy(hdr->magic, MC_FILEBUF_MAGIC, sizeof(hdr->magic));                  \
+    hdr->objsize = sizeof(obj_t);                                              \
+    hdr->len = 0;                                                              \
+  }                                                                            \
+  size_t size = (st.st_size - sizeof(mc_filebuf_hdr_t)) / sizeof(obj_t);       \
+  if(memcmp(hdr->magic, MC_FILEBUF_MAGIC, sizeof(hdr->magic)) != 0 ||          \
+     hdr->objsize != sizeof(obj_t) || hdr->len > size) {                       \
+    munmap(hdr, st.st_size);                                                   \
+    errno = EINVAL;                                                            \
+    goto fail;                                                                 \
+  }                                                                            \
+  buf->b = (obj_t*)(hdr + 1);                                                  \
+  buf->len = hdr->len;                                                         \
+  buf->size = size;                                                            \
+  buf->fd = fd;                                                                \
+  buf->readonly = (flags == MC_FILEBUF_RDONLY);                                \
+  return 0;                                                                    \
+  fail:                                                                        \
+  { int err = errno; close(fd); errno = err; }                                 \
+  return -1;                                                                   \
+}                                                                              \
+                                                                               \
+/* Write the length to the header and flush the mapping to disk */             \
+static inline int     FUNC ## _sync(buf_t *buf)                                \
+{                                                                              \
+  madcrow_filebuf_verify(buf);                                                 \
+  if(buf->readonly) return 0;                                                  \
+  madcrow_filebuf_hdr(buf)->len = buf->len;                                    \
+  return msync(madcrow_filebuf_hdr(buf), sizeof(mc_filebuf_hdr_t) +            \
+               buf->size * sizeof(obj_t), MS_SYNC);                            \
+}                                                                              \
+                                                                               \
+/* Sync, truncate the file to its length, then unmap and close it */           \
+static inline int     FUNC ## _close(buf_t *buf)                               \
+{                                                                              \
+  int ret = 0;                                                                 \
+  if(buf->fd < 0) return 0;                                                    \
+  size_t mapsize = sizeof(mc_filebuf_hdr_t) + buf->size * sizeof(obj_t);       \
+  if(!buf->readonly) {                                                         \
+    if(FUNC ## _sync(buf) < 0) ret = -1;                                       \
+    if(ftruncate(buf->fd, sizeof(mc_filebuf_hdr_t) +                           \
+                          buf->len * sizeof(obj_t)) < 0) ret = -1;             \
+  }                                                                            \
+  if(munmap(madcrow_filebuf_hdr(buf), mapsize) < 0) ret = -1;                  \
+  if(close(buf->fd) < 0) ret = -1;                                             \
+  memset(buf, 0, sizeof(buf_t));                                               \
+  buf->fd = -1;                                                                \
+  return ret;                                                                  \
+}                                                                              \
+                                                                               \
+/* Grow the file and mapping to hold at least cap elements. On failure */      \
+/* both are left as they were */                                               \
+static inline int     FUNC ## _capacity(buf_t *buf, size_t cap)                \
+{                                                                              \
+  madcrow_filebuf_verify(buf);                                                 \
+  if(cap <= buf->size) return 0;                                               \
+  assert(!buf->readonly);                                                      \
+  cap = roundup64(cap);                                                        \
+  size_t oldsize = sizeof(mc_filebuf_hdr_t) + buf->size * sizeof(obj_t);       \
+  size_t newsize = sizeof(mc_filebuf_hdr_t) + cap * sizeof(obj_t);             \
+  if(ftruncate(buf->fd, newsize) < 0) return -1;                               \
+  mc_filebuf_hdr_t *hdr = mc_filebuf_remap(madcrow_filebuf_hdr(buf),           \
+                                           oldsize, newsize, buf->fd);         \
+  if(hdr == MAP_FAILED) {                                                      \
+    /* shrink the file back so nothing changes on disk, keeping the error */   \
+    int err = errno;                                                           \
+    while(ftruncate(buf->fd, oldsize) < 0 && errno == EINTR) {}                \
+    errno = err;                                                               \
+    return -1;                                                                 \
+  }                                                                            \
+  buf->b = (obj_t*)(hdr + 1);                                                  \
+  buf->size = cap;                                                             \
+  return 0;                                                                    \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _reset(buf_t *buf) {                             \
+  assert(!buf->readonly);                                                      \
+  buf->len = 0;                                                                \
+}                                                                              \
+                                                                               \
+static inline size_t  FUNC ## _len(const buf_t *buf) {                         \
+  return buf->len;                                                             \
+}                                                                              \
+                                                                               \
+/* Returns index of new object or -1 on failure */                             \
+static inline ssize_t FUNC ## _add(buf_t *buf, obj_t obj) {                    \
+  return FUNC ## _push(buf, &obj, 1);                                          \
+}                                                                              \
+                                                                               \
+static inline obj_t   FUNC ## _get(const buf_t *buf, size_t idx) {             \
+  assert(idx < buf->len);                                                      \
+  return buf->b[idx];                                                          \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _set(buf_t *buf, size_t idx, obj_t obj) {        \
+  assert(idx < buf->len);                                                      \
+  assert(!buf->readonly);                                                      \
+  buf->b[idx] = obj;                                                           \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _getn(const buf_t *buf, size_t idx,              \
+                                    obj_t *ptr, size_t n) {                    \
+  assert(idx+n <= buf->len);                                                   \
+  memcpy(ptr, buf->b+idx, n * sizeof(obj_t));                                  \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _setn(buf_t *buf, size_t idx,                    \
+                                    obj_t const *ptr, size_t n) {              \
+  assert(idx+n <= buf->len);                                                   \
+  assert(!buf->readonly);                                                      \
+  memcpy(buf->b+idx, ptr, n * sizeof(obj_t));                                  \
+}                                                                              \
+                                                                               \
+static inline obj_t*  FUNC ## _getptr(buf_t *buf, size_t idx) {                \
+  assert(idx < buf->len);                                                      \
+  return buf->b + idx;                                                         \
+}                                                                              \
+                                                                               \
+/* Append n objects, returns index of the first or -1 on failure */            \
+static inline ssize_t FUNC ## _push(buf_t *buf, obj_t const *ptr, size_t n) {  \
+  assert(!buf->readonly);                                                      \
+  if(FUNC ## _capacity(buf, buf->len+n) < 0) return -1;                        \
+  memcpy(buf->b+buf->len, ptr, n * sizeof(obj_t));                             \
+  size_t idx = buf->len;                                                       \
+  buf->len += n;                                                               \
+  return idx;                                                                  \
+}                                                                              \
+                                                                               \
+/* Remove last n elements, copying them to ptr if != NULL */                   \
+static inline void    FUNC ## _pop(buf_t *buf, obj_t *ptr, size_t n) {         \
+  assert(n <= buf->len);                                                       \
+  assert(!buf->readonly);                                                      \
+  buf->len -= n;                                                               \
+  if(ptr) memcpy(ptr, buf->b+buf->len, n * sizeof(obj_t));                     \
+}                                                                              \
+
+#endif /* MADCROW_FILEBUF_H_ */
@@ -0,0 +1,300 @@
+#ifndef MADCROW_HASH_H_
+#define MADCROW_HASH_H_
+
+#include <stdlib.h>
+#include <string.h> // memset
+#include <assert.h>
+#include <inttypes.h> // uint64_t
+
+//
+// madcrow_hash.h
+// Define an open addressing hash map with keys and values in flat arrays and
+// one control byte per slot (empty, or 7 bits of the key's hash), in the style
+// of Swiss tables. A lookup loads 16 control bytes at a time and compares them
+// all against the hash bits with SSE2, so most probes touch one control line
+// and one key. Slots are probed linearly from the key's home slot, which lets
+// removal shift later entries back instead of leaving tombstones: the table
+// never fills with deleted slots and never needs cleaning up. The table grows
+// by doubling once it is 7/8 full.
+//
+// Example:
+//
+//   #include "madcrow_hash.h"
+//   madcrow_hash(kmap,KmerMap,uint64_t,uint32_t,MC_HASH_INT,MC_HASH_EQ)
+//
+// Creates:
+//
+//   typedef struct {
+//     uint8_t *ctrl; // capacity + 16 control bytes
+//     uint64_t *keys;
+//     uint32_t *vals;
+//     size_t capacity, len;
+//   } KmerMap;
+//
+//   int       kmap_alloc   (KmerMap *map, size_t n)
+//   void      kmap_dealloc (KmerMap *map)
+//   void      kmap_reset   (KmerMap *map)
+//   int       kmap_reserve (KmerMap *map, size_t n)
+//   size_t    kmap_len     (const KmerMap *map)
+//
+//   uint32_t* kmap_get     (const KmerMap *map, uint64_t key)
+//   uint32_t* kmap_add     (KmerMap *map, uint64_t key, int *added)
+//   int       kmap_set     (KmerMap *map, uint64_t key, uint32_t val)
+//   int       kmap_remove  (KmerMap *map, uint64_t key, uint32_t *val)
+//   size_t    kmap_next    (const KmerMap *map, size_t i)
+//
+// hash_f(key) must give a uint64_t and eq_f(a,b) non-zero if keys are equal.
+// MC_HASH_INT hashes integer keys, MC_HASH_EQ compares with ==.
+//
+// _alloc and _reserve make room for n entries without growing; they return 0,
+// or -1 if out of memory. _get returns a pointer to the value for key or NULL.
+// _add returns a pointer to the value for key, adding it with a zeroed value
+// if it is not there (*added is set to 1 if so, 0 otherwise, if added is not
+// NULL), or NULL if out of memory:
+//
+//   (*kmap_add(&map, kmer, NULL))++;
+//
+// _set returns 1 if key was added, 0 if it was replaced, -1 if out of memory.
+// _remove returns 1 and copies the value to val (if not NULL) if key was
+// there, 0 otherwise. Adding and removing move entries, so value pointers are
+// only good until the next _add, _set, _remove or _reserve.
+//
+// Iterate with _next, which returns the first full slot at or after i, or the
+// capacity if there are no more:
+//
+//   for(i = kmap_next(&map, 0); i < map.capacity; i = kmap_next(&map, i+1))
+//     printf("%" PRIu64 " %u\n", map.keys[i], map.vals[i]);
+//
+// Compile with -DMC_HASH_NO_SIMD to use a scalar loop instead of SSE2.
+//
+
+#if defined(__SSE2__) && !defined(MC_HASH_NO_SIMD)
+  #define MC_HASH_SSE2 1
+  #include <emmintrin.h>
+#endif
+
+// Round a number up to the nearest number that is a power of two
+#ifndef roundup64
+  #define roundup64(x) roundup64(x)
+  static inline uint64_t roundup64(uint64_t x) {
+    return (--x, x|=x>>1, x|=x>>2, x|=x>>4, x|=x>>8, x|=x>>16, x|=x>>32, ++x);
+  }
+#endif
+
+// Slots in a group of control bytes
+#define MC_HASH_GROUP 16
+
+// Control byte of an empty slot, full slots hold the low 7 bits of the hash
+#define MC_HASH_EMPTY 0x80
+
+// Mix the bits of an integer (murmur3 finaliser)
+static inline uint64_t mc_hash_int(uint64_t x) {
+  x ^= x >> 33; x *= UINT64_C(0xff51afd7ed558ccd);
+  x ^= x >> 33; x *= UINT64_C(0xc4ceb9fe1a85ec53);
+  x ^= x >> 33;
+  return x;
+}
+
+#define MC_HASH_INT(x) mc_hash_int((uint64_t)(x))
+#define MC_HASH_EQ(a,b) ((a) == (b))
+
+// Bit i set if ctrl[i] == h, for the 16 control bytes at ctrl
+static inline uint32_t mc_hash_match(const uint8_t *ctrl, uint8_t h) {
+  #ifdef MC_HASH_SSE2
+    __m128i g = _mm_loadu_si128((const __m128i*)ctrl);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8((char)h)));
+  #else
+    uint32_t i, m = 0;
+    for(i = 0; i < MC_HASH_GROUP; i++) m |= (uint32_t)(ctrl[i] == h) << i;
+    return m;
+  #endif
+}
+
+// Bit i set if slot i of the 16 at ctrl is empty
+static inline uint32_t mc_hash_match_empty(const uint8_t *ctrl) {
+  #ifdef MC_HASH_SSE2
+    // only empty slots have the top bit set
+    return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)ctrl));
+  #else
+    return mc_hash_match(ctrl, MC_HASH_EMPTY);
+  #endif
+}
+
+// Entries that fit in cap slots before growing
+#define mc_hash_max_load(cap) ((cap) - (cap) / 8)
+
+#define madcrow_hash(FUNC,map_t,key_t,val_t,hash_f,eq_f) \
+        madcrow_hash2(FUNC,map_t,key_t,val_t,hash_f,eq_f,calloc,free)
+
+#define madcrow_hash2(FUNC,map_t,key_t,val_t,hash_f,eq_f,mc_alloc,mc_free)     \
+                                                                               \
+typedef struct {                                                               \
+  uint8_t *ctrl; /* capacity + 16, the last 16 copy the first 16 */            \
+  key_t *keys;                                                                 \
+  val_t *vals;                                                                 \
+  size_t capacity, len;                                                        \
+} map_t;                                                                       \
+                                                                               \
+/* Define functions with unused attribute in case they're not used */          \
+static inline int     FUNC ## _alloc(map_t *map, size_t n)                     \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _dealloc(map_t *map)                             \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _reset(map_t *map)                               \
+ __attribute__((unused));                                                      \
+static inline int     FUNC ## _reserve(map_t *map, size_t n)                   \
+ __attribute__((unused));                                                      \
+static inline size_t  FUNC ## _len(const map_t *map)                           \
+ __attribute__((unused));                                                      \
+static inline val_t*  FUNC ## _get(const map_t *map, key_t key)                \
+ __attribute__((unused));                                                      \
+static inline val_t*  FUNC ## _add(map_t *map, key_t key, int *added)          \
+ __attribute__((unused));                                                      \
+static inline int     FUNC ## _set(map_t *map, key_t key, val_t val)           \
+ __attribute__((unused));                                                      \
+static inline int     FUNC ## _remove(map_t *map, key_t key, val_t *val)       \
+ __attribute__((unused));                                                      \
+static inline size_t  FUNC ## _next(const map_t *map, size_t i)                \
+ __attribute__((unused));                                                      \
+                                                                               \
+static inline void    FUNC ## _set_ctrl(map_t *map, size_t i, uint8_t c) {     \
+  map->ctrl[i] = c;                                                            \
+  if(i < MC_HASH_GROUP) map->ctrl[map->capacity + i] = c;                      \
+}                                                                              \
+                                                                               \
+/* First empty slot at or after pos */                                         \
+static inline size_t  FUNC ## _find_empty(const map_t *map, size_t pos) {      \
+  size_t mask = map->capacity - 1;                                             \
+  uint32_t m;                                                                  \
+  while((m = mc_hash_match_empty(map->ctrl + pos)) == 0)                       \
+    pos = (pos + MC_HASH_GROUP) & mask;                                        \
+  return (pos + __builtin_ctz(m)) & mask;                                      \
+}                                                                              \
+                                                                               \
+/* Slot holding key, or capacity if it is not there */                         \
+static inline size_t  FUNC ## _find(const map_t *map, key_t key,               \
+                                    uint64_t h) {                              \
+  size_t i, mask = map->capacity - 1, pos = (h >> 7) & mask;                   \
+  uint32_t m;                                                                  \
+  if(map->len == 0) return map->capacity;                                      \
+  while(1) {                                                                   \
+    for(m = mc_hash_match(map->ctrl + pos, h & 0x7f); m; m &= m - 1) {         \
+      i = (pos + __builtin_ctz(m)) & mask;                                     \
+      if(eq_f(map->keys[i], key)) return i;                                    \
+    }                                                                          \
+    if(mc_hash_match_empty(map->ctrl + pos)) return map->capacity;             \
+    pos = (pos + MC_HASH_GROUP) & mask;                                        \
+  }                                                                            \
+}                                                                              \
+                                                                               \
+/* Replace the arrays with empty ones of cap slots (a power of two >= 16) */   \
+/* and move every entry across. Returns 0 or -1 if out of memory */            \
+static inline int     FUNC ## _rehash(map_t *map, size_t cap) {                \
+  map_t old = *map;                                                            \
+  size_t i, j;                                                                 \
+  uint64_t h;                                                                  \
+  map->ctrl = mc_alloc(cap + MC_HASH_GROUP, sizeof(uint8_t));                  \
+  map->keys = mc_alloc(cap, sizeof(key_t));                                    \
+  map->vals = mc_alloc(cap, sizeof(val_t));                                    \
+  if(!map->ctrl || !map->keys || !map->vals) {                                 \
+    mc_free(map->ctrl); mc_free(map->keys); mc_free(map->vals);                \
+    *map = old;                                                                \
+    return -1;                                                                 \
+  }                                                                            \
+  memset(map->ctrl, MC_HASH_EMPTY, cap + MC_HASH_GROUP);                       \
+  map->capacity = cap;                                                         \
+  for(i = 0; i < old.capacity; i++) {                                          \
+    if(old.ctrl[i] & MC_HASH_EMPTY) continue;                                  \
+    h = hash_f(old.keys[i]);                                                   \
+    j = FUNC ## _find_empty(map, (h >> 7) & (cap - 1));                        \
+    FUNC ## _set_ctrl(map, j, h & 0x7f);                                       \
+    map->keys[j] = old.keys[i];                                                \
+    map->vals[j] = old.vals[i];                                                \
+  }                                                                            \
+  mc_free(old.ctrl); mc_free(old.keys); mc_free(old.vals);                     \
+  return 0;                                                                    \
+}                                                                              \
+                                                                               \
+static inline int     FUNC ## _reserve(map_t *map, size_t n) {                 \
+  size_t cap = MC_HASH_GROUP;                                                  \
+  if(n <= mc_hash_max_load(map->capacity)) return 0;                           \
+  while(mc_hash_max_load(cap) < n) cap *= 2;                                   \
+  return FUNC ## _rehash(map, cap);                                            \
+}                                                                              \
+                                                                               \
+static inline int     FUNC ## _alloc(map_t *map, size_t n) {                   \
+  memset(map, 0, sizeof(map_t));                                               \
+  return FUNC ## _reserve(map, n ? n : 1);                                     \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _dealloc(map_t *map) {                           \
+  mc_free(map->ctrl); mc_free(map->keys); mc_free(map->vals);                  \
+  memset(map, 0, sizeof(map_t));                                               \
+}                                                                              \
+                                                                               \
+/* Remove every entry, keeping the arrays */                                   \
+static inline void    FUNC ## _reset(map_t *map) {                             \
+  if(map->ctrl)                                                                \
+    memset(map->ctrl, MC_HASH_EMPTY, map->capacity + MC_HASH_GROUP);           \
+  map->len = 0;                                                                \
+}                                                                              \
+                                                                               \
+static inline size_t  FUNC ## _len(const map_t *map) {                         \
+  return map->len;                                                             \
+}                                                                              \
+                                                                               \
+static inline val_t*  FUNC ## _get(const map_t *map, key_t key) {              \
+  size_t i = FUNC ## _find(map, key, hash_f(key));                             \
+  return i < map->capacity ? map->vals + i : NULL;                             \
+}                                                                              \
+                                                                               \
+static inline val_t*  FUNC ## _add(map_t *map, key_t key, int *added) {        \
+  uint64_t h = hash_f(key);                                                    \
+  size_t i = FUNC ## _find(map, key, h);                                       \
+  if(added) *added = (i == map->capacity);                                     \
+  if(i < map->capacity) return map->vals + i;                                  \
+  if(FUNC ## _reserve(map, map->len + 1) < 0) return NULL;                     \
+  i = FUNC ## _find_empty(map, (h >> 7) & (map->capacity - 1));                \
+  FUNC ## _set_ctrl(map, i, h & 0x7f);                                         \
+  map->keys[i] = key;                                                          \
+  memset(map->vals + i, 0, sizeof(val_t));                                     \
+  map->len++;                                                                  \
+  return map->vals + i;                                                        \
+}                                                                              \
+                                                                               \
+static inline int     FUNC ## _set(map_t *map, key_t key, val_t val) {         \
+  int added;                                                                   \
+  val_t *v = FUNC ## _add(map, key, &added);                                   \
+  if(v == NULL) return -1;                                                     \
+  *v = val;                                                                    \
+  return added;                                                                \
+}                                                                              \
+                                                                               \
+/* Remove the entry at slot i, shifting back later entries in its run that */  \
+/* would be closer to their home slot */                                       \
+static inline int     FUNC ## _remove(map_t *map, key_t key, val_t *val) {     \
+  size_t i = FUNC ## _find(map, key, hash_f(key)), j, home;                    \
+  size_t mask = map->capacity - 1;                                             \
+  if(i == map->capacity) return 0;                                             \
+  if(val) *val = map->vals[i];                                                 \
+  for(j = (i + 1) & mask; !(map->ctrl[j] & MC_HASH_EMPTY); j = (j + 1) & mask) \
+  {                                                                            \
+    home = (hash_f(map->keys[j]) >> 7) & mask;                                 \
+    if(((j - home) & mask) >= ((j - i) & mask)) {                              \
+      FUNC ## _set_ctrl(map, i, map->ctrl[j]);                                 \
+      map->keys[i] = map->keys[j];                                             \
+      map->vals[i] = map->vals[j];                                             \
+      i = j;                                                                   \
+    }                                                                          \
+  }                                                                            \
+  FUNC ## _set_ctrl(map, i, MC_HASH_EMPTY);                                    \
+  map->len--;                                                                  \
+  return 1;                                                                    \
+}                                                                              \
+                                                                               \
+static inline size_t  FUNC ## _next(const map_t *map, size_t i) {              \
+  while(i < map->capacity && (map->ctrl[i] & MC_HASH_EMPTY)) i++;              \
+  return i;                                                                    \
+}                                                                              \
+
+#endif /* MADCROW_HASH_H_ */
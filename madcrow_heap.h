@@ -0,0 +1,310 @@
+#ifndef MADCROW_HEAP_H_
+#define MADCROW_HEAP_H_
+
+#include <stdlib.h>
+#include <string.h> // memset
+#include <assert.h>
+#include <inttypes.h> // uint64_t, SIZE_MAX
+
+#include "madcrow_buffer.h"
+
+//
+// madcrow_heap.h
+// Define a d-ary min-heap (priority queue) kept in a madcrow_buffer. Each node
+// has D children stored next to each other and the tree is log_D(n) deep
+// rather than log_2(n). D is 8 for elements of up to 4 bytes and 4 otherwise:
+// with 8 byte keys, 8 children cost more in serial compares than the levels
+// they save. The root is stored at h->buf.b[D-1] after D-1 unused slots, so
+// each group of siblings starts at a multiple of D elements, and the buffer
+// comes from mc_aligned_calloc (madcrow_alloc.h) so is cache line aligned.
+// Whenever D*sizeof(obj_t) divides 64 (both defaults with 1, 2, 4 or 8 byte
+// elements), picking the smallest child then reads exactly one cache line.
+//
+// Example:
+//
+//   #include "madcrow_heap.h"
+//   typedef struct { uint64_t time; uint32_t id; } Event;
+//   #define event_cmp(a,b) MC_HEAP_CMP((a).time, (b).time)
+//   madcrow_heap(evq,EventQueue,Event,event_cmp)
+//
+// Creates:
+//
+//   typedef struct {
+//     evq_buf_t buf; // madcrow_buffer of Event in heap order, evq_buf_*
+//     size_t *pos, npos; // indexed heaps only
+//   } EventQueue;
+//
+//   void   evq_alloc   (EventQueue *h, size_t capacity)
+//   void   evq_dealloc (EventQueue *h)
+//   void   evq_reset   (EventQueue *h)
+//   size_t evq_len     (const EventQueue *h)
+//
+//   void   evq_push    (EventQueue *h, Event obj)
+//   Event* evq_peek    (EventQueue *h) // smallest, or NULL if empty
+//   int    evq_pop     (EventQueue *h, Event *obj)
+//   void   evq_heapify (EventQueue *h)
+//   void   evq_build   (EventQueue *h, const Event *ptr, size_t n)
+//
+// cmp(a,b) compares two elements, returning < 0 if a should come out first,
+// 0 if they are equal and > 0 otherwise. MC_HEAP_CMP(x,y) does this for
+// numbers. _pop returns 0 if the heap is empty, otherwise 1 and copies the
+// smallest element to obj (if not NULL).
+//
+// _heapify restores heap order in O(n) after elements have been added to
+// h->buf directly (e.g. with evq_buf_push). _build replaces the contents with
+// n elements copied from ptr, e.g. an existing buffer, and heapifies them.
+//
+// madcrow_heap_indexed(FUNC,heap_t,obj_t,cmp,id_f) also tracks where each
+// element is, by an id id_f(obj) that is a small non-negative integer unique
+// to each element in the heap (e.g. a timer number). This adds:
+//
+//   int    evq_contains(const EventQueue *h, size_t id)
+//   Event* evq_get     (EventQueue *h, size_t id) // or NULL
+//   void   evq_update  (EventQueue *h, Event obj) // id_f(obj) must be in h
+//   void   evq_decrease(EventQueue *h, Event obj) // obj must not be larger
+//   int    evq_remove  (EventQueue *h, size_t id, Event *obj)
+//
+// _update replaces the element with the same id and moves it up or down,
+// _decrease only up (e.g. a timer brought forward). _remove returns 0 if id is
+// not in the heap. Positions are kept in h->pos, which grows to the largest id
+// seen.
+//
+// madcrow_heap2 / madcrow_heap_indexed2 take D and the allocator. Sibling
+// groups only line up with cache lines if it returns aligned memory.
+//
+
+#define MC_HEAP_CMP(x,y) (((x) > (y)) - ((x) < (y)))
+
+// Position of an id that is not in the heap
+#define MC_HEAP_NONE SIZE_MAX
+
+// Children per node, 4 or 8
+#define mc_heap_d(obj_t) (sizeof(obj_t) <= 4 ? 8 : 4)
+
+#define mc_heap_noid(obj) 0
+
+#define madcrow_heap(FUNC,heap_t,obj_t,cmp) \
+        madcrow_heap2(FUNC,heap_t,obj_t,cmp,mc_heap_d(obj_t),\
+                      mc_aligned_calloc,mc_aligned_realloc,mc_aligned_free)
+
+#define madcrow_heap_indexed(FUNC,heap_t,obj_t,cmp,id_f) \
+        madcrow_heap_indexed2(FUNC,heap_t,obj_t,cmp,id_f,mc_heap_d(obj_t),\
+                              mc_aligned_calloc,mc_aligned_realloc,\
+                              mc_aligned_free)
+
+#define madcrow_heap2(FUNC,heap_t,obj_t,cmp,D,mc_alloc,mc_realloc,mc_free)     \
+        madcrow_heap3(FUNC,heap_t,obj_t,cmp,mc_heap_noid,0,D,                  \
+                      mc_alloc,mc_realloc,mc_free)
+
+#define madcrow_heap_indexed2(FUNC,heap_t,obj_t,cmp,id_f,D,                    \
+                              mc_alloc,mc_realloc,mc_free)                     \
+        madcrow_heap3(FUNC,heap_t,obj_t,cmp,id_f,1,D,                          \
+                      mc_alloc,mc_realloc,mc_free)                             \
+        madcrow_heap_index_funcs(FUNC,heap_t,obj_t,id_f)
+
+// indexed is 1 to keep h->pos[id_f(obj)] up to date, 0 to skip it
+#define madcrow_heap3(FUNC,heap_t,obj_t,cmp,id_f,indexed,D,                    \
+                      mc_alloc,mc_realloc,mc_free)                             \
+                                                                               \
+madcrow_buffer2(FUNC ## _buf,FUNC ## _buf_t,obj_t,                             \
+                mc_alloc,mc_realloc,mc_free,MC_INIT_MEM_UNDEF)                 \
+                                                                               \
+typedef struct {                                                               \
+  FUNC ## _buf_t buf; /* D-1 unused slots, then elements in heap order */      \
+  size_t *pos, npos; /* position of each id (indexed only), MC_HEAP_NONE */    \
+} heap_t;                                                                      \
+                                                                               \
+/* Define functions with unused attribute in case they're not used */          \
+static inline void    FUNC ## _alloc(heap_t *h, size_t capacity)               \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _dealloc(heap_t *h)                              \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _reset(heap_t *h)                                \
+ __attribute__((unused));                                                      \
+static inline size_t  FUNC ## _len(const heap_t *h)                            \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _push(heap_t *h, obj_t obj)                      \
+ __attribute__((unused));                                                      \
+static inline obj_t*  FUNC ## _peek(heap_t *h)                                 \
+ __attribute__((unused));                                                      \
+static inline int     FUNC ## _pop(heap_t *h, obj_t *obj)                      \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _heapify(heap_t *h)                              \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _build(heap_t *h, const obj_t *ptr, size_t n)    \
+ __attribute__((unused));                                                      \
+                                                                               \
+/* Heap position i is at h->buf.b[D-1+i], so the children of i, D*i+1 to */    \
+/* D*i+D, are stored from D*(i+1) on and each group starts a cache line */     \
+static inline obj_t*  FUNC ## _arr(const heap_t *h) {                          \
+  return h->buf.b + (D) - 1;                                                   \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _alloc(heap_t *h, size_t capacity) {             \
+  FUNC ## _buf_alloc(&h->buf, capacity + (D) - 1);                             \
+  FUNC ## _buf_resize(&h->buf, (D) - 1);                                       \
+  h->pos = NULL;                                                               \
+  h->npos = 0;                                                                 \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _dealloc(heap_t *h) {                            \
+  FUNC ## _buf_dealloc(&h->buf);                                               \
+  mc_free(h->pos);                                                             \
+  h->pos = NULL;                                                               \
+  h->npos = 0;                                                                 \
+}                                                                              \
+                                                                               \
+static inline size_t  FUNC ## _len(const heap_t *h) {                          \
+  return h->buf.len - ((D) - 1);                                               \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _reset(heap_t *h) {                              \
+  size_t i, n = FUNC ## _len(h);                                               \
+  if(indexed)                                                                  \
+    for(i = 0; i < n; i++) h->pos[id_f(FUNC ## _arr(h)[i])] = MC_HEAP_NONE;    \
+  h->buf.len = (D) - 1;                                                        \
+}                                                                              \
+                                                                               \
+/* Make room in h->pos for id, new entries are MC_HEAP_NONE */                 \
+static inline void    FUNC ## _pos_grow(heap_t *h, size_t id) {                \
+  size_t n;                                                                    \
+  if(id < h->npos) return;                                                     \
+  n = roundup64(id + 1 < 64 ? 64 : id + 1);                                    \
+  h->pos = mc_realloc(h->pos, n * sizeof(size_t));                             \
+  memset(h->pos + h->npos, 0xff, (n - h->npos) * sizeof(size_t));              \
+  h->npos = n;                                                                 \
+}                                                                              \
+                                                                               \
+/* Put obj at position i */                                                    \
+static inline void    FUNC ## _place(heap_t *h, size_t i, obj_t obj) {         \
+  FUNC ## _arr(h)[i] = obj;                                                    \
+  if(indexed) h->pos[id_f(obj)] = i;                                           \
+}                                                                              \
+                                                                               \
+/* Move a hole at i up (no higher than top) until obj fits, then fill it */   \
+static inline void    FUNC ## _sift_up(heap_t *h, size_t i, size_t top,        \
+                                       obj_t obj) {                            \
+  obj_t *b = FUNC ## _arr(h);                                                  \
+  size_t p;                                                                    \
+  while(i > top) {                                                             \
+    p = (i - 1) / (D);                                                         \
+    if(cmp(obj, b[p]) >= 0) break;                                             \
+    FUNC ## _place(h, i, b[p]);                                                \
+    i = p;                                                                     \
+  }                                                                            \
+  FUNC ## _place(h, i, obj);                                                   \
+}                                                                              \
+                                                                               \
+/* Move a hole at i down to a leaf, always to the smallest child, then sift */ \
+/* obj up from there, but not above i. obj usually belongs near the bottom */ \
+/* (it was a leaf), so this saves comparing it with children on the way down */\
+static inline void    FUNC ## _sift_down(heap_t *h, size_t i, obj_t obj) {     \
+  obj_t *b = FUNC ## _arr(h);                                                  \
+  size_t c, e, m, n = FUNC ## _len(h), top = i;                                \
+  while((c = (D) * i + 1) < n) {                                               \
+    e = c + (D) < n ? c + (D) : n;                                             \
+    for(m = c++; c < e; c++) m = cmp(b[c], b[m]) < 0 ? c : m;                  \
+    FUNC ## _place(h, i, b[m]);                                                \
+    i = m;                                                                     \
+  }                                                                            \
+  FUNC ## _sift_up(h, i, top, obj);                                            \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _push(heap_t *h, obj_t obj) {                    \
+  if(indexed) {                                                                \
+    FUNC ## _pos_grow(h, id_f(obj));                                           \
+    assert(h->pos[id_f(obj)] == MC_HEAP_NONE);                                 \
+  }                                                                            \
+  FUNC ## _buf_capacity(&h->buf, h->buf.len + 1);                              \
+  h->buf.len++;                                                                \
+  FUNC ## _sift_up(h, FUNC ## _len(h) - 1, 0, obj);                            \
+}                                                                              \
+                                                                               \
+static inline obj_t*  FUNC ## _peek(heap_t *h) {                               \
+  return FUNC ## _len(h) ? FUNC ## _arr(h) : NULL;                             \
+}                                                                              \
+                                                                               \
+static inline int     FUNC ## _pop(heap_t *h, obj_t *obj) {                    \
+  obj_t top, *b = FUNC ## _arr(h);                                             \
+  if(FUNC ## _len(h) == 0) return 0;                                           \
+  top = b[0];                                                                  \
+  if(indexed) h->pos[id_f(top)] = MC_HEAP_NONE;                                \
+  h->buf.len--;                                                                \
+  if(FUNC ## _len(h) > 0) FUNC ## _sift_down(h, 0, b[FUNC ## _len(h)]);        \
+  if(obj) *obj = top;                                                          \
+  return 1;                                                                    \
+}                                                                              \
+                                                                               \
+/* Sift down every node with children, from the last one back to the root */   \
+static inline void    FUNC ## _heapify(heap_t *h) {                            \
+  size_t i, n = FUNC ## _len(h);                                               \
+  obj_t *b = FUNC ## _arr(h);                                                  \
+  if(indexed) {                                                                \
+    for(i = 0; i < n; i++) {                                                   \
+      FUNC ## _pos_grow(h, id_f(b[i]));                                        \
+      h->pos[id_f(b[i])] = i;                                                  \
+    }                                                                          \
+  }                                                                            \
+  for(i = n > 1 ? (n - 2) / (D) + 1 : 0; i > 0; i--)                           \
+    FUNC ## _sift_down(h, i - 1, b[i - 1]);                                    \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _build(heap_t *h, const obj_t *ptr, size_t n) {  \
+  FUNC ## _reset(h);                                                           \
+  FUNC ## _buf_push(&h->buf, ptr, n);                                          \
+  FUNC ## _heapify(h);                                                         \
+}                                                                              \
+
+#define madcrow_heap_index_funcs(FUNC,heap_t,obj_t,id_f)                       \
+                                                                               \
+static inline int     FUNC ## _contains(const heap_t *h, size_t id)            \
+ __attribute__((unused));                                                      \
+static inline obj_t*  FUNC ## _get(heap_t *h, size_t id)                       \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _update(heap_t *h, obj_t obj)                    \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _decrease(heap_t *h, obj_t obj)                  \
+ __attribute__((unused));                                                      \
+static inline int     FUNC ## _remove(heap_t *h, size_t id, obj_t *obj)        \
+ __attribute__((unused));                                                      \
+                                                                               \
+static inline int     FUNC ## _contains(const heap_t *h, size_t id) {          \
+  return id < h->npos && h->pos[id] != MC_HEAP_NONE;                           \
+}                                                                              \
+                                                                               \
+static inline obj_t*  FUNC ## _get(heap_t *h, size_t id) {                     \
+  return FUNC ## _contains(h, id) ? FUNC ## _arr(h) + h->pos[id] : NULL;       \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _decrease(heap_t *h, obj_t obj) {                \
+  assert(FUNC ## _contains(h, id_f(obj)));                                     \
+  FUNC ## _sift_up(h, h->pos[id_f(obj)], 0, obj);                              \
+}                                                                              \
+                                                                               \
+/* Sift up, and if obj did not move up, sift down */                           \
+static inline void    FUNC ## _update(heap_t *h, obj_t obj) {                  \
+  size_t i;                                                                    \
+  assert(FUNC ## _contains(h, id_f(obj)));                                     \
+  i = h->pos[id_f(obj)];                                                       \
+  FUNC ## _sift_up(h, i, 0, obj);                                              \
+  if(h->pos[id_f(obj)] == i) FUNC ## _sift_down(h, i, obj);                    \
+}                                                                              \
+                                                                               \
+/* Fill the hole with the last element, which may need to go up or down */     \
+static inline int     FUNC ## _remove(heap_t *h, size_t id, obj_t *obj) {      \
+  size_t i;                                                                    \
+  obj_t last;                                                                  \
+  if(!FUNC ## _contains(h, id)) return 0;                                      \
+  i = h->pos[id];                                                              \
+  if(obj) *obj = FUNC ## _arr(h)[i];                                           \
+  h->pos[id] = MC_HEAP_NONE;                                                   \
+  h->buf.len--;                                                                \
+  last = FUNC ## _arr(h)[FUNC ## _len(h)];                                     \
+  if(i < FUNC ## _len(h)) {                                                    \
+    FUNC ## _sift_up(h, i, 0, last);                                           \
+    if(h->pos[id_f(last)] == i) FUNC ## _sift_down(h, i, last);                \
+  }                                                                            \
+  return 1;                                                                    \
+}                                                                              \
+
+#endif /* MADCROW_HEAP_H_ */
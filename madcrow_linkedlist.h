@@ -5,6 +5,7 @@
 #include <string.h> // memset
 #include <assert.h>
 #include <unistd.h> // ssize_t
+#include <stdint.h> // uintptr_t
 
 //
 // madcrow_linkedlist.h
@@ -24,6 +25,7 @@
 //
 //   typedef struct {
 //     LinkedNode *first, *last;
+//     size_t len;
 //   } LinkedList;
 //
 //   void        llist_init    (LinkedList *llist)
@@ -33,18 +35,77 @@
 //   LinkedNode* llist_unshift (LinkedList *llist)
 //   size_t      llist_length  (const LinkedList *llist)
 //
+//   void        llist_insert_before(LinkedList *llist, LinkedNode *at,
+//                                   LinkedNode *node)
+//   void        llist_insert_after (LinkedList *llist, LinkedNode *at,
+//                                   LinkedNode *node)
+//   void        llist_remove  (LinkedList *llist, LinkedNode *node)
+//   void        llist_concat  (LinkedList *dst, LinkedList *src)
+//   void        llist_splice  (LinkedList *dst, LinkedNode *at,
+//                              LinkedList *src, LinkedNode *first,
+//                              LinkedNode *last, size_t n)
+//
+// llist_pop and llist_unshift return NULL if the list is empty.
+//
+// All of these are O(1). _insert_before/_insert_after add node next to at,
+// which must be in the list (NULL adds at the end/start). _remove unlinks node,
+// which must be in the list. _concat moves every node of src to the end of dst,
+// leaving src empty. _splice moves the n nodes first..last (inclusive, in that
+// order in src) out of src and in before at in dst (at the end if at is NULL).
+// n must be the number of nodes from first to last, since counting them would
+// not be O(1). dst and src may be the same list if at is not in first..last.
+//
+// madcrow_linkedlist_sort(llist,LinkedList,LinkedNode,cmp) adds:
+//
+//   void        llist_sort    (LinkedList *llist)
+//
+// a stable bottom-up merge sort that relinks the nodes without allocating, in
+// O(n log n). cmp(a,b) compares two nodes' data, returning < 0 if a comes
+// first, 0 if they are equal and > 0 otherwise.
+//
 //  LinkedList llist = madcrow_linkedlist_init;
 //  madcrow_linkedlist_verify(&llist);
 //
+// Node pool:
+//
+//   madcrow_nodepool(lpool,NodePool,llist,LinkedList,LinkedNode,char)
+//
+// Creates a pool that hands out nodes from 64-byte aligned slabs, keeping
+// free nodes on a list threaded through node->next:
+//
+//   typedef struct {
+//     LinkedNode *free;
+//     mc_slab_t *slabs;
+//     size_t slab_nodes;
+//   } NodePool;
+//
+//   void        lpool_alloc   (NodePool *pool, size_t slab_nodes)
+//   void        lpool_dealloc (NodePool *pool)
+//   LinkedNode* lpool_get     (NodePool *pool)
+//   void        lpool_put     (NodePool *pool, LinkedNode *node)
+//
+//   int         lpool_push    (NodePool *pool, LinkedList *llist, char obj)
+//   int         lpool_pop     (NodePool *pool, LinkedList *llist, char *obj)
+//   int         lpool_shift   (NodePool *pool, LinkedList *llist, char obj)
+//   int         lpool_unshift (NodePool *pool, LinkedList *llist, char *obj)
+//
+// lpool_push/lpool_shift return 0 if a new slab could not be allocated (the
+// list is unchanged), 1 otherwise. lpool_pop/lpool_unshift return nodes to the
+// pool and return 0 if the list was empty, 1 otherwise. lpool_dealloc frees every slab at once, so nodes
+// still on lists must not be used afterwards. slab_nodes of 0 picks about 64KB.
+//
 
 #define madcrow_linkedlist_init {.first = NULL, .last = NULL, .len = 0}
 
 #define madcrow_linkedlist_verify(list) do {                                   \
   assert(!(list)->first == !(list)->last);                                     \
   assert(!(list)->first == !(list)->len);                                      \
-  { size_t _n = 0; __typeof((list)->first) _ptr = (list)->first;               \
-    while(_ptr) { _ptr = _ptr->next; _n++; }                                   \
-    assert(_n == (list)->len);                                                 \
+  { size_t _n = 0; __typeof((list)->first) _ptr = (list)->first, _prev = NULL; \
+    while(_ptr) {                                                              \
+      assert(_ptr->prev == _prev);                                             \
+      _prev = _ptr; _ptr = _ptr->next; _n++;                                   \
+    }                                                                          \
+    assert(_n == (list)->len && _prev == (list)->last);                        \
   }                                                                            \
 } while(0)
 
@@ -74,6 +135,19 @@ static inline void FUNC ## _shift(list_t *list, node_t *node)                  \
 static inline node_t*  FUNC ## _unshift(list_t *list)                          \
  __attribute__((unused));                                                      \
 static inline size_t FUNC ## _length(const list_t *list)                       \
+ __attribute__((unused));                                                      \
+static inline void FUNC ## _insert_before(list_t *list, node_t *at,            \
+                                          node_t *node)                        \
+ __attribute__((unused));                                                      \
+static inline void FUNC ## _insert_after(list_t *list, node_t *at,             \
+                                         node_t *node)                         \
+ __attribute__((unused));                                                      \
+static inline void FUNC ## _remove(list_t *list, node_t *node)                 \
+ __attribute__((unused));                                                      \
+static inline void FUNC ## _concat(list_t *dst, list_t *src)                   \
+ __attribute__((unused));                                                      \
+static inline void FUNC ## _splice(list_t *dst, node_t *at, list_t *src,       \
+                                   node_t *first, node_t *last, size_t n)      \
  __attribute__((unused));                                                      \
                                                                                \
 static inline void FUNC ## _init(list_t *list) {                               \
@@ -81,9 +155,7 @@ static inline void FUNC ## _init(list_t *list) {                               \
 }                                                                              \
                                                                                \
 static inline size_t FUNC ## _length(const list_t *list) {                     \
-  node_t *n = list->first; size_t len = 0;                                     \
-  while(n != NULL) { n++; len++; }                                             \
-  return len;                                                                  \
+  return list->len;                                                            \
 }                                                                              \
                                                                                \
 /* Add an element to the end of the list */                                    \
@@ -93,13 +165,17 @@ static inline void FUNC ## _push(list_t *list, node_t *node) {                 \
   node->next = NULL;                                                           \
   node->prev = list->last;                                                     \
   list->last = node;                                                           \
+  list->len++;                                                                 \
 }                                                                              \
                                                                                \
 /* Remove (and return) an element from the end of the list */                  \
 static inline node_t* FUNC ## _pop(list_t *list) {                             \
   node_t *node = list->last;                                                   \
-  list->last = list->last->prev;                                               \
-  if(list->last == NULL) list->first = NULL;                                   \
+  if(node == NULL) return NULL;                                                \
+  list->last = node->prev;                                                     \
+  if(list->last) list->last->next = NULL;                                      \
+  else           list->first = NULL;                                           \
+  list->len--;                                                                 \
   return node;                                                                 \
 }                                                                              \
                                                                                \
@@ -110,14 +186,225 @@ static inline void FUNC ## _shift(list_t *list, node_t *node) {                \
   node->next = list->first;                                                    \
   node->prev = NULL;                                                           \
   list->first = node;                                                          \
+  list->len++;                                                                 \
 }                                                                              \
                                                                                \
 /* Remove (and return) an element from the start of the list */                \
 static inline node_t* FUNC ## _unshift(list_t *list) {                         \
   node_t *node = list->first;                                                  \
-  list->first = list->first->next;                                             \
-  if(list->first == NULL) list->last = NULL;                                   \
+  if(node == NULL) return NULL;                                                \
+  list->first = node->next;                                                    \
+  if(list->first) list->first->prev = NULL;                                    \
+  else            list->last = NULL;                                           \
+  list->len--;                                                                 \
   return node;                                                                 \
+}                                                                              \
+                                                                               \
+/* Link the chain first..last in between prev and next (either may be NULL) */ \
+static inline void FUNC ## _link(list_t *list, node_t *prev, node_t *next,     \
+                                 node_t *first, node_t *last, size_t n) {      \
+  first->prev = prev;                                                          \
+  last->next = next;                                                           \
+  if(prev) prev->next = first; else list->first = first;                       \
+  if(next) next->prev = last;  else list->last = last;                         \
+  list->len += n;                                                              \
+}                                                                              \
+                                                                               \
+/* Unlink the n nodes first..last, leaving their outer links untouched */      \
+static inline void FUNC ## _unlink(list_t *list, node_t *first, node_t *last,  \
+                                   size_t n) {                                 \
+  assert(list->len >= n);                                                      \
+  node_t *prev = first->prev, *next = last->next;                              \
+  if(prev) prev->next = next; else list->first = next;                         \
+  if(next) next->prev = prev; else list->last = prev;                          \
+  list->len -= n;                                                              \
+}                                                                              \
+                                                                               \
+/* Add node before at (at the end if at is NULL) */                            \
+static inline void FUNC ## _insert_before(list_t *list, node_t *at,            \
+                                          node_t *node) {                      \
+  FUNC ## _link(list, at ? at->prev : list->last, at, node, node, 1);          \
+}                                                                              \
+                                                                               \
+/* Add node after at (at the start if at is NULL) */                           \
+static inline void FUNC ## _insert_after(list_t *list, node_t *at,             \
+                                         node_t *node) {                       \
+  FUNC ## _link(list, at, at ? at->next : list->first, node, node, 1);         \
+}                                                                              \
+                                                                               \
+static inline void FUNC ## _remove(list_t *list, node_t *node) {               \
+  FUNC ## _unlink(list, node, node, 1);                                        \
+  node->next = node->prev = NULL;                                              \
+}                                                                              \
+                                                                               \
+/* Move all of src to the end of dst */                                        \
+static inline void FUNC ## _concat(list_t *dst, list_t *src) {                 \
+  if(src->first == NULL) return;                                               \
+  FUNC ## _link(dst, dst->last, NULL, src->first, src->last, src->len);        \
+  memset(src, 0, sizeof(list_t));                                              \
+}                                                                              \
+                                                                               \
+/* Move the n nodes first..last from src to before at in dst */                \
+static inline void FUNC ## _splice(list_t *dst, node_t *at, list_t *src,       \
+                                   node_t *first, node_t *last, size_t n) {    \
+  FUNC ## _unlink(src, first, last, n);                                        \
+  FUNC ## _link(dst, at ? at->prev : dst->last, at, first, last, n);           \
+}
+
+#define madcrow_linkedlist_sort(FUNC,list_t,node_t,cmp)                        \
+                                                                               \
+static inline void FUNC ## _sort(list_t *list) __attribute__((unused));        \
+                                                                               \
+/* Merge two NULL terminated chains linked by next, a first on ties */         \
+static inline node_t* FUNC ## _merge(node_t *a, node_t *b) {                   \
+  node_t *head = NULL, **tail = &head;                                         \
+  while(a && b) {                                                              \
+    if(cmp(b->data, a->data) < 0) { *tail = b; b = b->next; }                  \
+    else                          { *tail = a; a = a->next; }                  \
+    tail = &(*tail)->next;                                                     \
+  }                                                                            \
+  *tail = a ? a : b;                                                           \
+  return head;                                                                 \
+}                                                                              \
+                                                                               \
+/* Bottom-up merge sort: bins[i] holds a sorted run of 2^i nodes (or is */     \
+/* empty), merged upwards like a binary counter as nodes are added. Runs in */ \
+/* higher bins hold earlier nodes, so merging them first keeps it stable. */   \
+/* prev links and last are fixed in one pass at the end */                     \
+static inline void FUNC ## _sort(list_t *list) {                               \
+  node_t *bins[64] = {NULL}, *node = list->first, *next, *run;                 \
+  size_t i;                                                                    \
+  while(node) {                                                                \
+    next = node->next;                                                         \
+    node->next = NULL;                                                         \
+    for(run = node, i = 0; bins[i]; i++) {                                     \
+      run = FUNC ## _merge(bins[i], run);                                      \
+      bins[i] = NULL;                                                          \
+    }                                                                          \
+    bins[i] = run;                                                             \
+    node = next;                                                               \
+  }                                                                            \
+  for(run = NULL, i = 0; i < 64; i++)                                          \
+    if(bins[i]) run = FUNC ## _merge(bins[i], run);                            \
+  list->first = run;                                                           \
+  for(next = NULL; run; next = run, run = run->next) run->prev = next;         \
+  list->last = next;                                                           \
+}
+
+// Slabs start with this header, padded to a cache line, followed by nodes
+typedef struct mc_slab_t mc_slab_t;
+struct mc_slab_t {
+  void *mem; // pointer returned by the allocator
+  mc_slab_t *next;
+  char pad[64 - 2*sizeof(void*)];
+};
+
+#define madcrow_nodepool(FUNC,pool_t,LFUNC,list_t,node_t,obj_t) \
+        madcrow_nodepool2(FUNC,pool_t,LFUNC,list_t,node_t,obj_t,calloc,free)
+
+#define madcrow_nodepool2(FUNC,pool_t,LFUNC,list_t,node_t,obj_t,mc_alloc,mc_free)\
+                                                                               \
+typedef struct {                                                               \
+  node_t *free;                                                                \
+  mc_slab_t *slabs;                                                            \
+  size_t slab_nodes;                                                           \
+} pool_t;                                                                      \
+                                                                               \
+/* Define functions with unused attribute in case they're not used */          \
+static inline void    FUNC ## _alloc(pool_t *pool, size_t slab_nodes)          \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _dealloc(pool_t *pool)                           \
+ __attribute__((unused));                                                      \
+static inline node_t* FUNC ## _get(pool_t *pool)                               \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _put(pool_t *pool, node_t *node)                 \
+ __attribute__((unused));                                                      \
+static inline int     FUNC ## _push(pool_t *pool, list_t *list, obj_t obj)     \
+ __attribute__((unused));                                                      \
+static inline int     FUNC ## _pop(pool_t *pool, list_t *list, obj_t *obj)     \
+ __attribute__((unused));                                                      \
+static inline int     FUNC ## _shift(pool_t *pool, list_t *list, obj_t obj)    \
+ __attribute__((unused));                                                      \
+static inline int     FUNC ## _unshift(pool_t *pool, list_t *list, obj_t *obj) \
+ __attribute__((unused));                                                      \
+                                                                               \
+static inline void    FUNC ## _alloc(pool_t *pool, size_t slab_nodes) {        \
+  if(slab_nodes == 0) slab_nodes = (65536 - sizeof(mc_slab_t)) / sizeof(node_t);\
+  pool->free = NULL;                                                           \
+  pool->slabs = NULL;                                                          \
+  pool->slab_nodes = slab_nodes ? slab_nodes : 1;                              \
+}                                                                              \
+                                                                               \
+/* Free all slabs, including nodes that were not returned */                   \
+static inline void    FUNC ## _dealloc(pool_t *pool) {                         \
+  mc_slab_t *slab, *next;                                                      \
+  for(slab = pool->slabs; slab != NULL; slab = next) {                         \
+    next = slab->next;                                                         \
+    mc_free(slab->mem);                                                        \
+  }                                                                            \
+  memset(pool, 0, sizeof(pool_t));                                             \
+}                                                                              \
+                                                                               \
+/* Returns a node, or NULL if out of memory */                                 \
+static inline node_t* FUNC ## _get(pool_t *pool) {                             \
+  if(pool->free == NULL) {                                                     \
+    size_t i, n = pool->slab_nodes;                                            \
+    void *mem = mc_alloc(1, 63 + sizeof(mc_slab_t) + n * sizeof(node_t));      \
+    if(mem == NULL) return NULL;                                               \
+    mc_slab_t *slab = (mc_slab_t*)(((uintptr_t)mem + 63) & ~(uintptr_t)63);    \
+    slab->mem = mem;                                                           \
+    slab->next = pool->slabs;                                                  \
+    pool->slabs = slab;                                                        \
+    /* Thread in address order so nodes are handed out contiguously */         \
+    node_t *nodes = (node_t*)(slab + 1);                                       \
+    for(i = 0; i+1 < n; i++) nodes[i].next = &nodes[i+1];                      \
+    nodes[n-1].next = NULL;                                                    \
+    pool->free = nodes;                                                        \
+  }                                                                            \
+  node_t *node = pool->free;                                                   \
+  pool->free = node->next;                                                     \
+  return node;                                                                 \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _put(pool_t *pool, node_t *node) {               \
+  node->next = pool->free;                                                     \
+  pool->free = node;                                                           \
+}                                                                              \
+                                                                               \
+/* Add an element to the end of the list, returns 0 if out of memory */        \
+static inline int     FUNC ## _push(pool_t *pool, list_t *list, obj_t obj) {   \
+  node_t *node = FUNC ## _get(pool);                                           \
+  if(node == NULL) return 0;                                                   \
+  node->data = obj;                                                            \
+  LFUNC ## _push(list, node);                                                  \
+  return 1;                                                                    \
+}                                                                              \
+                                                                               \
+/* Remove an element from the end of the list, returns 0 if empty */           \
+static inline int     FUNC ## _pop(pool_t *pool, list_t *list, obj_t *obj) {   \
+  node_t *node = LFUNC ## _pop(list);                                          \
+  if(node == NULL) return 0;                                                   \
+  if(obj) *obj = node->data;                                                   \
+  FUNC ## _put(pool, node);                                                    \
+  return 1;                                                                    \
+}                                                                              \
+                                                                               \
+/* Add an element to the start of the list, returns 0 if out of memory */      \
+static inline int     FUNC ## _shift(pool_t *pool, list_t *list, obj_t obj) {  \
+  node_t *node = FUNC ## _get(pool);                                           \
+  if(node == NULL) return 0;                                                   \
+  node->data = obj;                                                            \
+  LFUNC ## _shift(list, node);                                                 \
+  return 1;                                                                    \
+}                                                                              \
+                                                                               \
+/* Remove an element from the start of the list, returns 0 if empty */         \
+static inline int     FUNC ## _unshift(pool_t *pool, list_t *list, obj_t *obj) {\
+  node_t *node = LFUNC ## _unshift(list);                                      \
+  if(node == NULL) return 0;                                                   \
+  if(obj) *obj = node->data;                                                   \
+  FUNC ## _put(pool, node);                                                    \
+  return 1;                                                                    \
 }
 
 #endif /* MADCROW_LINKEDLIST_H_ */
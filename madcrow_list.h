@@ -2,11 +2,16 @@
 #define MADCROW_LIST_H_
 
 #include <stdlib.h>
+#include <stddef.h> // ptrdiff_t
 #include <string.h> // memset
 #include <assert.h>
 #include <unistd.h> // ssize_t
 #include <inttypes.h> // uint64_t
 
+#include "madcrow_stats.h"
+#include "madcrow_search.h"
+#include "madcrow_alloc.h"
+
 //
 // madcrow_list.h
 // Define a list with functions to alloc, reset, push, pop, shift, unshift etc.
@@ -30,6 +35,7 @@
 //   void      clist_reset   (CharList *list)
 //   void      clist_capacity(CharList *list, size_t capacity)
 //   void      clist_len     (const CharList *list)
+//   void      clist_shrink_to_fit(CharList *list)
 //
 // Pass object:
 //   size_t    clist_prepend  (CharList *list, char obj)
@@ -52,9 +58,68 @@
 //
 //   void       clist_copy    (CharList *dst, const CharList *src)
 //
+// Search between start and end, returning an index relative to start or -1
+// (bitwise compare, SIMD for 1/2/4/8 byte elements, see madcrow_search.h):
+//   ssize_t    clist_find    (const CharList *list, char obj)
+//   ssize_t    clist_rfind   (const CharList *list, char obj)
+//   size_t     clist_count   (const CharList *list, char obj)
+//   ssize_t    clist_find_any(const CharList *list,
+//                             const char *objs, size_t nobjs)
+//
 //  CharList clist = madcrow_list_init;
 //  madcrow_list_verify(&clist);
 //
+// clist_shrink_to_fit() moves the elements to the middle of a len element
+// allocation (at least 8). madcrow_list_autoshrink(clist,CharList,char) adds
+// clist_autoshrink(), which works as for madcrow_buffer_autoshrink, counting
+// lcut/rcut/pop/shift/reset and recentring into 2*len elements.
+//
+// madcrow_list_arena(clist,CharList,char) adds a `mc_arena_t *ctx` field that
+// all of the list's memory comes from (madcrow_list_ctx2 takes any allocator
+// with a context, see madcrow_alloc.h). Set it before alloc, e.g.
+// CharList l = madcrow_list_ctx_init(&arena).
+//
+// madcrow_list_incr(clist,IncrList,char) creates a list that bounds the work
+// done by any one operation, as madcrow_buffer_incr does for buffers. When an
+// end runs out of room it allocates a new array (twice the size if at least
+// half full) with the elements centred, and append/prepend/lcut/rcut each
+// move mc_incr_step() of them across from the old array until it is freed.
+// Positions [list->lo, list->hi) in list->b are still in list->old at an
+// offset of list->shift, so use get/set/getptr. clist_flush() finishes the
+// migration, after which list->b[start..end) holds every element:
+//
+//   typedef struct {
+//     char *b, *old;
+//     size_t start, end, capacity, lo, hi;
+//     ptrdiff_t shift;
+//   } IncrList;
+//
+//   void      clist_alloc   (IncrList *list, size_t capacity)
+//   void      clist_dealloc (IncrList *list)
+//   void      clist_reset   (IncrList *list)
+//   size_t    clist_len     (const IncrList *list)
+//   void      clist_flush   (IncrList *list)
+//   size_t    clist_append  (IncrList *list, char obj)
+//   size_t    clist_prepend (IncrList *list, char obj)
+//   char      clist_lcut    (IncrList *list)
+//   char      clist_rcut    (IncrList *list)
+//   char      clist_get     (const IncrList *list, size_t idx)
+//   void      clist_set     (IncrList *list, size_t idx, char obj)
+//   char*     clist_getptr  (IncrList *list, size_t idx)
+//   void      clist_getn    (IncrList *list, size_t idx, char *ptr, size_t n)
+//   void      clist_setn    (IncrList *list, size_t idx,
+//                            const char *ptr, size_t n)
+//   size_t    clist_push    (IncrList *list, char *ptr, size_t n)
+//   void      clist_pop     (IncrList *list, char *ptr, size_t n)
+//   size_t    clist_unshift (IncrList *list, char *ptr, size_t n)
+//   void      clist_shift   (IncrList *list, char *ptr, size_t n)
+//
+// clist_push and clist_unshift migrate n steps' worth at once, in proportion
+// to the elements they add.
+//
+// Compile with -DMC_STATS to count reallocs, memmoves etc. in clist_stats,
+// see madcrow_stats.h
+//
 
 // Round a number up to the nearest number that is a power of two
 #ifndef roundup64
@@ -65,6 +130,8 @@
 #endif
 
 #define madcrow_list_init {.b = NULL, .start = 0, .end = 0, .capacity = 0}
+#define madcrow_list_ctx_init(c) \
+        {.b = NULL, .start = 0, .end = 0, .capacity = 0, .ctx = (c)}
 
 #define madcrow_list_verify(list) do {                                         \
   assert((list)->start <= (list)->end);                                        \
@@ -75,6 +142,13 @@
 #define madcrow_list(name,list_t,obj_t) \
         madcrow_list2(name,list_t,obj_t,calloc,realloc,free)
 
+#define madcrow_list_autoshrink(name,list_t,obj_t) \
+        madcrow_list_autoshrink2(name,list_t,obj_t,calloc,realloc,free)
+
+#define madcrow_list_arena(name,list_t,obj_t) \
+        madcrow_list_ctx2(name,list_t,obj_t,mc_arena_t,mc_arena_calloc,\
+                          mc_arena_realloc,mc_arena_free)
+
 // MACROs
 #define mdc_list_getptr(l,idx) ((l)->b + (l)->start + (idx))
 #define mdc_list_get(l,idx) (*mdc_list_getptr(l,idx))
@@ -87,6 +161,42 @@ typedef struct {                                                               \
   size_t start, end, capacity;                                                 \
 } list_t;                                                                      \
                                                                                \
+madcrow_list_funcs(FUNC,list_t,obj_t,madcrow_mem,mc_alloc,mc_realloc,mc_free,  \
+                   0,mc_noshrink)
+
+// Shrink after a run of removals that leave the list mostly empty
+#define madcrow_list_autoshrink2(FUNC,list_t,obj_t,mc_alloc,mc_realloc,mc_free)\
+                                                                               \
+typedef struct {                                                               \
+  obj_t *b;                                                                    \
+  size_t start, end, capacity;                                                 \
+  mc_shrink_t shrink; /* auto-shrink policy and count */                       \
+} list_t;                                                                      \
+                                                                               \
+madcrow_list_funcs(FUNC,list_t,obj_t,madcrow_mem,mc_alloc,mc_realloc,mc_free,  \
+                   1,mc_shrink)
+
+// Carry an allocator context in list->ctx, passed to every allocator call
+// (see madcrow_alloc.h)
+#define madcrow_list_ctx2(FUNC,list_t,obj_t,ctx_t,mc_alloc,mc_realloc,mc_free) \
+                                                                               \
+typedef struct {                                                               \
+  obj_t *b;                                                                    \
+  size_t start, end, capacity;                                                 \
+  ctx_t *ctx; /* allocator context */                                          \
+} list_t;                                                                      \
+                                                                               \
+madcrow_list_funcs(FUNC,list_t,obj_t,madcrow_mem_ctx,                          \
+                   mc_alloc,mc_realloc,mc_free,0,mc_noshrink)
+
+// MEM is madcrow_mem or madcrow_mem_ctx, which define FUNC_mem_alloc etc.
+// autoshrink is 1 if SHRINK(list) is an mc_shrink_t in the struct, else 0.
+#define madcrow_list_funcs(FUNC,list_t,obj_t,MEM,mc_alloc,mc_realloc,mc_free,  \
+                           autoshrink,SHRINK)                                  \
+                                                                               \
+MC_STATS_DEFINE(FUNC)                                                          \
+MEM(FUNC,list_t,mc_alloc,mc_realloc,mc_free)                                   \
+                                                                               \
 /* Define functions with unused attribute in case they're not used */          \
 static inline list_t* FUNC ## _new(size_t capacity)                            \
  __attribute__((unused));                                                      \
@@ -98,6 +208,14 @@ static inline void    FUNC ## _dealloc(list_t *list)                           \
  __attribute__((unused));                                                      \
 static inline void    FUNC ## _capacity(list_t *list, size_t cap)              \
  __attribute__((unused));                                                      \
+static inline void    FUNC ## _shrink_to_fit(list_t *list)                     \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _autoshrink(list_t *list, uint32_t nops)         \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _shrink(list_t *list, size_t cap)                \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _shrink_check(list_t *list)                      \
+ __attribute__((unused));                                                      \
 static inline size_t  FUNC ## _push(list_t *list, obj_t *obj, size_t n)        \
  __attribute__((unused));                                                      \
 static inline void    FUNC ## _pop(list_t *list, obj_t *ptr, size_t n)         \
@@ -132,17 +250,26 @@ static inline void    FUNC ## _getn(list_t *list, size_t idx,                  \
  __attribute__((unused));                                                      \
 static inline void    FUNC ## _setn(list_t *list, size_t idx,                  \
                                     const obj_t *ptr, size_t n)                \
+ __attribute__((unused));                                                      \
+static inline ssize_t FUNC ## _find(const list_t *list, obj_t obj)             \
+ __attribute__((unused));                                                      \
+static inline ssize_t FUNC ## _rfind(const list_t *list, obj_t obj)            \
+ __attribute__((unused));                                                      \
+static inline size_t  FUNC ## _count(const list_t *list, obj_t obj)            \
+ __attribute__((unused));                                                      \
+static inline ssize_t FUNC ## _find_any(const list_t *list,                    \
+                                        const obj_t *objs, size_t nobjs)       \
  __attribute__((unused));                                                      \
                                                                                \
 static inline list_t* FUNC ## _new(size_t capacity) {                          \
-  list_t *l = mc_alloc(1, sizeof(list_t));                                     \
+  list_t *l = FUNC ## _mem_alloc(NULL, 1, sizeof(list_t));                     \
   if(l) FUNC ## _alloc(l, capacity);                                           \
   return l;                                                                    \
 }                                                                              \
                                                                                \
 static inline void    FUNC ## _destroy(list_t *list) {                         \
   FUNC ## _dealloc(list);                                                      \
-  mc_free(list);                                                               \
+  FUNC ## _mem_free(NULL, list, sizeof(list_t));                               \
 }                                                                              \
                                                                                \
 static inline size_t  FUNC ## _len(const list_t *list) {                       \
@@ -170,37 +297,95 @@ static inline void    FUNC ## _set(list_t *list, size_t idx, obj_t obj) {      \
                                                                                \
 static inline void    FUNC ## _alloc(list_t *list, size_t capacity) {          \
   list->capacity = capacity < 8 ? 8 : roundup64(capacity);                     \
-  list->b = mc_alloc(list->capacity, sizeof(obj_t));                           \
+  list->b = FUNC ## _mem_alloc(list, list->capacity, sizeof(obj_t));           \
   list->start = list->end = list->capacity / 2;                                \
+  if(autoshrink) SHRINK(list)->ops = SHRINK(list)->low_ops = 0;                \
 }                                                                              \
                                                                                \
 static inline void    FUNC ## _dealloc(list_t *list) {                         \
   madcrow_list_verify(list);                                                   \
-  mc_free(list->b);                                                            \
-  memset(list, 0, sizeof(list_t));                                             \
+  FUNC ## _mem_free(list, list->b, list->capacity * sizeof(obj_t));            \
+  list->b = NULL;                                                              \
+  list->start = list->end = list->capacity = 0;                                \
+  if(autoshrink) SHRINK(list)->low_ops = 0;                                    \
 }                                                                              \
                                                                                \
 static inline void    FUNC ## _capacity(list_t *list, size_t cap) {            \
   madcrow_list_verify(list);                                                   \
   if(cap > list->capacity) {                                                   \
     cap = roundup64(cap);                                                      \
-    list->b = mc_realloc(list->b, list->capacity * sizeof(obj_t));             \
+    MC_STATS_ADD(FUNC, reallocs, 1);                                           \
+    MC_STATS_ADD(FUNC, realloc_bytes, cap * sizeof(obj_t));                    \
+    MC_STATS_MAX(FUNC, max_capacity, cap);                                     \
+    list->b = FUNC ## _mem_realloc(list, list->b,                              \
+                                   list->capacity * sizeof(obj_t),             \
+                                   cap * sizeof(obj_t));                       \
+    list->capacity = cap;                                                      \
+  }                                                                            \
+}                                                                              \
+                                                                               \
+/* Centre the elements in a max(len,cap,8) element allocation if smaller */    \
+static inline void    FUNC ## _shrink(list_t *list, size_t cap) {              \
+  madcrow_list_verify(list);                                                   \
+  size_t len = list->end - list->start, new_start;                             \
+  obj_t *b;                                                                    \
+  if(cap < len) cap = len;                                                     \
+  if(cap < 8) cap = 8;                                                         \
+  if(cap >= list->capacity) return;                                            \
+  new_start = (cap - len) / 2;                                                 \
+  MC_STATS_ADD(FUNC, memmove_bytes, len * sizeof(obj_t));                      \
+  memmove(list->b+new_start, list->b+list->start, len*sizeof(obj_t));          \
+  list->start = new_start;                                                     \
+  list->end = new_start + len;                                                 \
+  b = FUNC ## _mem_realloc(list, list->b, list->capacity * sizeof(obj_t),      \
+                           cap * sizeof(obj_t));                               \
+  if(b != NULL) {                                                              \
+    list->b = b;                                                               \
     list->capacity = cap;                                                      \
   }                                                                            \
 }                                                                              \
                                                                                \
+static inline void    FUNC ## _shrink_to_fit(list_t *list) {                   \
+  FUNC ## _shrink(list, list->end - list->start);                              \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _autoshrink(list_t *list, uint32_t nops) {       \
+  SHRINK(list)->ops = nops;                                                    \
+  SHRINK(list)->low_ops = 0;                                                   \
+}                                                                              \
+                                                                               \
+/* Called after removing elements: shrink if len has stayed low */             \
+static inline void    FUNC ## _shrink_check(list_t *list) {                    \
+  size_t len = list->end - list->start, cap;                                   \
+  mc_shrink_t *sh = SHRINK(list);                                              \
+  if(sh->ops == 0) return;                                                     \
+  if(len >= list->capacity / MC_SHRINK_FRACTION ||                             \
+     list->capacity * sizeof(obj_t) <= MC_SHRINK_MIN) sh->low_ops = 0;         \
+  else if(++sh->low_ops >= sh->ops) {                                          \
+    cap = MC_SHRINK_MIN / sizeof(obj_t);                                       \
+    sh->low_ops = 0;                                                           \
+    FUNC ## _shrink(list, 2 * len > cap ? 2 * len : cap);                      \
+  }                                                                            \
+}                                                                              \
+                                                                               \
 /* Add an element to the end of the list */                                    \
 static inline size_t  FUNC ## _push(list_t *list, obj_t *ptr, size_t n) {      \
   madcrow_list_verify(list);                                                   \
   if(list->end + n > list->capacity) {                                         \
     size_t oldlen = FUNC ## _len(list), newlen = oldlen + n;                   \
     if(newlen >= list->capacity / 2) {                                         \
+      size_t oldcap = list->capacity;                                          \
       list->capacity = list->start + newlen;                                   \
       list->capacity = roundup64(list->capacity);                              \
-      list->b = mc_realloc(list->b, list->capacity * sizeof(obj_t));           \
+      MC_STATS_ADD(FUNC, reallocs, 1);                                         \
+      MC_STATS_ADD(FUNC, realloc_bytes, list->capacity * sizeof(obj_t));       \
+      MC_STATS_MAX(FUNC, max_capacity, list->capacity);                        \
+      list->b = FUNC ## _mem_realloc(list, list->b, oldcap * sizeof(obj_t),    \
+                                     list->capacity * sizeof(obj_t));          \
     }                                                                          \
     else {                                                                     \
       size_t new_start = (list->capacity - newlen) / 2;                        \
+      MC_STATS_ADD(FUNC, memmove_bytes, oldlen * sizeof(obj_t));               \
       memmove(list->b+new_start, list->b+list->start, oldlen*sizeof(obj_t));   \
       list->start = new_start;                                                 \
       list->end = new_start + oldlen;                                          \
@@ -210,6 +395,7 @@ static inline size_t  FUNC ## _push(list_t *list, obj_t *ptr, size_t n) {      \
   memcpy(list->b+list->end, ptr, n*sizeof(obj_t));                             \
   size_t idx = list->end - list->start;                                        \
   list->end += n;                                                              \
+  MC_STATS_MAX(FUNC, max_len, list->end - list->start);                        \
   return idx;                                                                  \
 }                                                                              \
                                                                                \
@@ -220,6 +406,7 @@ static inline void    FUNC ## _pop(list_t *list, obj_t *ptr, size_t n) {       \
   assert(list->start+n <= list->end);                                          \
   list->end -= n;                                                              \
   if(ptr) memcpy(ptr, list->b+list->end, n*sizeof(obj_t));                     \
+  if(autoshrink) FUNC ## _shrink_check(list);                                  \
 }                                                                              \
                                                                                \
 /* Add one or more elements to the start of the list */                        \
@@ -228,10 +415,16 @@ static inline size_t  FUNC ## _unshift(list_t *l, obj_t *ptr, size_t n) {      \
   if(l->start < n) {                                                           \
     size_t oldlen = FUNC ## _len(l), newlen = oldlen + n;                      \
     if(newlen >= l->capacity / 2) {                                            \
+      size_t oldcap = l->capacity;                                             \
       l->capacity = roundup64(newlen);                                         \
-      l->b = mc_realloc(l->b, l->capacity * sizeof(obj_t));                    \
+      MC_STATS_ADD(FUNC, reallocs, 1);                                         \
+      MC_STATS_ADD(FUNC, realloc_bytes, l->capacity * sizeof(obj_t));          \
+      MC_STATS_MAX(FUNC, max_capacity, l->capacity);                           \
+      l->b = FUNC ## _mem_realloc(l, l->b, oldcap * sizeof(obj_t),             \
+                                  l->capacity * sizeof(obj_t));                \
     }                                                                          \
     size_t new_start = (l->capacity - newlen) / 2 + n;                         \
+    MC_STATS_ADD(FUNC, memmove_bytes, oldlen * sizeof(obj_t));                 \
     memmove(l->b+new_start, l->b+l->start, oldlen*sizeof(obj_t));              \
     l->start = new_start;                                                      \
     l->end = new_start + oldlen;                                               \
@@ -240,6 +433,8 @@ static inline size_t  FUNC ## _unshift(list_t *l, obj_t *ptr, size_t n) {      \
   assert(l->start >= n);                                                       \
   l->start -= n;                                                               \
   memcpy(l->b+l->start, ptr, n*sizeof(obj_t));                                 \
+  MC_STATS_ADD(FUNC, unshifts, 1);                                             \
+  MC_STATS_MAX(FUNC, max_len, l->end - l->start);                              \
   return 0;                                                                    \
 }                                                                              \
                                                                                \
@@ -250,10 +445,14 @@ static inline void    FUNC ## _shift(list_t *list, obj_t *ptr, size_t n) {     \
   assert(list->start+n <= list->end);                                          \
   if(ptr) memcpy(ptr, list->b+list->start, n*sizeof(obj_t));                   \
   list->start += n;                                                            \
+  MC_STATS_ADD(FUNC, shifts, 1);                                               \
+  if(autoshrink) FUNC ## _shrink_check(list);                                  \
 }                                                                              \
                                                                                \
 static inline void    FUNC ## _reset(list_t *list) {                           \
   madcrow_list_verify(list);                                                   \
+  /* judge by the length before reset */                                       \
+  if(autoshrink) FUNC ## _shrink_check(list);                                  \
   list->start = list->end = list->capacity / 2;                                \
 }                                                                              \
                                                                                \
@@ -264,6 +463,7 @@ static inline void    FUNC ## _copy(list_t *dst, const list_t *src) {          \
   dst->start = (dst->capacity - len) / 2;                                      \
   dst->end = dst->start + len;                                                 \
   memcpy(dst->b+dst->start, src->b+src->start, len * sizeof(obj_t));           \
+  MC_STATS_MAX(FUNC, max_len, len);                                            \
   madcrow_list_verify(dst);                                                    \
 }                                                                              \
                                                                                \
@@ -279,13 +479,18 @@ static inline size_t  FUNC ## _prepend(list_t *list, obj_t obj) {              \
 static inline obj_t   FUNC ## _lcut(list_t *list) {                            \
   madcrow_list_verify(list);                                                   \
   assert(list->start < list->end);                                             \
-  return list->b[list->start++];                                               \
+  MC_STATS_ADD(FUNC, shifts, 1);                                               \
+  obj_t obj = list->b[list->start++];                                          \
+  if(autoshrink) FUNC ## _shrink_check(list);                                  \
+  return obj;                                                                  \
 }                                                                              \
                                                                                \
 static inline obj_t   FUNC ## _rcut(list_t *list) {                            \
   madcrow_list_verify(list);                                                   \
   assert(list->start < list->end);                                             \
-  return list->b[--list->end];                                                 \
+  obj_t obj = list->b[--list->end];                                            \
+  if(autoshrink) FUNC ## _shrink_check(list);                                  \
+  return obj;                                                                  \
 }                                                                              \
                                                                                \
 static inline void    FUNC ## _getn(list_t *list, size_t idx,                  \
@@ -303,5 +508,317 @@ static inline void    FUNC ## _setn(list_t *list, size_t idx,                  \
   assert(list->start+idx+n <= list->end);                                      \
   memcpy(list->b+list->start+idx, ptr, n*sizeof(obj_t));                       \
 }                                                                              \
+                                                                               \
+/* Index from start of the first element equal to obj, or -1 */                \
+static inline ssize_t FUNC ## _find(const list_t *list, obj_t obj) {           \
+  size_t n = list->end - list->start;                                          \
+  size_t i = mc_find(list->b+list->start, n, sizeof(obj_t), &obj);             \
+  return i < n ? (ssize_t)i : -1;                                              \
+}                                                                              \
+                                                                               \
+/* Index from start of the last element equal to obj, or -1 */                 \
+static inline ssize_t FUNC ## _rfind(const list_t *list, obj_t obj) {          \
+  size_t n = list->end - list->start;                                          \
+  size_t i = mc_rfind(list->b+list->start, n, sizeof(obj_t), &obj);            \
+  return i < n ? (ssize_t)i : -1;                                              \
+}                                                                              \
+                                                                               \
+/* Number of elements equal to obj */                                          \
+static inline size_t  FUNC ## _count(const list_t *list, obj_t obj) {          \
+  return mc_count(list->b+list->start, list->end - list->start,                \
+                  sizeof(obj_t), &obj);                                        \
+}                                                                              \
+                                                                               \
+/* Index from start of the first element equal to any of objs, or -1 */        \
+static inline ssize_t FUNC ## _find_any(const list_t *list,                    \
+                                        const obj_t *objs, size_t nobjs) {     \
+  size_t n = list->end - list->start;                                          \
+  size_t i = mc_find_any(list->b+list->start, n, sizeof(obj_t), objs, nobjs);  \
+  return i < n ? (ssize_t)i : -1;                                              \
+}                                                                              \
+
+#define madcrow_list_incr(FUNC,list_t,obj_t)                                   \
+        madcrow_list_incr2(FUNC,list_t,obj_t,calloc,free)
+
+// Grow or recentre into a new array, migrating elements a few at a time
+#define madcrow_list_incr2(FUNC,list_t,obj_t,mc_alloc,mc_free)                 \
+                                                                               \
+typedef struct {                                                               \
+  obj_t *b; /* current array */                                                \
+  obj_t *old; /* previous array, NULL unless migrating */                      \
+  size_t start, end, capacity;                                                 \
+  size_t lo, hi; /* positions [lo,hi) of b are still in old */                 \
+  ptrdiff_t shift; /* position in b minus position in old */                   \
+} list_t;                                                                      \
+                                                                               \
+MC_STATS_DEFINE(FUNC)                                                          \
+                                                                               \
+/* Define functions with unused attribute in case they're not used */          \
+static inline void    FUNC ## _alloc(list_t *list, size_t capacity)            \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _dealloc(list_t *list)                           \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _reset(list_t *list)                             \
+ __attribute__((unused));                                                      \
+static inline size_t  FUNC ## _len(const list_t *list)                         \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _flush(list_t *list)                             \
+ __attribute__((unused));                                                      \
+static inline size_t  FUNC ## _append(list_t *list, obj_t obj)                 \
+ __attribute__((unused));                                                      \
+static inline size_t  FUNC ## _prepend(list_t *list, obj_t obj)                \
+ __attribute__((unused));                                                      \
+static inline obj_t   FUNC ## _lcut(list_t *list)                              \
+ __attribute__((unused));                                                      \
+static inline obj_t   FUNC ## _rcut(list_t *list)                              \
+ __attribute__((unused));                                                      \
+static inline obj_t   FUNC ## _get(const list_t *list, size_t idx)             \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _set(list_t *list, size_t idx, obj_t obj)        \
+ __attribute__((unused));                                                      \
+static inline obj_t*  FUNC ## _getptr(list_t *list, size_t idx)                \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _getn(list_t *list, size_t idx,                  \
+                                    obj_t *ptr, size_t n)                      \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _setn(list_t *list, size_t idx,                  \
+                                    const obj_t *ptr, size_t n)                \
+ __attribute__((unused));                                                      \
+static inline size_t  FUNC ## _push(list_t *list, obj_t *ptr, size_t n)        \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _pop(list_t *list, obj_t *ptr, size_t n)         \
+ __attribute__((unused));                                                      \
+static inline size_t  FUNC ## _unshift(list_t *list, obj_t *ptr, size_t n)     \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _shift(list_t *list, obj_t *ptr, size_t n)       \
+ __attribute__((unused));                                                      \
+                                                                               \
+static inline void    FUNC ## _alloc(list_t *list, size_t capacity) {          \
+  memset(list, 0, sizeof(list_t));                                             \
+  list->capacity = capacity < 8 ? 8 : roundup64(capacity);                     \
+  list->b = mc_alloc(list->capacity, sizeof(obj_t));                           \
+  list->start = list->end = list->capacity / 2;                                \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _dealloc(list_t *list) {                         \
+  mc_free(list->b);                                                            \
+  mc_free(list->old);                                                          \
+  memset(list, 0, sizeof(list_t));                                             \
+}                                                                              \
+                                                                               \
+static inline size_t  FUNC ## _len(const list_t *list) {                       \
+  return list->end - list->start;                                              \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _reset_old(list_t *list) {                       \
+  mc_free(list->old);                                                          \
+  list->old = NULL;                                                            \
+  list->lo = list->hi = 0;                                                     \
+  list->shift = 0;                                                             \
+}                                                                              \
+                                                                               \
+/* Move up to n elements from old to b, freeing old once it's empty */         \
+static inline void    FUNC ## _migrate(list_t *list, size_t n) {               \
+  if(n > list->hi - list->lo) n = list->hi - list->lo;                         \
+  memcpy(list->b + list->lo, list->old + (list->lo - list->shift),             \
+         n * sizeof(obj_t));                                                   \
+  MC_STATS_ADD(FUNC, memmove_bytes, n * sizeof(obj_t));                        \
+  mc_incr_release(list->old, (list->lo - list->shift) * sizeof(obj_t),         \
+                  (list->lo + n - list->shift) * sizeof(obj_t));               \
+  list->lo += n;                                                               \
+  if(list->lo >= list->hi) FUNC ## _reset_old(list);                           \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _flush(list_t *list) {                           \
+  if(list->old) FUNC ## _migrate(list, list->hi - list->lo);                   \
+}                                                                              \
+                                                                               \
+/* Migrate on behalf of n added elements: n steps, which keeps the old array */\
+/* draining at least as fast as either end fills */                            \
+static inline void    FUNC ## _migrate_n(list_t *list, size_t n) {             \
+  size_t step = mc_incr_step(sizeof(obj_t));                                   \
+  FUNC ## _migrate(list, n < list->hi / step ? n * step : list->hi);           \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _reset(list_t *list) {                           \
+  if(list->old) FUNC ## _reset_old(list);                                      \
+  list->start = list->end = list->capacity / 2;                                \
+}                                                                              \
+                                                                               \
+/* Swap in a new array with the elements centred, leaving them in old, to */   \
+/* add n elements at one end. Double if at least half full, and until n fit */ \
+/* at each end. Either way there are len/2 free slots at each end, by which */ \
+/* time mc_incr_step() >= 2 per op has moved them all */                       \
+static inline void    FUNC ## _grow(list_t *list, size_t n) {                  \
+  size_t len = list->end - list->start, cap = list->capacity, start;           \
+  /* a no-op for one element: migrating ends before an end is full. Adding */  \
+  /* n leaves fewer than n steps to do */                                      \
+  FUNC ## _flush(list);                                                        \
+  if(cap == 0) cap = 8;                                                        \
+  else if(2 * len >= cap) cap *= 2;                                            \
+  while(cap < len + 2 * n) cap *= 2;                                           \
+  start = (cap - len) / 2;                                                     \
+  MC_STATS_ADD(FUNC, reallocs, 1);                                             \
+  MC_STATS_ADD(FUNC, realloc_bytes, cap * sizeof(obj_t));                      \
+  MC_STATS_MAX(FUNC, max_capacity, cap);                                       \
+  list->old = list->b;                                                         \
+  list->shift = (ptrdiff_t)start - (ptrdiff_t)list->start;                     \
+  list->lo = start;                                                            \
+  list->hi = start + len;                                                      \
+  list->b = mc_alloc(cap, sizeof(obj_t));                                      \
+  list->capacity = cap;                                                        \
+  list->start = start;                                                         \
+  list->end = start + len;                                                     \
+}                                                                              \
+                                                                               \
+static inline obj_t*  FUNC ## _getptr(list_t *list, size_t idx) {              \
+  size_t pos = list->start + idx;                                              \
+  assert(idx < list->end - list->start);                                       \
+  if(pos >= list->lo && pos < list->hi) return list->old + (pos - list->shift);\
+  return list->b + pos;                                                        \
+}                                                                              \
+                                                                               \
+static inline obj_t   FUNC ## _get(const list_t *list, size_t idx) {           \
+  size_t pos = list->start + idx;                                              \
+  assert(idx < list->end - list->start);                                       \
+  if(pos >= list->lo && pos < list->hi) return list->old[pos - list->shift];   \
+  return list->b[pos];                                                         \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _set(list_t *list, size_t idx, obj_t obj) {      \
+  *FUNC ## _getptr(list, idx) = obj;                                           \
+}                                                                              \
+                                                                               \
+/* Pointer to position pos, and in *m how many positions from there on are */  \
+/* in the same array */                                                        \
+static inline obj_t*  FUNC ## _run(const list_t *list, size_t pos, size_t *m) {\
+  if(pos < list->lo) { *m = list->lo - pos; return list->b + pos; }            \
+  if(pos < list->hi) {                                                         \
+    *m = list->hi - pos;                                                       \
+    return list->old + (pos - list->shift);                                    \
+  }                                                                            \
+  *m = SIZE_MAX;                                                               \
+  return list->b + pos;                                                        \
+}                                                                              \
+                                                                               \
+/* Copy n elements from idx to ptr, from whichever array holds them */         \
+static inline void    FUNC ## _getn(list_t *list, size_t idx,                  \
+                                    obj_t *ptr, size_t n) {                    \
+  size_t pos = list->start + idx, m;                                           \
+  obj_t *p;                                                                    \
+  assert(list->start+idx+n <= list->end);                                      \
+  for(; n > 0; pos += m, ptr += m, n -= m) {                                   \
+    p = FUNC ## _run(list, pos, &m);                                           \
+    if(m > n) m = n;                                                           \
+    memcpy(ptr, p, m * sizeof(obj_t));                                         \
+  }                                                                            \
+}                                                                              \
+                                                                               \
+/* Overwrite n elements from idx with ptr */                                   \
+static inline void    FUNC ## _setn(list_t *list, size_t idx,                  \
+                                    const obj_t *ptr, size_t n) {              \
+  size_t pos = list->start + idx, m;                                           \
+  obj_t *p;                                                                    \
+  assert(list->start+idx+n <= list->end);                                      \
+  for(; n > 0; pos += m, ptr += m, n -= m) {                                   \
+    p = FUNC ## _run(list, pos, &m);                                           \
+    if(m > n) m = n;                                                           \
+    memcpy(p, ptr, m * sizeof(obj_t));                                         \
+  }                                                                            \
+}                                                                              \
+                                                                               \
+/* Add an element to the end of the list, returns its index */                 \
+static inline size_t  FUNC ## _append(list_t *list, obj_t obj) {               \
+  if(list->end == list->capacity) FUNC ## _grow(list, 1);                      \
+  else if(list->old) FUNC ## _migrate(list, mc_incr_step(sizeof(obj_t)));      \
+  list->b[list->end++] = obj;                                                  \
+  MC_STATS_MAX(FUNC, max_len, list->end - list->start);                        \
+  return list->end - list->start - 1;                                          \
+}                                                                              \
+                                                                               \
+/* Add an element to the start of the list, returns 0 */                       \
+static inline size_t  FUNC ## _prepend(list_t *list, obj_t obj) {              \
+  if(list->start == 0) FUNC ## _grow(list, 1);                                 \
+  else if(list->old) FUNC ## _migrate(list, mc_incr_step(sizeof(obj_t)));      \
+  list->b[--list->start] = obj;                                                \
+  MC_STATS_ADD(FUNC, unshifts, 1);                                             \
+  MC_STATS_MAX(FUNC, max_len, list->end - list->start);                        \
+  return 0;                                                                    \
+}                                                                              \
+                                                                               \
+/* Skip elements cut from the start that were still waiting in old */          \
+static inline void    FUNC ## _lcut_old(list_t *list) {                        \
+  if(list->old && list->lo < list->start) {                                    \
+    /* cut elements are never copied, but their old pages can go too */        \
+    size_t lo = list->start < list->hi ? list->start : list->hi;               \
+    mc_incr_release(list->old, (list->lo - list->shift) * sizeof(obj_t),       \
+                    (lo - list->shift) * sizeof(obj_t));                       \
+    list->lo = lo;                                                             \
+  }                                                                            \
+  if(list->old) FUNC ## _migrate(list, mc_incr_step(sizeof(obj_t)));           \
+}                                                                              \
+                                                                               \
+/* Drop elements cut from the end that were still waiting in old */            \
+static inline void    FUNC ## _rcut_old(list_t *list) {                        \
+  if(list->hi > list->end)                                                     \
+    list->hi = list->end > list->lo ? list->end : list->lo;                    \
+  if(list->old) FUNC ## _migrate(list, mc_incr_step(sizeof(obj_t)));           \
+}                                                                              \
+                                                                               \
+static inline obj_t   FUNC ## _lcut(list_t *list) {                            \
+  obj_t obj = FUNC ## _get(list, 0);                                           \
+  list->start++;                                                               \
+  MC_STATS_ADD(FUNC, shifts, 1);                                               \
+  FUNC ## _lcut_old(list);                                                     \
+  return obj;                                                                  \
+}                                                                              \
+                                                                               \
+static inline obj_t   FUNC ## _rcut(list_t *list) {                            \
+  obj_t obj = FUNC ## _get(list, list->end - list->start - 1);                 \
+  list->end--;                                                                 \
+  FUNC ## _rcut_old(list);                                                     \
+  return obj;                                                                  \
+}                                                                              \
+                                                                               \
+/* Add n elements to the end of the list, returns the index of the first */    \
+static inline size_t  FUNC ## _push(list_t *list, obj_t *ptr, size_t n) {      \
+  size_t idx = list->end - list->start;                                        \
+  if(list->end + n > list->capacity) FUNC ## _grow(list, n);                   \
+  if(list->old) FUNC ## _migrate_n(list, n);                                   \
+  memcpy(list->b + list->end, ptr, n * sizeof(obj_t));                         \
+  list->end += n;                                                              \
+  MC_STATS_MAX(FUNC, max_len, list->end - list->start);                        \
+  return idx;                                                                  \
+}                                                                              \
+                                                                               \
+/* Add n elements to the start of the list, returns 0 */                       \
+static inline size_t  FUNC ## _unshift(list_t *list, obj_t *ptr, size_t n) {   \
+  if(list->start < n) FUNC ## _grow(list, n);                                  \
+  if(list->old) FUNC ## _migrate_n(list, n);                                   \
+  list->start -= n;                                                            \
+  memcpy(list->b + list->start, ptr, n * sizeof(obj_t));                       \
+  MC_STATS_ADD(FUNC, unshifts, 1);                                             \
+  MC_STATS_MAX(FUNC, max_len, list->end - list->start);                        \
+  return 0;                                                                    \
+}                                                                              \
+                                                                               \
+/* Remove n elements from the end of the list */                               \
+/* @param ptr if != NULL, removed elements are copied to ptr */                \
+static inline void    FUNC ## _pop(list_t *list, obj_t *ptr, size_t n) {       \
+  assert(list->start+n <= list->end);                                          \
+  if(ptr) FUNC ## _getn(list, list->end - list->start - n, ptr, n);            \
+  list->end -= n;                                                              \
+  FUNC ## _rcut_old(list);                                                     \
+}                                                                              \
+                                                                               \
+/* Remove n elements from the start of the list */                             \
+/* @param ptr if != NULL, removed elements are copied to ptr */                \
+static inline void    FUNC ## _shift(list_t *list, obj_t *ptr, size_t n) {     \
+  assert(list->start+n <= list->end);                                          \
+  if(ptr) FUNC ## _getn(list, 0, ptr, n);                                      \
+  list->start += n;                                                            \
+  MC_STATS_ADD(FUNC, shifts, 1);                                               \
+  FUNC ## _lcut_old(list);                                                     \
+}
 
 #endif /* MADCROW_LIST_H_ */
@@ -0,0 +1,170 @@
+#ifndef MADCROW_MMAP_H_
+#define MADCROW_MMAP_H_
+
+#include <stdlib.h>
+#include <stdint.h> // SIZE_MAX
+#include <string.h> // memcpy
+#include <unistd.h> // sysconf
+#include <sys/mman.h>
+
+//
+// madcrow_mmap.h
+// Allocator for madcrow_buffer2 / madcrow_list2 that uses malloc for small
+// allocations and anonymous mmap for allocations of MC_MMAP_THRESHOLD bytes or
+// more. Mapped allocations grow with mremap(MREMAP_MAYMOVE), which moves page
+// table entries rather than copying, so growing a multi-GB buffer does not
+// scale with its size or need old and new copies in memory at once.
+//
+// mremap is Linux only and needs _GNU_SOURCE defined before the first
+// #include. Otherwise growing a mapping falls back to mmap + memcpy + munmap.
+//
+// Example:
+//
+//   #define _GNU_SOURCE
+//   #define MC_MMAP_THRESHOLD (1UL<<30) // optional, default 64MB
+//   #include "madcrow_buffer.h"
+//   #include "madcrow_list.h"
+//   #include "madcrow_mmap.h"
+//
+//   madcrow_buffer_mmap(kbuf,KmerBuffer,uint64_t)
+//   madcrow_list_mmap(klist,KmerList,uint64_t)
+//   madcrow_buffer_mmap_wipe(bmap,Bitmap,uint64_t) // kept zeroed, see below
+//
+// Or pass mc_mmap_calloc, mc_mmap_realloc, mc_mmap_free to madcrow_buffer2()
+// or madcrow_list2() directly.
+//
+
+#ifndef MC_MMAP_THRESHOLD
+  #define MC_MMAP_THRESHOLD (1UL<<26)
+#endif
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+  #define MAP_ANONYMOUS MAP_ANON
+#endif
+
+// Header before every allocation, one cache line to keep the data aligned
+typedef struct {
+  size_t mapsize; // bytes mapped including header, 0 if malloc'd
+  size_t size; // bytes requested
+  size_t filemap; // 1 if a private file mapping (see madcrow_save.h)
+  char pad[64 - 3*sizeof(size_t)];
+} mc_mmap_hdr_t;
+
+#define mc_mmap_hdr(ptr) ((mc_mmap_hdr_t*)(ptr) - 1)
+
+static inline void* mc_mmap_calloc(size_t n, size_t size)
+ __attribute__((unused));
+static inline void* mc_mmap_realloc(void *ptr, size_t size)
+ __attribute__((unused));
+static inline void  mc_mmap_free(void *ptr)
+ __attribute__((unused));
+
+// Round up to a whole number of pages
+static inline size_t mc_mmap_pageround(size_t n) {
+  size_t pagesize = (size_t)sysconf(_SC_PAGESIZE);
+  return (n + pagesize - 1) & ~(pagesize - 1);
+}
+
+// Returns a new zeroed mapping with room for size bytes, or NULL
+static inline mc_mmap_hdr_t* mc_mmap_map(size_t size) {
+  size_t mapsize = mc_mmap_pageround(sizeof(mc_mmap_hdr_t) + size);
+  void *mem = mmap(NULL, mapsize, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(mem == MAP_FAILED) return NULL;
+  mc_mmap_hdr_t *hdr = mem;
+  hdr->mapsize = mapsize;
+  hdr->size = size;
+  hdr->filemap = 0;
+  return hdr;
+}
+
+static inline void* mc_mmap_calloc(size_t n, size_t size) {
+  mc_mmap_hdr_t *hdr;
+  if(size && n > (SIZE_MAX - sizeof(mc_mmap_hdr_t)) / size) return NULL;
+  size *= n;
+  if(size >= MC_MMAP_THRESHOLD) hdr = mc_mmap_map(size);
+  else if((hdr = calloc(1, sizeof(mc_mmap_hdr_t) + size)) != NULL) {
+    hdr->mapsize = 0;
+    hdr->size = size;
+    hdr->filemap = 0;
+  }
+  return hdr ? hdr + 1 : NULL;
+}
+
+static inline void* mc_mmap_realloc(void *ptr, size_t size) {
+  if(ptr == NULL) return mc_mmap_calloc(1, size);
+  mc_mmap_hdr_t *hdr = mc_mmap_hdr(ptr), *newhdr;
+
+  if(hdr->filemap) {
+    // Mapped from a file: pages past the end of the file cannot be used, so
+    // copy out to an anonymous mapping or the heap
+    if(size <= hdr->size) { hdr->size = size; return ptr; }
+    if((newhdr = mc_mmap_calloc(1, size)) == NULL) return NULL;
+    newhdr = mc_mmap_hdr(newhdr);
+    memcpy(newhdr + 1, hdr + 1, hdr->size);
+    munmap(hdr, hdr->mapsize);
+    return newhdr + 1;
+  }
+
+  if(hdr->mapsize == 0 && size < MC_MMAP_THRESHOLD) {
+    newhdr = realloc(hdr, sizeof(mc_mmap_hdr_t) + size);
+    if(newhdr == NULL) return NULL;
+    newhdr->size = size;
+    return newhdr + 1;
+  }
+
+  if(hdr->mapsize == 0) {
+    // Crossed the threshold: move from the heap to a mapping
+    if((newhdr = mc_mmap_map(size)) == NULL) return NULL;
+    memcpy(newhdr + 1, hdr + 1, hdr->size < size ? hdr->size : size);
+    free(hdr);
+    return newhdr + 1;
+  }
+
+  size_t mapsize = mc_mmap_pageround(sizeof(mc_mmap_hdr_t) + size);
+
+  if(mapsize != hdr->mapsize) {
+    #if defined(__linux__) && defined(MREMAP_MAYMOVE)
+      newhdr = mremap(hdr, hdr->mapsize, mapsize, MREMAP_MAYMOVE);
+      if(newhdr == MAP_FAILED) return NULL;
+      newhdr->mapsize = mapsize;
+    #else
+      if(mapsize < hdr->mapsize) {
+        munmap((char*)hdr + mapsize, hdr->mapsize - mapsize);
+        hdr->mapsize = mapsize;
+        newhdr = hdr;
+      } else {
+        if((newhdr = mc_mmap_map(size)) == NULL) return NULL;
+        memcpy(newhdr + 1, hdr + 1, hdr->size);
+        munmap(hdr, hdr->mapsize);
+      }
+    #endif
+    hdr = newhdr;
+  }
+
+  hdr->size = size;
+  return hdr + 1;
+}
+
+static inline void mc_mmap_free(void *ptr) {
+  if(ptr == NULL) return;
+  mc_mmap_hdr_t *hdr = mc_mmap_hdr(ptr);
+  if(hdr->mapsize) munmap(hdr, hdr->mapsize);
+  else free(hdr);
+}
+
+#define madcrow_buffer_mmap(FUNC,buf_t,obj_t)                                  \
+        madcrow_buffer2(FUNC,buf_t,obj_t,mc_mmap_calloc,mc_mmap_realloc,       \
+                        mc_mmap_free,MC_INIT_MEM_UNDEF)
+
+// Zeroed buffer: growth past the threshold gets fresh zero pages from mremap
+// and large resets give pages back with madvise (MC_INIT_MEM_PAGES)
+#define madcrow_buffer_mmap_wipe(FUNC,buf_t,obj_t)                             \
+        madcrow_buffer2(FUNC,buf_t,obj_t,mc_mmap_calloc,mc_mmap_realloc,       \
+                        mc_mmap_free,MC_INIT_MEM_PAGES)
+
+#define madcrow_list_mmap(FUNC,list_t,obj_t)                                   \
+        madcrow_list2(FUNC,list_t,obj_t,mc_mmap_calloc,mc_mmap_realloc,        \
+                      mc_mmap_free)
+
+#endif /* MADCROW_MMAP_H_ */
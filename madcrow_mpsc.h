@@ -0,0 +1,106 @@
+#ifndef MADCROW_MPSC_H_
+#define MADCROW_MPSC_H_
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+//
+// madcrow_mpsc.h
+// Define a lock-free multi-producer single-consumer queue of intrusive nodes,
+// after Dmitry Vyukov's intrusive MPSC queue. Uses the node_t from
+// madcrow_linkedlist.h (or any struct with a `next` pointer), so work items
+// can move between linked lists and queues without copying. Needs C11.
+//
+// Example:
+//
+//   #include "madcrow_linkedlist.h"
+//   #include "madcrow_mpsc.h"
+//   madcrow_linkedlist(llist,LinkedList,LinkedNode,Task)
+//   madcrow_mpsc(tqueue,TaskQueue,LinkedNode)
+//
+// Creates:
+//
+//   typedef struct {
+//     _Atomic(LinkedNode*) head; // producers, own cache line
+//     LinkedNode *tail, stub;    // consumer, own cache line
+//   } TaskQueue;
+//
+//   void        tqueue_init (TaskQueue *q)
+//   void        tqueue_push (TaskQueue *q, LinkedNode *node)
+//   LinkedNode* tqueue_pop  (TaskQueue *q)
+//
+// tqueue_push is wait-free and can be called from any number of threads.
+// tqueue_pop must only be called from one thread at a time. It returns NULL if
+// the queue is empty, or if the next node is still being linked in by a
+// producer, in which case it will be returned by a later call. Nodes are
+// returned in the order their tqueue_push calls swapped them into the queue.
+//
+// While queued, node->next is accessed atomically and node->prev is unused.
+//
+
+// Access a plain node_t* field as an atomic pointer
+#define MC_ATOMIC_PTR(node_t,ptr) ((_Atomic(node_t*)*)(ptr))
+
+#define madcrow_mpsc(FUNC,queue_t,node_t)                                      \
+                                                                               \
+typedef struct {                                                               \
+  _Alignas(64) _Atomic(node_t*) head;                                          \
+  _Alignas(64) node_t *tail;                                                   \
+  node_t stub;                                                                 \
+} queue_t;                                                                     \
+                                                                               \
+/* Define functions with unused attribute in case they're not used */          \
+static inline void    FUNC ## _init(queue_t *q)                                \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _push(queue_t *q, node_t *node)                  \
+ __attribute__((unused));                                                      \
+static inline node_t* FUNC ## _pop(queue_t *q)                                 \
+ __attribute__((unused));                                                      \
+                                                                               \
+static inline void    FUNC ## _init(queue_t *q) {                              \
+  atomic_init(MC_ATOMIC_PTR(node_t, &q->stub.next), NULL);                     \
+  atomic_init(&q->head, &q->stub);                                             \
+  q->tail = &q->stub;                                                          \
+}                                                                              \
+                                                                               \
+/* Add a node to the end of the queue. Wait-free, any thread */                \
+static inline void    FUNC ## _push(queue_t *q, node_t *node) {                \
+  atomic_store_explicit(MC_ATOMIC_PTR(node_t, &node->next), NULL,              \
+                        memory_order_relaxed);                                 \
+  node_t *prev = atomic_exchange_explicit(&q->head, node,                      \
+                                          memory_order_acq_rel);               \
+  /* Between the exchange and this store the queue is briefly unlinked */      \
+  atomic_store_explicit(MC_ATOMIC_PTR(node_t, &prev->next), node,              \
+                        memory_order_release);                                 \
+}                                                                              \
+                                                                               \
+/* Remove a node from the start of the queue. Single consumer only. */         \
+/* Returns NULL if empty or the next node has not been linked in yet */        \
+static inline node_t* FUNC ## _pop(queue_t *q) {                               \
+  node_t *tail = q->tail, *head;                                               \
+  node_t *next = atomic_load_explicit(MC_ATOMIC_PTR(node_t, &tail->next),      \
+                                      memory_order_acquire);                   \
+  if(tail == &q->stub) {                                                       \
+    if(next == NULL) return NULL;                                              \
+    q->tail = tail = next;                                                     \
+    next = atomic_load_explicit(MC_ATOMIC_PTR(node_t, &next->next),            \
+                                memory_order_acquire);                         \
+  }                                                                            \
+  if(next) {                                                                   \
+    q->tail = next;                                                            \
+    return tail;                                                               \
+  }                                                                            \
+  head = atomic_load_explicit(&q->head, memory_order_acquire);                 \
+  if(tail != head) return NULL; /* a producer is mid-push */                   \
+  /* tail is the last node: re-insert the stub behind it so it can be taken */ \
+  FUNC ## _push(q, &q->stub);                                                  \
+  next = atomic_load_explicit(MC_ATOMIC_PTR(node_t, &tail->next),              \
+                              memory_order_acquire);                           \
+  if(next) {                                                                   \
+    q->tail = next;                                                            \
+    return tail;                                                               \
+  }                                                                            \
+  return NULL;                                                                 \
+}                                                                              \
+
+#endif /* MADCROW_MPSC_H_ */
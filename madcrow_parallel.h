@@ -0,0 +1,385 @@
+#ifndef MADCROW_PARALLEL_H_
+#define MADCROW_PARALLEL_H_
+
+#include <stdlib.h>
+#include <string.h> // memcpy
+#include <stdint.h> // uintptr_t
+#include <unistd.h> // sysconf
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+//
+// madcrow_parallel.h
+// A small pthread worker pool, and parallel for-each, reduce and fill over the
+// elements of a buffer (b[0..len)) or list (b[start..end)). The range is cut
+// into chunks of about MC_PARALLEL_CHUNK bytes whose boundaries fall on cache
+// lines where the element size allows, so no two threads write to the same
+// line. Each thread is given an equal run of chunks; a thread that finishes
+// its own run takes chunks from the others' runs, so uneven work per element
+// is balanced out. The calling thread works too. Link with -pthread, needs C11.
+//
+// Example:
+//
+//   #include "madcrow_buffer.h"
+//   #include "madcrow_parallel.h"
+//
+//   madcrow_buffer(dbuf,DoubleBuffer,double)
+//   madcrow_buffer_parallel(dbuf,DoubleBuffer,double)
+//
+//   static void scale(double *ptr, size_t n, size_t idx, void *ctx) {
+//     for(size_t i = 0; i < n; i++) ptr[i] *= *(double*)ctx;
+//   }
+//
+//   mc_pool_t pool;
+//   mc_pool_alloc(&pool, 0); // 0 => one thread per online CPU
+//   dbuf_parallel_for(&pool, &buf, scale, &factor);
+//   mc_pool_dealloc(&pool);
+//
+// Creates:
+//
+//   void dbuf_parallel_for    (mc_pool_t *pool, DoubleBuffer *buf,
+//                              void (*fn)(double *ptr, size_t n, size_t idx,
+//                                         void *ctx),
+//                              void *ctx)
+//   int  dbuf_parallel_reduce (mc_pool_t *pool, const DoubleBuffer *buf,
+//                              void *acc, size_t accsize,
+//                              void (*fold)(void *acc, const double *ptr,
+//                                           size_t n, size_t idx, void *ctx),
+//                              void (*merge)(void *acc, const void *part,
+//                                            void *ctx),
+//                              void *ctx)
+//   void dbuf_parallel_fill   (mc_pool_t *pool, DoubleBuffer *buf, double obj)
+//
+// fn is called on runs of n elements starting at ptr, which is element idx of
+// the container (relative to start for a list), from any thread in the pool.
+//
+// _parallel_reduce gives each thread its own copy of the accsize bytes at
+// acc, which should hold the identity value (e.g. zero for a sum), folds
+// chunks into the copies and then merges each copy into acc on the calling
+// thread. Which chunks end up in which copy varies between runs, so merge
+// should be associative and commutative. Returns 0, or -1 if the copies could
+// not be allocated.
+//
+// A NULL pool runs everything on the calling thread. A pool runs one job at a
+// time and should only be used from one thread. Set pool.chunk_bytes to change
+// the chunk size for that pool.
+//
+// Pool on its own:
+//
+//   int  mc_pool_alloc   (mc_pool_t *pool, size_t nthreads)
+//   void mc_pool_dealloc (mc_pool_t *pool)
+//   void mc_pool_run     (mc_pool_t *pool, size_t n, size_t chunk, size_t off,
+//                         mc_pool_f f, void *arg)
+//
+// mc_pool_alloc starts up to nthreads-1 workers (the caller is the last
+// thread) and returns 0, or -1 with errno set if out of memory. mc_pool_run
+// calls f(arg, start, end, thread) on every chunk of [0,n) and returns once
+// they are all done. Chunks are `chunk` long, except the first which is
+// `chunk - off` long.
+//
+
+// Bytes per chunk for parallel functions
+#ifndef MC_PARALLEL_CHUNK
+  #define MC_PARALLEL_CHUNK 65536
+#endif
+
+#ifndef MC_CACHE_LINE
+  #define MC_CACHE_LINE 64
+#endif
+
+typedef void (*mc_pool_f)(void *arg, size_t start, size_t end, size_t thread);
+
+// One thread's run of chunks, on its own cache line
+typedef struct {
+  _Alignas(MC_CACHE_LINE) _Atomic size_t next; // next chunk to take
+  size_t end; // end of this run
+} mc_pool_queue_t;
+
+typedef struct mc_pool_t mc_pool_t;
+
+typedef struct {
+  mc_pool_t *pool;
+  size_t id;
+} mc_pool_worker_t;
+
+struct mc_pool_t {
+  size_t nthreads; // workers + the calling thread
+  size_t chunk_bytes; // 0 => MC_PARALLEL_CHUNK
+  pthread_t *threads;
+  mc_pool_worker_t *workers;
+  mc_pool_queue_t *queues;
+  void *qmem; // pointer returned by calloc for queues
+  pthread_mutex_t lock;
+  pthread_cond_t start, done;
+  size_t gen; // incremented for each job
+  size_t running; // workers still on the current job
+  int quit;
+  // current job
+  mc_pool_f f;
+  void *arg;
+  size_t n, chunk, off;
+};
+
+static inline int   mc_pool_alloc(mc_pool_t *pool, size_t nthreads)
+ __attribute__((unused));
+static inline void  mc_pool_dealloc(mc_pool_t *pool)
+ __attribute__((unused));
+static inline void  mc_pool_run(mc_pool_t *pool, size_t n, size_t chunk,
+                                size_t off, mc_pool_f f, void *arg)
+ __attribute__((unused));
+
+// Take chunks from this thread's run, then from everyone else's
+static inline void  mc_pool_work(mc_pool_t *pool, size_t id) {
+  size_t t, c, start, end, nt = pool->nthreads;
+  for(t = 0; t < nt; t++) {
+    mc_pool_queue_t *q = &pool->queues[(id + t) % nt];
+    while((c = atomic_fetch_add_explicit(&q->next, 1, memory_order_relaxed))
+          < q->end) {
+      start = c * pool->chunk;
+      start = start < pool->off ? 0 : start - pool->off;
+      end = (c+1) * pool->chunk - pool->off;
+      pool->f(pool->arg, start, end < pool->n ? end : pool->n, id);
+    }
+  }
+}
+
+static inline void* mc_pool_worker(void *arg) {
+  mc_pool_worker_t *w = arg;
+  mc_pool_t *pool = w->pool;
+  size_t gen = 0;
+  pthread_mutex_lock(&pool->lock);
+  while(1) {
+    while(pool->gen == gen && !pool->quit)
+      pthread_cond_wait(&pool->start, &pool->lock);
+    if(pool->quit) break;
+    gen = pool->gen;
+    pthread_mutex_unlock(&pool->lock);
+    mc_pool_work(pool, w->id);
+    pthread_mutex_lock(&pool->lock);
+    if(--pool->running == 0) pthread_cond_signal(&pool->done);
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+static inline int   mc_pool_alloc(mc_pool_t *pool, size_t nthreads) {
+  size_t t;
+  memset(pool, 0, sizeof(mc_pool_t));
+  if(nthreads == 0) {
+    #ifdef _SC_NPROCESSORS_ONLN
+      long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+      nthreads = ncpus > 0 ? (size_t)ncpus : 1;
+    #else
+      nthreads = 1;
+    #endif
+  }
+  pool->threads = calloc(nthreads, sizeof(pthread_t));
+  pool->workers = calloc(nthreads, sizeof(mc_pool_worker_t));
+  pool->qmem = calloc(1, (MC_CACHE_LINE-1) + nthreads*sizeof(mc_pool_queue_t));
+  if(!pool->threads || !pool->workers || !pool->qmem) {
+    free(pool->threads); free(pool->workers); free(pool->qmem);
+    memset(pool, 0, sizeof(mc_pool_t));
+    errno = ENOMEM;
+    return -1;
+  }
+  pool->queues = (mc_pool_queue_t*)(((uintptr_t)pool->qmem + MC_CACHE_LINE-1) &
+                                    ~(uintptr_t)(MC_CACHE_LINE-1));
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->start, NULL);
+  pthread_cond_init(&pool->done, NULL);
+  // thread 0 is the caller, run with however many workers could be started
+  pool->nthreads = 1;
+  for(t = 1; t < nthreads; t++) {
+    pool->workers[t].pool = pool;
+    pool->workers[t].id = t;
+    if(pthread_create(&pool->threads[t], NULL, mc_pool_worker,
+                      &pool->workers[t]) != 0) break;
+    pool->nthreads++;
+  }
+  return 0;
+}
+
+static inline void  mc_pool_dealloc(mc_pool_t *pool) {
+  size_t t;
+  if(pool->threads == NULL) return;
+  pthread_mutex_lock(&pool->lock);
+  pool->quit = 1;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+  for(t = 1; t < pool->nthreads; t++) pthread_join(pool->threads[t], NULL);
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->start);
+  pthread_cond_destroy(&pool->done);
+  free(pool->threads); free(pool->workers); free(pool->qmem);
+  memset(pool, 0, sizeof(mc_pool_t));
+}
+
+static inline void  mc_pool_run(mc_pool_t *pool, size_t n, size_t chunk,
+                                size_t off, mc_pool_f f, void *arg)
+{
+  size_t t, nt, nchunks;
+  if(n == 0) return;
+  if(chunk == 0) chunk = 1;
+  off %= chunk;
+  nchunks = (n + off + chunk - 1) / chunk;
+  if(pool == NULL || pool->nthreads < 2 || nchunks < 2) {
+    f(arg, 0, n, 0);
+    return;
+  }
+  nt = pool->nthreads < nchunks ? pool->nthreads : nchunks;
+  pthread_mutex_lock(&pool->lock);
+  pool->f = f;
+  pool->arg = arg;
+  pool->n = n;
+  pool->chunk = chunk;
+  pool->off = off;
+  // equal runs of chunks, empty for threads beyond nchunks
+  for(t = 0; t < pool->nthreads; t++) {
+    size_t s = t < nt ? t * nchunks / nt : nchunks;
+    atomic_store_explicit(&pool->queues[t].next, s, memory_order_relaxed);
+    pool->queues[t].end = t < nt ? (t+1) * nchunks / nt : nchunks;
+  }
+  pool->running = pool->nthreads - 1;
+  pool->gen++;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+  mc_pool_work(pool, 0);
+  pthread_mutex_lock(&pool->lock);
+  while(pool->running > 0) pthread_cond_wait(&pool->done, &pool->lock);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+// Run f over n elements of size bytes at ptr, in chunks of about chunk_bytes
+// that start on cache lines where possible
+static inline void  mc_pool_run_array(mc_pool_t *pool, const void *ptr,
+                                      size_t n, size_t size, mc_pool_f f,
+                                      void *arg)
+{
+  size_t g = size, b = MC_CACHE_LINE, r, unit, chunk, k;
+  size_t bytes = pool && pool->chunk_bytes ? pool->chunk_bytes
+                                           : MC_PARALLEL_CHUNK;
+  while(b) { r = g % b; g = b; b = r; } // g = gcd(size, line)
+  unit = MC_CACHE_LINE / g; // elements in a whole number of cache lines
+  chunk = (bytes / (size * unit)) * unit;
+  if(chunk == 0) chunk = unit;
+  // first element that starts a cache line
+  for(k = 0; k < unit && ((uintptr_t)ptr + k*size) % MC_CACHE_LINE; k++) {}
+  mc_pool_run(pool, n, chunk, k < unit ? (chunk - k) % chunk : 0, f, arg);
+}
+
+#define mc_parallel_buf_ptr(c) ((c)->b)
+#define mc_parallel_buf_len(c) ((c)->len)
+#define mc_parallel_list_ptr(c) ((c)->b + (c)->start)
+#define mc_parallel_list_len(c) ((c)->end - (c)->start)
+
+#define madcrow_buffer_parallel(FUNC,buf_t,obj_t) \
+        madcrow_buffer_parallel2(FUNC,buf_t,obj_t,calloc,free)
+
+#define madcrow_list_parallel(FUNC,list_t,obj_t) \
+        madcrow_list_parallel2(FUNC,list_t,obj_t,calloc,free)
+
+#define madcrow_buffer_parallel2(FUNC,buf_t,obj_t,mc_alloc,mc_free)            \
+        madcrow_parallel(FUNC,buf_t,obj_t,mc_alloc,mc_free,                    \
+                         mc_parallel_buf_ptr,mc_parallel_buf_len)
+
+#define madcrow_list_parallel2(FUNC,list_t,obj_t,mc_alloc,mc_free)             \
+        madcrow_parallel(FUNC,list_t,obj_t,mc_alloc,mc_free,                   \
+                         mc_parallel_list_ptr,mc_parallel_list_len)
+
+//
+// Container functions, PTR(c) and LEN(c) give the elements
+//
+#define madcrow_parallel(FUNC,cont_t,obj_t,mc_alloc,mc_free,PTR,LEN)           \
+                                                                               \
+typedef struct {                                                               \
+  obj_t *ptr;                                                                  \
+  void (*fn)(obj_t *ptr, size_t n, size_t idx, void *ctx);                     \
+  void (*fold)(void *acc, const obj_t *ptr, size_t n, size_t idx, void *ctx);  \
+  void *ctx;                                                                   \
+  char *accs; /* one accumulator per thread */                                 \
+  size_t stride;                                                               \
+  obj_t obj;                                                                   \
+} FUNC ## _pjob_t;                                                             \
+                                                                               \
+static inline void    FUNC ## _parallel_for(mc_pool_t *pool, cont_t *c,        \
+                        void (*fn)(obj_t *ptr, size_t n, size_t idx,           \
+                                   void *ctx),                                 \
+                        void *ctx)                                             \
+ __attribute__((unused));                                                      \
+static inline int     FUNC ## _parallel_reduce(mc_pool_t *pool,                \
+                        const cont_t *c, void *acc, size_t accsize,            \
+                        void (*fold)(void *acc, const obj_t *ptr, size_t n,    \
+                                     size_t idx, void *ctx),                   \
+                        void (*merge)(void *acc, const void *part, void *ctx), \
+                        void *ctx)                                             \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _parallel_fill(mc_pool_t *pool, cont_t *c,       \
+                                             obj_t obj)                        \
+ __attribute__((unused));                                                      \
+                                                                               \
+static inline void    FUNC ## _pjob_for(void *arg, size_t start, size_t end,   \
+                                        size_t thread) {                       \
+  FUNC ## _pjob_t *job = arg;                                                  \
+  (void)thread;                                                                \
+  job->fn(job->ptr + start, end - start, start, job->ctx);                     \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _pjob_fold(void *arg, size_t start, size_t end,  \
+                                         size_t thread) {                      \
+  FUNC ## _pjob_t *job = arg;                                                  \
+  job->fold(job->accs + thread * job->stride, job->ptr + start, end - start,   \
+            start, job->ctx);                                                  \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _pjob_fill(void *arg, size_t start, size_t end,  \
+                                         size_t thread) {                      \
+  FUNC ## _pjob_t *job = arg;                                                  \
+  size_t i;                                                                    \
+  (void)thread;                                                                \
+  for(i = start; i < end; i++) job->ptr[i] = job->obj;                         \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _parallel_for(mc_pool_t *pool, cont_t *c,        \
+                        void (*fn)(obj_t *ptr, size_t n, size_t idx,           \
+                                   void *ctx),                                 \
+                        void *ctx)                                             \
+{                                                                              \
+  FUNC ## _pjob_t job = {.ptr = PTR(c), .fn = fn, .ctx = ctx};                 \
+  mc_pool_run_array(pool, job.ptr, LEN(c), sizeof(obj_t),                      \
+                    FUNC ## _pjob_for, &job);                                  \
+}                                                                              \
+                                                                               \
+static inline int     FUNC ## _parallel_reduce(mc_pool_t *pool,                \
+                        const cont_t *c, void *acc, size_t accsize,            \
+                        void (*fold)(void *acc, const obj_t *ptr, size_t n,    \
+                                     size_t idx, void *ctx),                   \
+                        void (*merge)(void *acc, const void *part, void *ctx), \
+                        void *ctx)                                             \
+{                                                                              \
+  FUNC ## _pjob_t job = {.ptr = PTR(c), .fold = fold, .ctx = ctx};             \
+  size_t t, nt = pool ? pool->nthreads : 1;                                    \
+  if(nt < 2) {                                                                 \
+    if(LEN(c)) fold(acc, job.ptr, LEN(c), 0, ctx);                             \
+    return 0;                                                                  \
+  }                                                                            \
+  /* accumulators on separate cache lines */                                   \
+  job.stride = (accsize + MC_CACHE_LINE-1) & ~(size_t)(MC_CACHE_LINE-1);       \
+  if((job.accs = mc_alloc(nt, job.stride)) == NULL) return -1;                 \
+  for(t = 0; t < nt; t++) memcpy(job.accs + t * job.stride, acc, accsize);     \
+  mc_pool_run_array(pool, job.ptr, LEN(c), sizeof(obj_t),                      \
+                    FUNC ## _pjob_fold, &job);                                 \
+  for(t = 0; t < nt; t++) merge(acc, job.accs + t * job.stride, ctx);          \
+  mc_free(job.accs);                                                           \
+  return 0;                                                                    \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _parallel_fill(mc_pool_t *pool, cont_t *c,       \
+                                             obj_t obj)                        \
+{                                                                              \
+  FUNC ## _pjob_t job = {.ptr = PTR(c), .obj = obj};                           \
+  mc_pool_run_array(pool, job.ptr, LEN(c), sizeof(obj_t),                      \
+                    FUNC ## _pjob_fill, &job);                                 \
+}                                                                              \
+
+#endif /* MADCROW_PARALLEL_H_ */
@@ -0,0 +1,335 @@
+#ifndef MADCROW_RING_H_
+#define MADCROW_RING_H_
+
+#include <stdlib.h>
+#include <string.h> // memset
+#include <assert.h>
+#include <unistd.h> // ssize_t
+#include <inttypes.h> // uint64_t
+
+#include "madcrow_stats.h"
+
+//
+// madcrow_ring.h
+// Define a circular buffer with the same functions as madcrow_list.h. Capacity
+// is always a power of two and indices wrap with a mask, so elements are never
+// moved to make space at either end. Growing only happens when the ring is
+// full, at which point the wrapped part is moved to unwrap the data.
+//
+// Example:
+//
+//   #include "madcrow_ring.h"
+//   madcrow_ring(cring,CharRing,char)
+//
+// Creates:
+//
+//   typedef struct {
+//     char *b;
+//     size_t head, len, capacity;
+//   } CharRing;
+//
+//   CharRing* cring_new     (size_t capacity)
+//   void      cring_destroy (CharRing *ring)
+//   void      cring_alloc   (CharRing *ring, size_t capacity)
+//   void      cring_dealloc (CharRing *ring)
+//   void      cring_reset   (CharRing *ring)
+//   void      cring_capacity(CharRing *ring, size_t capacity)
+//   size_t    cring_len     (const CharRing *ring)
+//
+// Pass object:
+//   size_t    cring_prepend (CharRing *ring, char obj)
+//   size_t    cring_append  (CharRing *ring, char obj)
+//   char      cring_lcut    (CharRing *ring)
+//   char      cring_rcut    (CharRing *ring)
+//   char      cring_get     (CharRing *ring, size_t idx)
+//   void      cring_set     (CharRing *ring, size_t idx, char obj)
+//
+// Pass pointers:
+//   void      cring_getn    (CharRing *ring, size_t idx, char *ptr, size_t n)
+//   void      cring_setn    (CharRing *ring, size_t idx,
+//                            char const *ptr, size_t n)
+//   char*     cring_getptr  (CharRing *ring, size_t idx)
+//
+//   size_t    cring_push    (CharRing *ring, char const *ptr, size_t n)
+//   void      cring_pop     (CharRing *ring, char *ptr, size_t n)
+//   size_t    cring_unshift (CharRing *ring, char const *ptr, size_t n)
+//   void      cring_shift   (CharRing *ring, char *ptr, size_t n)
+//
+//   void      cring_copy    (CharRing *dst, const CharRing *src)
+//
+//  CharRing cring = madcrow_ring_init;
+//  madcrow_ring_verify(&cring);
+//
+// Note: pointers returned by cring_getptr() are only valid for the element
+// requested, the next element may have wrapped to the start of the array.
+//
+
+// Round a number up to the nearest number that is a power of two
+#ifndef roundup64
+  #define roundup64(x) roundup64(x)
+  static inline uint64_t roundup64(uint64_t x) {
+    return (--x, x|=x>>1, x|=x>>2, x|=x>>4, x|=x>>8, x|=x>>16, x|=x>>32, ++x);
+  }
+#endif
+
+#define madcrow_ring_init {.b = NULL, .head = 0, .len = 0, .capacity = 0}
+
+#define madcrow_ring_verify(ring) do {                                         \
+  assert((ring)->len <= (ring)->capacity);                                     \
+  assert(((ring)->capacity & ((ring)->capacity - 1)) == 0);                    \
+  assert((ring)->capacity == 0 || (ring)->head < (ring)->capacity);            \
+  assert((ring)->capacity == 0 || (ring)->b != NULL);                          \
+} while(0)
+
+#define madcrow_ring(FUNC,ring_t,obj_t) \
+        madcrow_ring2(FUNC,ring_t,obj_t,calloc,realloc,free)
+
+// MACROs
+#define mdc_ring_getptr(r,idx) \
+        ((r)->b + (((r)->head + (idx)) & ((r)->capacity - 1)))
+#define mdc_ring_get(r,idx) (*mdc_ring_getptr(r,idx))
+#define mdc_ring_len(r) ((r)->len)
+
+#define madcrow_ring2(FUNC,ring_t,obj_t,mc_alloc,mc_realloc,mc_free)           \
+                                                                               \
+typedef struct {                                                               \
+  obj_t *b;                                                                    \
+  size_t head, len, capacity;                                                  \
+} ring_t;                                                                      \
+                                                                               \
+MC_STATS_DEFINE(FUNC)                                                          \
+                                                                               \
+/* Define functions with unused attribute in case they're not used */          \
+static inline ring_t* FUNC ## _new(size_t capacity)                            \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _destroy(ring_t *ring)                           \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _alloc(ring_t *ring, size_t capacity)            \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _dealloc(ring_t *ring)                           \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _capacity(ring_t *ring, size_t cap)              \
+ __attribute__((unused));                                                      \
+static inline size_t  FUNC ## _push(ring_t *ring, obj_t const *ptr, size_t n)  \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _pop(ring_t *ring, obj_t *ptr, size_t n)         \
+ __attribute__((unused));                                                      \
+static inline size_t  FUNC ## _unshift(ring_t *ring, obj_t const *ptr, size_t n)\
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _shift(ring_t *ring, obj_t *ptr, size_t n)       \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _reset(ring_t *ring)                             \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _copy(ring_t *dst, const ring_t *src)            \
+ __attribute__((unused));                                                      \
+static inline size_t  FUNC ## _len(const ring_t *ring)                         \
+ __attribute__((unused));                                                      \
+static inline obj_t   FUNC ## _get(ring_t *ring, size_t idx)                   \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _set(ring_t *ring, size_t idx, obj_t obj)        \
+ __attribute__((unused));                                                      \
+static inline obj_t*  FUNC ## _getptr(ring_t *ring, size_t idx)                \
+ __attribute__((unused));                                                      \
+\
+static inline size_t  FUNC ## _prepend(ring_t *ring, obj_t obj)                \
+ __attribute__((unused));                                                      \
+static inline size_t  FUNC ## _append(ring_t *ring, obj_t obj)                 \
+ __attribute__((unused));                                                      \
+static inline obj_t   FUNC ## _lcut(ring_t *ring)                              \
+ __attribute__((unused));                                                      \
+static inline obj_t   FUNC ## _rcut(ring_t *ring)                              \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _getn(const ring_t *ring, size_t idx,            \
+                                    obj_t *ptr, size_t n)                      \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _setn(ring_t *ring, size_t idx,                  \
+                                    const obj_t *ptr, size_t n)                \
+ __attribute__((unused));                                                      \
+                                                                               \
+static inline ring_t* FUNC ## _new(size_t capacity) {                          \
+  ring_t *r = mc_alloc(1, sizeof(ring_t));                                     \
+  if(r) FUNC ## _alloc(r, capacity);                                           \
+  return r;                                                                    \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _destroy(ring_t *ring) {                         \
+  FUNC ## _dealloc(ring);                                                      \
+  mc_free(ring);                                                               \
+}                                                                              \
+                                                                               \
+static inline size_t  FUNC ## _len(const ring_t *ring) {                       \
+  madcrow_ring_verify(ring);                                                   \
+  return ring->len;                                                            \
+}                                                                              \
+                                                                               \
+static inline obj_t*  FUNC ## _getptr(ring_t *ring, size_t idx) {              \
+  madcrow_ring_verify(ring);                                                   \
+  assert(idx < ring->len);                                                     \
+  return mdc_ring_getptr(ring, idx);                                           \
+}                                                                              \
+                                                                               \
+static inline obj_t   FUNC ## _get(ring_t *ring, size_t idx) {                 \
+  return *FUNC ## _getptr(ring, idx);                                          \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _set(ring_t *ring, size_t idx, obj_t obj) {      \
+  *FUNC ## _getptr(ring, idx) = obj;                                           \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _alloc(ring_t *ring, size_t capacity) {          \
+  ring->capacity = capacity < 8 ? 8 : roundup64(capacity);                     \
+  ring->b = mc_alloc(ring->capacity, sizeof(obj_t));                           \
+  ring->head = ring->len = 0;                                                  \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _dealloc(ring_t *ring) {                         \
+  madcrow_ring_verify(ring);                                                   \
+  mc_free(ring->b);                                                            \
+  memset(ring, 0, sizeof(ring_t));                                             \
+}                                                                              \
+                                                                               \
+/* Grow to hold at least cap elements. If the contents wrap around the end */  \
+/* of the old array, move whichever side is shorter so they are contiguous */  \
+/* again in the new array. */                                                  \
+static inline void    FUNC ## _capacity(ring_t *ring, size_t cap) {            \
+  madcrow_ring_verify(ring);                                                   \
+  if(cap > ring->capacity) {                                                   \
+    size_t oldcap = ring->capacity;                                            \
+    cap = roundup64(cap);                                                      \
+    MC_STATS_ADD(FUNC, reallocs, 1);                                           \
+    MC_STATS_ADD(FUNC, realloc_bytes, cap * sizeof(obj_t));                    \
+    MC_STATS_MAX(FUNC, max_capacity, cap);                                     \
+    ring->b = mc_realloc(ring->b, cap * sizeof(obj_t));                        \
+    ring->capacity = cap;                                                      \
+    if(ring->head + ring->len > oldcap) {                                      \
+      size_t nhead = oldcap - ring->head, nwrap = ring->len - nhead;           \
+      if(nhead <= nwrap) {                                                     \
+        MC_STATS_ADD(FUNC, memmove_bytes, nhead * sizeof(obj_t));              \
+        memcpy(ring->b+cap-nhead, ring->b+ring->head, nhead*sizeof(obj_t));    \
+        ring->head = cap - nhead;                                              \
+      } else {                                                                 \
+        MC_STATS_ADD(FUNC, memmove_bytes, nwrap * sizeof(obj_t));              \
+        memcpy(ring->b+oldcap, ring->b, nwrap*sizeof(obj_t));                  \
+      }                                                                        \
+    }                                                                          \
+  }                                                                            \
+}                                                                              \
+                                                                               \
+/* Copy n elements out of the ring starting at position pos in ring->b */      \
+static inline void    FUNC ## _cpyout(const ring_t *ring, size_t pos,          \
+                                      obj_t *ptr, size_t n) {                  \
+  size_t n0 = ring->capacity - pos < n ? ring->capacity - pos : n;             \
+  memcpy(ptr, ring->b+pos, n0*sizeof(obj_t));                                  \
+  if(n0 < n) memcpy(ptr+n0, ring->b, (n-n0)*sizeof(obj_t));                    \
+}                                                                              \
+                                                                               \
+/* Copy n elements into the ring starting at position pos in ring->b */        \
+static inline void    FUNC ## _cpyin(ring_t *ring, size_t pos,                 \
+                                     const obj_t *ptr, size_t n) {             \
+  size_t n0 = ring->capacity - pos < n ? ring->capacity - pos : n;             \
+  memcpy(ring->b+pos, ptr, n0*sizeof(obj_t));                                  \
+  if(n0 < n) memcpy(ring->b, ptr+n0, (n-n0)*sizeof(obj_t));                    \
+}                                                                              \
+                                                                               \
+/* Add elements to the end of the ring, returns index of first added */        \
+static inline size_t  FUNC ## _push(ring_t *ring, obj_t const *ptr, size_t n) {\
+  size_t idx = ring->len;                                                      \
+  assert(ptr || !n);                                                           \
+  FUNC ## _capacity(ring, ring->len + n);                                      \
+  if(n) FUNC ## _cpyin(ring, (ring->head + ring->len) & (ring->capacity-1), ptr, n);\
+  ring->len += n;                                                              \
+  MC_STATS_MAX(FUNC, max_len, ring->len);                                      \
+  return idx;                                                                  \
+}                                                                              \
+                                                                               \
+/* Remove (and return) elements from the end of the ring */                    \
+/* @param ptr if != NULL, removed elements are copied to ptr */                \
+static inline void    FUNC ## _pop(ring_t *ring, obj_t *ptr, size_t n) {       \
+  madcrow_ring_verify(ring);                                                   \
+  assert(n <= ring->len);                                                      \
+  ring->len -= n;                                                              \
+  if(ptr && n)                                                                 \
+    FUNC ## _cpyout(ring, (ring->head + ring->len) & (ring->capacity-1), ptr, n);\
+}                                                                              \
+                                                                               \
+/* Add elements to the start of the ring */                                    \
+static inline size_t  FUNC ## _unshift(ring_t *ring, obj_t const *ptr, size_t n)\
+{                                                                              \
+  assert(ptr || !n);                                                           \
+  FUNC ## _capacity(ring, ring->len + n);                                      \
+  if(!n) return 0;                                                             \
+  ring->head = (ring->head - n) & (ring->capacity-1);                          \
+  FUNC ## _cpyin(ring, ring->head, ptr, n);                                    \
+  ring->len += n;                                                              \
+  MC_STATS_ADD(FUNC, unshifts, 1);                                             \
+  MC_STATS_MAX(FUNC, max_len, ring->len);                                      \
+  return 0;                                                                    \
+}                                                                              \
+                                                                               \
+/* Remove (and return) elements from the start of the ring */                  \
+/* @param ptr if != NULL, removed elements are copied to ptr */                \
+static inline void    FUNC ## _shift(ring_t *ring, obj_t *ptr, size_t n) {     \
+  madcrow_ring_verify(ring);                                                   \
+  assert(n <= ring->len);                                                      \
+  if(!n) return;                                                               \
+  if(ptr) FUNC ## _cpyout(ring, ring->head, ptr, n);                           \
+  ring->head = (ring->head + n) & (ring->capacity-1);                          \
+  ring->len -= n;                                                              \
+  MC_STATS_ADD(FUNC, shifts, 1);                                               \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _reset(ring_t *ring) {                           \
+  madcrow_ring_verify(ring);                                                   \
+  ring->head = ring->len = 0;                                                  \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _copy(ring_t *dst, const ring_t *src) {          \
+  madcrow_ring_verify(src);                                                    \
+  FUNC ## _capacity(dst, src->len);                                            \
+  if(src->len) FUNC ## _cpyout(src, src->head, dst->b, src->len);              \
+  dst->head = 0;                                                               \
+  dst->len = src->len;                                                         \
+  MC_STATS_MAX(FUNC, max_len, dst->len);                                       \
+  madcrow_ring_verify(dst);                                                    \
+}                                                                              \
+                                                                               \
+static inline size_t  FUNC ## _append(ring_t *ring, obj_t obj) {               \
+  return FUNC ## _push(ring, &obj, 1);                                         \
+}                                                                              \
+                                                                               \
+static inline size_t  FUNC ## _prepend(ring_t *ring, obj_t obj) {              \
+  return FUNC ## _unshift(ring, &obj, 1);                                      \
+}                                                                              \
+                                                                               \
+static inline obj_t   FUNC ## _lcut(ring_t *ring) {                            \
+  madcrow_ring_verify(ring);                                                   \
+  assert(ring->len > 0);                                                       \
+  obj_t obj = ring->b[ring->head];                                             \
+  ring->head = (ring->head + 1) & (ring->capacity-1);                          \
+  ring->len--;                                                                 \
+  MC_STATS_ADD(FUNC, shifts, 1);                                               \
+  return obj;                                                                  \
+}                                                                              \
+                                                                               \
+static inline obj_t   FUNC ## _rcut(ring_t *ring) {                            \
+  madcrow_ring_verify(ring);                                                   \
+  assert(ring->len > 0);                                                       \
+  ring->len--;                                                                 \
+  return *mdc_ring_getptr(ring, ring->len);                                    \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _getn(const ring_t *ring, size_t idx,            \
+                                    obj_t *ptr, size_t n) {                    \
+  madcrow_ring_verify(ring);                                                   \
+  assert(idx+n <= ring->len);                                                  \
+  if(n) FUNC ## _cpyout(ring, (ring->head + idx) & (ring->capacity-1), ptr, n);\
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _setn(ring_t *ring, size_t idx,                  \
+                                    const obj_t *ptr, size_t n) {              \
+  madcrow_ring_verify(ring);                                                   \
+  assert(idx+n <= ring->len);                                                  \
+  if(n) FUNC ## _cpyin(ring, (ring->head + idx) & (ring->capacity-1), ptr, n); \
+}                                                                              \
+
+#endif /* MADCROW_RING_H_ */
@@ -0,0 +1,385 @@
+#ifndef MADCROW_SAVE_H_
+#define MADCROW_SAVE_H_
+
+#include <stdlib.h>
+#include <stdio.h> // rename
+#include <string.h> // memcpy, memcmp
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h> // read, write, lseek
+#include <inttypes.h> // uint64_t
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "madcrow_mmap.h"
+
+//
+// madcrow_save.h
+// Save a buffer or list to a file and load it back. The file is a 64 byte
+// header (magic, version, sizeof(obj_t), count, checksum) followed by the
+// elements as they are in memory, written and read in MC_SAVE_BLOCK byte
+// blocks. Files are only portable between builds with the same obj_t layout
+// and byte order; sizeof(obj_t) is checked on load.
+//
+// Example:
+//
+//   #include "madcrow_buffer.h"
+//   #include "madcrow_save.h"
+//
+//   madcrow_buffer(kbuf,KmerBuffer,uint64_t)
+//   madcrow_buffer_save(kbuf,KmerBuffer,uint64_t)
+//
+//   // zero-copy loading needs the madcrow_mmap.h allocator
+//   madcrow_buffer_mmap(mbuf,KmerMap,uint64_t)
+//   madcrow_buffer_save_mmap(mbuf,KmerMap,uint64_t)
+//
+// Creates:
+//
+//   int kbuf_save     (const KmerBuffer *buf, const char *path)
+//   int kbuf_load     (KmerBuffer *buf, const char *path)
+//   int mbuf_load_mmap(KmerMap *buf, const char *path, int verify)
+//
+// Lists (madcrow_list_save / madcrow_list_save_mmap) save the elements between
+// start and end, and load into start = 0.
+//
+// _save writes to path.tmp and renames it over path once the data is synced,
+// so a crash or error never leaves a truncated file at path.
+//
+// All return 0, or -1 with errno set: EINVAL if the file is not a saved
+// container of this obj_t, EIO if the checksum does not match. _load and
+// _load_mmap replace the contents of an allocated container (or one set to
+// madcrow_buffer_init / madcrow_list_init). On failure _load leaves it empty
+// and _load_mmap leaves it unchanged.
+//
+// _load_mmap maps the file copy-on-write and points the container at the
+// elements in the mapping, so nothing is read until it is used. Writes stay in
+// memory and never reach the file. Growing the container copies the elements
+// out to a new allocation once. verify=1 reads the whole file to check the
+// checksum, verify=0 skips it. Do not use it with madcrow_buffer_mmap_wipe:
+// large resets would bring back the file contents rather than zeros.
+//
+
+// Bytes per read() / write() call
+#ifndef MC_SAVE_BLOCK
+  #define MC_SAVE_BLOCK (1UL<<20)
+#endif
+
+#define MC_SAVE_MAGIC "MCSAVE01"
+#define MC_SAVE_VERSION 1
+
+typedef struct {
+  char magic[8];
+  uint32_t version, objsize;
+  uint64_t count, checksum;
+  char pad[32];
+} mc_save_hdr_t;
+
+static inline uint64_t mc_save_checksum(uint64_t h, const void *ptr,
+                                        size_t nbytes) __attribute__((unused));
+static inline int      mc_save_file(const char *path, const void *ptr,
+                                    size_t count, size_t objsize)
+ __attribute__((unused));
+static inline int      mc_load_open(const char *path, size_t objsize,
+                                    mc_save_hdr_t *hdr) __attribute__((unused));
+static inline int      mc_load_read(int fd, void *ptr, size_t nbytes,
+                                    uint64_t checksum) __attribute__((unused));
+static inline void*    mc_load_map(const char *path, size_t objsize,
+                                   size_t *count, int verify)
+ __attribute__((unused));
+
+// Hash nbytes at ptr into h, 8 bytes at a time. When checksumming in pieces
+// every piece but the last must be a multiple of 8 bytes. Start with h = 0.
+static inline uint64_t mc_save_checksum(uint64_t h, const void *ptr,
+                                        size_t nbytes)
+{
+  const char *p = ptr;
+  uint64_t w;
+  for(; nbytes >= 8; p += 8, nbytes -= 8) {
+    memcpy(&w, p, 8);
+    h = (h ^ w) * UINT64_C(0x9E3779B97F4A7C15);
+    h ^= h >> 32;
+  }
+  if(nbytes) {
+    w = 0;
+    memcpy(&w, p, nbytes);
+    h = (h ^ w ^ ((uint64_t)nbytes << 56)) * UINT64_C(0x9E3779B97F4A7C15);
+    h ^= h >> 32;
+  }
+  return h;
+}
+
+// Checksum of nbytes at ptr, in MC_SAVE_BLOCK pieces as it was written
+static inline uint64_t mc_load_checksum(const void *ptr, size_t nbytes)
+{
+  const char *p = ptr;
+  uint64_t h = 0;
+  size_t n;
+  for(; nbytes > 0; p += n, nbytes -= n) {
+    n = nbytes < MC_SAVE_BLOCK ? nbytes : MC_SAVE_BLOCK;
+    h = mc_save_checksum(h, p, n);
+  }
+  return h;
+}
+
+// Write all nbytes, retrying short writes and EINTR. Returns 0 or -1
+static inline int      mc_save_write_all(int fd, const char *ptr, size_t nbytes)
+{
+  ssize_t w;
+  while(nbytes > 0) {
+    w = write(fd, ptr, nbytes);
+    if(w < 0 && errno == EINTR) continue;
+    if(w < 0) return -1;
+    ptr += w;
+    nbytes -= w;
+  }
+  return 0;
+}
+
+// Write count elements of objsize bytes at ptr to path. The data goes to
+// path.tmp, which is synced and then renamed over path, so path always holds
+// either the old file or the complete new one. The header is written last so
+// a partly written temporary file does not load either.
+static inline int      mc_save_file(const char *path, const void *ptr,
+                                    size_t count, size_t objsize)
+{
+  mc_save_hdr_t hdr;
+  const char *p = ptr;
+  size_t nbytes = count * objsize, n, pathlen = strlen(path);
+  char *tmp;
+  int fd, err;
+  if((tmp = malloc(pathlen + 5)) == NULL) { errno = ENOMEM; return -1; }
+  memcpy(tmp, path, pathlen);
+  memcpy(tmp + pathlen, ".tmp", 5);
+  memset(&hdr, 0, sizeof(hdr));
+  if((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+    err = errno; free(tmp); errno = err;
+    return -1;
+  }
+  if(mc_save_write_all(fd, (char*)&hdr, sizeof(hdr)) < 0) goto fail;
+  for(; nbytes > 0; p += n, nbytes -= n) {
+    n = nbytes < MC_SAVE_BLOCK ? nbytes : MC_SAVE_BLOCK;
+    hdr.checksum = mc_save_checksum(hdr.checksum, p, n);
+    if(mc_save_write_all(fd, p, n) < 0) goto fail;
+  }
+  memcpy(hdr.magic, MC_SAVE_MAGIC, sizeof(hdr.magic));
+  hdr.version = MC_SAVE_VERSION;
+  hdr.objsize = (uint32_t)objsize;
+  hdr.count = count;
+  if(lseek(fd, 0, SEEK_SET) < 0 ||
+     mc_save_write_all(fd, (char*)&hdr, sizeof(hdr)) < 0 ||
+     fsync(fd) < 0) goto fail;
+  if(close(fd) < 0) { fd = -1; goto fail; }
+  if(rename(tmp, path) < 0) { fd = -1; goto fail; }
+  free(tmp);
+  return 0;
+  fail:
+  err = errno;
+  if(fd >= 0) close(fd);
+  unlink(tmp);
+  free(tmp);
+  errno = err;
+  return -1;
+}
+
+// Check a header against the file size and element size
+static inline int      mc_load_check(const mc_save_hdr_t *hdr, size_t objsize,
+                                     size_t filesize)
+{
+  if(filesize < sizeof(mc_save_hdr_t) ||
+     memcmp(hdr->magic, MC_SAVE_MAGIC, sizeof(hdr->magic)) != 0 ||
+     hdr->version != MC_SAVE_VERSION || hdr->objsize != objsize ||
+     hdr->count > (filesize - sizeof(mc_save_hdr_t)) / objsize ||
+     hdr->count * objsize != filesize - sizeof(mc_save_hdr_t)) {
+    errno = EINVAL;
+    return -1;
+  }
+  return 0;
+}
+
+// Read all nbytes, retrying short reads and EINTR. Returns 0, or -1 with errno
+// EIO if the file ends first
+static inline int      mc_load_read_all(int fd, char *ptr, size_t nbytes)
+{
+  ssize_t r;
+  while(nbytes > 0) {
+    r = read(fd, ptr, nbytes);
+    if(r < 0 && errno == EINTR) continue;
+    if(r == 0) errno = EIO;
+    if(r <= 0) return -1;
+    ptr += r;
+    nbytes -= r;
+  }
+  return 0;
+}
+
+// Open a saved file and read its header. Returns fd positioned at the first
+// element, or -1
+static inline int      mc_load_open(const char *path, size_t objsize,
+                                    mc_save_hdr_t *hdr)
+{
+  struct stat st;
+  int fd, err;
+  if((fd = open(path, O_RDONLY)) < 0) return -1;
+  if(fstat(fd, &st) < 0) goto fail;
+  if((size_t)st.st_size < sizeof(mc_save_hdr_t)) { errno = EINVAL; goto fail; }
+  if(mc_load_read_all(fd, (char*)hdr, sizeof(mc_save_hdr_t)) < 0) goto fail;
+  if(mc_load_check(hdr, objsize, st.st_size) < 0) goto fail;
+  return fd;
+  fail:
+  err = errno; close(fd); errno = err;
+  return -1;
+}
+
+// Read nbytes into ptr in blocks, checksumming each block as it arrives.
+// Returns 0, or -1 with errno EIO if the file ends early or the data does not
+// match checksum
+static inline int      mc_load_read(int fd, void *ptr, size_t nbytes,
+                                    uint64_t checksum)
+{
+  char *p = ptr;
+  uint64_t h = 0;
+  size_t n;
+  for(; nbytes > 0; p += n, nbytes -= n) {
+    n = nbytes < MC_SAVE_BLOCK ? nbytes : MC_SAVE_BLOCK;
+    if(mc_load_read_all(fd, p, n) < 0) return -1;
+    h = mc_save_checksum(h, p, n);
+  }
+  if(h != checksum) { errno = EIO; return -1; }
+  return 0;
+}
+
+// Map a saved file copy-on-write. Returns a pointer to the elements that
+// mc_mmap_realloc / mc_mmap_free accept, or NULL
+static inline void*    mc_load_map(const char *path, size_t objsize,
+                                   size_t *count, int verify)
+{
+  struct stat st;
+  mc_save_hdr_t *hdr;
+  size_t mapsize;
+  int fd, err;
+  if((fd = open(path, O_RDONLY)) < 0) return NULL;
+  if(fstat(fd, &st) < 0) goto fail;
+  if((size_t)st.st_size < sizeof(mc_save_hdr_t)) { errno = EINVAL; goto fail; }
+  mapsize = mc_mmap_pageround(st.st_size);
+  hdr = mmap(NULL, mapsize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(hdr == MAP_FAILED) goto fail;
+  close(fd); // the mapping keeps the file open
+  if(mc_load_check(hdr, objsize, st.st_size) < 0) goto fail_unmap;
+  if(verify &&
+     mc_load_checksum(hdr + 1, hdr->count * objsize) != hdr->checksum) {
+    errno = EIO;
+    goto fail_unmap;
+  }
+  *count = hdr->count;
+  // reuse the file header as the allocation header (private page)
+  mc_mmap_hdr_t *mhdr = (mc_mmap_hdr_t*)hdr;
+  mhdr->mapsize = mapsize;
+  mhdr->size = *count * objsize;
+  mhdr->filemap = 1;
+  return mhdr + 1;
+  fail_unmap:
+  err = errno; munmap(hdr, mapsize); errno = err;
+  return NULL;
+  fail:
+  err = errno; close(fd); errno = err;
+  return NULL;
+}
+
+//
+// Container functions
+//
+
+// Empty c and make room for n elements, setting its length to n
+#define mc_save_buf_resize(FUNC,c,n) do {                                      \
+  FUNC ## _reset(c);                                                           \
+  FUNC ## _capacity(c, n);                                                     \
+  (c)->len = (n);                                                              \
+} while(0)
+
+#define mc_save_list_resize(FUNC,c,n) do {                                     \
+  FUNC ## _reset(c);                                                           \
+  (c)->start = (c)->end = 0;                                                   \
+  FUNC ## _capacity(c, n);                                                     \
+  (c)->end = (n);                                                              \
+} while(0)
+
+// Free c and point it at n elements at ptr
+#define mc_save_buf_adopt(FUNC,c,ptr,n) do {                                   \
+  FUNC ## _dealloc(c);                                                         \
+  (c)->b = (ptr);                                                              \
+  (c)->len = (c)->size = (n);                                                  \
+} while(0)
+
+#define mc_save_list_adopt(FUNC,c,ptr,n) do {                                  \
+  FUNC ## _dealloc(c);                                                         \
+  (c)->b = (ptr);                                                              \
+  (c)->start = 0;                                                              \
+  (c)->end = (c)->capacity = (n);                                              \
+} while(0)
+
+#define mc_save_buf_ptr(c) ((c)->b)
+#define mc_save_buf_len(c) ((c)->len)
+#define mc_save_list_ptr(c) ((c)->b + (c)->start)
+#define mc_save_list_len(c) ((c)->end - (c)->start)
+
+#define madcrow_buffer_save(FUNC,buf_t,obj_t)                                  \
+        madcrow_save(FUNC,buf_t,obj_t,mc_save_buf_ptr,mc_save_buf_len,         \
+                     mc_save_buf_resize)
+
+#define madcrow_list_save(FUNC,list_t,obj_t)                                   \
+        madcrow_save(FUNC,list_t,obj_t,mc_save_list_ptr,mc_save_list_len,      \
+                     mc_save_list_resize)
+
+#define madcrow_buffer_save_mmap(FUNC,buf_t,obj_t)                             \
+        madcrow_buffer_save(FUNC,buf_t,obj_t)                                  \
+        madcrow_save_mmap(FUNC,buf_t,obj_t,mc_save_buf_adopt)
+
+#define madcrow_list_save_mmap(FUNC,list_t,obj_t)                              \
+        madcrow_list_save(FUNC,list_t,obj_t)                                   \
+        madcrow_save_mmap(FUNC,list_t,obj_t,mc_save_list_adopt)
+
+// PTR(c) and LEN(c) give the elements, RESIZE(FUNC,c,n) empties c and gives
+// it n elements to read into
+#define madcrow_save(FUNC,cont_t,obj_t,PTR,LEN,RESIZE)                         \
+                                                                               \
+static inline int     FUNC ## _save(const cont_t *c, const char *path)         \
+ __attribute__((unused));                                                      \
+static inline int     FUNC ## _load(cont_t *c, const char *path)               \
+ __attribute__((unused));                                                      \
+                                                                               \
+static inline int     FUNC ## _save(const cont_t *c, const char *path) {       \
+  return mc_save_file(path, PTR(c), LEN(c), sizeof(obj_t));                    \
+}                                                                              \
+                                                                               \
+static inline int     FUNC ## _load(cont_t *c, const char *path) {             \
+  mc_save_hdr_t hdr;                                                           \
+  int fd, err;                                                                 \
+  if((fd = mc_load_open(path, sizeof(obj_t), &hdr)) < 0) return -1;            \
+  RESIZE(FUNC, c, hdr.count);                                                  \
+  if(mc_load_read(fd, PTR(c), hdr.count * sizeof(obj_t), hdr.checksum) < 0) {  \
+    err = errno;                                                               \
+    RESIZE(FUNC, c, 0);                                                        \
+    close(fd);                                                                 \
+    errno = err;                                                               \
+    return -1;                                                                 \
+  }                                                                            \
+  return close(fd);                                                            \
+}                                                                              \
+
+// ADOPT(FUNC,c,ptr,n) frees c and points it at n elements at ptr
+#define madcrow_save_mmap(FUNC,cont_t,obj_t,ADOPT)                             \
+                                                                               \
+static inline int     FUNC ## _load_mmap(cont_t *c, const char *path,          \
+                                         int verify)                           \
+ __attribute__((unused));                                                      \
+                                                                               \
+static inline int     FUNC ## _load_mmap(cont_t *c, const char *path,          \
+                                         int verify) {                         \
+  size_t count;                                                                \
+  obj_t *ptr = mc_load_map(path, sizeof(obj_t), &count, verify);               \
+  if(ptr == NULL) return -1;                                                   \
+  ADOPT(FUNC, c, ptr, count);                                                  \
+  return 0;                                                                    \
+}                                                                              \
+
+#endif /* MADCROW_SAVE_H_ */
@@ -0,0 +1,311 @@
+#ifndef MADCROW_SEARCH_H_
+#define MADCROW_SEARCH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h> // memcpy, memcmp
+
+//
+// madcrow_search.h
+// Search kernels behind the _find, _rfind, _count and _find_any functions of
+// madcrow_buffer.h and madcrow_list.h. Elements compare bitwise (memcmp), so
+// for floats -0.0 != 0.0, and struct padding must be consistent.
+//
+// 1, 2, 4 and 8 byte elements use SSE2, AVX2 or AVX-512BW kernels on x86-64,
+// picked at runtime from what the CPU supports. Other sizes and platforms use
+// a scalar loop. Compile with -DMC_SEARCH_NO_SIMD to always use scalar loops.
+//
+//   size_t mc_find    (const void *arr, size_t n, size_t objsize, const void *obj)
+//   size_t mc_rfind   (const void *arr, size_t n, size_t objsize, const void *obj)
+//   size_t mc_count   (const void *arr, size_t n, size_t objsize, const void *obj)
+//   size_t mc_find_any(const void *arr, size_t n, size_t objsize,
+//                      const void *objs, size_t nobjs)
+//
+// find/rfind/find_any return the index of the first/last match, or n if there
+// is none.
+//
+// mc_search_max caps the kernel used (0 scalar, 1 SSE2, 2 AVX2, 3 AVX-512BW),
+// e.g. to compare kernels in tests. It is per translation unit.
+//
+
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(MC_SEARCH_NO_SIMD)
+  #define MC_SEARCH_X86 1
+  #include <immintrin.h>
+#endif
+
+// find_any uses SIMD for up to this many values, a scalar loop for more
+#define MC_FIND_ANY_SIMD 8
+
+static int mc_search_max __attribute__((unused)) = 3;
+
+// Highest kernel level the CPU supports, capped by mc_search_max
+static inline int mc_search_level(void) __attribute__((unused));
+static inline int mc_search_level(void) {
+  #ifdef MC_SEARCH_X86
+    int level = 1;
+    if(__builtin_cpu_supports("avx2")) level = 2;
+    if(__builtin_cpu_supports("avx512bw")) level = 3;
+    return level < mc_search_max ? level : mc_search_max;
+  #else
+    return 0;
+  #endif
+}
+
+#define MC_LOAD_W(W,p) mc_load ## W(p)
+
+#define MC_SEARCH_LOAD(W)                                                      \
+static inline uint ## W ## _t mc_load ## W(const char *p) {                    \
+  uint ## W ## _t v;                                                           \
+  memcpy(&v, p, sizeof(v));                                                    \
+  return v;                                                                    \
+}
+
+MC_SEARCH_LOAD(8)
+MC_SEARCH_LOAD(16)
+MC_SEARCH_LOAD(32)
+MC_SEARCH_LOAD(64)
+
+//
+// Kernels for W bit elements. isa is SCALAR, SSE2, AVX2 or AVX512, each of
+// which defines MC_<isa>_LOAD(p), MC_<isa>_SET<W>(x) and MC_<isa>_EQ<W>(a,b).
+// EQ returns a bit mask with MW bits set per matching element. VB is the vector
+// width in bytes.
+//
+
+#define MC_SEARCH_SCALAR(W)                                                    \
+static inline size_t mc_find_SCALAR ## W(const char *a, size_t n,              \
+                                         uint ## W ## _t x) {                  \
+  size_t i;                                                                    \
+  for(i = 0; i < n; i++) if(MC_LOAD_W(W, a + i*(W/8)) == x) return i;          \
+  return n;                                                                    \
+}                                                                              \
+static inline size_t mc_rfind_SCALAR ## W(const char *a, size_t n,             \
+                                          uint ## W ## _t x) {                 \
+  size_t i = n;                                                                \
+  while(i > 0) if(MC_LOAD_W(W, a + --i*(W/8)) == x) return i;                  \
+  return n;                                                                    \
+}                                                                              \
+static inline size_t mc_count_SCALAR ## W(const char *a, size_t n,             \
+                                          uint ## W ## _t x) {                 \
+  size_t i, c = 0;                                                             \
+  for(i = 0; i < n; i++) c += (MC_LOAD_W(W, a + i*(W/8)) == x);                \
+  return c;                                                                    \
+}                                                                              \
+static inline size_t mc_find_any_SCALAR ## W(const char *a, size_t n,          \
+                                             const uint ## W ## _t *xs,        \
+                                             size_t k) {                       \
+  size_t i, j;                                                                 \
+  for(i = 0; i < n; i++) {                                                     \
+    uint ## W ## _t v = MC_LOAD_W(W, a + i*(W/8));                             \
+    for(j = 0; j < k; j++) if(v == xs[j]) return i;                            \
+  }                                                                            \
+  return n;                                                                    \
+}
+
+MC_SEARCH_SCALAR(8)
+MC_SEARCH_SCALAR(16)
+MC_SEARCH_SCALAR(32)
+MC_SEARCH_SCALAR(64)
+
+#define MC_SEARCH_SIMD(isa,tgt,vec_t,VB,MW,W)                                  \
+__attribute__((target(tgt)))                                                   \
+static inline size_t mc_find_ ## isa ## W(const char *a, size_t n,             \
+                                          uint ## W ## _t x) {                 \
+  const size_t V = VB/(W/8);                                                   \
+  vec_t vx = MC_ ## isa ## _SET ## W(x);                                       \
+  uint64_t m;                                                                  \
+  size_t i;                                                                    \
+  for(i = 0; i + V <= n; i += V) {                                             \
+    m = MC_ ## isa ## _EQ ## W(MC_ ## isa ## _LOAD(a + i*(W/8)), vx);          \
+    if(m) return i + __builtin_ctzll(m) / (MW);                                \
+  }                                                                            \
+  for(; i < n; i++) if(MC_LOAD_W(W, a + i*(W/8)) == x) return i;               \
+  return n;                                                                    \
+}                                                                              \
+__attribute__((target(tgt)))                                                   \
+static inline size_t mc_rfind_ ## isa ## W(const char *a, size_t n,            \
+                                           uint ## W ## _t x) {                \
+  const size_t V = VB/(W/8);                                                   \
+  vec_t vx = MC_ ## isa ## _SET ## W(x);                                       \
+  uint64_t m;                                                                  \
+  size_t i;                                                                    \
+  for(i = n; i >= V; i -= V) {                                                 \
+    m = MC_ ## isa ## _EQ ## W(MC_ ## isa ## _LOAD(a + (i-V)*(W/8)), vx);      \
+    if(m) return i-V + (63 - __builtin_clzll(m)) / (MW);                       \
+  }                                                                            \
+  while(i > 0) if(MC_LOAD_W(W, a + --i*(W/8)) == x) return i;                  \
+  return n;                                                                    \
+}                                                                              \
+__attribute__((target(tgt)))                                                   \
+static inline size_t mc_count_ ## isa ## W(const char *a, size_t n,            \
+                                           uint ## W ## _t x) {                \
+  const size_t V = VB/(W/8);                                                   \
+  vec_t vx = MC_ ## isa ## _SET ## W(x);                                       \
+  size_t i, bits = 0, c = 0;                                                   \
+  for(i = 0; i + V <= n; i += V)                                               \
+    bits += __builtin_popcountll(                                              \
+              MC_ ## isa ## _EQ ## W(MC_ ## isa ## _LOAD(a + i*(W/8)), vx));   \
+  for(; i < n; i++) c += (MC_LOAD_W(W, a + i*(W/8)) == x);                     \
+  return c + bits / (MW);                                                      \
+}                                                                              \
+__attribute__((target(tgt)))                                                   \
+static inline size_t mc_find_any_ ## isa ## W(const char *a, size_t n,         \
+                                              const uint ## W ## _t *xs,       \
+                                              size_t k) {                      \
+  const size_t V = VB/(W/8);                                                   \
+  vec_t v, vx[MC_FIND_ANY_SIMD];                                               \
+  uint64_t m;                                                                  \
+  size_t i, j;                                                                 \
+  for(j = 0; j < k; j++) vx[j] = MC_ ## isa ## _SET ## W(xs[j]);               \
+  for(i = 0; i + V <= n; i += V) {                                             \
+    v = MC_ ## isa ## _LOAD(a + i*(W/8));                                      \
+    for(m = 0, j = 0; j < k; j++) m |= MC_ ## isa ## _EQ ## W(v, vx[j]);       \
+    if(m) return i + __builtin_ctzll(m) / (MW);                                \
+  }                                                                            \
+  return i + mc_find_any_SCALAR ## W(a + i*(W/8), n-i, xs, k);                 \
+}
+
+#ifdef MC_SEARCH_X86
+
+#define MC_SSE2_LOAD(p)    _mm_loadu_si128((const __m128i*)(p))
+#define MC_SSE2_SET8(x)    _mm_set1_epi8((char)(x))
+#define MC_SSE2_SET16(x)   _mm_set1_epi16((short)(x))
+#define MC_SSE2_SET32(x)   _mm_set1_epi32((int)(x))
+#define MC_SSE2_SET64(x)   _mm_set1_epi64x((long long)(x))
+#define MC_SSE2_EQ8(a,b)   (uint64_t)_mm_movemask_epi8(_mm_cmpeq_epi8(a,b))
+#define MC_SSE2_EQ16(a,b)  (uint64_t)_mm_movemask_epi8(_mm_cmpeq_epi16(a,b))
+#define MC_SSE2_EQ32(a,b)  (uint64_t)_mm_movemask_epi8(_mm_cmpeq_epi32(a,b))
+#define MC_SSE2_EQ64(a,b)  mc_sse2_eq64(a,b)
+
+// SSE2 has no 64 bit compare: both 32 bit halves must match
+static inline uint64_t mc_sse2_eq64(__m128i a, __m128i b) {
+  __m128i t = _mm_cmpeq_epi32(a, b);
+  t = _mm_and_si128(t, _mm_shuffle_epi32(t, _MM_SHUFFLE(2,3,0,1)));
+  return (uint64_t)_mm_movemask_epi8(t);
+}
+
+#define MC_AVX2_LOAD(p)    _mm256_loadu_si256((const __m256i*)(p))
+#define MC_AVX2_SET8(x)    _mm256_set1_epi8((char)(x))
+#define MC_AVX2_SET16(x)   _mm256_set1_epi16((short)(x))
+#define MC_AVX2_SET32(x)   _mm256_set1_epi32((int)(x))
+#define MC_AVX2_SET64(x)   _mm256_set1_epi64x((long long)(x))
+#define MC_AVX2_EQ(W,a,b)  \
+        (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi ## W(a,b))
+#define MC_AVX2_EQ8(a,b)   MC_AVX2_EQ(8,a,b)
+#define MC_AVX2_EQ16(a,b)  MC_AVX2_EQ(16,a,b)
+#define MC_AVX2_EQ32(a,b)  MC_AVX2_EQ(32,a,b)
+#define MC_AVX2_EQ64(a,b)  MC_AVX2_EQ(64,a,b)
+
+#define MC_AVX512_LOAD(p)   _mm512_loadu_si512((const void*)(p))
+#define MC_AVX512_SET8(x)   _mm512_set1_epi8((char)(x))
+#define MC_AVX512_SET16(x)  _mm512_set1_epi16((short)(x))
+#define MC_AVX512_SET32(x)  _mm512_set1_epi32((int)(x))
+#define MC_AVX512_SET64(x)  _mm512_set1_epi64((long long)(x))
+#define MC_AVX512_EQ8(a,b)  (uint64_t)_mm512_cmpeq_epi8_mask(a,b)
+#define MC_AVX512_EQ16(a,b) (uint64_t)_mm512_cmpeq_epi16_mask(a,b)
+#define MC_AVX512_EQ32(a,b) (uint64_t)_mm512_cmpeq_epi32_mask(a,b)
+#define MC_AVX512_EQ64(a,b) (uint64_t)_mm512_cmpeq_epi64_mask(a,b)
+
+// SSE2 and AVX2 masks have a bit per byte, AVX-512 a bit per element
+#define MC_SEARCH_SIMD_ALL(W)                                                  \
+  MC_SEARCH_SIMD(SSE2,   "sse2",               __m128i, 16, W/8, W)            \
+  MC_SEARCH_SIMD(AVX2,   "avx2,popcnt",        __m256i, 32, W/8, W)            \
+  MC_SEARCH_SIMD(AVX512, "avx512bw,popcnt",    __m512i, 64, 1,   W)
+
+MC_SEARCH_SIMD_ALL(8)
+MC_SEARCH_SIMD_ALL(16)
+MC_SEARCH_SIMD_ALL(32)
+MC_SEARCH_SIMD_ALL(64)
+
+#define MC_SEARCH_CALL(fn,W,...) do {                                          \
+  switch(mc_search_level()) {                                                  \
+    case 3:  return fn ## _AVX512 ## W(__VA_ARGS__);                           \
+    case 2:  return fn ## _AVX2 ## W(__VA_ARGS__);                             \
+    case 1:  return fn ## _SSE2 ## W(__VA_ARGS__);                             \
+    default: return fn ## _SCALAR ## W(__VA_ARGS__);                           \
+  }                                                                            \
+} while(0)
+
+#else
+
+#define MC_SEARCH_CALL(fn,W,...) return fn ## _SCALAR ## W(__VA_ARGS__)
+
+#endif /* MC_SEARCH_X86 */
+
+static inline size_t mc_find(const void *arr, size_t n, size_t objsize,
+                             const void *obj) __attribute__((unused));
+static inline size_t mc_rfind(const void *arr, size_t n, size_t objsize,
+                              const void *obj) __attribute__((unused));
+static inline size_t mc_count(const void *arr, size_t n, size_t objsize,
+                              const void *obj) __attribute__((unused));
+static inline size_t mc_find_any(const void *arr, size_t n, size_t objsize,
+                                 const void *objs, size_t nobjs)
+ __attribute__((unused));
+
+// Dispatch on element size, which is a constant when called from a generator
+#define MC_SEARCH_SIZES(fn,arr,n,objsize,obj) do {                             \
+  switch(objsize) {                                                            \
+    case 1: MC_SEARCH_CALL(fn, 8,  arr, n, mc_load8(obj));                     \
+    case 2: MC_SEARCH_CALL(fn, 16, arr, n, mc_load16(obj));                    \
+    case 4: MC_SEARCH_CALL(fn, 32, arr, n, mc_load32(obj));                    \
+    case 8: MC_SEARCH_CALL(fn, 64, arr, n, mc_load64(obj));                    \
+  }                                                                            \
+} while(0)
+
+static inline size_t mc_find(const void *arr, size_t n, size_t objsize,
+                             const void *obj)
+{
+  size_t i;
+  MC_SEARCH_SIZES(mc_find, (const char*)arr, n, objsize, (const char*)obj);
+  for(i = 0; i < n; i++)
+    if(memcmp((const char*)arr + i*objsize, obj, objsize) == 0) return i;
+  return n;
+}
+
+static inline size_t mc_rfind(const void *arr, size_t n, size_t objsize,
+                              const void *obj)
+{
+  size_t i = n;
+  MC_SEARCH_SIZES(mc_rfind, (const char*)arr, n, objsize, (const char*)obj);
+  while(i > 0)
+    if(memcmp((const char*)arr + --i*objsize, obj, objsize) == 0) return i;
+  return n;
+}
+
+static inline size_t mc_count(const void *arr, size_t n, size_t objsize,
+                              const void *obj)
+{
+  size_t i, c = 0;
+  MC_SEARCH_SIZES(mc_count, (const char*)arr, n, objsize, (const char*)obj);
+  for(i = 0; i < n; i++)
+    c += (memcmp((const char*)arr + i*objsize, obj, objsize) == 0);
+  return c;
+}
+
+// Copy up to MC_FIND_ANY_SIMD values of W bits into xs and run find_any
+#define MC_SEARCH_ANY(W) do {                                                  \
+  uint ## W ## _t xs[MC_FIND_ANY_SIMD];                                        \
+  for(j = 0; j < nobjs; j++) xs[j] = mc_load ## W((const char*)objs + j*(W/8));\
+  MC_SEARCH_CALL(mc_find_any, W, (const char*)arr, n, xs, nobjs);              \
+} while(0)
+
+static inline size_t mc_find_any(const void *arr, size_t n, size_t objsize,
+                                 const void *objs, size_t nobjs)
+{
+  size_t i, j;
+  if(nobjs <= MC_FIND_ANY_SIMD) {
+    switch(objsize) {
+      case 1: MC_SEARCH_ANY(8);
+      case 2: MC_SEARCH_ANY(16);
+      case 4: MC_SEARCH_ANY(32);
+      case 8: MC_SEARCH_ANY(64);
+    }
+  }
+  for(i = 0; i < n; i++)
+    for(j = 0; j < nobjs; j++)
+      if(memcmp((const char*)arr + i*objsize,
+                (const char*)objs + j*objsize, objsize) == 0) return i;
+  return n;
+}
+
+#endif /* MADCROW_SEARCH_H_ */
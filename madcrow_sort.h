@@ -0,0 +1,277 @@
+#ifndef MADCROW_SORT_H_
+#define MADCROW_SORT_H_
+
+#include <stdlib.h>
+#include <string.h> // memcpy
+#include <unistd.h> // ssize_t
+#include <inttypes.h> // uint64_t
+#include <pthread.h>
+
+//
+// madcrow_sort.h
+// Add radix sort and binary search to a buffer or list, ordering elements by
+// an unsigned 64 bit key. The sort is an LSD radix sort on 8 bit digits, which
+// is stable and skips digits that are the same in every key, so small keys
+// cost fewer passes. It needs a scratch array of n elements, which comes from
+// the container's own allocator through the FUNC_mem_realloc/FUNC_mem_free
+// adapters (see madcrow_alloc.h), so FUNC must be the container's FUNC. It
+// is allocated like realloc(NULL,..) and not zeroed. Link with -pthread.
+//
+// Example:
+//
+//   #include "madcrow_buffer.h"
+//   #include "madcrow_list.h"
+//   #include "madcrow_sort.h"
+//
+//   madcrow_buffer(kbuf,KmerBuffer,uint64_t)
+//   madcrow_buffer_sort(kbuf,KmerBuffer,uint64_t,MC_SORT_KEY)
+//
+//   typedef struct { uint32_t pos; char strand; } Hit;
+//   #define hit_key(h) ((uint64_t)(h).pos)
+//   madcrow_list(hlist,HitList,Hit)
+//   madcrow_list_sort(hlist,HitList,Hit,hit_key)
+//
+// Creates:
+//
+//   int     kbuf_sort        (KmerBuffer *buf)
+//   int     kbuf_sort_mt     (KmerBuffer *buf, size_t nthreads)
+//   ssize_t kbuf_bsearch     (const KmerBuffer *buf, uint64_t key)
+//   size_t  kbuf_lower_bound (const KmerBuffer *buf, uint64_t key)
+//   size_t  kbuf_upper_bound (const KmerBuffer *buf, uint64_t key)
+//
+//   int     kbuf_radix       (uint64_t *arr, size_t n, size_t nthreads)
+//   size_t  kbuf_bound       (const uint64_t *arr, size_t n, uint64_t key,
+//                             int upper)
+//
+// key_f(obj) must give a uint64_t. Use MC_SORT_KEY for unsigned integers and
+// MC_SORT_KEY_SIGNED for signed integers.
+//
+// _sort and _sort_mt return 0 on success, or -1 if the scratch array could not
+// be allocated. _radix sorts a plain array, allocating as _new() does (a NULL
+// container, so a ctx allocator gets a NULL ctx). _sort_mt splits each pass between nthreads threads if there are
+// at least MC_SORT_MT_THRESHOLD elements.
+//
+// On a sorted container, _bsearch returns the index of an element with the
+// given key or -1, _lower_bound the first index with key >= key and
+// _upper_bound the first index with key > key (the length if there is none).
+// List indices are relative to start.
+//
+
+#define MC_SORT_KEY(x) ((uint64_t)(x))
+#define MC_SORT_KEY_SIGNED(x) ((uint64_t)(int64_t)(x) ^ (UINT64_C(1) << 63))
+
+#ifndef MC_SORT_MT_THRESHOLD
+  #define MC_SORT_MT_THRESHOLD (1UL<<20)
+#endif
+
+#define MC_SORT_DIGIT(key,d) (size_t)(((key) >> (8*(d))) & 255)
+
+#define mc_sort_buf_ptr(c) ((c)->b)
+#define mc_sort_buf_len(c) ((c)->len)
+#define mc_sort_list_ptr(c) ((c)->b + (c)->start)
+#define mc_sort_list_len(c) ((c)->end - (c)->start)
+
+#define madcrow_buffer_sort(FUNC,buf_t,obj_t,key_f)                            \
+        madcrow_sort(FUNC,buf_t,obj_t,key_f)                                   \
+        madcrow_sort_container(FUNC,buf_t,key_f,mc_sort_buf_ptr,               \
+                               mc_sort_buf_len)
+
+#define madcrow_list_sort(FUNC,list_t,obj_t,key_f)                             \
+        madcrow_sort(FUNC,list_t,obj_t,key_f)                                  \
+        madcrow_sort_container(FUNC,list_t,key_f,mc_sort_list_ptr,             \
+                               mc_sort_list_len)
+
+//
+// Functions on plain arrays: FUNC_radix and FUNC_bound. Memory comes from
+// the FUNC_mem_* adapters of the container cont_t
+//
+#define madcrow_sort(FUNC,cont_t,obj_t,key_f)                                  \
+                                                                               \
+/* One thread's share of a radix pass */                                       \
+typedef struct {                                                               \
+  const obj_t *src;                                                            \
+  obj_t *dst;                                                                  \
+  size_t start, end, digit;                                                    \
+  size_t cnt[256]; /* histogram, then output offsets */                        \
+} FUNC ## _sortjob_t;                                                          \
+                                                                               \
+static inline int     FUNC ## _radix(obj_t *arr, size_t n, size_t nthreads)    \
+ __attribute__((unused));                                                      \
+static inline size_t  FUNC ## _bound(const obj_t *arr, size_t n,               \
+                                     uint64_t key, int upper)                  \
+ __attribute__((unused));                                                      \
+                                                                               \
+static inline void*   FUNC ## _sortjob_hist(void *arg) {                       \
+  FUNC ## _sortjob_t *job = arg;                                               \
+  size_t i;                                                                    \
+  memset(job->cnt, 0, sizeof(job->cnt));                                       \
+  for(i = job->start; i < job->end; i++)                                       \
+    job->cnt[MC_SORT_DIGIT(key_f(job->src[i]), job->digit)]++;                 \
+  return NULL;                                                                 \
+}                                                                              \
+                                                                               \
+static inline void*   FUNC ## _sortjob_scatter(void *arg) {                    \
+  FUNC ## _sortjob_t *job = arg;                                               \
+  size_t i;                                                                    \
+  for(i = job->start; i < job->end; i++)                                       \
+    job->dst[job->cnt[MC_SORT_DIGIT(key_f(job->src[i]), job->digit)]++]        \
+      = job->src[i];                                                           \
+  return NULL;                                                                 \
+}                                                                              \
+                                                                               \
+/* Run f on every job, in threads if there is more than one */                 \
+static inline void    FUNC ## _sortjob_run(FUNC ## _sortjob_t *jobs,           \
+                                           pthread_t *threads, size_t njobs,   \
+                                           void* (*f)(void*)) {                \
+  size_t t;                                                                    \
+  for(t = 1; t < njobs; t++)                                                   \
+    if(pthread_create(&threads[t], NULL, f, &jobs[t]) != 0) {                  \
+      threads[t] = threads[0]; /* could not start: run it here instead */      \
+      f(&jobs[t]);                                                             \
+    }                                                                          \
+  f(&jobs[0]);                                                                 \
+  for(t = 1; t < njobs; t++)                                                   \
+    if(!pthread_equal(threads[t], threads[0])) pthread_join(threads[t], NULL); \
+}                                                                              \
+                                                                               \
+/* Radix sort on one thread. The digit counts do not depend on the order, */   \
+/* so all eight are counted in a single read of the keys */                    \
+static inline void    FUNC ## _radix1(obj_t *arr, obj_t *tmp, size_t n) {      \
+  size_t cnt[8][256] = {{0}}, i, b, d, c, total;                               \
+  obj_t *src = arr, *dst = tmp, *swp;                                          \
+  uint64_t k;                                                                  \
+  for(i = 0; i < n; i++) {                                                     \
+    k = key_f(arr[i]);                                                         \
+    for(d = 0; d < 8; d++) cnt[d][MC_SORT_DIGIT(k, d)]++;                      \
+  }                                                                            \
+  for(d = 0; d < 8; d++) {                                                     \
+    /* skip digits that are the same in every key */                           \
+    if(cnt[d][MC_SORT_DIGIT(key_f(src[0]), d)] == n) continue;                 \
+    for(total = 0, b = 0; b < 256; b++) {                                      \
+      c = cnt[d][b]; cnt[d][b] = total; total += c;                            \
+    }                                                                          \
+    for(i = 0; i < n; i++)                                                     \
+      dst[cnt[d][MC_SORT_DIGIT(key_f(src[i]), d)]++] = src[i];                 \
+    swp = src; src = dst; dst = swp;                                           \
+  }                                                                            \
+  if(src != arr) memcpy(arr, src, n * sizeof(obj_t));                          \
+}                                                                              \
+                                                                               \
+/* Radix sort with each pass split between nthreads threads */                 \
+static inline int     FUNC ## _radixn(const cont_t *c, obj_t *arr, obj_t *tmp, \
+                                      size_t n, size_t nthreads) {             \
+  size_t jbytes = nthreads * sizeof(FUNC ## _sortjob_t);                       \
+  size_t tbytes = nthreads * sizeof(pthread_t);                                \
+  FUNC ## _sortjob_t *jobs = FUNC ## _mem_realloc(c, NULL, 0, jbytes);         \
+  pthread_t *threads = FUNC ## _mem_realloc(c, NULL, 0, tbytes);               \
+  obj_t *src = arr, *dst = tmp, *swp;                                          \
+  size_t t, b, d, total, chunk = (n + nthreads - 1) / nthreads;                \
+  if(jobs == NULL || threads == NULL) {                                        \
+    if(jobs) FUNC ## _mem_free(c, jobs, jbytes);                               \
+    if(threads) FUNC ## _mem_free(c, threads, tbytes);                         \
+    return -1;                                                                 \
+  }                                                                            \
+  threads[0] = pthread_self();                                                 \
+  for(t = 0; t < nthreads; t++) {                                              \
+    jobs[t].start = t * chunk < n ? t * chunk : n;                             \
+    jobs[t].end = jobs[t].start + chunk < n ? jobs[t].start + chunk : n;       \
+  }                                                                            \
+  for(d = 0; d < 8; d++) {                                                     \
+    for(t = 0; t < nthreads; t++) {                                            \
+      jobs[t].src = src; jobs[t].dst = dst; jobs[t].digit = d;                 \
+    }                                                                          \
+    FUNC ## _sortjob_run(jobs, threads, nthreads, FUNC ## _sortjob_hist);      \
+    /* skip digits that are the same in every key */                           \
+    b = MC_SORT_DIGIT(key_f(src[0]), d);                                       \
+    for(total = 0, t = 0; t < nthreads; t++) total += jobs[t].cnt[b];          \
+    if(total == n) continue;                                                   \
+    /* offsets: by digit, then by thread so that the sort is stable */         \
+    for(total = 0, b = 0; b < 256; b++) {                                      \
+      for(t = 0; t < nthreads; t++) {                                          \
+        size_t c = jobs[t].cnt[b];                                             \
+        jobs[t].cnt[b] = total;                                                \
+        total += c;                                                            \
+      }                                                                        \
+    }                                                                          \
+    FUNC ## _sortjob_run(jobs, threads, nthreads, FUNC ## _sortjob_scatter);   \
+    swp = src; src = dst; dst = swp;                                           \
+  }                                                                            \
+  if(src != arr) memcpy(arr, src, n * sizeof(obj_t));                          \
+  FUNC ## _mem_free(c, jobs, jbytes);                                          \
+  FUNC ## _mem_free(c, threads, tbytes);                                       \
+  return 0;                                                                    \
+}                                                                              \
+                                                                               \
+/* Sort arr by key_f, stable, with scratch from c's allocator (c may be */     \
+/* NULL). Returns 0 or -1 if out of memory */                                  \
+static inline int     FUNC ## _radix_in(const cont_t *c, obj_t *arr, size_t n, \
+                                        size_t nthreads) {                     \
+  obj_t *tmp;                                                                  \
+  int ret = 0;                                                                 \
+  if(n < 2) return 0;                                                          \
+  if(nthreads < 1 || n < MC_SORT_MT_THRESHOLD) nthreads = 1;                   \
+  if(nthreads > n) nthreads = n;                                               \
+  /* realloc from NULL: the scratch is overwritten, so don't zero it */        \
+  tmp = FUNC ## _mem_realloc(c, NULL, 0, n * sizeof(obj_t));                   \
+  if(tmp == NULL) return -1;                                                   \
+  if(nthreads == 1) FUNC ## _radix1(arr, tmp, n);                              \
+  else ret = FUNC ## _radixn(c, arr, tmp, n, nthreads);                        \
+  FUNC ## _mem_free(c, tmp, n * sizeof(obj_t));                                \
+  return ret;                                                                  \
+}                                                                              \
+                                                                               \
+static inline int     FUNC ## _radix(obj_t *arr, size_t n, size_t nthreads) {  \
+  return FUNC ## _radix_in(NULL, arr, n, nthreads);                            \
+}                                                                              \
+                                                                               \
+/* First index in sorted arr with key_f >= key (or > key if upper), or n */    \
+static inline size_t  FUNC ## _bound(const obj_t *arr, size_t n,               \
+                                     uint64_t key, int upper) {                \
+  size_t lo = 0, hi = n, mid;                                                  \
+  while(lo < hi) {                                                             \
+    mid = lo + (hi - lo) / 2;                                                  \
+    uint64_t k = key_f(arr[mid]);                                              \
+    if(k < key || (upper && k == key)) lo = mid + 1;                           \
+    else hi = mid;                                                             \
+  }                                                                            \
+  return lo;                                                                   \
+}                                                                              \
+
+//
+// Container functions, PTR(c) and LEN(c) give the elements
+//
+#define madcrow_sort_container(FUNC,cont_t,key_f,PTR,LEN)                      \
+                                                                               \
+static inline int     FUNC ## _sort(cont_t *c)                                 \
+ __attribute__((unused));                                                      \
+static inline int     FUNC ## _sort_mt(cont_t *c, size_t nthreads)             \
+ __attribute__((unused));                                                      \
+static inline ssize_t FUNC ## _bsearch(const cont_t *c, uint64_t key)          \
+ __attribute__((unused));                                                      \
+static inline size_t  FUNC ## _lower_bound(const cont_t *c, uint64_t key)      \
+ __attribute__((unused));                                                      \
+static inline size_t  FUNC ## _upper_bound(const cont_t *c, uint64_t key)      \
+ __attribute__((unused));                                                      \
+                                                                               \
+static inline int     FUNC ## _sort(cont_t *c) {                               \
+  return FUNC ## _radix_in(c, PTR(c), LEN(c), 1);                              \
+}                                                                              \
+                                                                               \
+static inline int     FUNC ## _sort_mt(cont_t *c, size_t nthreads) {           \
+  return FUNC ## _radix_in(c, PTR(c), LEN(c), nthreads);                       \
+}                                                                              \
+                                                                               \
+static inline ssize_t FUNC ## _bsearch(const cont_t *c, uint64_t key) {        \
+  size_t i = FUNC ## _bound(PTR(c), LEN(c), key, 0);                           \
+  return i < LEN(c) && key_f(PTR(c)[i]) == key ? (ssize_t)i : -1;              \
+}                                                                              \
+                                                                               \
+static inline size_t  FUNC ## _lower_bound(const cont_t *c, uint64_t key) {    \
+  return FUNC ## _bound(PTR(c), LEN(c), key, 0);                               \
+}                                                                              \
+                                                                               \
+static inline size_t  FUNC ## _upper_bound(const cont_t *c, uint64_t key) {    \
+  return FUNC ## _bound(PTR(c), LEN(c), key, 1);                               \
+}                                                                              \
+
+#endif /* MADCROW_SORT_H_ */
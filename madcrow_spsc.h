@@ -0,0 +1,211 @@
+#ifndef MADCROW_SPSC_H_
+#define MADCROW_SPSC_H_
+
+#include <stdlib.h>
+#include <string.h> // memcpy
+#include <assert.h>
+#include <inttypes.h> // uint64_t
+#include <stdatomic.h>
+
+//
+// madcrow_spsc.h
+// Define a lock-free single-producer single-consumer ring of fixed power-of-two
+// capacity, for passing records between two threads without locks or syscalls.
+// Head and tail indices sit on their own cache lines with acquire/release
+// ordering, and each side caches the other's index so it only touches the
+// shared line when it appears full/empty. Needs C11.
+//
+// Example:
+//
+//   #include "madcrow_spsc.h"
+//   madcrow_spsc(rpipe,RecordPipe,Record)
+//
+// Creates:
+//
+//   typedef struct {
+//     _Atomic size_t tail; size_t head_cache; // producer, own cache line
+//     _Atomic size_t head; size_t tail_cache; // consumer, own cache line
+//     Record *b;
+//     size_t size;
+//   } RecordPipe;
+//
+//   void    rpipe_alloc  (RecordPipe *q, size_t capacity)
+//   void    rpipe_dealloc(RecordPipe *q)
+//   size_t  rpipe_size   (const RecordPipe *q)  // capacity
+//
+// Producer thread only:
+//   int     rpipe_push          (RecordPipe *q, Record obj)
+//   size_t  rpipe_push_n        (RecordPipe *q, const Record *ptr, size_t n)
+//   size_t  rpipe_acquire_write (RecordPipe *q, Record **ptr, size_t n)
+//   void    rpipe_commit_write  (RecordPipe *q, size_t n)
+//
+// Consumer thread only:
+//   int     rpipe_pop           (RecordPipe *q, Record *obj)
+//   size_t  rpipe_pop_n         (RecordPipe *q, Record *ptr, size_t n)
+//   size_t  rpipe_acquire_read  (RecordPipe *q, Record **ptr, size_t n)
+//   void    rpipe_release_read  (RecordPipe *q, size_t n)
+//
+// push/pop return 1 on success, 0 if full/empty. push_n/pop_n return the
+// number of elements moved, which may be less than n. acquire_write/
+// acquire_read set *ptr to a contiguous span inside the ring and return its
+// length, up to n (0 if full/empty). Write into / read from the span, then
+// publish it with commit_write/release_read of at most that many elements.
+//
+
+// Round a number up to the nearest number that is a power of two
+#ifndef roundup64
+  #define roundup64(x) roundup64(x)
+  static inline uint64_t roundup64(uint64_t x) {
+    return (--x, x|=x>>1, x|=x>>2, x|=x>>4, x|=x>>8, x|=x>>16, x|=x>>32, ++x);
+  }
+#endif
+
+#define madcrow_spsc(FUNC,spsc_t,obj_t) \
+        madcrow_spsc2(FUNC,spsc_t,obj_t,calloc,free)
+
+#define madcrow_spsc2(FUNC,spsc_t,obj_t,mc_alloc,mc_free)                      \
+                                                                               \
+typedef struct {                                                               \
+  _Alignas(64) _Atomic size_t tail; /* next slot to write */                   \
+  size_t head_cache; /* producer's last view of head */                        \
+  _Alignas(64) _Atomic size_t head; /* next slot to read */                    \
+  size_t tail_cache; /* consumer's last view of tail */                        \
+  _Alignas(64) obj_t *b;                                                       \
+  size_t size;                                                                 \
+} spsc_t;                                                                      \
+                                                                               \
+/* Define functions with unused attribute in case they're not used */          \
+static inline void    FUNC ## _alloc(spsc_t *q, size_t capacity)               \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _dealloc(spsc_t *q)                              \
+ __attribute__((unused));                                                      \
+static inline size_t  FUNC ## _size(const spsc_t *q)                           \
+ __attribute__((unused));                                                      \
+static inline int     FUNC ## _push(spsc_t *q, obj_t obj)                      \
+ __attribute__((unused));                                                      \
+static inline size_t  FUNC ## _push_n(spsc_t *q, const obj_t *ptr, size_t n)   \
+ __attribute__((unused));                                                      \
+static inline size_t  FUNC ## _acquire_write(spsc_t *q, obj_t **ptr, size_t n) \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _commit_write(spsc_t *q, size_t n)               \
+ __attribute__((unused));                                                      \
+static inline int     FUNC ## _pop(spsc_t *q, obj_t *obj)                      \
+ __attribute__((unused));                                                      \
+static inline size_t  FUNC ## _pop_n(spsc_t *q, obj_t *ptr, size_t n)          \
+ __attribute__((unused));                                                      \
+static inline size_t  FUNC ## _acquire_read(spsc_t *q, obj_t **ptr, size_t n)  \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _release_read(spsc_t *q, size_t n)               \
+ __attribute__((unused));                                                      \
+                                                                               \
+static inline void    FUNC ## _alloc(spsc_t *q, size_t capacity) {             \
+  q->size = capacity < 2 ? 2 : roundup64(capacity);                            \
+  q->b = mc_alloc(q->size, sizeof(obj_t));                                     \
+  atomic_init(&q->head, 0);                                                    \
+  atomic_init(&q->tail, 0);                                                    \
+  q->head_cache = q->tail_cache = 0;                                           \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _dealloc(spsc_t *q) {                            \
+  mc_free(q->b);                                                               \
+  q->b = NULL;                                                                 \
+  q->size = 0;                                                                 \
+}                                                                              \
+                                                                               \
+static inline size_t  FUNC ## _size(const spsc_t *q) {                         \
+  return q->size;                                                              \
+}                                                                              \
+                                                                               \
+/* Producer: number of free slots, refreshing head only if needed */           \
+static inline size_t  FUNC ## _space(spsc_t *q, size_t tail, size_t n) {       \
+  size_t space = q->size - (tail - q->head_cache);                             \
+  if(space < n) {                                                              \
+    q->head_cache = atomic_load_explicit(&q->head, memory_order_acquire);      \
+    space = q->size - (tail - q->head_cache);                                  \
+  }                                                                            \
+  return space;                                                                \
+}                                                                              \
+                                                                               \
+/* Consumer: number of filled slots, refreshing tail only if needed */         \
+static inline size_t  FUNC ## _avail(spsc_t *q, size_t head, size_t n) {       \
+  size_t avail = q->tail_cache - head;                                         \
+  if(avail < n) {                                                              \
+    q->tail_cache = atomic_load_explicit(&q->tail, memory_order_acquire);      \
+    avail = q->tail_cache - head;                                              \
+  }                                                                            \
+  return avail;                                                                \
+}                                                                              \
+                                                                               \
+static inline int     FUNC ## _push(spsc_t *q, obj_t obj) {                    \
+  size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);          \
+  if(FUNC ## _space(q, tail, 1) == 0) return 0;                                \
+  q->b[tail & (q->size-1)] = obj;                                              \
+  atomic_store_explicit(&q->tail, tail+1, memory_order_release);               \
+  return 1;                                                                    \
+}                                                                              \
+                                                                               \
+static inline size_t  FUNC ## _push_n(spsc_t *q, const obj_t *ptr, size_t n) { \
+  size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);          \
+  size_t space = FUNC ## _space(q, tail, n);                                   \
+  if(n > space) n = space;                                                     \
+  size_t pos = tail & (q->size-1), n0 = q->size - pos < n ? q->size - pos : n; \
+  memcpy(q->b+pos, ptr, n0 * sizeof(obj_t));                                   \
+  if(n0 < n) memcpy(q->b, ptr+n0, (n-n0) * sizeof(obj_t));                     \
+  atomic_store_explicit(&q->tail, tail+n, memory_order_release);               \
+  return n;                                                                    \
+}                                                                              \
+                                                                               \
+static inline size_t  FUNC ## _acquire_write(spsc_t *q, obj_t **ptr, size_t n) \
+{                                                                              \
+  size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);          \
+  size_t space = FUNC ## _space(q, tail, n);                                   \
+  size_t pos = tail & (q->size-1);                                             \
+  if(n > space) n = space;                                                     \
+  if(n > q->size - pos) n = q->size - pos;                                     \
+  *ptr = q->b + pos;                                                           \
+  return n;                                                                    \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _commit_write(spsc_t *q, size_t n) {             \
+  size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);          \
+  assert(n <= q->size - (tail - q->head_cache));                               \
+  atomic_store_explicit(&q->tail, tail+n, memory_order_release);               \
+}                                                                              \
+                                                                               \
+static inline int     FUNC ## _pop(spsc_t *q, obj_t *obj) {                    \
+  size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);          \
+  if(FUNC ## _avail(q, head, 1) == 0) return 0;                                \
+  *obj = q->b[head & (q->size-1)];                                             \
+  atomic_store_explicit(&q->head, head+1, memory_order_release);               \
+  return 1;                                                                    \
+}                                                                              \
+                                                                               \
+static inline size_t  FUNC ## _pop_n(spsc_t *q, obj_t *ptr, size_t n) {        \
+  size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);          \
+  size_t avail = FUNC ## _avail(q, head, n);                                   \
+  if(n > avail) n = avail;                                                     \
+  size_t pos = head & (q->size-1), n0 = q->size - pos < n ? q->size - pos : n; \
+  memcpy(ptr, q->b+pos, n0 * sizeof(obj_t));                                   \
+  if(n0 < n) memcpy(ptr+n0, q->b, (n-n0) * sizeof(obj_t));                     \
+  atomic_store_explicit(&q->head, head+n, memory_order_release);               \
+  return n;                                                                    \
+}                                                                              \
+                                                                               \
+static inline size_t  FUNC ## _acquire_read(spsc_t *q, obj_t **ptr, size_t n)  \
+{                                                                              \
+  size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);          \
+  size_t avail = FUNC ## _avail(q, head, n);                                   \
+  size_t pos = head & (q->size-1);                                             \
+  if(n > avail) n = avail;                                                     \
+  if(n > q->size - pos) n = q->size - pos;                                     \
+  *ptr = q->b + pos;                                                           \
+  return n;                                                                    \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _release_read(spsc_t *q, size_t n) {             \
+  size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);          \
+  assert(n <= q->tail_cache - head);                                           \
+  atomic_store_explicit(&q->head, head+n, memory_order_release);               \
+}                                                                              \
+
+#endif /* MADCROW_SPSC_H_ */
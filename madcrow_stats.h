@@ -0,0 +1,98 @@
+#ifndef MADCROW_STATS_H_
+#define MADCROW_STATS_H_
+
+//
+// madcrow_stats.h
+// Opt-in counters kept per madcrow_buffer2 / madcrow_list2 instantiation.
+// Compile with -DMC_STATS to enable. Without it the counters compile away.
+//
+// Example:
+//
+//   #define MC_STATS
+//   #include "madcrow_buffer.h"
+//   madcrow_buffer(charbuf,String,char)
+//   ...
+//   mc_stats_dump(stderr);          // one row per FUNC name
+//   charbuf_stats.reallocs;         // counters for a single instantiation
+//
+// Counters:
+//   reallocs, realloc_bytes  calls to mc_realloc and bytes requested
+//   memmove_bytes            bytes moved to make space or recentre contents
+//   max_len, max_capacity    high-water length and capacity
+//   shifts, unshifts         calls to remove from / add to the start
+//
+// Instantiations register themselves at startup, so mc_stats_dump() lists
+// those in the current compilation unit.
+//
+
+#ifdef MC_STATS
+
+#include <stdio.h>
+#include <string.h>
+
+typedef struct mc_stats_t mc_stats_t;
+
+struct mc_stats_t {
+  const char *name;
+  size_t reallocs, realloc_bytes, memmove_bytes;
+  size_t max_len, max_capacity;
+  size_t shifts, unshifts;
+  mc_stats_t *next;
+};
+
+static mc_stats_t *mc_stats_list __attribute__((unused)) = NULL;
+
+#define MC_STATS_DEFINE(FUNC)                                                  \
+static mc_stats_t FUNC ## _stats = {.name = #FUNC};                            \
+static void FUNC ## _stats_register(void) __attribute__((constructor));       \
+static void FUNC ## _stats_register(void) {                                    \
+  FUNC ## _stats.next = mc_stats_list;                                         \
+  mc_stats_list = &FUNC ## _stats;                                             \
+}
+
+#define MC_STATS_ADD(FUNC,field,n) ((FUNC ## _stats).field += (n))
+
+#define MC_STATS_MAX(FUNC,field,x) do {                                        \
+  size_t _mc_x = (x);                                                          \
+  if(_mc_x > (FUNC ## _stats).field) (FUNC ## _stats).field = _mc_x;           \
+} while(0)
+
+static inline void mc_stats_dump(FILE *out) __attribute__((unused));
+static inline void mc_stats_reset() __attribute__((unused));
+
+static inline void mc_stats_dump(FILE *out)
+{
+  const mc_stats_t *st;
+  fprintf(out, "%-20s %10s %15s %15s %12s %12s %10s %10s\n",
+          "name", "reallocs", "realloc_bytes", "memmove_bytes",
+          "max_len", "max_capacity", "shifts", "unshifts");
+  for(st = mc_stats_list; st != NULL; st = st->next) {
+    fprintf(out, "%-20s %10zu %15zu %15zu %12zu %12zu %10zu %10zu\n",
+            st->name, st->reallocs, st->realloc_bytes, st->memmove_bytes,
+            st->max_len, st->max_capacity, st->shifts, st->unshifts);
+  }
+}
+
+static inline void mc_stats_reset()
+{
+  mc_stats_t *st, *next;
+  for(st = mc_stats_list; st != NULL; st = next) {
+    const char *name = st->name;
+    next = st->next;
+    memset(st, 0, sizeof(*st));
+    st->name = name;
+    st->next = next;
+  }
+}
+
+#else
+
+#define MC_STATS_DEFINE(FUNC)
+#define MC_STATS_ADD(FUNC,field,n) do {} while(0)
+#define MC_STATS_MAX(FUNC,field,x) do {} while(0)
+#define mc_stats_dump(out) do {} while(0)
+#define mc_stats_reset() do {} while(0)
+
+#endif /* MC_STATS */
+
+#endif /* MADCROW_STATS_H_ */
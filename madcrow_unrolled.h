@@ -0,0 +1,377 @@
+#ifndef MADCROW_UNROLLED_H_
+#define MADCROW_UNROLLED_H_
+
+#include <stdlib.h>
+#include <string.h> // memmove
+#include <assert.h>
+#include <stdint.h> // uint32_t
+
+//
+// madcrow_unrolled.h
+// Define an unrolled doubly-linked list: each node holds a small array of
+// elements (MC_UNROLLED_BYTES, about four cache lines, by default), so scans
+// touch memory almost like an array while inserting and removing in the
+// middle only moves elements within one node. Each node keeps its elements in
+// b[start..start+n) so adding or removing at either end is O(1). A full node
+// is split in two on insert, and a node under a quarter full is merged with a
+// neighbour on removal. Seeking to an index walks nodes from the nearer end,
+// O(n/B) for B elements per node.
+//
+// Example:
+//
+//   #include "madcrow_unrolled.h"
+//   madcrow_unrolled(ulist,JobList,JobNode,JobIter,Job)
+//
+// Creates:
+//
+//   struct JobNode {
+//     JobNode *next, *prev;
+//     uint32_t start, n;
+//     Job b[B];
+//   };
+//
+//   typedef struct {
+//     JobNode *first, *last;
+//     size_t len;
+//   } JobList;
+//
+//   typedef struct {
+//     JobNode *node; // NULL at the end of the list
+//     size_t i; // index within node
+//   } JobIter;
+//
+//   void    ulist_init      (JobList *list)
+//   void    ulist_dealloc   (JobList *list)
+//   size_t  ulist_len       (const JobList *list)
+//
+//   void    ulist_push      (JobList *list, Job obj) // add to end
+//   int     ulist_pop       (JobList *list, Job *obj) // remove from end
+//   void    ulist_unshift   (JobList *list, Job obj) // add to start
+//   int     ulist_shift     (JobList *list, Job *obj) // remove from start
+//
+//   Job*    ulist_getptr    (JobList *list, size_t idx)
+//   Job     ulist_get       (JobList *list, size_t idx)
+//   void    ulist_set       (JobList *list, size_t idx, Job obj)
+//   void    ulist_insert_at (JobList *list, size_t idx, Job obj)
+//   Job     ulist_remove_at (JobList *list, size_t idx)
+//
+// Iterators:
+//   void    ulist_seek      (const JobList *list, JobIter *it, size_t idx)
+//   void    ulist_next      (JobIter *it)
+//   Job*    ulist_iter_ptr  (const JobIter *it)
+//   void    ulist_insert    (JobList *list, JobIter *it, Job obj)
+//   void    ulist_erase     (JobList *list, JobIter *it)
+//
+// pop/shift return 0 if the list was empty, 1 otherwise. seek to len (or
+// next past the last element) gives the end iterator, it.node == NULL.
+// insert adds obj before it and leaves it pointing to obj; inserting at the
+// end iterator appends. erase leaves it pointing to the following element.
+// Any other insert or erase invalidates iterators and element pointers.
+//
+//   JobIter it;
+//   for(ulist_seek(&list, &it, 0); it.node; ulist_next(&it))
+//     run(ulist_iter_ptr(&it));
+//
+
+// Target bytes per node, including the header
+#ifndef MC_UNROLLED_BYTES
+  #define MC_UNROLLED_BYTES 256
+#endif
+
+// Elements per node for objects of size bytes, at least 4
+#define mc_unrolled_cap(size)                                                  \
+  ((MC_UNROLLED_BYTES - 2*sizeof(void*) - 8) / (size) < 4 ? 4 :                \
+   (MC_UNROLLED_BYTES - 2*sizeof(void*) - 8) / (size))
+
+#define madcrow_unrolled_init {.first = NULL, .last = NULL, .len = 0}
+
+#define madcrow_unrolled_verify(list) do {                                     \
+  assert(!(list)->first == !(list)->last);                                     \
+  assert(!(list)->first == !(list)->len);                                      \
+  { size_t _n = 0; __typeof((list)->first) _ptr = (list)->first;               \
+    for(; _ptr; _ptr = _ptr->next) {                                           \
+      assert(_ptr->n > 0);                                                     \
+      assert(_ptr->next ? _ptr->next->prev == _ptr : _ptr == (list)->last);    \
+      _n += _ptr->n;                                                           \
+    }                                                                          \
+    assert(_n == (list)->len);                                                 \
+  }                                                                            \
+} while(0)
+
+#define madcrow_unrolled(FUNC,list_t,node_t,iter_t,obj_t) \
+        madcrow_unrolled2(FUNC,list_t,node_t,iter_t,obj_t,\
+                          mc_unrolled_cap(sizeof(obj_t)),calloc,free)
+
+#define madcrow_unrolled2(FUNC,list_t,node_t,iter_t,obj_t,B,mc_alloc,mc_free)  \
+                                                                               \
+typedef struct __##node_t node_t;                                              \
+                                                                               \
+struct __##node_t {                                                            \
+  node_t *next, *prev;                                                         \
+  uint32_t start, n; /* elements are b[start..start+n) */                      \
+  obj_t b[B];                                                                  \
+};                                                                             \
+                                                                               \
+typedef struct {                                                               \
+  node_t *first, *last;                                                        \
+  size_t len;                                                                  \
+} list_t;                                                                      \
+                                                                               \
+typedef struct {                                                               \
+  node_t *node; /* NULL at the end */                                          \
+  size_t i; /* index within node */                                            \
+} iter_t;                                                                      \
+                                                                               \
+/* Define functions with unused attribute in case they're not used */          \
+static inline void    FUNC ## _init(list_t *list)                              \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _dealloc(list_t *list)                           \
+ __attribute__((unused));                                                      \
+static inline size_t  FUNC ## _len(const list_t *list)                         \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _push(list_t *list, obj_t obj)                   \
+ __attribute__((unused));                                                      \
+static inline int     FUNC ## _pop(list_t *list, obj_t *obj)                   \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _unshift(list_t *list, obj_t obj)                \
+ __attribute__((unused));                                                      \
+static inline int     FUNC ## _shift(list_t *list, obj_t *obj)                 \
+ __attribute__((unused));                                                      \
+static inline obj_t*  FUNC ## _getptr(list_t *list, size_t idx)                \
+ __attribute__((unused));                                                      \
+static inline obj_t   FUNC ## _get(list_t *list, size_t idx)                   \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _set(list_t *list, size_t idx, obj_t obj)        \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _insert_at(list_t *list, size_t idx, obj_t obj)  \
+ __attribute__((unused));                                                      \
+static inline obj_t   FUNC ## _remove_at(list_t *list, size_t idx)             \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _seek(const list_t *list, iter_t *it, size_t idx)\
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _next(iter_t *it)                                \
+ __attribute__((unused));                                                      \
+static inline obj_t*  FUNC ## _iter_ptr(const iter_t *it)                      \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _insert(list_t *list, iter_t *it, obj_t obj)     \
+ __attribute__((unused));                                                      \
+static inline void    FUNC ## _erase(list_t *list, iter_t *it)                 \
+ __attribute__((unused));                                                      \
+                                                                               \
+static inline void    FUNC ## _init(list_t *list) {                            \
+  memset(list, 0, sizeof(list_t));                                             \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _dealloc(list_t *list) {                         \
+  node_t *node, *next;                                                         \
+  for(node = list->first; node; node = next) {                                 \
+    next = node->next;                                                         \
+    mc_free(node);                                                             \
+  }                                                                            \
+  memset(list, 0, sizeof(list_t));                                             \
+}                                                                              \
+                                                                               \
+static inline size_t  FUNC ## _len(const list_t *list) {                       \
+  return list->len;                                                            \
+}                                                                              \
+                                                                               \
+/* Link a new empty node after prev (NULL for the front), elements will */     \
+/* start at b[start] */                                                        \
+static inline node_t* FUNC ## _node_new(list_t *list, node_t *prev,            \
+                                        uint32_t start) {                      \
+  node_t *node = mc_alloc(1, sizeof(node_t));                                  \
+  node->start = start;                                                         \
+  node->n = 0;                                                                 \
+  node->prev = prev;                                                           \
+  node->next = prev ? prev->next : list->first;                                \
+  if(node->next) node->next->prev = node;                                      \
+  else           list->last = node;                                            \
+  if(prev) prev->next = node;                                                  \
+  else     list->first = node;                                                 \
+  return node;                                                                 \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _node_free(list_t *list, node_t *node) {         \
+  if(node->prev) node->prev->next = node->next;                                \
+  else           list->first = node->next;                                     \
+  if(node->next) node->next->prev = node->prev;                                \
+  else           list->last = node->prev;                                      \
+  mc_free(node);                                                               \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _push(list_t *list, obj_t obj) {                 \
+  node_t *node = list->last;                                                   \
+  if(node == NULL || node->start + node->n == (B))                             \
+    node = FUNC ## _node_new(list, list->last, 0);                             \
+  node->b[node->start + node->n++] = obj;                                      \
+  list->len++;                                                                 \
+}                                                                              \
+                                                                               \
+static inline int     FUNC ## _pop(list_t *list, obj_t *obj) {                 \
+  node_t *node = list->last;                                                   \
+  if(node == NULL) return 0;                                                   \
+  *obj = node->b[node->start + --node->n];                                     \
+  if(node->n == 0) FUNC ## _node_free(list, node);                             \
+  list->len--;                                                                 \
+  return 1;                                                                    \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _unshift(list_t *list, obj_t obj) {              \
+  node_t *node = list->first;                                                  \
+  if(node == NULL || node->start == 0)                                         \
+    node = FUNC ## _node_new(list, NULL, (B));                                 \
+  node->b[--node->start] = obj;                                                \
+  node->n++;                                                                   \
+  list->len++;                                                                 \
+}                                                                              \
+                                                                               \
+static inline int     FUNC ## _shift(list_t *list, obj_t *obj) {               \
+  node_t *node = list->first;                                                  \
+  if(node == NULL) return 0;                                                   \
+  *obj = node->b[node->start++];                                               \
+  if(--node->n == 0) FUNC ## _node_free(list, node);                           \
+  list->len--;                                                                 \
+  return 1;                                                                    \
+}                                                                              \
+                                                                               \
+/* Walk from whichever end is nearer */                                        \
+static inline void    FUNC ## _seek(const list_t *list, iter_t *it, size_t idx)\
+{                                                                              \
+  node_t *node;                                                                \
+  assert(idx <= list->len);                                                    \
+  if(idx < list->len / 2) {                                                    \
+    for(node = list->first; idx >= node->n; node = node->next) idx -= node->n; \
+  }                                                                            \
+  else if(idx == list->len) { node = NULL; idx = 0; }                          \
+  else {                                                                       \
+    idx = list->len - idx; /* count from the end, 1..len */                    \
+    for(node = list->last; idx > node->n; node = node->prev) idx -= node->n;   \
+    idx = node->n - idx;                                                       \
+  }                                                                            \
+  it->node = node;                                                             \
+  it->i = idx;                                                                 \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _next(iter_t *it) {                              \
+  if(++it->i == it->node->n) { it->node = it->node->next; it->i = 0; }         \
+}                                                                              \
+                                                                               \
+static inline obj_t*  FUNC ## _iter_ptr(const iter_t *it) {                    \
+  assert(it->node && it->i < it->node->n);                                     \
+  return it->node->b + it->node->start + it->i;                                \
+}                                                                              \
+                                                                               \
+static inline obj_t*  FUNC ## _getptr(list_t *list, size_t idx) {              \
+  iter_t it;                                                                   \
+  assert(idx < list->len);                                                     \
+  FUNC ## _seek(list, &it, idx);                                               \
+  return FUNC ## _iter_ptr(&it);                                               \
+}                                                                              \
+                                                                               \
+static inline obj_t   FUNC ## _get(list_t *list, size_t idx) {                 \
+  return *FUNC ## _getptr(list, idx);                                          \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _set(list_t *list, size_t idx, obj_t obj) {      \
+  *FUNC ## _getptr(list, idx) = obj;                                           \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _insert(list_t *list, iter_t *it, obj_t obj) {   \
+  node_t *node = it->node, *half;                                              \
+  size_t i = it->i, h = (B) / 2;                                               \
+  obj_t *w;                                                                    \
+  if(node == NULL) {                                                           \
+    FUNC ## _push(list, obj);                                                  \
+    it->node = list->last;                                                     \
+    it->i = list->last->n - 1;                                                 \
+    return;                                                                    \
+  }                                                                            \
+  assert(i < node->n);                                                         \
+  if(node->n == (B)) {                                                         \
+    /* split: move the upper half to a new node */                             \
+    half = FUNC ## _node_new(list, node, 0);                                   \
+    memcpy(half->b, node->b + h, ((B) - h) * sizeof(obj_t));                   \
+    half->n = (B) - h;                                                         \
+    node->n = h;                                                               \
+    if(i > h) { node = half; i -= h; }                                         \
+  }                                                                            \
+  /* open a gap at i, moving the shorter side if both ends have room */        \
+  w = node->b + node->start;                                                   \
+  if(node->start > 0 && (i < node->n / 2 || node->start + node->n == (B))) {   \
+    memmove(w - 1, w, i * sizeof(obj_t));                                      \
+    node->start--;                                                             \
+  }                                                                            \
+  else memmove(w + i + 1, w + i, (node->n - i) * sizeof(obj_t));               \
+  node->b[node->start + i] = obj;                                              \
+  node->n++;                                                                   \
+  list->len++;                                                                 \
+  it->node = node;                                                             \
+  it->i = i;                                                                   \
+}                                                                              \
+                                                                               \
+/* Append next's elements to node and free next */                             \
+static inline void    FUNC ## _merge(list_t *list, node_t *node) {             \
+  node_t *next = node->next;                                                   \
+  if(node->start + node->n + next->n > (B)) {                                  \
+    memmove(node->b, node->b + node->start, node->n * sizeof(obj_t));          \
+    node->start = 0;                                                           \
+  }                                                                            \
+  memcpy(node->b + node->start + node->n, next->b + next->start,               \
+         next->n * sizeof(obj_t));                                             \
+  node->n += next->n;                                                          \
+  FUNC ## _node_free(list, next);                                              \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _erase(list_t *list, iter_t *it) {               \
+  node_t *node = it->node, *prev;                                              \
+  size_t i = it->i;                                                            \
+  obj_t *w;                                                                    \
+  assert(node && i < node->n);                                                 \
+  w = node->b + node->start;                                                   \
+  if(i < node->n / 2) {                                                        \
+    memmove(w + 1, w, i * sizeof(obj_t));                                      \
+    node->start++;                                                             \
+  }                                                                            \
+  else memmove(w + i, w + i + 1, (node->n - i - 1) * sizeof(obj_t));           \
+  node->n--;                                                                   \
+  list->len--;                                                                 \
+  if(node->n == 0) {                                                           \
+    it->node = node->next;                                                     \
+    it->i = 0;                                                                 \
+    FUNC ## _node_free(list, node);                                            \
+    return;                                                                    \
+  }                                                                            \
+  if(node->n < (B) / 4) {                                                      \
+    /* merge with a neighbour if the result is at most 3/4 full */             \
+    prev = node->prev;                                                         \
+    if(node->next && node->n + node->next->n <= 3 * (B) / 4) {                 \
+      FUNC ## _merge(list, node);                                              \
+    }                                                                          \
+    else if(prev && prev->n + node->n <= 3 * (B) / 4) {                        \
+      i += prev->n;                                                            \
+      FUNC ## _merge(list, prev);                                              \
+      node = prev;                                                             \
+    }                                                                          \
+  }                                                                            \
+  if(i == node->n) { node = node->next; i = 0; }                               \
+  it->node = node;                                                             \
+  it->i = i;                                                                   \
+}                                                                              \
+                                                                               \
+static inline void    FUNC ## _insert_at(list_t *list, size_t idx, obj_t obj) {\
+  iter_t it;                                                                   \
+  FUNC ## _seek(list, &it, idx);                                               \
+  FUNC ## _insert(list, &it, obj);                                             \
+}                                                                              \
+                                                                               \
+static inline obj_t   FUNC ## _remove_at(list_t *list, size_t idx) {           \
+  iter_t it;                                                                   \
+  obj_t obj;                                                                   \
+  assert(idx < list->len);                                                     \
+  FUNC ## _seek(list, &it, idx);                                               \
+  obj = *FUNC ## _iter_ptr(&it);                                               \
+  FUNC ## _erase(list, &it);                                                   \
+  return obj;                                                                  \
+}                                                                              \
+
+#endif /* MADCROW_UNROLLED_H_ */
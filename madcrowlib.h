@@ -1,3 +1,4 @@
 #include "madcrow_buffer.h"
 #include "madcrow_list.h"
 #include "madcrow_linkedlist.h"
+#include "madcrow_ring.h"
@@ -1,18 +1,127 @@
+#define _GNU_SOURCE // mremap
 #include <stdlib.h>
 #include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h> // setrlimit
+#include <sys/wait.h>
 
 // #define MC_CALLOC  calloc2
 // #define MC_REALLOC realloc2
 
 #include "madcrow_list.h"
 madcrow_list(list,SizeList,size_t);
+madcrow_list_arena(alist,ArenaSizeList,size_t);
+madcrow_list_incr(ilist,IncrSizeList,size_t);
+madcrow_list_autoshrink(shlist,ShrinkSizeList,size_t);
 
 #include "madcrow_buffer.h"
 madcrow_buffer(buf,SizeBuffer,size_t);
 madcrow_buffer_wipe(zbuf,ZeroSizeBuffer,size_t);
+madcrow_buffer_wipe_pages(pzbuf,PageZeroSizeBuffer,size_t);
+madcrow_buffer_lazy(lbuf,LazySizeBuffer,size_t);
+madcrow_buffer_autoshrink(shbuf,ShrinkSizeBuffer,size_t);
+madcrow_buffer_sbo(sbuf,SboBuffer,size_t,8);
+madcrow_buffer_arena(abuf,ArenaSizeBuffer,size_t);
+madcrow_buffer_incr(ibuf,IncrSizeBuffer,size_t);
+madcrow_buffer_incr(iu8buf,IncrU8Buffer,uint8_t);
+madcrow_buffer(u8buf,U8Buffer,uint8_t);
+madcrow_buffer(u16buf,U16Buffer,uint16_t);
+madcrow_buffer(u32buf,U32Buffer,uint32_t);
+typedef struct { uint8_t x[3]; } Rgb;
+madcrow_buffer(rgbbuf,RgbBuffer,Rgb);
+
+typedef struct { int32_t key; uint32_t order; } Pair;
+madcrow_buffer(pairbuf,PairBuffer,Pair);
+
+#define MC_SORT_MT_THRESHOLD 1000
+#include "madcrow_sort.h"
+#define pair_key(p) MC_SORT_KEY_SIGNED((p).key)
+madcrow_buffer_sort(buf,SizeBuffer,size_t,MC_SORT_KEY);
+madcrow_buffer_sort(u16buf,U16Buffer,uint16_t,MC_SORT_KEY);
+madcrow_buffer_sort(pairbuf,PairBuffer,Pair,pair_key);
+madcrow_list_sort(list,SizeList,size_t,MC_SORT_KEY);
+madcrow_buffer_sort(abuf,ArenaSizeBuffer,size_t,MC_SORT_KEY);
+
+// Counts reallocs, to check where sort scratch comes from
+static size_t counted_reallocs = 0;
+static void* counted_realloc(void *ptr, size_t n)
+{
+  counted_reallocs++;
+  return realloc(ptr, n);
+}
+madcrow_buffer2(rbuf,CountedBuffer,size_t,calloc,counted_realloc,free,
+                MC_INIT_MEM_UNDEF);
+madcrow_buffer_sort(rbuf,CountedBuffer,size_t,MC_SORT_KEY);
+
+#include "madcrow_parallel.h"
+madcrow_buffer_parallel(buf,SizeBuffer,size_t);
+madcrow_buffer_parallel(rgbbuf,RgbBuffer,Rgb);
+madcrow_list_parallel(list,SizeList,size_t);
+
+#include "madcrow_chunkbuf.h"
+madcrow_chunkbuf(cbuf,SizeChunkBuffer,size_t);
+madcrow_chunkbuf2(ccbuf,CharChunkBuffer,char,4,calloc,realloc,free);
+
+#include "madcrow_hash.h"
+// hash that keeps low bits of the key so runs collide and wrap around
+#define hash_clump(x) ((uint64_t)(x) << 7 | ((x) & 3))
+madcrow_hash(hmap,SizeMap,size_t,size_t,MC_HASH_INT,MC_HASH_EQ);
+madcrow_hash(cmap,ClumpMap,size_t,size_t,hash_clump,MC_HASH_EQ);
+
+#include "madcrow_bitbuf.h"
+madcrow_bitbuf(bits,BitBuf);
+
+#include "madcrow_heap.h"
+typedef struct { uint64_t time; size_t id; } Timer;
+#define timer_cmp(a,b) MC_HEAP_CMP((a).time, (b).time)
+#define timer_id(t) ((t).id)
+madcrow_heap(sheap,SizeHeap,size_t,MC_HEAP_CMP);
+madcrow_heap2(bheap,BinSizeHeap,size_t,MC_HEAP_CMP,2,calloc,realloc,free);
+madcrow_heap(uheap,U32Heap,uint32_t,MC_HEAP_CMP); // 8-ary
+madcrow_heap_indexed(theap,TimerHeap,Timer,timer_cmp,timer_id);
 
 #include "madcrow_linkedlist.h"
 madcrow_linkedlist(llist,LinkedList,LinkedNode,size_t);
+madcrow_nodepool(lpool,NodePool,llist,LinkedList,LinkedNode,size_t);
+// calloc that fails while failing_allocs is set, to run a pool out of memory
+static int failing_allocs = 0;
+static void* failing_calloc(size_t n, size_t size)
+{
+  return failing_allocs ? NULL : calloc(n, size);
+}
+madcrow_nodepool2(fpool,FailingPool,llist,LinkedList,LinkedNode,size_t,
+                  failing_calloc,free);
+madcrow_linkedlist_sort(llist,LinkedList,LinkedNode,MC_HEAP_CMP);
+
+#include "madcrow_unrolled.h"
+madcrow_unrolled(ulist,SizeUnrolled,SizeUNode,SizeUIter,size_t);
+madcrow_unrolled2(uclist,CharUnrolled,CharUNode,CharUIter,char,8,calloc,free);
+
+#include "madcrow_mpsc.h"
+madcrow_mpsc(mpsc,SizeQueue,LinkedNode);
+
+#include "madcrow_spsc.h"
+madcrow_spsc(spsc,SizePipe,size_t);
+
+#include "madcrow_ring.h"
+madcrow_ring(ring,SizeRing,size_t);
+
+#define MC_MMAP_THRESHOLD 8192
+#include "madcrow_mmap.h"
+madcrow_buffer_mmap(mbuf,MmapSizeBuffer,size_t);
+madcrow_list_mmap(mlist,MmapSizeList,size_t);
+madcrow_buffer_mmap_wipe(mzbuf,MmapZeroSizeBuffer,size_t);
+
+#include "madcrow_save.h"
+madcrow_buffer_save(buf,SizeBuffer,size_t);
+madcrow_buffer_save(u32buf,U32Buffer,uint32_t);
+madcrow_list_save(list,SizeList,size_t);
+madcrow_buffer_save_mmap(mbuf,MmapSizeBuffer,size_t);
+madcrow_list_save_mmap(mlist,MmapSizeList,size_t);
+
+#include "madcrow_filebuf.h"
+madcrow_filebuf(fbuf,FileSizeBuffer,size_t);
 
 static void test_buffer()
 {
@@ -26,6 +135,978 @@ static void test_buffer()
   buf_dealloc(&abuf);
 }
 
+static void test_buffer_lazy()
+{
+  size_t i, j, tmp[4];
+  LazySizeBuffer abuf;
+  lbuf_alloc(&abuf, 64);
+  // only lazy buffers carry head
+  assert(sizeof(LazySizeBuffer) == sizeof(SizeBuffer) + sizeof(size_t));
+
+  // shift only moves b, the allocation is reused when the prefix gets large
+  for(i = 0; i < 48; i++) lbuf_add(&abuf, i);
+  lbuf_shift(&abuf, tmp, 4);
+  for(i = 0; i < 4; i++) assert(tmp[i] == i);
+  assert(abuf.head == 4 && abuf.len == 44);
+  for(i = 0; i < abuf.len; i++) assert(abuf.b[i] == i+4);
+
+  // unshift reuses the dead prefix
+  lbuf_unshift(&abuf, tmp+2, 2);
+  assert(abuf.head == 2 && abuf.len == 46);
+  for(i = 0; i < abuf.len; i++) assert(lbuf_get(&abuf, i) == i+2);
+  madcrow_buffer_lazy_verify(&abuf);
+
+  // compacting once half the allocation is dead
+  for(j = 0; j < 7; j++) lbuf_shift(&abuf, NULL, 4);
+  assert(abuf.head == 30 && lbuf_get(&abuf, 0) == 30);
+  lbuf_shift(&abuf, NULL, 4);
+  assert(abuf.head == 0 && abuf.len == 14);
+  for(i = 0; i < abuf.len; i++) assert(abuf.b[i] == i+34);
+
+  // growing compacts before reallocating
+  lbuf_shift(&abuf, NULL, 4);
+  for(i = 0; i < 54; i++) lbuf_add(&abuf, i+48);
+  assert(abuf.head == 0 && abuf.size == 64 && abuf.len == 64);
+  for(i = 0; i < abuf.len; i++) assert(abuf.b[i] == i+38);
+
+  // streaming from the front only grows once, to fit len+1
+  for(i = 0; i < 1000; i++) {
+    lbuf_add(&abuf, i);
+    assert(lbuf_get(&abuf, 0) == (i < 64 ? i+38 : i-64));
+    lbuf_shift(&abuf, NULL, 1);
+  }
+  assert(abuf.len == 64 && abuf.head + abuf.size == 128);
+
+  // growing past the whole allocation copies the elements to a new array
+  lbuf_reset(&abuf);
+  for(i = 0; i < 100; i++) lbuf_add(&abuf, i);
+  lbuf_shift(&abuf, NULL, 10);
+  assert(abuf.head == 10 && abuf.head + abuf.size == 128);
+  lbuf_reserve(&abuf, 100);
+  assert(abuf.head == 0 && abuf.size == 256 && abuf.len == 90);
+  for(i = 0; i < abuf.len; i++) assert(abuf.b[i] == i+10);
+
+  lbuf_dealloc(&abuf);
+}
+
+static void test_buffer_sbo()
+{
+  size_t i, tmp[4];
+  SboBuffer abuf = madcrow_buffer_init, bbuf;
+
+  // starts inline when first used
+  sbuf_add(&abuf, 0);
+  assert(abuf.b == abuf.inl && abuf.size == 8);
+  for(i = 1; i < 8; i++) sbuf_add(&abuf, i);
+  assert(abuf.b == abuf.inl && abuf.len == 8);
+  sbuf_shift(&abuf, tmp, 2);
+  sbuf_unshift(&abuf, tmp, 2);
+  sbuf_pop(&abuf, tmp, 1);
+  sbuf_push(&abuf, tmp, 1);
+  for(i = 0; i < 8; i++) assert(sbuf_get(&abuf, i) == i && *sbuf_getptr(&abuf, i) == i);
+
+  // moves to the heap when it overflows
+  sbuf_add(&abuf, 8);
+  assert(abuf.b != abuf.inl && abuf.size == 16);
+  for(i = 9; i < 100; i++) sbuf_add(&abuf, i);
+  for(i = 0; i < 100; i++) assert(sbuf_get(&abuf, i) == i);
+  assert(sbuf_find(&abuf, 50) == 50);
+
+  // copying into a small buffer
+  sbuf_alloc(&bbuf, 4);
+  assert(bbuf.b == bbuf.inl);
+  sbuf_copy(&bbuf, &abuf);
+  assert(bbuf.b != bbuf.inl && bbuf.len == 100);
+  for(i = 0; i < 100; i++) assert(sbuf_get(&bbuf, i) == i);
+  sbuf_dealloc(&bbuf);
+  sbuf_alloc(&bbuf, 4);
+  abuf.len = 3;
+  sbuf_copy(&bbuf, &abuf);
+  assert(bbuf.b == bbuf.inl && bbuf.len == 3 && bbuf.b[2] == 2);
+  sbuf_dealloc(&bbuf);
+
+  // large initial capacity goes straight to the heap
+  sbuf_dealloc(&abuf);
+  sbuf_alloc(&abuf, 9);
+  assert(abuf.b != abuf.inl && abuf.size == 9);
+  sbuf_dealloc(&abuf);
+  assert(abuf.b == NULL && abuf.size == 0);
+}
+
+static void test_arena()
+{
+  size_t i, *p, *q;
+  mc_arena_t arena;
+  mc_arena_alloc(&arena, 1024);
+
+  // raw arena: last allocation grows in place, others are copied
+  p = mc_arena_calloc(&arena, 4, sizeof(size_t));
+  for(i = 0; i < 4; i++) assert(p[i] == 0);
+  p[3] = 3;
+  q = mc_arena_realloc(&arena, p, 4*sizeof(size_t), 8*sizeof(size_t));
+  assert(q == p && q[3] == 3);
+  q = mc_arena_calloc(&arena, 1, sizeof(size_t));
+  p = mc_arena_realloc(&arena, p, 8*sizeof(size_t), 16*sizeof(size_t));
+  assert(p != q && p[3] == 3 && (uintptr_t)p % MC_ARENA_ALIGN == 0);
+  mc_arena_free(&arena, p, 16*sizeof(size_t));
+  assert(mc_arena_calloc(&arena, 1, 1) == p);
+  // larger than a block
+  p = mc_arena_calloc(&arena, 4096, sizeof(size_t));
+  assert(p != NULL && p[4095] == 0);
+  mc_arena_reset(&arena);
+  assert(arena.block != NULL && arena.block->prev == NULL && arena.used == 0);
+
+  // buffer appending grows in place while it is the last allocation
+  ArenaSizeBuffer abuf = madcrow_buffer_ctx_init(&arena), bbuf;
+  abuf_alloc(&abuf, 8);
+  p = abuf.b;
+  for(i = 0; i < 64; i++) abuf_add(&abuf, i);
+  assert(abuf.b == p && abuf.len == 64);
+  bbuf.ctx = &arena;
+  abuf_alloc(&bbuf, 8);
+  for(i = 0; i < 1000; i++) abuf_add(&abuf, i);
+  assert(abuf.b != p && abuf.len == 1064);
+  for(i = 0; i < 64; i++) assert(abuf_get(&abuf, i) == i);
+  for(i = 0; i < 1000; i++) assert(abuf_get(&abuf, 64+i) == i);
+  abuf_copy(&bbuf, &abuf);
+  assert(bbuf.len == 1064 && abuf_get(&bbuf, 1063) == 999);
+  abuf_dealloc(&bbuf);
+  assert(bbuf.b == NULL && bbuf.ctx == &arena);
+
+  // list in the same arena
+  ArenaSizeList alist = madcrow_list_ctx_init(&arena);
+  alist_alloc(&alist, 8);
+  for(i = 0; i < 100; i++) { alist_append(&alist, i); alist_prepend(&alist, i); }
+  assert(alist_len(&alist) == 200);
+  for(i = 0; i < 100; i++) {
+    assert(alist_get(&alist, i) == 99-i && alist_get(&alist, 100+i) == i);
+  }
+
+  // NULL context falls back to calloc/realloc/free
+  ArenaSizeBuffer *cbuf = abuf_new(4);
+  assert(cbuf->ctx == NULL);
+  for(i = 0; i < 100; i++) abuf_add(cbuf, i);
+  assert(abuf_get(cbuf, 99) == 99);
+  abuf_destroy(cbuf);
+
+  // abuf and alist are freed with the arena
+  mc_arena_dealloc(&arena);
+  assert(arena.block == NULL);
+}
+
+static void test_shrink()
+{
+  size_t i, tmp[8], n = 10000, minlen = MC_SHRINK_MIN / sizeof(size_t);
+  SizeBuffer abuf;
+  LazySizeBuffer lazybuf;
+  SboBuffer sbobuf = madcrow_buffer_init;
+  SizeList alist;
+  ShrinkSizeBuffer shbuf;
+  ShrinkSizeList shlist;
+
+  // only the autoshrink generators carry a policy
+  assert(sizeof(SizeBuffer) == 3 * sizeof(size_t));
+  assert(sizeof(SizeList) == 4 * sizeof(size_t));
+  assert(sizeof(ShrinkSizeBuffer) > sizeof(SizeBuffer));
+
+  buf_alloc(&abuf, 8);
+  for(i = 0; i < n; i++) buf_add(&abuf, i);
+  buf_pop(&abuf, NULL, n-10);
+  assert(abuf.size >= n);
+  buf_shrink_to_fit(&abuf);
+  assert(abuf.size == 10 && abuf.len == 10 && abuf.b[9] == 9);
+  buf_add(&abuf, 10);
+  assert(abuf.size == 16 && abuf.b[10] == 10);
+  abuf.len = 0;
+  buf_shrink_to_fit(&abuf);
+  assert(abuf.b == NULL && abuf.size == 0);
+  buf_add(&abuf, 1);
+  assert(abuf.len == 1 && abuf.b[0] == 1);
+
+  // auto-shrink only after 4 consecutive low removals
+  buf_dealloc(&abuf);
+  shbuf_alloc(&shbuf, 8);
+  shbuf_autoshrink(&shbuf, 4);
+  for(i = 0; i < n; i++) shbuf_add(&shbuf, i);
+  size_t peak = shbuf.size;
+  for(i = 0; i < 3; i++) shbuf_pop(&shbuf, NULL, (n-100)/3);
+  assert(shbuf.size == peak);
+  shbuf_remove(&shbuf);
+  shbuf_add(&shbuf, 0); // adding does not reset the count
+  shbuf_add(&shbuf, 0);
+  shbuf_remove(&shbuf);
+  assert(shbuf.size == minlen);
+  for(i = 0; i < shbuf.len - 1; i++) assert(shbuf.b[i] == i);
+  // a long-lived buffer that is reset with a small load follows it down
+  for(i = 0; i < 8; i++) {
+    shbuf_push_zero(&shbuf, n);
+    shbuf_reset(&shbuf);
+  }
+  assert(shbuf.size > minlen);
+  for(i = 0; i < 4; i++) { shbuf_push_zero(&shbuf, 10); shbuf_reset(&shbuf); }
+  assert(shbuf.size == minlen);
+  shbuf_autoshrink(&shbuf, 0);
+  shbuf_push_zero(&shbuf, n);
+  for(i = 0; i < 10; i++) shbuf_reset(&shbuf);
+  assert(shbuf.size >= n);
+  shbuf_dealloc(&shbuf);
+
+  // lazy buffers compact before shrinking
+  lbuf_alloc(&lazybuf, 8);
+  for(i = 0; i < 100; i++) lbuf_add(&lazybuf, i);
+  lbuf_shift(&lazybuf, tmp, 8);
+  assert(lazybuf.head > 0);
+  lbuf_shrink_to_fit(&lazybuf);
+  assert(lazybuf.head == 0 && lazybuf.size == 92 && lazybuf.b[0] == 8);
+  lbuf_dealloc(&lazybuf);
+
+  // sbo buffers go back to inline storage
+  for(i = 0; i < 100; i++) sbuf_add(&sbobuf, i);
+  sbuf_pop(&sbobuf, NULL, 95);
+  sbuf_shrink_to_fit(&sbobuf);
+  assert(sbobuf.b == sbobuf.inl && sbobuf.size == 8 && sbobuf.b[4] == 4);
+  sbuf_shrink_to_fit(&sbobuf);
+  assert(sbobuf.b == sbobuf.inl);
+  sbuf_dealloc(&sbobuf);
+
+  // lists recentre their window
+  list_alloc(&alist, 8);
+  for(i = 0; i < n; i++) list_append(&alist, i);
+  list_shift(&alist, NULL, n-20);
+  list_pop(&alist, NULL, 4);
+  list_shrink_to_fit(&alist);
+  assert(alist.capacity == 16 && alist.start == 0 && alist.end == 16);
+  for(i = 0; i < 16; i++) assert(list_get(&alist, i) == n-20+i);
+  list_append(&alist, 1);
+  list_prepend(&alist, 2);
+  assert(list_len(&alist) == 18 && list_get(&alist, 0) == 2);
+  list_dealloc(&alist);
+
+  // and follow the load back down when autoshrink is on
+  shlist_alloc(&shlist, 8);
+  for(i = 0; i < 18; i++) shlist_append(&shlist, i);
+  shlist_autoshrink(&shlist, 2);
+  for(i = 0; i < n; i++) shlist_append(&shlist, i);
+  for(i = 0; i < n-2; i++) shlist_lcut(&shlist);
+  assert(shlist.capacity == minlen);
+  assert(shlist_len(&shlist) == 20 && shlist_get(&shlist, 19) == n-1);
+  shlist_dealloc(&shlist);
+}
+
+static void test_buffer_incr()
+{
+  IncrSizeBuffer ib;
+  IncrU8Buffer ib8;
+  SizeBuffer ref;
+  size_t i, j, x, tmp[5];
+
+  // Grow from 8: the old array is drained mc_incr_step() elements per add
+  ibuf_alloc(&ib, 0);
+  assert(ib.size == 8 && ib.old == NULL);
+  for(i = 0; i < 8; i++) assert(ibuf_add(&ib, i) == i);
+  ibuf_add(&ib, 8);
+  assert(ib.size == 16 && ib.old != NULL && ib.lo == 0 && ib.hi == 8);
+  for(i = 0; i < 9; i++) assert(ibuf_get(&ib, i) == i);
+  ibuf_set(&ib, 3, 30); // still in old
+  assert(*ibuf_getptr(&ib, 3) == 30 && ib.old[3] == 30);
+  ibuf_add(&ib, 9); // step of 32 finishes it
+  assert(ib.old == NULL && ib.b[3] == 30 && ib.b[8] == 8);
+  ibuf_reset(&ib);
+  assert(ibuf_len(&ib) == 0);
+
+  // 1 byte elements migrate 256 at a time, 2 byte elements take longer
+  iu8buf_alloc(&ib8, 256);
+  for(i = 0; i < 257; i++) iu8buf_add(&ib8, (uint8_t)i);
+  assert(ib8.size == 512 && ib8.old != NULL);
+  iu8buf_add(&ib8, 0);
+  assert(ib8.old == NULL);
+  for(i = 0; i < 257; i++) assert(ib8.b[i] == (uint8_t)i);
+  iu8buf_dealloc(&ib8);
+
+  // push migrates n steps at once, then copies the new elements in
+  for(i = 0; i < 129; i++) ibuf_add(&ib, i);
+  assert(ib.size == 256 && ib.old != NULL && ib.lo == 0 && ib.hi == 128);
+  ibuf_push(&ib, (size_t[]){129, 130}, 2);
+  assert(ib.old != NULL && ib.lo == 2 * mc_incr_step(sizeof(size_t)));
+  ibuf_getn(&ib, 60, tmp, 5); // spans b and old
+  for(j = 0; j < 5; j++) assert(tmp[j] == 60 + j);
+  ibuf_setn(&ib, 60, (size_t[]){1, 2, 3, 4, 5}, 5);
+  assert(ib.b[63] == 4 && ib.old[64] == 5);
+  ibuf_setn(&ib, 60, (size_t[]){60, 61, 62, 63, 64}, 5);
+  // growing past a migration finishes it first
+  size_t *big = malloc(300 * sizeof(size_t));
+  for(j = 0; j < 300; j++) big[j] = 131 + j;
+  assert(ibuf_push(&ib, big, 300) == 131);
+  assert(ib.size == 512 && ib.old == NULL);
+  size_t *rsv = ibuf_reserve(&ib, 10);
+  for(j = 0; j < 10; j++) rsv[j] = 431 + j;
+  ibuf_commit(&ib, 10);
+  for(j = 0; j < 441; j++) assert(ibuf_get(&ib, j) == j);
+  free(big);
+  ibuf_reset(&ib);
+
+  // Random adds/removes/sets against a normal buffer; removing past lo
+  // while migrating must not leave old elements behind
+  buf_alloc(&ref, 8);
+  for(i = 0; i < 20000; i++) {
+    x = (size_t)rand();
+    if(x % 10 < 5 || ref.len == 0) {
+      assert(ibuf_add(&ib, i) == buf_add(&ref, i));
+    } else if(x % 10 == 5) {
+      assert(ibuf_remove(&ib) == buf_remove(&ref));
+    } else if(x % 10 == 6) {
+      j = (x >> 8) % ref.len;
+      ibuf_set(&ib, j, x); buf_set(&ref, j, x);
+    } else if(x % 10 == 7) {
+      tmp[0] = i; tmp[1] = x; tmp[2] = i+1;
+      assert(ibuf_push(&ib, tmp, 3) == buf_push(&ref, tmp, 3));
+    } else if(x % 10 == 8 && ref.len >= 5) {
+      j = (x >> 8) % (ref.len - 4);
+      ibuf_getn(&ib, j, tmp, 5);
+      assert(memcmp(tmp, ref.b + j, sizeof(tmp)) == 0);
+      for(x = 0; x < 5; x++) tmp[x] = i + x;
+      ibuf_setn(&ib, j, tmp, 5); buf_setn(&ref, j, tmp, 5);
+    } else if(ref.len >= 5) {
+      ibuf_pop(&ib, tmp, 5);
+      for(j = 0; j < 5; j++) assert(tmp[j] == ref.b[ref.len-5+j]);
+      buf_pop(&ref, NULL, 5);
+    }
+    assert(ibuf_len(&ib) == ref.len && ib.len <= ib.size);
+    assert(ib.old || (ib.lo == 0 && ib.hi == 0));
+    assert(ib.lo <= ib.hi && ib.hi <= ib.len);
+    if(i % 97 == 0)
+      for(j = 0; j < ref.len; j++) assert(ibuf_get(&ib, j) == ref.b[j]);
+  }
+  big = malloc(ref.len * sizeof(size_t));
+  memcpy(big, ref.b, ref.len * sizeof(size_t));
+  ibuf_push(&ib, big, ref.len);
+  buf_push(&ref, big, ref.len);
+  free(big);
+  ibuf_flush(&ib);
+  assert(ib.old == NULL && memcmp(ib.b, ref.b, ref.len*sizeof(size_t)) == 0);
+  buf_dealloc(&ref);
+  ibuf_dealloc(&ib);
+
+  // A zeroed struct works without _alloc
+  memset(&ib, 0, sizeof(ib));
+  for(i = 0; i < 100; i++) ibuf_add(&ib, i);
+  for(i = 100; i > 0; i--) assert(ibuf_remove(&ib) == i-1);
+  ibuf_dealloc(&ib);
+}
+
+static void test_chunkbuf()
+{
+  size_t i, n = 100000, *ptrs[4], tmp[100];
+  SizeChunkBuffer abuf = madcrow_chunkbuf_init;
+
+  // pointers stay valid as it grows
+  for(i = 0; i < 4; i++) cbuf_add(&abuf, i);
+  for(i = 0; i < 4; i++) ptrs[i] = cbuf_getptr(&abuf, i);
+  for(i = 4; i < n; i++) assert(cbuf_add(&abuf, i) == i);
+  assert(cbuf_len(&abuf) == n && abuf.nchunks > 1);
+  for(i = 0; i < 4; i++) assert(ptrs[i] == cbuf_getptr(&abuf, i) && *ptrs[i] == i);
+  for(i = 0; i < n; i++) assert(cbuf_get(&abuf, i) == i);
+
+  // bulk copies across chunk boundaries
+  size_t csize = (size_t)1 << mc_chunkbuf_shift(sizeof(size_t));
+  cbuf_getn(&abuf, csize-50, tmp, 100);
+  for(i = 0; i < 100; i++) assert(tmp[i] == csize-50+i);
+  for(i = 0; i < 100; i++) tmp[i] = i;
+  cbuf_setn(&abuf, csize-50, tmp, 100);
+  assert(cbuf_get(&abuf, csize-50) == 0 && cbuf_get(&abuf, csize+49) == 99);
+  cbuf_pop(&abuf, tmp, 3);
+  assert(tmp[0] == n-3 && tmp[2] == n-1 && cbuf_remove(&abuf) == n-4);
+  size_t nchunks = abuf.nchunks;
+  cbuf_reset(&abuf);
+  assert(cbuf_len(&abuf) == 0 && abuf.nchunks == nchunks);
+  cbuf_dealloc(&abuf);
+
+  // 16 byte chunks, export to iovecs and writev
+  CharChunkBuffer *cb = ccbuf_new(0);
+  const char *str = "the quick brown fox jumps over the lazy dog";
+  size_t len = strlen(str);
+  for(i = 0; i < 5; i++) ccbuf_add(cb, str[i]);
+  ccbuf_push(cb, str+5, len-5);
+  assert(cb->nchunks == 3);
+  struct iovec iov[4];
+  assert(ccbuf_iovec(cb, 0, iov, 4) == 3);
+  assert(iov[0].iov_len == 16 && iov[2].iov_len == len-32);
+  assert(ccbuf_iovec(cb, 20, iov, 4) == 2 && iov[0].iov_len == 12);
+  assert(ccbuf_iovec(cb, 0, iov, 2) == 2);
+  assert(ccbuf_iovec(cb, len, iov, 4) == 0);
+
+  char path[] = "/tmp/madcrow_chunkbuf_XXXXXX", out[64];
+  int fd = mkstemp(path);
+  assert(fd >= 0);
+  unlink(path);
+  assert(writev(fd, iov, ccbuf_iovec(cb, 0, iov, 4)) == (ssize_t)len);
+  assert(pread(fd, out, sizeof(out), 0) == (ssize_t)len);
+  assert(memcmp(out, str, len) == 0);
+  close(fd);
+  ccbuf_destroy(cb);
+}
+
+static void test_buffer_fd()
+{
+  size_t i, n = 20000, *ptr;
+  ssize_t r;
+  char path[] = "/tmp/madcrow_buffer_XXXXXX";
+  int fd = mkstemp(path);
+  assert(fd >= 0);
+  unlink(path);
+
+  // fill in place
+  SizeBuffer abuf, bbuf;
+  buf_alloc(&abuf, 8);
+  buf_alloc(&bbuf, 8);
+  ptr = buf_reserve(&abuf, n);
+  assert(abuf.size >= n && abuf.len == 0);
+  for(i = 0; i < n/2; i++) ptr[i] = i;
+  buf_commit(&abuf, n/2);
+  ptr = buf_reserve(&bbuf, n/2);
+  for(i = 0; i < n/2; i++) ptr[i] = n/2+i;
+  buf_commit(&bbuf, n/2);
+  assert(abuf.len == n/2 && bbuf.len == n/2);
+
+  // write both, read back with read() then readv() spilling past the end
+  SizeBuffer *bufs[2] = {&abuf, &bbuf};
+  assert(buf_writev(bufs, 2, fd) == (ssize_t)n);
+  assert(buf_write(&abuf, fd) == (ssize_t)n/2);
+  assert(lseek(fd, 0, SEEK_SET) == 0);
+
+  LazySizeBuffer lbuf;
+  lbuf_alloc(&lbuf, 16);
+  assert(lbuf_read(&lbuf, fd, 10) == 10);
+  lbuf_shift(&lbuf, NULL, 4); // readv grows with a dead prefix
+  while((r = lbuf_readv(&lbuf, fd)) > 0) {}
+  assert(r == 0 && lbuf.len == n + n/2 - 4);
+  for(i = 0; i < lbuf.len; i++) assert(lbuf.b[i] == (i+4) % n);
+
+  // EOF part way through an element
+  assert(write(fd, "abc", 3) == 3);
+  assert(lseek(fd, -3 - (off_t)sizeof(size_t), SEEK_END) >= 0);
+  buf_reset(&abuf);
+  assert(buf_read(&abuf, fd, 4) == -1 && errno == EIO);
+  assert(abuf.len == 1 && abuf.b[0] == n/2-1);
+
+  close(fd);
+  buf_dealloc(&abuf);
+  buf_dealloc(&bbuf);
+  lbuf_dealloc(&lbuf);
+}
+
+// Check find/rfind/count/find_any against simple loops for every kernel level
+#define TEST_SEARCH(f,buf_t,obj_t,MAKE) do {                                   \
+  size_t i, j, n, c, lvl, len = 1000;                                          \
+  ssize_t first, last, any;                                                    \
+  obj_t x, xs[3];                                                              \
+  buf_t abuf;                                                                  \
+  f##_alloc(&abuf, len);                                                       \
+  for(i = 0; i < len; i++) { x = MAKE((i * 7919) % 97); f##_add(&abuf, x); }  \
+  for(lvl = 0; lvl <= 3; lvl++) {                                              \
+    mc_search_max = lvl;                                                       \
+    for(n = 0; n < len; n = n*3+1) {                                           \
+      abuf.len = n;                                                            \
+      for(j = 0; j < 100; j++) {                                               \
+        x = MAKE(j); xs[0] = MAKE(j+1); xs[1] = MAKE(j+2); xs[2] = x;          \
+        first = last = any = -1; c = 0;                                        \
+        for(i = 0; i < n; i++) {                                               \
+          int eq = !memcmp(&abuf.b[i], &x, sizeof(x));                         \
+          if(eq) { if(first < 0) first = i; last = i; c++; }                   \
+          if(any < 0 && (eq || !memcmp(&abuf.b[i], &xs[0], sizeof(x)) ||       \
+                         !memcmp(&abuf.b[i], &xs[1], sizeof(x)))) any = i;     \
+        }                                                                      \
+        assert(f##_find(&abuf, x) == first);                                   \
+        assert(f##_rfind(&abuf, x) == last);                                   \
+        assert(f##_count(&abuf, x) == c);                                      \
+        assert(f##_find_any(&abuf, xs, 3) == any);                             \
+      }                                                                        \
+    }                                                                          \
+    abuf.len = len;                                                            \
+  }                                                                            \
+  mc_search_max = 3;                                                           \
+  f##_dealloc(&abuf);                                                          \
+} while(0)
+
+#define MAKE_INT(i) (i)
+#define MAKE_RGB(i) ((Rgb){{(uint8_t)(i), 0, (uint8_t)((i)>>8)}})
+
+static void test_search()
+{
+  TEST_SEARCH(u8buf, U8Buffer, uint8_t, MAKE_INT);
+  TEST_SEARCH(u16buf, U16Buffer, uint16_t, MAKE_INT);
+  TEST_SEARCH(u32buf, U32Buffer, uint32_t, MAKE_INT);
+  TEST_SEARCH(buf, SizeBuffer, size_t, MAKE_INT);
+  TEST_SEARCH(rgbbuf, RgbBuffer, Rgb, MAKE_RGB);
+
+  // lists only search between start and end
+  size_t i, tmp[4] = {5, 5, 5, 5};
+  SizeList alist;
+  list_alloc(&alist, 8);
+  for(i = 0; i < 200; i++) list_append(&alist, i % 50);
+  list_unshift(&alist, tmp, 4);
+  list_push(&alist, tmp, 4);
+  list_shift(&alist, NULL, 4);
+  list_pop(&alist, NULL, 4);
+  assert(list_find(&alist, 5) == 5);
+  assert(list_rfind(&alist, 5) == 155);
+  assert(list_count(&alist, 5) == 4);
+  assert(list_find(&alist, 50) == -1);
+  tmp[0] = 60; tmp[1] = 49;
+  assert(list_find_any(&alist, tmp, 2) == 49);
+  alist.b[alist.start-1] = 77; // outside the window
+  alist.b[alist.end] = 77;
+  assert(list_find(&alist, 77) == -1 && list_count(&alist, 77) == 0);
+  list_dealloc(&alist);
+}
+
+static int cmp_size(const void *a, const void *b)
+{
+  size_t x = *(const size_t*)a, y = *(const size_t*)b;
+  return x < y ? -1 : x > y;
+}
+
+static void test_sort()
+{
+  size_t i, n = 50000, *copy = malloc(n * sizeof(size_t));
+  uint64_t r = 88172645463325252ULL;
+  SizeBuffer abuf;
+  buf_alloc(&abuf, n);
+
+  // single and multithreaded give the same order as qsort
+  for(i = 0; i < n; i++) {
+    r ^= r << 13; r ^= r >> 7; r ^= r << 17;
+    buf_add(&abuf, i % 3 ? r : r % 1000);
+  }
+  memcpy(copy, abuf.b, n * sizeof(size_t));
+  qsort(copy, n, sizeof(size_t), cmp_size);
+  assert(buf_sort(&abuf) == 0);
+  assert(memcmp(abuf.b, copy, n * sizeof(size_t)) == 0);
+  for(i = 0; i < n; i++) abuf.b[i] = copy[(i * 7919) % n];
+  assert(buf_sort_mt(&abuf, 3) == 0);
+  assert(memcmp(abuf.b, copy, n * sizeof(size_t)) == 0);
+
+  // bounds
+  assert(buf_lower_bound(&abuf, 0) == 0);
+  assert(buf_upper_bound(&abuf, SIZE_MAX) == n);
+  for(i = 0; i < 1000; i += 37) {
+    size_t lo = buf_lower_bound(&abuf, i), hi = buf_upper_bound(&abuf, i);
+    assert(lo <= hi && (lo == 0 || abuf.b[lo-1] < i));
+    assert(hi == n || abuf.b[hi] > i);
+    assert(hi - lo == buf_count(&abuf, i));
+    ssize_t j = buf_bsearch(&abuf, i);
+    assert(lo == hi ? j == -1 : (lo <= (size_t)j && (size_t)j < hi));
+  }
+  buf_dealloc(&abuf);
+  free(copy);
+
+  // small keys, empty and single element buffers
+  U16Buffer sbuf;
+  u16buf_alloc(&sbuf, 8);
+  assert(u16buf_sort(&sbuf) == 0);
+  for(i = 0; i < 3000; i++) u16buf_add(&sbuf, (uint16_t)(65535 - i * 31));
+  assert(u16buf_sort_mt(&sbuf, 4) == 0);
+  for(i = 1; i < sbuf.len; i++) assert(sbuf.b[i-1] <= sbuf.b[i]);
+  u16buf_dealloc(&sbuf);
+
+  // signed keys in structs, stable
+  PairBuffer pbuf;
+  pairbuf_alloc(&pbuf, 8);
+  for(i = 0; i < 2000; i++) pairbuf_add(&pbuf, (Pair){(int32_t)(i % 21) - 10, i});
+  assert(pairbuf_sort_mt(&pbuf, 2) == 0);
+  for(i = 1; i < pbuf.len; i++) {
+    assert(pbuf.b[i-1].key <= pbuf.b[i].key);
+    if(pbuf.b[i-1].key == pbuf.b[i].key)
+      assert(pbuf.b[i-1].order < pbuf.b[i].order);
+  }
+  assert(pbuf.b[pairbuf_bsearch(&pbuf, MC_SORT_KEY_SIGNED(-3))].key == -3);
+  assert(pairbuf_bsearch(&pbuf, MC_SORT_KEY_SIGNED(11)) == -1);
+  pairbuf_dealloc(&pbuf);
+
+  // lists only sort between start and end
+  size_t tmp[2] = {100, 0};
+  SizeList alist;
+  list_alloc(&alist, 8);
+  for(i = 0; i < 20; i++) list_append(&alist, 20 - i);
+  list_unshift(&alist, tmp, 2);
+  list_shift(&alist, NULL, 2);
+  list_sort(&alist);
+  for(i = 0; i < 20; i++) assert(list_get(&alist, i) == i+1);
+  assert(alist.b[alist.start-1] == 0 && alist.b[alist.start-2] == 100);
+  assert(list_lower_bound(&alist, 5) == 4 && list_upper_bound(&alist, 5) == 5);
+  list_dealloc(&alist);
+
+  // scratch comes from the container's allocator, not calloc
+  CountedBuffer cbuf;
+  rbuf_alloc(&cbuf, 3000);
+  for(i = 0; i < 3000; i++) rbuf_add(&cbuf, 3000 - i);
+  counted_reallocs = 0;
+  assert(rbuf_sort(&cbuf) == 0 && counted_reallocs == 1);
+  for(i = 0; i < 3000; i++) assert(cbuf.b[i] == i+1);
+  rbuf_dealloc(&cbuf);
+
+  // and from an arena for arena containers
+  mc_arena_t arena;
+  mc_arena_alloc(&arena, 0);
+  ArenaSizeBuffer arbuf = madcrow_buffer_ctx_init(&arena);
+  abuf_alloc(&arbuf, 8);
+  for(i = 0; i < 1000; i++) abuf_add(&arbuf, (i * 7919) % 1000);
+  assert(arena.last == (char*)arbuf.b);
+  assert(abuf_sort(&arbuf) == 0);
+  assert(arena.last == NULL); // scratch was the last arena allocation, freed
+  for(i = 0; i < 1000; i++) assert(abuf_get(&arbuf, i) == i);
+  mc_arena_dealloc(&arena);
+}
+
+static void par_set_idx(size_t *ptr, size_t n, size_t idx, void *ctx)
+{
+  size_t i;
+  // chunks after the first start on a cache line
+  assert(idx == 0 || (uintptr_t)ptr % MC_CACHE_LINE == 0);
+  // uneven work, more towards the end
+  for(i = 0; i < n; i++) ptr[i] = (idx + i) * *(size_t*)ctx;
+  if(idx > 90000) sched_yield();
+}
+
+static void par_sum(void *acc, const size_t *ptr, size_t n, size_t idx,
+                    void *ctx)
+{
+  size_t i, sum = 0;
+  (void)idx; (void)ctx;
+  for(i = 0; i < n; i++) sum += ptr[i];
+  *(size_t*)acc += sum;
+}
+
+static void par_merge(void *acc, const void *part, void *ctx)
+{
+  (void)ctx;
+  *(size_t*)acc += *(const size_t*)part;
+}
+
+static void test_parallel()
+{
+  size_t i, n = 100000, mul = 3, sum;
+  mc_pool_t pool;
+  assert(mc_pool_alloc(&pool, 4) == 0);
+  assert(pool.nthreads == 4);
+  pool.chunk_bytes = 256; // lots of chunks to share out
+
+  SizeBuffer abuf;
+  buf_alloc(&abuf, n);
+  abuf.len = n;
+  buf_parallel_for(&pool, &abuf, par_set_idx, &mul);
+  for(i = 0; i < n; i++) assert(abuf.b[i] == i*3);
+  sum = 0;
+  assert(buf_parallel_reduce(&pool, &abuf, &sum, sizeof(sum),
+                             par_sum, par_merge, NULL) == 0);
+  assert(sum == 3 * (n * (n-1) / 2));
+  buf_parallel_fill(&pool, &abuf, 7);
+  for(i = 0; i < n; i++) assert(abuf.b[i] == 7);
+
+  // NULL pool and an unaligned start run the same way
+  abuf.b++; abuf.len--;
+  buf_parallel_for(NULL, &abuf, par_set_idx, &mul);
+  sum = 0;
+  assert(buf_parallel_reduce(NULL, &abuf, &sum, sizeof(sum),
+                             par_sum, par_merge, NULL) == 0);
+  assert(sum == 3 * ((n-1) * (n-2) / 2));
+  buf_parallel_fill(&pool, &abuf, 5);
+  assert(abuf.b[-1] == 7 && abuf.b[0] == 5 && abuf.b[n-2] == 5);
+  abuf.b--;
+  buf_dealloc(&abuf);
+
+  // 3 byte elements: chunks are whole numbers of cache lines
+  RgbBuffer cbuf;
+  rgbbuf_alloc(&cbuf, 5000);
+  cbuf.len = 5000;
+  rgbbuf_parallel_fill(&pool, &cbuf, (Rgb){{1,2,3}});
+  for(i = 0; i < cbuf.len; i++) assert(cbuf.b[i].x[0] == 1 && cbuf.b[i].x[2] == 3);
+  rgbbuf_dealloc(&cbuf);
+
+  // lists only use the start..end window
+  SizeList alist;
+  list_alloc(&alist, 8);
+  for(i = 0; i < 1000; i++) { list_append(&alist, 0); list_prepend(&alist, 0); }
+  mul = 1;
+  list_parallel_for(&pool, &alist, par_set_idx, &mul);
+  for(i = 0; i < 2000; i++) assert(list_get(&alist, i) == i);
+  alist.b[alist.start-1] = 99; alist.b[alist.end] = 99;
+  list_parallel_fill(&pool, &alist, 1);
+  sum = 0;
+  list_parallel_reduce(&pool, &alist, &sum, sizeof(sum), par_sum, par_merge, NULL);
+  assert(sum == 2000);
+  assert(alist.b[alist.start-1] == 99 && alist.b[alist.end] == 99);
+  list_dealloc(&alist);
+
+  mc_pool_dealloc(&pool);
+  assert(pool.threads == NULL);
+}
+
+static void test_hash()
+{
+  size_t i, j, k, n, *v, x, ref[2000];
+  int added;
+  SizeMap map;
+  hmap_alloc(&map, 0);
+  assert(map.capacity == MC_HASH_GROUP && hmap_len(&map) == 0);
+  assert(hmap_get(&map, 5) == NULL);
+  assert(hmap_remove(&map, 5, &x) == 0);
+
+  // add, grow, look up
+  for(i = 0; i < 1000; i++) assert(hmap_set(&map, i*7, i) == 1);
+  assert(hmap_len(&map) == 1000);
+  assert(map.len <= mc_hash_max_load(map.capacity));
+  for(i = 0; i < 1000; i++) assert(*hmap_get(&map, i*7) == i);
+  for(i = 0; i < 1000; i++) assert(hmap_get(&map, i*7+1) == NULL);
+  assert(hmap_set(&map, 7, 100) == 0 && *hmap_get(&map, 7) == 100);
+
+  // counting with _add
+  (*hmap_add(&map, 3, &added))++;
+  assert(added && *hmap_get(&map, 3) == 1);
+  (*hmap_add(&map, 3, &added))++;
+  assert(!added && *hmap_get(&map, 3) == 2);
+
+  // iterate over every entry once
+  for(n = 0, i = hmap_next(&map, 0); i < map.capacity; i = hmap_next(&map, i+1))
+    n++;
+  assert(n == hmap_len(&map));
+
+  // remove every other key
+  for(i = 0; i < 1000; i += 2) {
+    assert(hmap_remove(&map, i*7, &x) == 1);
+    assert(x == i);
+  }
+  for(i = 0; i < 1000; i++) {
+    v = hmap_get(&map, i*7);
+    assert(i & 1 ? *v == (i == 1 ? 100 : i) : v == NULL);
+  }
+
+  // reserve does not grow again
+  hmap_reset(&map);
+  assert(hmap_len(&map) == 0 && hmap_get(&map, 7) == NULL);
+  assert(hmap_reserve(&map, 10000) == 0);
+  n = map.capacity;
+  assert(n >= 10000);
+  for(i = 0; i < 10000; i++) hmap_set(&map, i, i);
+  assert(map.capacity == n);
+  hmap_dealloc(&map);
+  assert(map.capacity == 0 && map.ctrl == NULL);
+
+  // random adds and removes with long colliding runs against an array
+  ClumpMap cm;
+  cmap_alloc(&cm, 64);
+  memset(ref, 0, sizeof(ref));
+  for(i = 0, n = 0; i < 50000; i++) {
+    k = rand() % 2000;
+    if(rand() % 3) { n += !ref[k]; ref[k] = i+1; cmap_set(&cm, k, i+1); }
+    else { n -= !!ref[k]; assert(cmap_remove(&cm, k, NULL) == !!ref[k]); ref[k] = 0; }
+    if(i % 1000 == 0) {
+      assert(cmap_len(&cm) == n);
+      for(j = 0; j < 2000; j++) {
+        v = cmap_get(&cm, j);
+        assert(ref[j] ? v && *v == ref[j] : v == NULL);
+      }
+    }
+  }
+  // control bytes past the end copy the first group
+  assert(memcmp(cm.ctrl, cm.ctrl + cm.capacity, MC_HASH_GROUP) == 0);
+  cmap_dealloc(&cm);
+}
+
+static void bits_check(const BitBuf *bb, const char *ref, size_t n)
+{
+  size_t i, c = 0;
+  assert(bits_len(bb) == n);
+  for(i = 0; i < n; i++) { assert(bits_test(bb, i) == ref[i]); c += ref[i]; }
+  assert(bits_count(bb) == c);
+  // bits past the end are zero
+  if(n & 63) assert((bb->w.b[n/64] >> (n & 63)) == 0);
+}
+
+static void test_bitbuf()
+{
+  size_t i, j, k, n = 5000, start, len;
+  char ref[5000], ref2[5000];
+  int level, op;
+  BitBuf a, b;
+  bits_alloc(&a, 0);
+  bits_alloc(&b, 100);
+
+  for(i = 0; i < n; i++) { ref[i] = rand() & 1; bits_add(&a, ref[i]); }
+  bits_check(&a, ref, n);
+
+  // single bits and ranges
+  for(i = 0; i < 2000; i++) {
+    j = rand() % n;
+    switch(rand() % 3) {
+      case 0: bits_set(&a, j); ref[j] = 1; break;
+      case 1: bits_clear(&a, j); ref[j] = 0; break;
+      case 2: bits_toggle(&a, j); ref[j] ^= 1; break;
+    }
+  }
+  bits_check(&a, ref, n);
+  for(i = 0; i < 300; i++) {
+    start = rand() % n;
+    len = rand() % (i < 100 ? 70 : n - start + 1);
+    if(start + len > n) len = n - start;
+    op = rand() % 3;
+    if(op == 0) bits_set_range(&a, start, len);
+    if(op == 1) bits_clear_range(&a, start, len);
+    if(op == 2) bits_toggle_range(&a, start, len);
+    for(j = start; j < start + len; j++) ref[j] = op == 2 ? ref[j] ^ 1 : op == 0;
+  }
+  bits_check(&a, ref, n);
+
+  // bulk ops on every kernel, src shorter and longer than dst
+  for(level = 0; level <= 3; level++) {
+    mc_search_max = level;
+    for(k = 0; k < 8; k++) {
+      size_t nb = k & 1 ? n - 77 : n + 77;
+      bits_reset(&b);
+      bits_resize(&b, nb);
+      for(i = 0; i < nb; i++) if(rand() & 1) bits_set(&b, i);
+      for(i = 0; i < n; i++) ref2[i] = i < nb ? bits_test(&b, i) : 0;
+      if(k / 2 == 0) bits_and(&a, &b);
+      if(k / 2 == 1) bits_or(&a, &b);
+      if(k / 2 == 2) bits_xor(&a, &b);
+      if(k / 2 == 3) bits_andnot(&a, &b);
+      for(i = 0; i < n; i++) {
+        if(k / 2 == 0) ref[i] &= ref2[i];
+        if(k / 2 == 1) ref[i] |= ref2[i];
+        if(k / 2 == 2) ref[i] ^= ref2[i];
+        if(k / 2 == 3) ref[i] &= !ref2[i];
+      }
+      bits_check(&a, ref, n);
+    }
+  }
+  mc_search_max = 3;
+
+  // shrink clears the dropped bits, growing adds zeros
+  bits_set_range(&a, 0, n);
+  bits_resize(&a, 1000);
+  bits_resize(&a, n);
+  for(i = 0; i < n; i++) ref[i] = i < 1000;
+  bits_check(&a, ref, n);
+
+  // rank and select on dense, sparse and empty vectors
+  for(k = 0; k < 3; k++) {
+    for(i = 0; i < n; i++)
+      ref[i] = k == 0 ? rand() % 2 : k == 1 ? rand() % 300 == 0 : 0;
+    bits_reset(&a);
+    for(i = 0; i < n; i++) bits_add(&a, ref[i]);
+    assert(bits_index(&a) == 0);
+    for(i = 0, j = 0; i <= n; i++) {
+      assert(bits_rank(&a, i) == j);
+      if(i < n && ref[i]) { assert(bits_select(&a, j) == i); j++; }
+    }
+    assert(bits_select(&a, j) == n && bits_select(&a, j + 1000) == n);
+  }
+
+  bits_dealloc(&a);
+  bits_dealloc(&b);
+  assert(a.rank == NULL && bits_len(&a) == 0);
+}
+
+static void test_heap()
+{
+  size_t i, j, x, prev, n = 3000, arr[3000];
+  uint32_t u;
+  SizeHeap h;
+  BinSizeHeap bh;
+  U32Heap uh;
+  sheap_alloc(&h, 16);
+  bheap_alloc(&bh, 0);
+  uheap_alloc(&uh, 0);
+  assert(sheap_peek(&h) == NULL && !sheap_pop(&h, &x));
+
+  // push then pop comes out sorted, with duplicates
+  for(i = 0; i < n; i++) {
+    arr[i] = rand() % 1000;
+    sheap_push(&h, arr[i]);
+    bheap_push(&bh, arr[i]);
+    uheap_push(&uh, arr[i]);
+  }
+  assert(sheap_len(&h) == n);
+  // first child of the root (and so every sibling group) starts a cache line
+  assert((uintptr_t)(sheap_peek(&h) + 1) % (4 * sizeof(size_t)) == 0);
+  assert((uintptr_t)(uheap_peek(&uh) + 1) % (8 * sizeof(uint32_t)) == 0);
+  qsort(arr, n, sizeof(size_t), cmp_size);
+  assert(*sheap_peek(&h) == arr[0]);
+  for(i = 0; i < n; i++) {
+    assert(sheap_pop(&h, &x) && x == arr[i]);
+    assert(bheap_pop(&bh, &x) && x == arr[i]);
+    assert(uheap_pop(&uh, &u) && u == arr[i]);
+  }
+  assert(sheap_len(&h) == 0 && !sheap_pop(&h, NULL));
+
+  // interleaved push and pop
+  for(i = 0, prev = 0; i < 10000; i++) {
+    if(rand() % 3) sheap_push(&h, prev + rand() % 100);
+    else if(sheap_pop(&h, &x)) { assert(x >= prev); prev = x; }
+  }
+  while(sheap_pop(&h, &x)) { assert(x >= prev); prev = x; }
+
+  // build from an array, heapify after pushing to the buffer directly
+  for(i = 0; i < n; i++) arr[i] = rand();
+  sheap_build(&h, arr, n);
+  qsort(arr, n, sizeof(size_t), cmp_size);
+  for(i = 0; i < n; i++) assert(sheap_pop(&h, &x) && x == arr[i]);
+  for(j = 0; j < 20; j++) {
+    sheap_reset(&h);
+    sheap_buf_push(&h.buf, arr + n - j, j);
+    sheap_heapify(&h);
+    for(i = 0; i < j; i++) assert(sheap_pop(&h, &x) && x == arr[n - j + i]);
+  }
+  sheap_dealloc(&h);
+  bheap_dealloc(&bh);
+  uheap_dealloc(&uh);
+
+  // indexed: update, decrease and remove timers against an array of times
+  uint64_t times[500];
+  TimerHeap th;
+  Timer t;
+  theap_alloc(&th, 0);
+  for(i = 0; i < 500; i++) {
+    times[i] = rand() % 100000;
+    t.time = times[i]; t.id = i;
+    theap_push(&th, t);
+  }
+  assert(!theap_contains(&th, 500) && theap_get(&th, 500) == NULL);
+  for(i = 0; i < 5000; i++) {
+    j = rand() % 500;
+    t.id = j;
+    if(times[j] == UINT64_MAX) {
+      t.time = times[j] = rand() % 100000;
+      theap_push(&th, t);
+    }
+    else if(rand() % 4 == 0) {
+      assert(theap_remove(&th, j, &t) && t.id == j && t.time == times[j]);
+      assert(!theap_contains(&th, j) && !theap_remove(&th, j, NULL));
+      times[j] = UINT64_MAX;
+    }
+    else if(rand() % 2) {
+      t.time = times[j] = times[j] / 2;
+      theap_decrease(&th, t);
+    }
+    else {
+      t.time = times[j] = rand() % 100000;
+      theap_update(&th, t);
+    }
+    if(times[j] != UINT64_MAX) assert(theap_get(&th, j)->time == times[j]);
+  }
+  for(i = 0, n = 0; i < 500; i++) {
+    if(times[i] != UINT64_MAX) arr[n++] = times[i];
+    assert(theap_contains(&th, i) == (times[i] != UINT64_MAX));
+  }
+  qsort(arr, n, sizeof(size_t), cmp_size);
+  assert(theap_len(&th) == n);
+  for(i = 0; i < n; i++) {
+    assert(theap_pop(&th, &t) && t.time == arr[i] && times[t.id] == t.time);
+    assert(!theap_contains(&th, t.id));
+  }
+  theap_dealloc(&th);
+}
+
 static void test_list()
 {
   size_t i;
@@ -70,6 +1151,384 @@ static void test_list()
   list_dealloc(&alist);
 }
 
+static void test_list_incr()
+{
+  IncrSizeList il;
+  SizeList ref;
+  size_t i, j, x, len, tmp[10];
+
+  // Appending fills the right half then doubles, centring the elements
+  ilist_alloc(&il, 8);
+  for(i = 0; i < 4; i++) ilist_append(&il, i);
+  assert(il.end == 8 && il.old == NULL);
+  ilist_append(&il, 4);
+  assert(il.capacity == 16 && il.old != NULL);
+  assert(il.start == 6 && il.lo == 6 && il.hi == 10 && il.shift == 2);
+  for(i = 0; i < 5; i++) assert(ilist_get(&il, i) == i);
+  assert(ilist_prepend(&il, 100) == 0); // migrates all 4
+  assert(il.old == NULL && ilist_get(&il, 0) == 100 && ilist_get(&il, 4) == 3);
+
+  // Cutting from one end and adding at the other recentres in place
+  ilist_reset(&il);
+  for(i = 0; i < 200; i++) {
+    ilist_append(&il, i);
+    if(i >= 3) assert(ilist_lcut(&il) == i-3);
+  }
+  assert(il.capacity == 16 && ilist_len(&il) == 3);
+  ilist_dealloc(&il);
+
+  // push/unshift migrate n steps at once; getn/setn span both arrays
+  ilist_alloc(&il, 128);
+  for(i = 0; i < 65; i++) ilist_append(&il, i);
+  assert(il.capacity == 256 && il.old != NULL && il.hi - il.lo == 64);
+  assert(ilist_push(&il, (size_t[]){65, 66}, 2) == 65);
+  assert(il.old == NULL);
+  ilist_dealloc(&il);
+  ilist_alloc(&il, 256);
+  for(i = 0; i < 129; i++) ilist_append(&il, i);
+  assert(il.capacity == 512 && il.old != NULL && il.hi - il.lo == 128);
+  assert(ilist_unshift(&il, (size_t[]){1000, 1001}, 2) == 0);
+  assert(il.old != NULL && il.hi - il.lo == 128 - 64);
+  ilist_getn(&il, 60, tmp, 10);
+  for(j = 0; j < 10; j++) assert(tmp[j] == 58 + j);
+  ilist_setn(&il, 0, (size_t[]){7, 8, 9}, 3);
+  ilist_shift(&il, tmp, 3);
+  assert(tmp[0] == 7 && tmp[2] == 9 && ilist_get(&il, 0) == 1);
+  ilist_pop(&il, tmp, 3);
+  assert(tmp[0] == 126 && tmp[2] == 128 && ilist_len(&il) == 125);
+  ilist_dealloc(&il);
+
+  // Random ops at both ends against a normal list
+  list_alloc(&ref, 8);
+  ilist_alloc(&il, 8);
+  for(i = 0; i < 20000; i++) {
+    x = (size_t)rand();
+    len = list_len(&ref);
+    if(x % 12 < 3 || len == 0) {
+      assert(ilist_append(&il, i) == list_append(&ref, i));
+    } else if(x % 12 < 5) {
+      ilist_prepend(&il, i); list_prepend(&ref, i);
+    } else if(x % 12 == 5) {
+      assert(ilist_lcut(&il) == list_lcut(&ref));
+    } else if(x % 12 == 6) {
+      assert(ilist_rcut(&il) == list_rcut(&ref));
+    } else if(x % 12 == 7) {
+      tmp[0] = i; tmp[1] = x; tmp[2] = i+1;
+      assert(ilist_push(&il, tmp, 3) == list_push(&ref, tmp, 3));
+    } else if(x % 12 == 8) {
+      tmp[0] = i; tmp[1] = x; tmp[2] = i+1;
+      ilist_unshift(&il, tmp, 3); list_unshift(&ref, tmp, 3);
+    } else if(x % 12 == 9 && len >= 5) {
+      ilist_shift(&il, tmp, 2); list_shift(&ref, tmp+2, 2);
+      ilist_pop(&il, tmp+4, 1); list_pop(&ref, tmp+5, 1);
+      assert(tmp[0] == tmp[2] && tmp[1] == tmp[3] && tmp[4] == tmp[5]);
+    } else if(x % 12 == 10 && len >= 5) {
+      j = (x >> 8) % (len - 4);
+      ilist_getn(&il, j, tmp, 5);
+      for(x = 0; x < 5; x++) assert(tmp[x] == list_get(&ref, j+x));
+      for(x = 0; x < 5; x++) tmp[x] = i + x;
+      ilist_setn(&il, j, tmp, 5); list_setn(&ref, j, tmp, 5);
+    } else {
+      j = (x >> 8) % len;
+      ilist_set(&il, j, x); list_set(&ref, j, x);
+    }
+    assert(ilist_len(&il) == list_len(&ref));
+    assert(il.start <= il.end && il.end <= il.capacity);
+    assert(il.old || (il.lo == 0 && il.hi == 0));
+    assert(!il.old || (il.lo <= il.hi && il.hi <= il.end));
+    if(i % 97 == 0)
+      for(j = 0; j < list_len(&ref); j++)
+        assert(ilist_get(&il, j) == list_get(&ref, j));
+  }
+  ilist_flush(&il);
+  assert(il.old == NULL);
+  for(j = 0; j < list_len(&ref); j++)
+    assert(il.b[il.start+j] == list_get(&ref, j));
+  list_dealloc(&ref);
+  ilist_dealloc(&il);
+
+  // Mostly cutting from the front while a large array migrates: cut elements
+  // are skipped rather than copied, and old is freed once lo reaches hi
+  ilist_alloc(&il, 8);
+  for(i = 0; !il.old || ilist_len(&il) < (1UL << 16); i++)
+    ilist_append(&il, i);
+  for(x = 0, j = i; il.old; x++) {
+    assert(ilist_lcut(&il) == x);
+    assert(!il.old || (il.lo >= il.start && il.lo <= il.hi));
+    if(x % 4 == 0) ilist_append(&il, j++);
+  }
+  for(len = ilist_len(&il), i = 0; i < len; i++)
+    assert(ilist_get(&il, i) == x + i);
+  assert(x + len == j);
+  ilist_dealloc(&il);
+}
+
+static void test_ring()
+{
+  size_t i, tmp[20];
+  SizeRing aring;
+  ring_alloc(&aring, 8);
+
+  // FIFO through the wrap point never grows the ring
+  for(i = 0; i < 6; i++) ring_append(&aring, i);
+  for(i = 0; i < 100; i++) {
+    ring_append(&aring, i+6);
+    assert(ring_lcut(&aring) == i);
+  }
+  assert(aring.capacity == 8 && ring_len(&aring) == 6);
+  assert(aring.head + aring.len > aring.capacity); // wrapped
+
+  // getn/setn across the wrap point
+  ring_getn(&aring, 0, tmp, 6);
+  for(i = 0; i < 6; i++) assert(tmp[i] == i+100);
+  for(i = 0; i < 6; i++) tmp[i] = i;
+  ring_setn(&aring, 0, tmp, 6);
+  for(i = 0; i < 6; i++) assert(ring_get(&aring, i) == i);
+
+  // grow while wrapped at both ends
+  for(i = 0; i < 10; i++) ring_prepend(&aring, 100+i);
+  for(i = 6; i < 20; i++) ring_append(&aring, i);
+  assert(ring_len(&aring) == 30);
+  for(i = 0; i < 10; i++) assert(ring_get(&aring, i) == 109-i);
+  for(i = 0; i < 20; i++) assert(ring_get(&aring, i+10) == i);
+
+  ring_shift(&aring, tmp, 10);
+  for(i = 0; i < 10; i++) assert(tmp[i] == 109-i);
+  ring_pop(&aring, tmp, 20);
+  for(i = 0; i < 20; i++) assert(tmp[i] == i);
+  assert(ring_len(&aring) == 0);
+
+  ring_dealloc(&aring);
+}
+
+static void test_mmap()
+{
+  size_t i, n = 100000;
+  MmapSizeBuffer abuf;
+  MmapSizeList alist;
+
+  // starts on the heap, moves to a mapping past MC_MMAP_THRESHOLD
+  mbuf_alloc(&abuf, 8);
+  assert(mc_mmap_hdr(abuf.b)->mapsize == 0);
+  for(i = 0; i < n; i++) mbuf_add(&abuf, i);
+  assert(mc_mmap_hdr(abuf.b)->mapsize >= abuf.size * sizeof(size_t));
+  for(i = 0; i < n; i++) assert(abuf.b[i] == i);
+  mbuf_dealloc(&abuf);
+
+  mlist_alloc(&alist, 8);
+  for(i = 0; i < n; i++) mlist_prepend(&alist, i);
+  for(i = 0; i < n; i++) mlist_append(&alist, i);
+  assert(mc_mmap_hdr(alist.b)->mapsize > 0);
+  for(i = 0; i < n; i++) assert(mlist_get(&alist, i) == n-1-i);
+  for(i = 0; i < n; i++) assert(mlist_get(&alist, n+i) == i);
+  mlist_dealloc(&alist);
+}
+
+// Returns 1 if every element of arr is zero
+static int all_zero(const size_t *arr, size_t n)
+{
+  size_t i;
+  for(i = 0; i < n && arr[i] == 0; i++) {}
+  return i == n;
+}
+
+static void test_buffer_wipe_pages()
+{
+  size_t i, n = MC_ZERO_PAGES_THRESHOLD, tmp[4], pagesize = getpagesize();
+  unsigned char resident;
+  PageZeroSizeBuffer abuf;
+  MmapZeroSizeBuffer bbuf;
+
+  // small ranges are memset
+  pzbuf_alloc(&abuf, 8);
+  for(i = 0; i < 8; i++) pzbuf_add(&abuf, i+1);
+  pzbuf_pop(&abuf, tmp, 2);
+  pzbuf_shift(&abuf, tmp, 2);
+  assert(abuf.len == 4 && abuf.b[0] == 3 && all_zero(abuf.b+4, 4));
+  pzbuf_reset(&abuf);
+  assert(all_zero(abuf.b, 8));
+
+  // grown tail and large resets are zeroed, unaligned ends included
+  for(i = 0; i < n; i++) pzbuf_add(&abuf, ~i);
+  pzbuf_capacity(&abuf, 4*n);
+  assert(all_zero(abuf.b+n, abuf.size-n));
+  abuf.b++; abuf.len--; // start part way through a page
+  pzbuf_reset(&abuf);
+  abuf.b--;
+  assert(abuf.b[0] == ~(size_t)0 && all_zero(abuf.b+1, abuf.size-1));
+  // released pages are no longer resident until touched
+  abuf.len = n;
+  for(i = 0; i < n; i++) abuf.b[i] = i+1;
+  pzbuf_reset(&abuf);
+  char *page = (char*)(((uintptr_t)(abuf.b + n/2)) & ~(pagesize-1));
+  assert(mincore(page, pagesize, &resident) == 0 && !(resident & 1));
+  assert(abuf.b[n/2] == 0);
+  pzbuf_dealloc(&abuf);
+
+  // mapped buffer grows with mremap and stays zeroed
+  mzbuf_alloc(&bbuf, 8);
+  for(i = 0; i < n; i++) mzbuf_add(&bbuf, i+1);
+  assert(mc_mmap_hdr(bbuf.b)->mapsize > 0);
+  assert(all_zero(bbuf.b+n, bbuf.size-n));
+  mzbuf_pop(&bbuf, NULL, n/2);
+  assert(all_zero(bbuf.b+n/2, bbuf.size-n/2));
+  mzbuf_reset(&bbuf);
+  assert(all_zero(bbuf.b, bbuf.size));
+  mzbuf_dealloc(&bbuf);
+}
+
+static void test_filebuf()
+{
+  size_t i, n = 10000, tmp[4];
+  char path[] = "/tmp/madcrow_filebuf_XXXXXX";
+  int fd = mkstemp(path);
+  assert(fd >= 0);
+  close(fd);
+
+  FileSizeBuffer abuf = madcrow_filebuf_init;
+  assert(fbuf_open(&abuf, path, MC_FILEBUF_CREATE) == 0);
+  assert(fbuf_len(&abuf) == 0);
+  for(i = 0; i < n; i++) assert(fbuf_add(&abuf, i) == (ssize_t)i);
+  fbuf_pop(&abuf, tmp, 2);
+  assert(tmp[0] == n-2 && tmp[1] == n-1);
+  assert(fbuf_sync(&abuf) == 0);
+  assert(fbuf_close(&abuf) == 0);
+
+  // reopen read-only, data is mapped straight into b
+  assert(fbuf_open(&abuf, path, MC_FILEBUF_RDONLY) == 0);
+  assert(fbuf_len(&abuf) == n-2);
+  for(i = 0; i < n-2; i++) assert(abuf.b[i] == i);
+  assert(fbuf_close(&abuf) == 0);
+
+  // reopen to append
+  assert(fbuf_open(&abuf, path, MC_FILEBUF_RDWR) == 0);
+  fbuf_push(&abuf, tmp, 2);
+  fbuf_getn(&abuf, n-4, tmp, 4);
+  assert(tmp[0] == n-4 && tmp[1] == n-3 && tmp[2] == n-2 && tmp[3] == n-1);
+
+  // a grow whose remap fails leaves the file at its old size. The child
+  // caps its address space just above what it is using
+  struct stat st;
+  assert(fstat(abuf.fd, &st) == 0);
+  fflush(stdout);
+  pid_t pid = fork();
+  assert(pid >= 0);
+  if(pid == 0) {
+    struct rlimit rl;
+    long pages = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if(statm == NULL || fscanf(statm, "%ld", &pages) != 1) _exit(2);
+    fclose(statm);
+    rl.rlim_cur = rl.rlim_max = pages * sysconf(_SC_PAGESIZE) + (1UL << 20);
+    if(setrlimit(RLIMIT_AS, &rl) < 0) _exit(2);
+    int r = fbuf_capacity(&abuf, abuf.size + (64UL << 20));
+    int err = errno;
+    struct stat st2;
+    if(fstat(abuf.fd, &st2) < 0) _exit(2);
+    _exit(r == -1 && err == ENOMEM && st2.st_size == st.st_size ? 0 : 1);
+  }
+  int status;
+  assert(waitpid(pid, &status, 0) == pid);
+  assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  assert(fbuf_close(&abuf) == 0);
+
+  // files without a valid header are rejected
+  assert(truncate(path, 100) == 0 && (fd = open(path, O_WRONLY)) >= 0);
+  assert(write(fd, "not a filebuf", 13) == 13 && close(fd) == 0);
+  assert(fbuf_open(&abuf, path, MC_FILEBUF_RDONLY) == -1 && errno == EINVAL);
+  assert(unlink(path) == 0);
+}
+
+static void test_save()
+{
+  size_t i, n = 10000, x;
+  char path[] = "/tmp/madcrow_save_XXXXXX";
+  int fd = mkstemp(path);
+  assert(fd >= 0);
+  close(fd);
+
+  SizeBuffer abuf = madcrow_buffer_init, bbuf;
+  for(i = 0; i < n; i++) buf_add(&abuf, i);
+  assert(buf_save(&abuf, path) == 0);
+  buf_alloc(&bbuf, 4);
+  buf_add(&bbuf, 99); // replaced
+  assert(buf_load(&bbuf, path) == 0);
+  assert(bbuf.len == n);
+  for(i = 0; i < n; i++) assert(bbuf.b[i] == i);
+  buf_dealloc(&bbuf);
+
+  // wrong element size
+  U32Buffer ubuf = madcrow_buffer_init;
+  assert(u32buf_load(&ubuf, path) == -1 && errno == EINVAL);
+
+  // saves go through path.tmp; a failed save leaves the old file in place
+  char tmppath[sizeof(path) + 4];
+  sprintf(tmppath, "%s.tmp", path);
+  assert(access(tmppath, F_OK) == -1 && errno == ENOENT);
+  assert(mkdir(tmppath, 0700) == 0);
+  abuf.len = 1;
+  assert(buf_save(&abuf, path) == -1 && errno == EISDIR);
+  assert(rmdir(tmppath) == 0);
+  abuf.len = n;
+  assert(buf_load(&bbuf, path) == 0 && bbuf.len == n);
+  buf_dealloc(&bbuf);
+
+  // zero-copy: b points into a private mapping of the file
+  MmapSizeBuffer mbuf = madcrow_buffer_init;
+  assert(mbuf_load_mmap(&mbuf, path, 1) == 0);
+  assert(mbuf.len == n && mc_mmap_hdr(mbuf.b)->filemap == 1);
+  for(i = 0; i < n; i++) assert(mbuf.b[i] == i);
+  mbuf.b[0] = 42; // stays in memory
+  // growing copies out of the file mapping
+  mbuf_add(&mbuf, n);
+  assert(mc_mmap_hdr(mbuf.b)->filemap == 0);
+  assert(mbuf.b[0] == 42 && mbuf.b[n-1] == n-1 && mbuf.b[n] == n);
+  mbuf_dealloc(&mbuf);
+  assert(mbuf_load_mmap(&mbuf, path, 0) == 0 && mbuf.b[0] == 0);
+  mbuf_dealloc(&mbuf);
+
+  // lists save start..end and load at start 0
+  SizeList alist, blist = madcrow_list_init;
+  list_alloc(&alist, 8);
+  for(i = 0; i < 100; i++) { list_append(&alist, 100+i); list_prepend(&alist, 99-i); }
+  assert(list_save(&alist, path) == 0);
+  assert(list_load(&blist, path) == 0);
+  assert(list_len(&blist) == 200 && blist.start == 0);
+  for(i = 0; i < 200; i++) assert(list_get(&blist, i) == i);
+  list_dealloc(&alist);
+  list_dealloc(&blist);
+  MmapSizeList mlist = madcrow_list_init;
+  assert(mlist_load_mmap(&mlist, path, 1) == 0 && mlist_len(&mlist) == 200);
+  mlist_prepend(&mlist, 7);
+  assert(mlist_get(&mlist, 0) == 7 && mlist_get(&mlist, 200) == 199);
+  mlist_dealloc(&mlist);
+
+  // empty
+  abuf.len = 0;
+  assert(buf_save(&abuf, path) == 0);
+  assert(buf_load(&abuf, path) == 0 && abuf.len == 0);
+
+  // corrupt data fails the checksum, header damage fails the format check
+  abuf.len = n;
+  for(i = 0; i < n; i++) abuf.b[i] = i;
+  assert(buf_save(&abuf, path) == 0);
+  assert((fd = open(path, O_WRONLY)) >= 0);
+  x = 12345;
+  assert(pwrite(fd, &x, sizeof(x), sizeof(mc_save_hdr_t) + 800) == sizeof(x));
+  assert(buf_load(&abuf, path) == -1 && errno == EIO && abuf.len == 0);
+  assert(mbuf_load_mmap(&mbuf, path, 1) == -1 && errno == EIO);
+  assert(mbuf.b == NULL);
+  assert(mbuf_load_mmap(&mbuf, path, 0) == 0 && mbuf.b[100] == 12345);
+  mbuf_dealloc(&mbuf);
+  assert(pwrite(fd, "MCSAVE99", 8, 0) == 8 && close(fd) == 0);
+  assert(buf_load(&abuf, path) == -1 && errno == EINVAL);
+  assert(truncate(path, sizeof(mc_save_hdr_t) - 1) == 0);
+  assert(mbuf_load_mmap(&mbuf, path, 0) == -1 && errno == EINVAL);
+  assert(buf_load(&abuf, "/nonexistent/madcrow") == -1 && errno == ENOENT);
+  buf_dealloc(&abuf);
+  assert(unlink(path) == 0);
+}
+
 static void test_linked_list()
 {
   size_t i;
@@ -82,6 +1541,425 @@ static void test_linked_list()
     llist_push(&llist, &nodes[i]);
     assert(llist.last == &nodes[i]);
   }
+  assert(llist_length(&llist) == 100);
+  madcrow_linkedlist_verify(&llist);
+
+  for(i = 0; i < 50; i++) assert(llist_pop(&llist) == &nodes[99-i]);
+  for(i = 0; i < 50; i++) assert(llist_unshift(&llist) == &nodes[i]);
+  assert(llist_length(&llist) == 0);
+  assert(llist_pop(&llist) == NULL && llist_unshift(&llist) == NULL);
+  madcrow_linkedlist_verify(&llist);
+
+  llist_shift(&llist, &nodes[1]);
+  llist_shift(&llist, &nodes[0]);
+  llist_push(&llist, &nodes[2]);
+  assert(llist_length(&llist) == 3);
+  madcrow_linkedlist_verify(&llist);
+  for(i = 0; i < 3; i++) assert(llist_unshift(&llist) == &nodes[i]);
+  madcrow_linkedlist_verify(&llist);
+}
+
+static void llist_fill(LinkedList *llist, LinkedNode *nodes, size_t n)
+{
+  size_t i;
+  llist_init(llist);
+  for(i = 0; i < n; i++) { nodes[i].data = i; llist_push(llist, &nodes[i]); }
+}
+
+static void llist_check(LinkedList *llist, const size_t *vals, size_t n)
+{
+  const LinkedNode *node = llist->first;
+  size_t i;
+  madcrow_linkedlist_verify(llist);
+  assert(llist->len == n);
+  for(i = 0; i < n; i++, node = node->next) assert(node->data == vals[i]);
+}
+
+static void test_linked_list_ops()
+{
+  size_t i, n;
+  LinkedList a, b;
+  LinkedNode na[10], nb[10], nodes[1000];
+
+  // insert_before/insert_after/remove
+  for(i = 0; i < 10; i++) na[i].data = i;
+  llist_fill(&a, na, 3);
+  llist_remove(&a, &na[1]);
+  llist_check(&a, (size_t[]){0,2}, 2);
+  llist_insert_after(&a, &na[0], &na[1]);
+  llist_check(&a, (size_t[]){0,1,2}, 3);
+  llist_remove(&a, &na[0]);
+  llist_remove(&a, &na[2]);
+  llist_check(&a, (size_t[]){1}, 1);
+  llist_insert_before(&a, &na[1], &na[0]);
+  llist_insert_before(&a, NULL, &na[2]);
+  llist_insert_after(&a, NULL, &na[3]);
+  llist_check(&a, (size_t[]){3,0,1,2}, 4);
+  llist_remove(&a, &na[3]); llist_remove(&a, &na[0]);
+  llist_remove(&a, &na[1]); llist_remove(&a, &na[2]);
+  llist_check(&a, NULL, 0);
+  llist_insert_after(&a, NULL, &na[5]);
+  llist_check(&a, (size_t[]){5}, 1);
+
+  // concat
+  llist_fill(&a, na, 3);
+  llist_fill(&b, nb, 2);
+  llist_concat(&a, &b);
+  llist_check(&a, (size_t[]){0,1,2,0,1}, 5);
+  llist_check(&b, NULL, 0);
+  llist_concat(&a, &b);
+  llist_concat(&b, &a);
+  llist_check(&a, NULL, 0);
+  llist_check(&b, (size_t[]){0,1,2,0,1}, 5);
+
+  // splice between lists, from the middle, start and end
+  llist_fill(&a, na, 5);
+  llist_init(&b);
+  llist_splice(&b, NULL, &a, &na[1], &na[3], 3);
+  llist_check(&a, (size_t[]){0,4}, 2);
+  llist_check(&b, (size_t[]){1,2,3}, 3);
+  llist_splice(&b, &na[2], &a, &na[0], &na[0], 1);
+  llist_splice(&b, b.first, &a, &na[4], &na[4], 1);
+  llist_check(&a, NULL, 0);
+  llist_check(&b, (size_t[]){4,1,0,2,3}, 5);
+  // splice within a list: move 1,0 to the end
+  llist_splice(&b, NULL, &b, &na[1], &na[0], 2);
+  llist_check(&b, (size_t[]){4,2,3,1,0}, 5);
+
+  // sort: random, sorted, reversed, all equal (stability) and empty
+  for(n = 0; n < 1000; n = n*3+1) {
+    llist_init(&a);
+    for(i = 0; i < n; i++) {
+      nodes[i].data = (i * 7919) % 97;
+      llist_push(&a, &nodes[i]);
+    }
+    llist_sort(&a);
+    madcrow_linkedlist_verify(&a);
+    assert(a.len == n);
+    for(LinkedNode *node = a.first; node && node->next; node = node->next) {
+      assert(node->data <= node->next->data);
+      if(node->data == node->next->data) assert(node < node->next); // stable
+    }
+  }
+  llist_fill(&a, nodes, 1000);
+  llist_sort(&a);
+  for(i = 0; i < 1000; i++) assert(llist_unshift(&a) == &nodes[i]);
+  for(i = 0; i < 1000; i++) { nodes[i].data = 999-i; llist_shift(&a, &nodes[i]); }
+  llist_sort(&a);
+  for(i = 0; i < 1000; i++) assert(llist_unshift(&a) == &nodes[999-i]);
+  for(i = 0; i < 1000; i++) { nodes[i].data = 3; llist_push(&a, &nodes[i]); }
+  llist_sort(&a);
+  for(i = 0; i < 1000; i++) assert(llist_unshift(&a) == &nodes[i]);
+  llist_sort(&a);
+  llist_check(&a, NULL, 0);
+}
+
+static void test_unrolled()
+{
+  size_t i, j, x, ref[1000], n = 0;
+  SizeUnrolled ulist;
+  SizeUIter it;
+  ulist_init(&ulist);
+
+  // enough to fill several nodes at both ends
+  for(i = 0; i < 100; i++) ulist_push(&ulist, i);
+  for(i = 0; i < 100; i++) ulist_unshift(&ulist, 1000+i);
+  assert(ulist_len(&ulist) == 200);
+  madcrow_unrolled_verify(&ulist);
+  for(i = 0; i < 100; i++) assert(ulist_get(&ulist, i) == 1099-i);
+  for(i = 0; i < 100; i++) assert(ulist_get(&ulist, 100+i) == i);
+  for(i = 0; i < 100; i++) { assert(ulist_pop(&ulist, &x)); assert(x == 99-i); }
+  for(i = 0; i < 100; i++) { assert(ulist_shift(&ulist, &x)); assert(x == 1099-i); }
+  assert(!ulist_pop(&ulist, &x) && !ulist_shift(&ulist, &x));
+  assert(ulist.first == NULL && ulist.last == NULL);
+
+  // iterate
+  for(i = 0; i < 50; i++) ulist_push(&ulist, i);
+  for(ulist_seek(&ulist, &it, 10), i = 10; it.node; ulist_next(&it), i++)
+    assert(*ulist_iter_ptr(&it) == i);
+  assert(i == 50);
+  ulist_dealloc(&ulist);
+
+  // random inserts and removes against an array, small nodes split and merge
+  CharUnrolled clist;
+  CharUIter cit;
+  uclist_init(&clist);
+  for(i = 0; i < 20000; i++) {
+    if(n < 1000 && (n < 100 || rand() % 2)) {
+      j = rand() % (n+1);
+      memmove(ref+j+1, ref+j, (n-j)*sizeof(size_t));
+      ref[j] = rand() & 127;
+      uclist_insert_at(&clist, j, (char)ref[j]);
+      n++;
+    }
+    else {
+      j = rand() % n;
+      assert(uclist_remove_at(&clist, j) == (char)ref[j]);
+      memmove(ref+j, ref+j+1, (n-j-1)*sizeof(size_t));
+      n--;
+    }
+    if(i % 500 == 0) {
+      madcrow_unrolled_verify(&clist);
+      for(j = 0; j < n; j++) assert(uclist_get(&clist, j) == (char)ref[j]);
+    }
+  }
+  assert(uclist_len(&clist) == n);
+
+  // erase every other element through one iterator, insert keeps position
+  for(uclist_seek(&clist, &cit, 0), j = 0; cit.node; j++) {
+    uclist_next(&cit);
+    if(cit.node) uclist_erase(&clist, &cit);
+  }
+  for(i = 0; i < j; i++) ref[i] = ref[2*i];
+  n = j;
+  madcrow_unrolled_verify(&clist);
+  assert(uclist_len(&clist) == n);
+  for(j = 0; j < n; j++) assert(uclist_get(&clist, j) == (char)ref[j]);
+
+  uclist_seek(&clist, &cit, n/2);
+  uclist_insert(&clist, &cit, 'x');
+  assert(*uclist_iter_ptr(&cit) == 'x');
+  uclist_next(&cit);
+  assert(*uclist_iter_ptr(&cit) == (char)ref[n/2]);
+  uclist_seek(&clist, &cit, n+1);
+  uclist_insert(&clist, &cit, 'y');
+  assert(uclist_get(&clist, n+1) == 'y');
+  madcrow_unrolled_verify(&clist);
+  uclist_dealloc(&clist);
+  assert(uclist_len(&clist) == 0);
+}
+
+static void test_nodepool()
+{
+  size_t i, x;
+  NodePool pool;
+  LinkedList llist = madcrow_linkedlist_init;
+  lpool_alloc(&pool, 16);
+
+  for(i = 0; i < 100; i++) assert(lpool_push(&pool, &llist, i));
+  assert(llist_length(&llist) == 100);
+  assert(((uintptr_t)pool.slabs & 63) == 0);
+
+  // nodes come from the same slab in order
+  assert(llist.first->next == llist.first + 1);
+
+  for(i = 0; i < 50; i++) { assert(lpool_pop(&pool, &llist, &x)); assert(x == 99-i); }
+  for(i = 0; i < 50; i++) { assert(lpool_unshift(&pool, &llist, &x)); assert(x == i); }
+  assert(!lpool_pop(&pool, &llist, &x) && !lpool_unshift(&pool, &llist, &x));
+
+  // returned nodes are reused before allocating another slab
+  mc_slab_t *slabs = pool.slabs;
+  for(i = 0; i < 100; i++) assert(lpool_shift(&pool, &llist, i));
+  assert(pool.slabs == slabs);
+  assert(llist_length(&llist) == 100 && llist.first->data == 99);
+  madcrow_linkedlist_verify(&llist);
+
+  lpool_dealloc(&pool);
+
+  // running out of memory leaves the list unchanged
+  FailingPool fpool;
+  LinkedList flist = madcrow_linkedlist_init;
+  fpool_alloc(&fpool, 4);
+  for(i = 0; i < 4; i++) assert(fpool_push(&fpool, &flist, i));
+  failing_allocs = 1;
+  assert(!fpool_push(&fpool, &flist, 4) && !fpool_shift(&fpool, &flist, 4));
+  assert(llist_length(&flist) == 4 && flist.last->data == 3);
+  madcrow_linkedlist_verify(&flist);
+  assert(fpool_pop(&fpool, &flist, &x) && x == 3);
+  assert(fpool_shift(&fpool, &flist, 5)); // reuses the returned node
+  assert(flist.first->data == 5);
+  failing_allocs = 0;
+  fpool_dealloc(&fpool);
+}
+
+#ifdef MC_STATS
+static void test_stats()
+{
+  size_t i;
+  SizeBuffer abuf;
+  SizeList alist;
+  mc_stats_reset();
+
+  buf_alloc(&abuf, 8);
+  for(i = 0; i < 100; i++) buf_add(&abuf, i);
+  buf_unshift(&abuf, &i, 1);
+  buf_shift(&abuf, NULL, 1);
+  assert(buf_stats.reallocs == 4);
+  assert(buf_stats.realloc_bytes == (16+32+64+128)*sizeof(size_t));
+  assert(buf_stats.memmove_bytes == (100+100)*sizeof(size_t));
+  assert(buf_stats.max_len == 101);
+  assert(buf_stats.max_capacity == 128);
+  assert(buf_stats.shifts == 1 && buf_stats.unshifts == 1);
+  // reserving space is not length
+  buf_reserve(&abuf, 1000);
+  assert(buf_stats.max_len == 101 && buf_stats.max_capacity >= 1100);
+  buf_commit(&abuf, 10);
+  assert(buf_stats.max_len == 110);
+  buf_dealloc(&abuf);
+
+  list_alloc(&alist, 8);
+  for(i = 0; i < 100; i++) list_prepend(&alist, i);
+  for(i = 0; i < 100; i++) list_lcut(&alist);
+  assert(list_stats.reallocs > 0);
+  assert(list_stats.max_len == 100);
+  assert(list_stats.shifts == 100 && list_stats.unshifts == 100);
+  list_dealloc(&alist);
+
+  // one row per instantiation, in the columns of the header
+  char line[256], name[64];
+  size_t v[7], nrows = 0, found = 0;
+  FILE *out = tmpfile();
+  assert(out != NULL);
+  mc_stats_dump(out);
+  rewind(out);
+  assert(fgets(line, sizeof(line), out) != NULL);
+  assert(strncmp(line, "name", 4) == 0 && strstr(line, "unshifts\n") != NULL);
+  while(fgets(line, sizeof(line), out) != NULL) {
+    assert(sscanf(line, "%63s %zu %zu %zu %zu %zu %zu %zu", name,
+                  &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6]) == 8);
+    nrows++;
+    if(strcmp(name, "buf") == 0) {
+      assert(v[0] == buf_stats.reallocs && v[2] == buf_stats.memmove_bytes);
+      assert(v[3] == 110 && v[5] == 1 && v[6] == 1);
+      found++;
+    } else if(strcmp(name, "list") == 0) {
+      assert(v[3] == 100 && v[5] == 100 && v[6] == 100);
+      found++;
+    }
+  }
+  assert(found == 2 && nrows > 2);
+  fclose(out);
+}
+#endif
+
+#define MPSC_NTHREADS 4
+#define MPSC_NITEMS 100000
+
+typedef struct {
+  SizeQueue *q;
+  LinkedNode *nodes;
+  size_t id;
+} MpscProducer;
+
+static void* mpsc_produce(void *arg)
+{
+  MpscProducer *p = arg;
+  size_t i;
+  for(i = 0; i < MPSC_NITEMS; i++) {
+    p->nodes[i].data = (p->id << 32) | i;
+    mpsc_push(p->q, &p->nodes[i]);
+  }
+  return NULL;
+}
+
+static void test_mpsc()
+{
+  size_t i, next[MPSC_NTHREADS] = {0};
+  SizeQueue q;
+  pthread_t threads[MPSC_NTHREADS];
+  MpscProducer producers[MPSC_NTHREADS];
+  LinkedNode *nodes = malloc(MPSC_NTHREADS * MPSC_NITEMS * sizeof(LinkedNode));
+  LinkedNode *node;
+
+  mpsc_init(&q);
+  assert(mpsc_pop(&q) == NULL);
+
+  for(i = 0; i < MPSC_NTHREADS; i++) {
+    producers[i] = (MpscProducer){.q = &q, .id = i,
+                                  .nodes = nodes + i * MPSC_NITEMS};
+    assert(pthread_create(&threads[i], NULL, mpsc_produce, &producers[i]) == 0);
+  }
+
+  // each producer's items arrive complete and in order
+  for(i = 0; i < MPSC_NTHREADS * MPSC_NITEMS; ) {
+    if((node = mpsc_pop(&q)) == NULL) { sched_yield(); continue; }
+    size_t id = node->data >> 32, seq = node->data & 0xffffffff;
+    assert(id < MPSC_NTHREADS && seq == next[id]);
+    next[id]++;
+    i++;
+  }
+
+  for(i = 0; i < MPSC_NTHREADS; i++) pthread_join(threads[i], NULL);
+  assert(mpsc_pop(&q) == NULL);
+
+  // the queue still works after draining
+  mpsc_push(&q, &nodes[0]);
+  mpsc_push(&q, &nodes[1]);
+  assert(mpsc_pop(&q) == &nodes[0]);
+  assert(mpsc_pop(&q) == &nodes[1]);
+  assert(mpsc_pop(&q) == NULL);
+
+  free(nodes);
+}
+
+#define SPSC_NITEMS 1000000
+
+// Producer writes batches of varying size through push_n and acquire_write
+static void* spsc_produce(void *arg)
+{
+  SizePipe *q = arg;
+  size_t i = 0, j, n, batch[37], *ptr;
+  while(i < SPSC_NITEMS) {
+    if(i & 1024) {
+      n = spsc_acquire_write(q, &ptr, 1 + i % 61);
+      for(j = 0; j < n && i+j < SPSC_NITEMS; j++) ptr[j] = i+j;
+      spsc_commit_write(q, j);
+    } else {
+      for(j = 0; j < 37 && i+j < SPSC_NITEMS; j++) batch[j] = i+j;
+      for(n = 0; n < j; ) n += spsc_push_n(q, batch+n, j-n);
+    }
+    if(j == 0) sched_yield();
+    i += j;
+  }
+  return NULL;
+}
+
+static void test_spsc()
+{
+  size_t i, j, n, x, batch[29], *ptr;
+  SizePipe q;
+  pthread_t thread;
+
+  spsc_alloc(&q, 100);
+  assert(spsc_size(&q) == 128);
+
+  // single threaded: fill, wrap around and drain
+  assert(spsc_pop(&q, &x) == 0);
+  for(i = 0; i < 128; i++) assert(spsc_push(&q, i) == 1);
+  assert(spsc_push(&q, 128) == 0);
+  assert(spsc_acquire_write(&q, &ptr, 1) == 0);
+  assert(spsc_pop_n(&q, batch, 29) == 29);
+  for(i = 0; i < 29; i++) assert(batch[i] == i);
+  assert(spsc_push_n(&q, batch, 29) == 29); // wraps
+  assert(spsc_push(&q, 0) == 0);
+  // spans stop at the end of the ring
+  assert(spsc_acquire_read(&q, &ptr, 200) == 128-29);
+  assert(ptr[0] == 29 && ptr[128-29-1] == 127);
+  spsc_release_read(&q, 128-29);
+  assert(spsc_acquire_read(&q, &ptr, 200) == 29);
+  assert(ptr[0] == 0 && ptr[28] == 28);
+  spsc_release_read(&q, 10);
+  for(i = 10; i < 29; i++) { assert(spsc_pop(&q, &x) == 1 && x == i); }
+  assert(spsc_pop(&q, &x) == 0);
+  assert(spsc_acquire_read(&q, &ptr, 1) == 0);
+
+  // two threads, every item arrives once and in order
+  assert(pthread_create(&thread, NULL, spsc_produce, &q) == 0);
+  for(i = 0; i < SPSC_NITEMS; i += n) {
+    if(i & 2048) {
+      n = spsc_acquire_read(&q, &ptr, 1 + i % 53);
+      for(j = 0; j < n; j++) assert(ptr[j] == i+j);
+      spsc_release_read(&q, n);
+    } else {
+      n = spsc_pop_n(&q, batch, 29);
+      for(j = 0; j < n; j++) assert(batch[j] == i+j);
+    }
+    if(n == 0) sched_yield();
+  }
+  pthread_join(thread, NULL);
+  assert(spsc_pop(&q, &x) == 0);
+
+  spsc_dealloc(&q);
 }
 
 int main()
@@ -92,8 +1970,35 @@ int main()
   #endif
 
   test_buffer();
+  test_buffer_lazy();
+  test_buffer_sbo();
+  test_arena();
+  test_shrink();
+  test_buffer_incr();
+  test_chunkbuf();
+  test_buffer_fd();
+  test_search();
+  test_sort();
+  test_parallel();
+  test_hash();
+  test_bitbuf();
+  test_heap();
   test_list();
+  test_list_incr();
+  test_ring();
+  test_mmap();
+  test_buffer_wipe_pages();
+  test_filebuf();
+  test_save();
   test_linked_list();
+  test_linked_list_ops();
+  test_unrolled();
+  test_nodepool();
+  test_mpsc();
+  test_spsc();
+  #ifdef MC_STATS
+    test_stats();
+  #endif
 
   printf("  Tests Finished. Zero Errors\n");
   return 0;